@@ -0,0 +1,181 @@
+# Copyright 2015 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+"""Reads the latency histograms exported by the latency_hist dep.
+
+C test programs built against client/deps/latency_hist keep log-linear
+histograms of their latencies and export them either as "latency_hist:"
+lines in their output or as binary records in a file:
+
+        hists = latency_hist.parse_text(output)
+        self.write_perf_keyval(hists['wakeup'].perf_keyvals('wakeup'))
+
+The bucket layout and both formats are described in latency_hist.h.
+"""
+
+import math
+import struct
+
+TEXT_PREFIX = 'latency_hist:'
+RECORD_MAGIC = 0x5453484c
+RECORD_VERSION = 1
+RECORD_HEADER = struct.Struct('<IBBBBQQQQI')
+RECORD_BUCKET = struct.Struct('<HQ')
+
+DEFAULT_PERCENTILES = (50, 90, 99, 99.9)
+
+
+class LatencyHistogram(object):
+    """A log-linear histogram, as kept by latency_hist.h."""
+
+    def __init__(self, name, unit, sub_bits, count=0, total=0, minimum=0,
+                 maximum=0, buckets=None):
+        """
+        @param name: Name the histogram was exported with.
+        @param unit: Unit of the values, e.g. 'ns' or 'us'.
+        @param sub_bits: log2 of the number of buckets per power of two.
+        @param count: Number of values.
+        @param total: Sum of the values.
+        @param minimum: Smallest value.
+        @param maximum: Largest value.
+        @param buckets: Dict of bucket index to the number of values in it.
+        """
+        self.name = name
+        self.unit = unit
+        self.sub_bits = sub_bits
+        self.count = count
+        self.total = total
+        self.min = minimum
+        self.max = maximum
+        self.buckets = dict(buckets or {})
+
+
+    def bucket_high(self, index):
+        """Returns the largest value that falls into bucket |index|."""
+        sub_buckets = 1 << self.sub_bits
+        if index < 2 * sub_buckets:
+            return index
+        shift = index / sub_buckets - 1
+        low = (sub_buckets + index % sub_buckets) << shift
+        return low + (1 << shift) - 1
+
+
+    def mean(self):
+        """Returns the mean value, or 0 if there are none."""
+        return float(self.total) / self.count if self.count else 0
+
+
+    def percentile(self, percentile):
+        """Returns the value below which |percentile| percent of the values
+        fall, the same way latency_hist_percentile() does.
+        """
+        if not self.count:
+            return 0
+        rank = max(1, int(math.ceil(percentile / 100.0 * self.count)))
+        seen = 0
+        for index in sorted(self.buckets):
+            seen += self.buckets[index]
+            if seen >= rank:
+                return min(max(self.bucket_high(index), self.min), self.max)
+        return self.max
+
+
+    def merge(self, other):
+        """Adds the values of |other| to this histogram."""
+        if other.sub_bits != self.sub_bits:
+            raise ValueError('cannot merge histograms of %d and %d sub bits' %
+                             (self.sub_bits, other.sub_bits))
+        if not other.count:
+            return
+        if not self.count or other.min < self.min:
+            self.min = other.min
+        self.max = max(self.max, other.max)
+        self.count += other.count
+        self.total += other.total
+        for index, count in other.buckets.iteritems():
+            self.buckets[index] = self.buckets.get(index, 0) + count
+
+
+    def perf_keyvals(self, prefix, percentiles=DEFAULT_PERCENTILES):
+        """Returns a dict of perf keyvals summarizing the histogram.
+
+        @param prefix: Prefix of the keys, e.g. 'wakeup' gives
+                       'wakeup_p99_us'.
+        @param percentiles: Percentiles to report.
+        """
+        keyvals = {
+            '%s_count' % prefix: self.count,
+            '%s_min_%s' % (prefix, self.unit): self.min,
+            '%s_mean_%s' % (prefix, self.unit): self.mean(),
+            '%s_max_%s' % (prefix, self.unit): self.max,
+        }
+        for p in percentiles:
+            key = '%s_p%s_%s' % (prefix, ('%g' % p).replace('.', '_'),
+                                 self.unit)
+            keyvals[key] = self.percentile(p)
+        return keyvals
+
+
+def parse_text(output):
+    """Parses the "latency_hist:" lines in the output of a test program.
+
+    @param output: The program output; other lines are ignored.
+    @return A dict of histogram name to LatencyHistogram.
+    """
+    hists = {}
+    for line in output.splitlines():
+        if not line.startswith(TEXT_PREFIX):
+            continue
+        fields = dict(field.split('=', 1)
+                      for field in line[len(TEXT_PREFIX):].split())
+        buckets = {}
+        for bucket in filter(None, fields.get('buckets', '').split(',')):
+            index, count = bucket.split(':')
+            buckets[int(index)] = int(count)
+        hists[fields['name']] = LatencyHistogram(
+                fields['name'], fields['unit'], int(fields['sub_bits']),
+                int(fields['count']), int(fields['sum']), int(fields['min']),
+                int(fields['max']), buckets)
+    return hists
+
+
+def parse_binary(data):
+    """Parses the binary records written by latency_hist_write_binary().
+
+    @param data: The concatenated records.
+    @return A list of LatencyHistogram, in the order they were written.
+    @raises ValueError: if the data is not a sequence of records.
+    """
+    hists = []
+    offset = 0
+    while offset < len(data):
+        if len(data) - offset < RECORD_HEADER.size:
+            raise ValueError('truncated histogram record at %d' % offset)
+        (magic, version, sub_bits, name_len, unit_len, count, total,
+         minimum, maximum, nbuckets) = RECORD_HEADER.unpack_from(data, offset)
+        if magic != RECORD_MAGIC or version != RECORD_VERSION:
+            raise ValueError('bad histogram record at %d' % offset)
+        offset += RECORD_HEADER.size
+        end = offset + name_len + unit_len + nbuckets * RECORD_BUCKET.size
+        if end > len(data):
+            raise ValueError('truncated histogram record at %d' % offset)
+
+        name = data[offset:offset + name_len]
+        offset += name_len
+        unit = data[offset:offset + unit_len]
+        offset += unit_len
+        buckets = {}
+        for _ in xrange(nbuckets):
+            index, bucket_count = RECORD_BUCKET.unpack_from(data, offset)
+            buckets[index] = bucket_count
+            offset += RECORD_BUCKET.size
+        hists.append(LatencyHistogram(name, unit, sub_bits, count, total,
+                                      minimum, maximum, buckets))
+    return hists
+
+
+def read_binary(path):
+    """Reads a file of binary histogram records, see parse_binary()."""
+    with open(path, 'rb') as f:
+        return parse_binary(f.read())
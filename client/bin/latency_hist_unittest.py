@@ -0,0 +1,96 @@
+#!/usr/bin/python
+import struct
+import unittest
+import common
+from autotest_lib.client.bin import latency_hist
+
+
+TEXT_OUTPUT = """T: 0 ( 1234) P:80 I:1000 C: 100000
+latency_hist: name=T0 unit=us sub_bits=5 count=4 sum=172 min=3 max=100 buckets=3:1,33:2,82:1
+latency_hist: name=empty unit=ns sub_bits=5 count=0 sum=0 min=0 max=0 buckets=
+"""
+
+
+def binary_record(name, unit, count, total, minimum, maximum, buckets):
+    """Packs a record the way latency_hist_write_binary() does."""
+    data = latency_hist.RECORD_HEADER.pack(
+            latency_hist.RECORD_MAGIC, latency_hist.RECORD_VERSION, 5,
+            len(name), len(unit), count, total, minimum, maximum,
+            len(buckets))
+    data += name + unit
+    for index in sorted(buckets):
+        data += latency_hist.RECORD_BUCKET.pack(index, buckets[index])
+    return data
+
+
+class latency_hist_test(unittest.TestCase):
+
+    def test_bucket_high(self):
+        hist = latency_hist.LatencyHistogram('h', 'ns', 5)
+        # Values below 64 get a bucket each.
+        self.assertEqual(hist.bucket_high(3), 3)
+        self.assertEqual(hist.bucket_high(63), 63)
+        # 64..127 go in buckets of 2, 128..255 in buckets of 4.
+        self.assertEqual(hist.bucket_high(64), 65)
+        self.assertEqual(hist.bucket_high(95), 127)
+        self.assertEqual(hist.bucket_high(96), 131)
+        self.assertEqual(hist.bucket_high(60 * 32 - 1), 2 ** 64 - 1)
+
+
+    def test_parse_text(self):
+        hists = latency_hist.parse_text(TEXT_OUTPUT)
+        self.assertEqual(sorted(hists), ['T0', 'empty'])
+        hist = hists['T0']
+        self.assertEqual(hist.unit, 'us')
+        self.assertEqual(hist.count, 4)
+        self.assertEqual(hist.buckets, {3: 1, 33: 2, 82: 1})
+        self.assertEqual(hist.mean(), 43)
+        self.assertEqual(hists['empty'].buckets, {})
+        self.assertEqual(hists['empty'].percentile(99), 0)
+
+
+    def test_percentile(self):
+        hist = latency_hist.parse_text(TEXT_OUTPUT)['T0']
+        self.assertEqual(hist.percentile(0), 3)
+        self.assertEqual(hist.percentile(25), 3)
+        self.assertEqual(hist.percentile(50), 33)
+        self.assertEqual(hist.percentile(75), 33)
+        # Bucket 82 holds 100..101, clamped to the max.
+        self.assertEqual(hist.percentile(99), 100)
+        keyvals = hist.perf_keyvals('lat', percentiles=(50, 99.9))
+        self.assertEqual(keyvals['lat_p50_us'], 33)
+        self.assertEqual(keyvals['lat_p99_9_us'], 100)
+        self.assertEqual(keyvals['lat_max_us'], 100)
+
+
+    def test_merge(self):
+        hists = latency_hist.parse_text(TEXT_OUTPUT)
+        total = latency_hist.LatencyHistogram('all', 'us', 5)
+        total.merge(hists['empty'])
+        self.assertEqual(total.count, 0)
+        total.merge(hists['T0'])
+        total.merge(hists['T0'])
+        self.assertEqual(total.count, 8)
+        self.assertEqual(total.min, 3)
+        self.assertEqual(total.max, 100)
+        self.assertEqual(total.buckets, {3: 2, 33: 4, 82: 2})
+        self.assertRaises(ValueError, total.merge,
+                          latency_hist.LatencyHistogram('h', 'us', 4))
+
+
+    def test_parse_binary(self):
+        data = (binary_record('T0', 'us', 4, 172, 3, 100,
+                              {3: 1, 33: 2, 82: 1}) +
+                binary_record('all', 'us', 0, 0, 0, 0, {}))
+        hists = latency_hist.parse_binary(data)
+        self.assertEqual([h.name for h in hists], ['T0', 'all'])
+        self.assertEqual(hists[0].buckets, {3: 1, 33: 2, 82: 1})
+        self.assertEqual(hists[0].percentile(50), 33)
+        self.assertEqual(hists[1].count, 0)
+        self.assertRaises(ValueError, latency_hist.parse_binary, data[:-1])
+        self.assertRaises(ValueError, latency_hist.parse_binary,
+                          'x' + data[1:])
+
+
+if __name__ == '__main__':
+    unittest.main()
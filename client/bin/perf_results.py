@@ -0,0 +1,83 @@
+# Copyright 2015 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+"""Collects the perf values that native benchmarks report through the
+perf_results dep.
+
+Such a benchmark writes one JSON object per line to the file descriptor
+named by the AUTOTEST_PERF_RESULTS_FD environment variable, so its wrapper
+needs no regular expressions over its output:
+
+        path = os.path.join(self.resultsdir, 'perf_results.json')
+        utils.run(perf_results.wrap_command(cmd, path))
+        perf_results.output_perf_values(self, path)
+
+The keys of each object are the arguments of test.output_perf_value().
+"""
+
+import json
+import pipes
+
+FD_ENV = 'AUTOTEST_PERF_RESULTS_FD'
+# Far enough above stdin, stdout and stderr to be free in the shell.
+DEFAULT_FD = 9
+
+REQUIRED_KEYS = frozenset(['description', 'value'])
+KEYS = REQUIRED_KEYS | frozenset(['units', 'higher_is_better', 'graph'])
+
+
+def wrap_command(command, path, fd=DEFAULT_FD):
+    """Returns a shell command that runs |command| with its perf values
+    appended to |path|.
+
+    utils.run() closes the descriptors of the test, so the file is opened by
+    the shell that runs the command.
+
+    @param command: The shell command to run.
+    @param path: The file to append the results to.
+    @param fd: The descriptor the results are written to.
+    """
+    return '(export %s=%d; %s) %d>>%s' % (FD_ENV, fd, command, fd,
+                                          pipes.quote(path))
+
+
+def parse(data):
+    """Parses the lines written by perf_result() and perf_result_values().
+
+    @param data: The contents of a results file.
+    @return A list of dicts of output_perf_value() arguments, in the order
+            they were reported.
+    @raises ValueError: if a line is not a perf value.
+    """
+    results = []
+    for number, line in enumerate(data.splitlines(), 1):
+        if not line.strip():
+            continue
+        result = json.loads(line)
+        if (not isinstance(result, dict) or
+                not REQUIRED_KEYS <= set(result) <= KEYS):
+            raise ValueError('line %d is not a perf value: %s' %
+                             (number, line))
+        results.append(dict((str(key), value)
+                            for key, value in result.iteritems()))
+    return results
+
+
+def read(path):
+    """Reads a results file, see parse()."""
+    with open(path) as f:
+        return parse(f.read())
+
+
+def output_perf_values(test, path):
+    """Records the perf values in a results file with the test.
+
+    @param test: The test.test to record them with.
+    @param path: The results file.
+    @return The results, as returned by read().
+    """
+    results = read(path)
+    for result in results:
+        test.output_perf_value(**result)
+    return results
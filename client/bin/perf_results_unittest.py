@@ -0,0 +1,71 @@
+#!/usr/bin/python
+import os
+import shutil
+import tempfile
+import unittest
+import common
+from autotest_lib.client.bin import perf_results
+from autotest_lib.client.common_lib import utils
+
+
+RESULTS = """{"description": "fps", "value": 59.9, "units": "fps", "higher_is_better": true}
+
+{"description": "frame_ms", "value": [16.5, 17, 1e-09], "units": "ms", "higher_is_better": false}
+"""
+
+
+class FakeTest(object):
+    """Records what output_perf_value() is called with."""
+
+    def __init__(self):
+        self.values = []
+
+
+    def output_perf_value(self, **kwargs):
+        self.values.append(kwargs)
+
+
+class perf_results_test(unittest.TestCase):
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.path = os.path.join(self.tmpdir, 'perf results.json')
+
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+
+    def test_parse(self):
+        results = perf_results.parse(RESULTS)
+        self.assertEqual(len(results), 2)
+        self.assertEqual(results[0], {'description': 'fps', 'value': 59.9,
+                                      'units': 'fps',
+                                      'higher_is_better': True})
+        self.assertEqual(results[1]['value'], [16.5, 17, 1e-9])
+        self.assertEqual(perf_results.parse(''), [])
+
+
+    def test_parse_errors(self):
+        self.assertRaises(ValueError, perf_results.parse, '{"descr')
+        self.assertRaises(ValueError, perf_results.parse, '[1, 2]')
+        self.assertRaises(ValueError, perf_results.parse, '{"value": 1}')
+        self.assertRaises(ValueError, perf_results.parse,
+                          '{"description": "a", "value": 1, "unit": "ms"}')
+
+
+    def test_wrap_command(self):
+        command = ('echo $%s >&2; echo \'{"description": "a", "value": 1}\' '
+                   '>&$%s' % (perf_results.FD_ENV, perf_results.FD_ENV))
+        result = utils.run(perf_results.wrap_command(command, self.path))
+        self.assertEqual(result.stderr.strip(), str(perf_results.DEFAULT_FD))
+        utils.run(perf_results.wrap_command(command, self.path, fd=5))
+
+        test = FakeTest()
+        results = perf_results.output_perf_values(test, self.path)
+        self.assertEqual(test.values, [{'description': 'a', 'value': 1}] * 2)
+        self.assertEqual(results, test.values)
+
+
+if __name__ == '__main__':
+    unittest.main()
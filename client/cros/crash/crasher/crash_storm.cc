@@ -0,0 +1,376 @@
+// Copyright 2016 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Crash storm driver: launches many crashers at a controlled rate and
+// measures how long the crash pipeline takes to handle each crash.
+//
+// Every crasher runs with --sendpid, so the moment it is about to crash is
+// known from the handshake datagram; its pid comes with it as socket
+// credentials. The crash directory is watched with inotify for the files
+// crash_reporter writes, which are named <exec>.<date>.<time>.<pid>.<ext>:
+//   dump_ms   handshake to the .dmp (or kept .core) being written
+//   queue_ms  handshake to the .meta being written, i.e. the report queued
+//   exit_ms   handshake to the crasher being reaped, which the kernel delays
+//             until the core has been piped to crash_reporter
+// Results are printed as "crash_storm: ..." lines of key=value pairs.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Crash {
+  Crash() : crash_ms(-1), dump_ms(-1), queue_ms(-1), exit_ms(-1), status(0) {}
+  double crash_ms;  // time of the handshake
+  double dump_ms;
+  double queue_ms;
+  double exit_ms;
+  int status;
+};
+
+struct Options {
+  Options()
+      : crasher(NULL), crash_dir("/var/spool/crash"), count(100), rate(0),
+        heap_mb(64), timeout_s(60) {}
+  const char *crasher;
+  const char *crash_dir;
+  int count;
+  double rate;  // crashes per second, 0 for all at once
+  std::vector<std::string> types;
+  long heap_mb;  // for the "heap" crash type
+  int timeout_s;
+};
+
+double NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void Usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --crasher=PATH     crasher binary (crasher_nobreakpad next to\n"
+          "                     this one)\n"
+          "  --crash_dir=DIR    where crash_reporter queues the reports\n"
+          "                     (/var/spool/crash)\n"
+          "  --count=N          number of crashes (100)\n"
+          "  --rate=R           crashes per second, 0 for all at once (0)\n"
+          "  --types=T,...      crash types used in turn: segv, abort, stack\n"
+          "                     and heap, a segv with a large core (segv)\n"
+          "  --heap_mb=N        heap dirtied by the heap type (64)\n"
+          "  --timeout=S        wait for reports up to S seconds (60)\n",
+          argv0);
+}
+
+bool ParseOptions(int argc, char *argv[], Options *options) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = strchr(arg, '=');
+    if (strncmp(arg, "--", 2) != 0 || !value)
+      return false;
+    std::string name(arg + 2, value++ - arg - 2);
+    if (name == "crasher") {
+      options->crasher = value;
+    } else if (name == "crash_dir") {
+      options->crash_dir = value;
+    } else if (name == "count") {
+      options->count = atoi(value);
+    } else if (name == "rate") {
+      options->rate = atof(value);
+    } else if (name == "types") {
+      std::string types(value);
+      size_t start = 0, end;
+      do {
+        end = types.find(',', start);
+        options->types.push_back(types.substr(start, end - start));
+        start = end + 1;
+      } while (end != std::string::npos);
+    } else if (name == "heap_mb") {
+      options->heap_mb = atol(value);
+    } else if (name == "timeout") {
+      options->timeout_s = atoi(value);
+    } else {
+      return false;
+    }
+  }
+  if (options->types.empty())
+    options->types.push_back("segv");
+  return options->count > 0 && options->rate >= 0;
+}
+
+pid_t Launch(const Options &options, const std::string &type,
+             const char *socket_path) {
+  std::string crash = "--crash=" + (type == "heap" ? "segv" : type);
+  char heap[32];
+  snprintf(heap, sizeof(heap), "--heap_mb=%ld",
+           type == "heap" ? options.heap_mb : 0L);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+      dup2(null_fd, STDOUT_FILENO);
+      dup2(null_fd, STDERR_FILENO);
+    }
+    execl(options.crasher, options.crasher, "--sendpid", socket_path,
+          crash.c_str(), heap, static_cast<char *>(NULL));
+    _exit(127);
+  }
+  return pid;
+}
+
+// Receives a --sendpid handshake and returns the sender's pid, or -1.
+pid_t ReceiveHandshake(int sock) {
+  char data;
+  iovec iov = { &data, 1 };
+  union {
+    cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(ucred))];
+  } control;
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  if (recvmsg(sock, &msg, MSG_DONTWAIT) < 0)
+    return -1;
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_CREDENTIALS) {
+      ucred cred;
+      memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+      return cred.pid;
+    }
+  }
+  return -1;
+}
+
+// Extracts the pid and extension from a crash report file name.
+bool ParseReportName(const char *name, pid_t *pid, std::string *ext) {
+  const char *dot = strrchr(name, '.');
+  if (!dot || dot == name)
+    return false;
+  const char *start = dot - 1;
+  while (start > name && *start != '.')
+    start--;
+  if (*start != '.')
+    return false;
+  char *end;
+  long value = strtol(start + 1, &end, 10);
+  if (end != dot || value <= 0)
+    return false;
+  *pid = value;
+  ext->assign(dot + 1);
+  return true;
+}
+
+void HandleEvents(int inotify_fd, std::map<pid_t, Crash> *crashes) {
+  char buf[16 * (sizeof(inotify_event) + NAME_MAX + 1)]
+      __attribute__ ((aligned(__alignof__(inotify_event))));
+  ssize_t len = read(inotify_fd, buf, sizeof(buf));
+  double now = NowMs();
+  for (char *p = buf; len > 0 && p < buf + len;) {
+    const inotify_event *event = reinterpret_cast<inotify_event *>(p);
+    p += sizeof(inotify_event) + event->len;
+    pid_t pid;
+    std::string ext;
+    if (!event->len || !ParseReportName(event->name, &pid, &ext))
+      continue;
+    std::map<pid_t, Crash>::iterator it = crashes->find(pid);
+    if (it == crashes->end())
+      continue;
+    if ((ext == "dmp" || ext == "core") && it->second.dump_ms < 0)
+      it->second.dump_ms = now;
+    else if (ext == "meta" && it->second.queue_ms < 0)
+      it->second.queue_ms = now;
+  }
+}
+
+void PrintLatencies(const char *name, std::vector<double> samples) {
+  if (samples.empty())
+    return;
+  std::sort(samples.begin(), samples.end());
+  size_t last = samples.size() - 1;
+  printf("crash_storm: %s p50=%.1f p90=%.1f p99=%.1f max=%.1f\n", name,
+         samples[last * 50 / 100], samples[last * 90 / 100],
+         samples[last * 99 / 100], samples[last]);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    Usage(argv[0]);
+    return 1;
+  }
+  std::string default_crasher;
+  if (!options.crasher) {
+    default_crasher = argv[0];
+    size_t slash = default_crasher.rfind('/');
+    default_crasher.erase(slash == std::string::npos ? 0 : slash + 1);
+    default_crasher += "crasher_nobreakpad";
+    options.crasher = default_crasher.c_str();
+  }
+
+  // crash_reporter creates the directory as well, but it has to exist to be
+  // watched from the start.
+  mkdir(options.crash_dir, 0700);
+  int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0 ||
+      inotify_add_watch(inotify_fd, options.crash_dir,
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    fprintf(stderr, "Cannot watch %s: %s\n", options.crash_dir,
+            strerror(errno));
+    return 1;
+  }
+
+  char socket_path[64];
+  snprintf(socket_path, sizeof(socket_path), "/tmp/crash_storm.%d",
+           static_cast<int>(getpid()));
+  int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  sockaddr_un address = { AF_UNIX };
+  strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+  int one = 1;
+  unlink(socket_path);
+  if (sock < 0 ||
+      bind(sock, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) < 0 ||
+      setsockopt(sock, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) < 0) {
+    fprintf(stderr, "Cannot listen on %s: %s\n", socket_path,
+            strerror(errno));
+    return 1;
+  }
+  // Crashers run as other users must be able to connect.
+  chmod(socket_path, 0777);
+
+  // SIGCHLD wakes up the poll() below, so crashers are reaped promptly.
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  std::map<pid_t, Crash> crashes;
+  int launched = 0, running = 0;
+  double start = NowMs();
+  double deadline = 0;
+  while (launched < options.count || running > 0 || NowMs() < deadline) {
+    double now = NowMs();
+    while (launched < options.count &&
+           (options.rate == 0 || now >= start + launched * 1e3 / options.rate)) {
+      const std::string &type =
+          options.types[launched % options.types.size()];
+      pid_t pid = Launch(options, type, socket_path);
+      if (pid < 0) {
+        fprintf(stderr, "fork() failed: %s\n", strerror(errno));
+        options.count = launched;
+        break;
+      }
+      crashes[pid];
+      launched++;
+      running++;
+    }
+
+    int timeout_ms = 100;
+    if (launched < options.count && options.rate > 0) {
+      double next = start + launched * 1e3 / options.rate - now;
+      timeout_ms = std::max(0, std::min(timeout_ms, static_cast<int>(next)));
+    }
+    pollfd fds[] = { { sock, POLLIN, 0 }, { inotify_fd, POLLIN, 0 },
+                     { signal_fd, POLLIN, 0 } };
+    poll(fds, 3, timeout_ms);
+    now = NowMs();
+
+    pid_t pid;
+    while ((pid = ReceiveHandshake(sock)) > 0) {
+      std::map<pid_t, Crash>::iterator it = crashes.find(pid);
+      if (it != crashes.end())
+        it->second.crash_ms = now;
+    }
+    if (fds[1].revents & POLLIN)
+      HandleEvents(inotify_fd, &crashes);
+
+    signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) > 0) {
+    }
+    int status;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      Crash &crash = crashes[pid];
+      crash.exit_ms = now;
+      crash.status = status;
+      running--;
+    }
+
+    if (launched == options.count && running == 0 && deadline == 0)
+      deadline = now + options.timeout_s * 1e3;
+    if (deadline) {
+      bool done = true;
+      for (std::map<pid_t, Crash>::iterator it = crashes.begin();
+           it != crashes.end() && done; ++it)
+        done = it->second.crash_ms < 0 || it->second.queue_ms >= 0;
+      if (done)
+        break;
+    }
+  }
+  unlink(socket_path);
+
+  int handshakes = 0, signaled = 0, dumped = 0, queued = 0;
+  double last_queued = start;
+  std::vector<double> exit_ms, dump_ms, queue_ms;
+  for (std::map<pid_t, Crash>::iterator it = crashes.begin();
+       it != crashes.end(); ++it) {
+    const Crash &crash = it->second;
+    if (WIFSIGNALED(crash.status))
+      signaled++;
+    if (crash.crash_ms < 0)
+      continue;
+    handshakes++;
+    if (crash.exit_ms >= 0)
+      exit_ms.push_back(crash.exit_ms - crash.crash_ms);
+    if (crash.dump_ms >= 0) {
+      dumped++;
+      dump_ms.push_back(crash.dump_ms - crash.crash_ms);
+    }
+    if (crash.queue_ms >= 0) {
+      queued++;
+      queue_ms.push_back(crash.queue_ms - crash.crash_ms);
+      last_queued = std::max(last_queued, crash.queue_ms);
+    }
+  }
+  printf("crash_storm: crashes=%d handshakes=%d signaled=%d dumped=%d "
+         "queued=%d\n", launched, handshakes, signaled, dumped, queued);
+  PrintLatencies("exit_ms", exit_ms);
+  PrintLatencies("dump_ms", dump_ms);
+  PrintLatencies("queue_ms", queue_ms);
+  if (queued)
+    printf("crash_storm: reports_per_sec=%.1f\n",
+           queued * 1e3 / (last_queued - start));
+  return 0;
+}
@@ -25,20 +25,71 @@ int main(int argc, char *argv[]) {
 }
 
 bool SendPid(const char *socket_path);
+void DirtyHeap(long megabytes);
+void CrashAs(const char *type);
 
 // Prepare for doing the crash, but do it below main so that main's
 // line numbers remain stable.
+//
+// --crash=TYPE selects how to die, see CrashAs(). --heap_mb=N dirties N MiB
+// of heap first to make the core dump that large. Both are set up before the
+// --sendpid handshake, so the handshake marks the moment of the crash.
 void PrepareBelow(int argc, char *argv[]) {
   fprintf(stderr, "pid=%jd\n", (intmax_t) getpid());
-  if (argc == 2 && strcmp(argv[1], "--nocrash") == 0) {
-    fprintf(stderr, "Doing normal exit\n");
-    exit(0);
-  }
-  if (argc == 3 && strcmp(argv[1], "--sendpid") == 0) {
-    if (!SendPid(argv[2]))
+  const char *socket_path = NULL;
+  const char *crash_type = "segv";
+  long heap_mb = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--nocrash") == 0) {
+      fprintf(stderr, "Doing normal exit\n");
       exit(0);
+    } else if (strcmp(argv[i], "--sendpid") == 0 && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (strncmp(argv[i], "--crash=", 8) == 0) {
+      crash_type = argv[i] + 8;
+    } else if (strncmp(argv[i], "--heap_mb=", 10) == 0) {
+      heap_mb = atol(argv[i] + 10);
+    }
   }
+  if (heap_mb > 0)
+    DirtyHeap(heap_mb);
+  if (socket_path && !SendPid(socket_path))
+    exit(0);
   fprintf(stderr, "Crashing as requested.\n");
+  CrashAs(crash_type);
+}
+
+void DirtyHeap(long megabytes) {
+  const size_t size = megabytes << 20;
+  // Never freed: it has to be in the core dump.
+  char *heap = static_cast<char *>(malloc(size));
+  if (!heap) {
+    fprintf(stderr, "malloc(%zu) failed\n", size);
+    return;
+  }
+  // Not zero, so the pages can't be deduplicated.
+  memset(heap, 0x5a, size);
+}
+
+__attribute__ ((noinline)) int OverflowStack(volatile char *caller) {
+  volatile char frame[4096];
+  if (!caller)
+    return 0;
+  frame[0] = caller[0] + 1;
+  return OverflowStack(frame) + DefeatTailOptimizationForCrasher();
+}
+
+// Crashes as |type| says: "abort" raises SIGABRT, "stack" overflows the stack.
+// Returns for "segv", main then crashes through recbomb() as it always did.
+void CrashAs(const char *type) {
+  if (strcmp(type, "abort") == 0) {
+    abort();
+  } else if (strcmp(type, "stack") == 0) {
+    volatile char base = 0;
+    OverflowStack(&base);
+  } else if (strcmp(type, "segv") != 0) {
+    fprintf(stderr, "Unknown crash type %s, crashing with segv\n", type);
+  }
 }
 
 // Used when the crasher runs in a different PID namespace than the test. A PID
@@ -312,6 +312,53 @@ class UserCrashTest(crash_test.CrashTest):
         return result
 
 
+    def _run_crash_storm(self, count, rate=0, types=('segv',), heap_mb=64,
+                         timeout=60):
+        """Crashes many root processes at once with the crash_storm driver.
+
+        The driver launches |count| crashers, handshakes with each through
+        --sendpid right before it crashes and watches the system crash
+        directory for its report files.
+
+        @param count: Number of crashes.
+        @param rate: Crashes per second, or 0 to launch them all at once.
+        @param types: Crash types to use in turn: 'segv', 'abort', 'stack' or
+                      'heap', a segv with a core of about |heap_mb| MiB.
+        @param heap_mb: Heap size of the 'heap' crash type.
+        @param timeout: Seconds to wait for reports after the last crash.
+
+        @returns:
+          A dictionary with the crash counts 'crashes', 'handshakes',
+          'signaled', 'dumped' and 'queued', the latency percentiles in ms
+          as '<metric>_<percentile>', e.g. 'queue_ms_p99', for the metrics
+          'exit_ms', 'dump_ms' and 'queue_ms', and 'reports_per_sec'.
+        """
+        self.enable_crash_filtering(os.path.basename(self._crasher_path))
+        self._set_consent(True)
+        storm = os.path.join(os.path.dirname(self._crasher_path),
+                             'crash_storm')
+        output = utils.system_output(
+                '%s --crasher=%s --crash_dir=%s --count=%d --rate=%g '
+                '--types=%s --heap_mb=%d --timeout=%d' %
+                (storm, self._crasher_path, self._SYSTEM_CRASH_DIR, count,
+                 rate, ','.join(types), heap_mb, timeout))
+        logging.debug('crash_storm output:\n%s', output)
+
+        result = {}
+        for line in output.splitlines():
+            fields = line.split()
+            if not fields or fields[0] != 'crash_storm:':
+                continue
+            prefix = ''
+            if len(fields) > 1 and '=' not in fields[1]:
+                prefix = fields[1] + '_'
+                fields = fields[1:]
+            for field in fields[1:]:
+                key, value = field.split('=', 1)
+                result[prefix + key] = float(value)
+        return result
+
+
     def _check_crash_directory_permissions(self, crash_dir):
         stat_info = os.stat(crash_dir)
         user = pwd.getpwuid(stat_info.st_uid).pw_name
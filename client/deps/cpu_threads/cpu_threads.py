@@ -0,0 +1,27 @@
+#!/usr/bin/python
+
+# Copyright 2015 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+"""Builds libcpu_threads.a, the CPU set and pinned thread helpers shared by
+the multi-CPU timing tests (monotonic_time, tsc).
+
+Tests link it with -I<dep>/include and -L<dep>/lib -lcpu_threads.
+"""
+
+import common, os
+from autotest_lib.client.bin import utils
+
+version = 2
+
+def setup(topdir):
+    srcdir = os.path.join(topdir, 'src')
+    os.chdir(srcdir)
+    utils.make('clean')
+    utils.make()
+    utils.make('DESTDIR=%s install' % topdir)
+    os.chdir(topdir)
+
+pwd = os.getcwd()
+utils.update_version(pwd + '/src', True, version, setup, pwd)
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2008 Google Inc. All Rights Reserved.
+ * Author: md@google.com (Michael Davidson)
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "threads.h"
+
+/*
+ * Spins before a barrier waiter starts yielding the CPU, which only
+ * matters when there are more threads than CPUs.
+ */
+#define	SPINS_BEFORE_YIELD	1024
+
+struct thread_group {
+	spin_barrier_t	barrier;
+	int		nthreads;	/* group size			*/
+	int		started;	/* threads created		*/
+	volatile int	failed;		/* not all threads were created	*/
+	int		sense;		/* barrier sense of the creator	*/
+	thread_func_t	func;
+	thread_t	*threads;
+	char		*results;
+	size_t		result_stride;
+};
+
+
+static inline void cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__("rep; nop" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+
+void spin_barrier_init(spin_barrier_t *barrier, int size)
+{
+	barrier->count	= size;
+	barrier->sense	= 0;
+	barrier->size	= size;
+}
+
+
+/*
+ * Arrive at the barrier for the round that releases sense.
+ * The last thread to arrive resets the count and releases the others.
+ * Returns 1 for the last thread.
+ */
+static int spin_barrier_arrive(spin_barrier_t *barrier, int sense)
+{
+	if (__sync_sub_and_fetch(&barrier->count, 1) != 0)
+		return 0;
+
+	barrier->count = barrier->size;
+	__sync_synchronize();
+	barrier->sense = sense;
+	return 1;
+}
+
+
+void spin_barrier_wait(spin_barrier_t *barrier, int *sense)
+{
+	int	spins	= 0;
+
+	*sense = !*sense;
+	if (spin_barrier_arrive(barrier, *sense))
+		return;
+
+	while (barrier->sense != *sense) {
+		if (++spins < SPINS_BEFORE_YIELD)
+			cpu_relax();
+		else
+			sched_yield();
+	}
+	__sync_synchronize();
+}
+
+
+/*
+ * Helper function to run a thread on a specific CPU.
+ */
+static void *run_thread(void *arg)
+{
+	thread_t	*thread = arg;
+	thread_group_t	*group	= thread->group;
+
+	if (thread->cpu >= 0) {
+		cpu_set_t	cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(thread->cpu, &cpus);
+		if (sched_setaffinity(0, sizeof cpus, &cpus) < 0)
+			WARN(errno, "sched_setaffinity() failed for CPU %d",
+				thread->cpu);
+	}
+
+	thread_barrier(thread);
+
+	if (!group->failed)
+		group->func(thread);
+
+	return NULL;
+}
+
+
+thread_group_t *create_thread_group(const cpu_set_t *cpus, int nthreads,
+				    size_t result_size)
+{
+	thread_group_t	*group;
+	int		*cpu_list	= NULL;
+	int		ncpus		= 0;
+	int		cpu;
+	int		i;
+
+	if (cpus) {
+		if (count_cpus(cpus) == 0) {
+			errno = EINVAL;
+			return NULL;
+		}
+		cpu_list = malloc(sizeof *cpu_list * count_cpus(cpus));
+		if (!cpu_list)
+			return NULL;
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, cpus))
+				cpu_list[ncpus++] = cpu;
+		if (nthreads <= 0)
+			nthreads = ncpus;
+	}
+
+	if (nthreads <= 0 || (group = calloc(1, sizeof *group)) == NULL) {
+		free(cpu_list);
+		return NULL;
+	}
+
+	group->nthreads = nthreads;
+	group->result_stride = result_size ? result_size : 1;
+	group->result_stride = (group->result_stride + CACHE_LINE_SIZE - 1) &
+				~(size_t)(CACHE_LINE_SIZE - 1);
+
+	if (posix_memalign((void **)&group->threads, CACHE_LINE_SIZE,
+			   sizeof(thread_t) * nthreads) ||
+	    posix_memalign((void **)&group->results, CACHE_LINE_SIZE,
+			   group->result_stride * nthreads)) {
+		free(cpu_list);
+		destroy_thread_group(group);
+		return NULL;
+	}
+	memset(group->threads, 0, sizeof(thread_t) * nthreads);
+	memset(group->results, 0, group->result_stride * nthreads);
+
+	for (i = 0; i < nthreads; i++) {
+		thread_t	*thread = &group->threads[i];
+
+		thread->index	= i;
+		thread->cpu	= cpu_list ? cpu_list[i % ncpus] : -1;
+		thread->result	= group->results + group->result_stride * i;
+		thread->group	= group;
+	}
+
+	free(cpu_list);
+
+	return group;
+}
+
+
+int start_threads(thread_group_t *group, thread_func_t func, void *arg)
+{
+	int	i;
+
+	group->func = func;
+
+	/*
+	 * The creator waits at the start barrier too, so that no thread
+	 * gets ahead while the others are still being created.
+	 */
+	spin_barrier_init(&group->barrier, group->nthreads + 1);
+
+	for (i = 0; i < group->nthreads; i++) {
+		thread_t	*thread = &group->threads[i];
+		int		err;
+
+		thread->arg = arg;
+		err = pthread_create(&thread->thread, NULL, run_thread, thread);
+		if (err) {
+			WARN(err, "pthread_create() failed");
+			break;
+		}
+		group->started++;
+	}
+
+	if (group->started < group->nthreads) {
+		group->failed = 1;
+		for (i = group->started; i < group->nthreads; i++)
+			spin_barrier_arrive(&group->barrier, !group->sense);
+	}
+
+	/*
+	 * Later rounds are between the threads only. The count is reset
+	 * from the size by the last arrival, which is after this store.
+	 */
+	group->barrier.size = group->started;
+	spin_barrier_wait(&group->barrier, &group->sense);
+
+	return group->started;
+}
+
+
+void thread_barrier(thread_t *self)
+{
+	spin_barrier_wait(&self->group->barrier, &self->sense);
+}
+
+
+int thread_count(const thread_group_t *group)
+{
+	return group->nthreads;
+}
+
+
+void *thread_result(const thread_group_t *group, int index)
+{
+	return group->threads[index].result;
+}
+
+
+void merge_results(const thread_group_t *group, merge_func_t merge,
+		   void *total)
+{
+	int	i;
+
+	for (i = 0; i < group->started; i++)
+		merge(total, group->threads[i].result);
+}
+
+
+/*
+ * Join with the threads started in the group.
+ */
+void join_threads(thread_group_t *group)
+{
+	int	i;
+
+	for (i = 0; i < group->started; i++)
+		pthread_join(group->threads[i].thread, NULL);
+}
+
+
+void destroy_thread_group(thread_group_t *group)
+{
+	free(group->threads);
+	free(group->results);
+	free(group);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2008 Google Inc. All Rights Reserved.
+ * Author: md@google.com (Michael Davidson)
+ */
+
+#ifndef THREADS_H_
+#define THREADS_H_
+
+#include "cpuset.h"
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Big enough to keep per-thread data out of the lines the adjacent line
+ * prefetcher pulls in together with its neighbours.
+ */
+#define CACHE_LINE_SIZE	128
+
+/*
+ * A sense-reversing spin barrier. Each thread keeps its own sense,
+ * so the barrier can be reused without being reset.
+ */
+typedef struct spin_barrier {
+	volatile int	count;		/* threads yet to arrive	*/
+	volatile int	sense;		/* flipped to release a round	*/
+	int		size;		/* threads per round		*/
+} __attribute__((aligned(CACHE_LINE_SIZE))) spin_barrier_t;
+
+void spin_barrier_init(spin_barrier_t *barrier, int size);
+void spin_barrier_wait(spin_barrier_t *barrier, int *sense);
+
+typedef struct thread_group thread_group_t;
+
+typedef struct thread {
+	pthread_t	thread;
+	int		index;		/* 0 .. thread_count() - 1	*/
+	int		cpu;		/* CPU bound to, or -1		*/
+	int		sense;		/* barrier sense		*/
+	void		*arg;		/* argument to start_threads()	*/
+	void		*result;	/* this thread's result slot	*/
+	thread_group_t	*group;
+} __attribute__((aligned(CACHE_LINE_SIZE))) thread_t;
+
+typedef void (*thread_func_t)(thread_t *self);
+typedef void (*merge_func_t)(void *total, const void *result);
+
+/*
+ * Create a group of nthreads threads, bound round robin to the CPUs in
+ * cpus (one per CPU if nthreads is 0), or left unbound if cpus is NULL.
+ * Each thread gets a zeroed result slot of result_size bytes on cache
+ * lines of its own. Fails with EINVAL if cpus is empty.
+ */
+thread_group_t *create_thread_group(const cpu_set_t *cpus, int nthreads,
+				    size_t result_size);
+
+/*
+ * Create the threads and release them into func together once all of
+ * them are running. Returns the number of threads created; if that is
+ * short of the group size none of them calls func.
+ */
+int start_threads(thread_group_t *group, thread_func_t func, void *arg);
+
+/* Wait for all threads of the group, from a running thread. */
+void thread_barrier(thread_t *self);
+
+int thread_count(const thread_group_t *group);
+void *thread_result(const thread_group_t *group, int index);
+
+/* Fold the result slots, in thread order, into total. */
+void merge_results(const thread_group_t *group, merge_func_t merge,
+		   void *total);
+
+void join_threads(thread_group_t *group);
+void destroy_thread_group(thread_group_t *group);
+
+#endif /* THREADS_H_ */
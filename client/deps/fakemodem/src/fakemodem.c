@@ -7,9 +7,21 @@
 #define _POSIX_C_SOURCE 201108L
 #define _XOPEN_SOURCE 600
 
+/*
+ * One process serves --modems=N fake modems, each on its own PTY and at
+ * its own D-Bus object path, from a single main loop. The patterns of
+ * --patternfile are compiled once and shared by all modems; each modem
+ * owns the list it matches against, so --modempatternfile and SetResponse
+ * only change the modem they are aimed at. When the process is
+ * terminated, it prints a latency_hist line per modem with the time from
+ * the main loop waking up for a command to the result code being written.
+ */
+
 #include <assert.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,12 +29,22 @@
 #include <unistd.h>
 
 #include <glib.h>
+#if GLIB_CHECK_VERSION(2,30,0)
+#include <glib-unix.h>
+#endif
 #include <dbus/dbus-glib.h>
 
-GIOChannel* ioc;
-int masterfd;
+#include "latency_hist.h"
+
+static guint nmodems = 1;
+static gboolean quiet;
+
+/* When the main loop last returned from poll() */
+static gint64 loop_wakeup;
+static GPollFunc default_poll;
 
 typedef struct {
+  gint refcount; /* shared by the modems using a pattern file */
   GRegex *command;
   char *reply; // generic text
   char *responsetext; // ERROR, +CMS ERROR, etc.
@@ -30,11 +52,24 @@ typedef struct {
 
 typedef struct _FakeModem {
   GObject parent;
+  guint index;
+  int masterfd;
+  GIOChannel *ioc;
   gboolean echo;
   gboolean verbose;
   GPtrArray *patterns;
+  GPtrArray *unsolicited;
+  latency_hist_t latency; /* in microseconds */
 } FakeModem;
 
+typedef struct {
+  FakeModem *fakemodem;
+  gchar *text;
+  guint interval; /* in milliseconds */
+  gboolean staggered; /* the first timeout is offset from the others */
+  guint source;
+} Unsolicited;
+
 typedef struct _FakeModemClass
 {
   GObjectClass parent_class;
@@ -47,13 +82,19 @@ GType fakemodem_get_type (void) G_GNUC_CONST;
 
 G_DEFINE_TYPE (FakeModem, fake_modem, G_TYPE_OBJECT)
 
+static void pattern_unref (gpointer data);
+static void unsolicited_free (gpointer data);
+
 static void
 fake_modem_init (FakeModem* self)
 {
 
+  self->masterfd = -1;
   self->echo = TRUE;
   self->verbose = TRUE;
-  self->patterns = NULL;
+  self->patterns = g_ptr_array_new_with_free_func (pattern_unref);
+  self->unsolicited = g_ptr_array_new_with_free_func (unsolicited_free);
+  latency_hist_reset (&self->latency);
 }
 
 static void
@@ -70,9 +111,81 @@ static gboolean send_unsolicited (FakeModem* fakemodem, const gchar* text);
 static gboolean set_response (FakeModem* fakemodem, const gchar* command,
                               const gchar* reply, const gchar* response);
 static gboolean remove_response (FakeModem* fakemodem, const gchar* command);
+static gboolean schedule_unsolicited (FakeModem* fakemodem, const gchar* text,
+                                      guint interval_ms);
 
 #include "fakemodem-dbus.h"
 
+static void
+trace (FakeModem *fakemodem, const gchar *format, ...)
+{
+  va_list ap;
+
+  if (quiet)
+    return;
+  if (nmodems > 1)
+    printf ("[%u] ", fakemodem->index);
+  va_start (ap, format);
+  vprintf (format, ap);
+  va_end (ap);
+}
+
+static GRegex *
+compile_command (const gchar *command, GError **error)
+{
+  return g_regex_new (command,
+                      G_REGEX_ANCHORED |
+                      G_REGEX_CASELESS |
+                      G_REGEX_RAW |
+                      G_REGEX_OPTIMIZE,
+                      0,
+                      error);
+}
+
+/* Takes ownership of all three */
+static Pattern *
+pattern_new (GRegex *command, gchar *reply, gchar *responsetext)
+{
+  Pattern *pat;
+
+  pat = g_malloc (sizeof (*pat));
+  pat->refcount = 1;
+  pat->command = command;
+  pat->reply = reply;
+  pat->responsetext = responsetext;
+  return pat;
+}
+
+static Pattern *
+pattern_ref (Pattern *pat)
+{
+  pat->refcount++;
+  return pat;
+}
+
+static void
+pattern_unref (gpointer data)
+{
+  Pattern *pat = data;
+
+  if (--pat->refcount > 0)
+    return;
+  g_regex_unref (pat->command);
+  g_free (pat->reply);
+  g_free (pat->responsetext);
+  g_free (pat);
+}
+
+static void
+add_patterns (FakeModem *fakemodem, GPtrArray *patterns)
+{
+  guint i;
+
+  for (i = 0 ; i < patterns->len; i++)
+    g_ptr_array_add (fakemodem->patterns,
+                     pattern_ref (g_ptr_array_index (patterns, i)));
+}
+
 GPtrArray *
 parse_pattern_files(char **pattern_files, GError **error)
 {
@@ -81,7 +194,7 @@ parse_pattern_files(char **pattern_files, GError **error)
   GPtrArray *patterns;
   int i;
 
-  patterns = g_ptr_array_new();
+  patterns = g_ptr_array_new_with_free_func (pattern_unref);
 
   skip = g_regex_new ("^\\s*(#.*)?$", 0, 0, error);
   if (skip == NULL)
@@ -112,21 +225,14 @@ parse_pattern_files(char **pattern_files, GError **error)
       if (!g_regex_match (skip, line, 0, NULL)) {
         GMatchInfo *info;
         gboolean ret;
-        gchar *command, *responsetext;
+        gchar *command, *reply, *responsetext;
+        GRegex *regex;
         ret = g_regex_match (parts, line, 0, &info);
         if (ret) {
-          Pattern *pat;
-          pat = g_malloc (sizeof (*pat));
           command = g_match_info_fetch (info, 1);
-          pat->command = g_regex_new (command,
-                                      G_REGEX_ANCHORED |
-                                      G_REGEX_CASELESS |
-                                      G_REGEX_RAW |
-                                      G_REGEX_OPTIMIZE,
-                                      0,
-                                      error);
+          regex = compile_command (command, error);
           g_free (command);
-          if (pat->command == NULL) {
+          if (regex == NULL) {
             printf ("error: %s\n", (*error)->message);
             g_error_free (*error);
             *error = NULL;
@@ -136,20 +242,25 @@ parse_pattern_files(char **pattern_files, GError **error)
             g_free (responsetext);
             responsetext = NULL;
           }
-          pat->responsetext = responsetext;
-          pat->reply = g_match_info_fetch (info, 4);
-          while (pat->reply[strlen (pat->reply) - 1] == '\\') {
+          reply = g_match_info_fetch (info, 4);
+          while (reply[strlen (reply) - 1] == '\\') {
             gchar *origstr;
-            pat->reply[strlen (pat->reply) - 1] = '\0';
+            reply[strlen (reply) - 1] = '\0';
             g_free (line); /* probably invalidates fields in 'info' */
             g_io_channel_read_line (pf, &line, &len, &term, error);
             line[term] = '\0';
             linenum++;
-            origstr = pat->reply;
-            pat->reply = g_strjoin ("\r\n", origstr, line, NULL);
+            origstr = reply;
+            reply = g_strjoin ("\r\n", origstr, line, NULL);
             g_free (origstr);
           }
-          g_ptr_array_add (patterns, pat);
+          if (regex != NULL) {
+            g_ptr_array_add (patterns,
+                             pattern_new (regex, reply, responsetext));
+          } else {
+            g_free (reply);
+            g_free (responsetext);
+          }
         } else {
           printf (" Line %d '%s' was not parsed"
                   " as a command-response pattern\n",
@@ -210,6 +321,69 @@ create_dbus_proxy (DBusGConnection *bus)
     return proxy;
 }
 
+static gint
+timed_poll (GPollFD *fds, guint nfds, gint timeout)
+{
+  gint ret;
+
+  ret = default_poll (fds, nfds, timeout);
+  loop_wakeup = g_get_monotonic_time ();
+  return ret;
+}
+
+#if GLIB_CHECK_VERSION(2,30,0)
+static gboolean
+quit_loop (gpointer data)
+{
+  g_main_loop_quit (data);
+  return FALSE;
+}
+#endif
+
+/* Parses "N:rest" into N, which must be below limit, and rest */
+static gboolean
+parse_prefixed (const gchar *arg, guint64 limit, guint64 *value,
+                const gchar **rest)
+{
+  gchar *end;
+
+  *value = g_ascii_strtoull (arg, &end, 10);
+  if (end == arg || *end != ':' || *value >= limit)
+    return FALSE;
+  *rest = end + 1;
+  return TRUE;
+}
+
+static const char *
+open_master (FakeModem *fakemodem)
+{
+  const char *slavedevice = NULL;
+  struct termios t;
+
+  fakemodem->masterfd = posix_openpt (O_RDWR | O_NOCTTY);
+
+  if (fakemodem->masterfd == -1
+      || grantpt (fakemodem->masterfd) == -1
+      || unlockpt (fakemodem->masterfd) == -1
+      || (slavedevice = ptsname (fakemodem->masterfd)) == NULL)
+    return NULL;
+
+  /* Echo is actively harmful here */
+  tcgetattr (fakemodem->masterfd, &t);
+  t.c_lflag &= ~ECHO;
+  tcsetattr (fakemodem->masterfd, TCSANOW, &t);
+
+  fakemodem->ioc = g_io_channel_unix_new (fakemodem->masterfd);
+  g_io_channel_set_encoding (fakemodem->ioc, NULL, NULL);
+  g_io_channel_set_line_term (fakemodem->ioc, "\r", 1);
+  g_io_add_watch (fakemodem->ioc, G_IO_IN, master_read, fakemodem);
+
+  return slavedevice;
+}
+
+static void add_unsolicited (FakeModem *fakemodem, const gchar *text,
+                             guint interval, guint offset);
+
 int
 main (int argc, char *argv[])
 {
@@ -217,16 +391,34 @@ main (int argc, char *argv[])
   DBusGProxy *proxy;
   GMainLoop* loop;
   const char *slavedevice;
-  struct termios t;
-  FakeModem *fakemodem;
+  FakeModem **fakemodems;
+  GPtrArray *patterns;
   GOptionContext *opt_ctx;
   char **pattern_files = NULL;
+  char **modem_pattern_files = NULL;
+  char **unsolicited = NULL;
+  gint modems = 1;
   gboolean session = FALSE;
   GError *err = NULL;
+  guint64 n;
+  const gchar *rest;
+  gchar *path;
+  guint i, j;
 
   GOptionEntry entries[] = {
     { "patternfile", 0, 0, G_OPTION_ARG_STRING_ARRAY, &pattern_files,
       "Path to pattern file", NULL},
+    { "modems", 0, 0, G_OPTION_ARG_INT, &modems,
+      "Number of modems to emulate (default 1)", "N"},
+    { "modempatternfile", 0, 0, G_OPTION_ARG_STRING_ARRAY,
+      &modem_pattern_files,
+      "Pattern file for one modem, tried before the shared ones",
+      "INDEX:PATH"},
+    { "unsolicited", 0, 0, G_OPTION_ARG_STRING_ARRAY, &unsolicited,
+      "Have every modem send TEXT every MS milliseconds, staggered "
+      "across modems", "MS:TEXT"},
+    { "quiet", 0, 0, G_OPTION_ARG_NONE, &quiet,
+      "Don't log commands and replies", NULL},
     { "session", 0, 0, G_OPTION_ARG_NONE, &session,
       "Bind to session bus", NULL},
     { "system", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &session,
@@ -240,7 +432,7 @@ main (int argc, char *argv[])
 
   opt_ctx = g_option_context_new (NULL);
   g_option_context_set_summary (opt_ctx,
-                                "Emulate a modem with a set of "
+                                "Emulate modems with a set of "
                                 "regexp-programmed responses.");
   g_option_context_add_main_entries (opt_ctx, entries, NULL);
   if (!g_option_context_parse (opt_ctx, &argc, &argv, &err)) {
@@ -251,19 +443,71 @@ main (int argc, char *argv[])
 
   g_option_context_free (opt_ctx);
 
-  fakemodem = g_object_new (FAKEMODEM_TYPE, NULL);
+  if (modems < 1) {
+    g_warning ("--modems must be at least 1\n");
+    exit (1);
+  }
+  nmodems = modems;
+
   if (pattern_files) {
-    fakemodem->patterns = parse_pattern_files (pattern_files, &err);
-    if (fakemodem->patterns == NULL) {
+    patterns = parse_pattern_files (pattern_files, &err);
+    if (patterns == NULL) {
       g_warning ("%s\n", err->message);
       g_error_free (err);
       exit (1);
     }
   } else
-    fakemodem->patterns = g_ptr_array_sized_new (0);
+    patterns = g_ptr_array_sized_new (0);
+
+  fakemodems = g_new (FakeModem *, nmodems);
+  for (i = 0 ; i < nmodems; i++) {
+    fakemodems[i] = g_object_new (FAKEMODEM_TYPE, NULL);
+    fakemodems[i]->index = i;
+  }
+
+  for (i = 0 ; modem_pattern_files && modem_pattern_files[i]; i++) {
+    GPtrArray *own;
+    char *files[2] = { NULL, NULL };
+
+    if (!parse_prefixed (modem_pattern_files[i], nmodems, &n, &rest)) {
+      g_warning ("Bad --modempatternfile %s\n", modem_pattern_files[i]);
+      exit (1);
+    }
+    files[0] = (char *)rest;
+    own = parse_pattern_files (files, &err);
+    if (own == NULL) {
+      g_warning ("%s\n", err->message);
+      g_error_free (err);
+      exit (1);
+    }
+    add_patterns (fakemodems[n], own);
+    g_ptr_array_unref (own);
+  }
+
+  for (i = 0 ; i < nmodems; i++)
+    add_patterns (fakemodems[i], patterns);
+  g_ptr_array_unref (patterns);
+
+  for (i = 0 ; unsolicited && unsolicited[i]; i++) {
+    if (!parse_prefixed (unsolicited[i], G_MAXUINT, &n, &rest) || n == 0) {
+      g_warning ("Bad --unsolicited %s\n", unsolicited[i]);
+      exit (1);
+    }
+    for (j = 0 ; j < nmodems; j++)
+      add_unsolicited (fakemodems[j], rest, n, n * (j + 1) / nmodems);
+  }
 
   loop = g_main_loop_new (NULL, FALSE);
 
+  /* Timestamps the wakeups that command latencies are measured from */
+  default_poll = g_main_context_get_poll_func (NULL);
+  g_main_context_set_poll_func (NULL, timed_poll);
+
+#if GLIB_CHECK_VERSION(2,30,0)
+  g_unix_signal_add (SIGTERM, quit_loop, loop);
+  g_unix_signal_add (SIGINT, quit_loop, loop);
+#endif
+
   dbus_g_object_type_install_info (FAKEMODEM_TYPE,
                                    &dbus_glib_fakemodem_object_info);
 
@@ -283,40 +527,41 @@ main (int argc, char *argv[])
   if (!proxy)
     exit (1);
 
+  /* The first modem is also at "/", where single modem clients look */
   dbus_g_connection_register_g_object (bus,
                                        "/",
-                                       G_OBJECT (fakemodem));
-
-  masterfd = posix_openpt (O_RDWR | O_NOCTTY);
-
-  if (masterfd == -1
-      || grantpt (masterfd) == -1
-      || unlockpt (masterfd) == -1
-      || (slavedevice = ptsname (masterfd)) == NULL)
-    exit (1);
+                                       G_OBJECT (fakemodems[0]));
+  for (i = 0 ; i < nmodems; i++) {
+    path = g_strdup_printf ("/Modems/%u", i);
+    dbus_g_connection_register_g_object (bus,
+                                         path,
+                                         G_OBJECT (fakemodems[i]));
+    g_free (path);
+  }
 
-  printf ("%s\n", slavedevice);
+  /* One line per modem, in index order */
+  for (i = 0 ; i < nmodems; i++) {
+    slavedevice = open_master (fakemodems[i]);
+    if (slavedevice == NULL)
+      exit (1);
+    printf ("%s\n", slavedevice);
+  }
   fflush (stdout);
 
-  /* Echo is actively harmful here */
-  tcgetattr (masterfd, &t);
-  t.c_lflag &= ~ECHO;
-  tcsetattr (masterfd, TCSANOW, &t);
-
-  ioc = g_io_channel_unix_new (masterfd);
-  g_io_channel_set_encoding (ioc, NULL, NULL);
-  g_io_channel_set_line_term (ioc, "\r", 1);
-  g_io_add_watch (ioc, G_IO_IN, master_read, fakemodem);
-
   g_main_loop_run (loop);
 
   g_main_loop_unref (loop);
 
-  g_object_unref (fakemodem);
+  for (i = 0 ; i < nmodems; i++) {
+    gchar *name = g_strdup_printf ("modem%u", i);
+    latency_hist_write_text (&fakemodems[i]->latency, stdout, name, "us");
+    g_free (name);
+    g_object_unref (fakemodems[i]);
+  }
+  g_free (fakemodems);
   return 0;
 }
 
-
 /*
  * &?[A-CE-RT-Z][0-9]*
  * S[0-9]+?
@@ -346,6 +591,9 @@ static char *command_patterns[] =
 #undef VALUE
 #undef CVALUE
 
+/* Compiled command_patterns, shared by all modems */
+static GPtrArray *commands;
+
 static gboolean master_read (GIOChannel *source, GIOCondition condition,
                              gpointer data)
 {
@@ -357,8 +605,6 @@ static gboolean master_read (GIOChannel *source, GIOCondition condition,
   GIOStatus status;
   int i, rval;
 
-  static GPtrArray *commands;
-
   if (commands == NULL) {
     int n;
     n = sizeof (command_patterns) / sizeof (command_patterns[0]);
@@ -385,12 +631,12 @@ static gboolean master_read (GIOChannel *source, GIOCondition condition,
     return FALSE;
   line[term] = '\0';
 
-  printf ("Line: '%s'\n", line);
+  trace (fakemodem, "Line: '%s'\n", line);
 
   if (fakemodem->echo) {
-    rval = write (masterfd, line, term);
+    rval = write (fakemodem->masterfd, line, term);
     assert(term == rval);
-    rval = write (masterfd, "\r\n", 2);
+    rval = write (fakemodem->masterfd, "\r\n", 2);
     assert(2 == rval);
   }
 
@@ -433,16 +679,18 @@ done:
     if (response == NULL)
       response = "OK";
     rstr = g_strdup_printf("\r\n%s\r\n", response);
-    rval = write (masterfd, rstr, strlen (rstr));
+    rval = write (fakemodem->masterfd, rstr, strlen (rstr));
     assert(strlen(rstr) == rval);
     g_free (rstr);
   } else {
     gchar *rstr;
     rstr = g_strdup_printf("%s\n", response);
-    rval = write (masterfd, rstr, strlen (rstr));
+    rval = write (fakemodem->masterfd, rstr, strlen (rstr));
     assert(strlen(rstr) == rval);
     g_free (rstr);
   }
+  latency_hist_record (&fakemodem->latency,
+                       g_get_monotonic_time () - loop_wakeup);
 
 out:
   g_free (line);
@@ -455,7 +703,7 @@ handle_cmd(FakeModem *fakemodem, const gchar *cmd)
   guint i;
   Pattern *pat = NULL;
 
-  printf (" Cmd:  '%s'\n", cmd);
+  trace (fakemodem, " Cmd:  '%s'\n", cmd);
 
   if (toupper (cmd[0]) >= 'A' && toupper (cmd[0]) <= 'Z') {
     switch (toupper (cmd[0])) {
@@ -494,10 +742,10 @@ handle_cmd(FakeModem *fakemodem, const gchar *cmd)
 
   if (pat->reply && pat->reply[0]) {
     int rval;
-    printf (" Reply: '%s'\n", pat->reply);
-    rval = write (masterfd, pat->reply, strlen (pat->reply));
+    trace (fakemodem, " Reply: '%s'\n", pat->reply);
+    rval = write (fakemodem->masterfd, pat->reply, strlen (pat->reply));
     assert(strlen(pat->reply) == rval);
-    rval = write (masterfd, "\r\n", 2);
+    rval = write (fakemodem->masterfd, "\r\n", 2);
     assert(2 == rval);
   }
 
@@ -510,10 +758,10 @@ send_unsolicited (FakeModem *fakemodem, const gchar* text)
 {
   int rval;
 
-  rval = write (masterfd, "\r\n", 2);
-  rval = write (masterfd, text, strlen (text));
+  rval = write (fakemodem->masterfd, "\r\n", 2);
+  rval = write (fakemodem->masterfd, text, strlen (text));
   assert(strlen(text) == rval);
-  rval = write (masterfd, "\r\n", 2);
+  rval = write (fakemodem->masterfd, "\r\n", 2);
   assert(2 == rval);
 
   return TRUE;
@@ -534,32 +782,27 @@ set_response (FakeModem *fakemodem,
   for (i = 0 ; i < fakemodem->patterns->len; i++) {
     pat = (Pattern *)g_ptr_array_index (fakemodem->patterns, i);
     if (strcmp (g_regex_get_pattern (pat->command), command) == 0) {
-      g_free (pat->reply);
-      pat->reply = g_strdup (reply);
-      g_free (pat->responsetext);
-      pat->responsetext = g_strdup (response);
+      /* Other modems may share pat, so replace it rather than change it */
+      g_ptr_array_index (fakemodem->patterns, i) =
+          pattern_new (g_regex_ref (pat->command), g_strdup (reply),
+                       g_strdup (response));
+      pattern_unref (pat);
       break;
     }
   }
 
   if (i == fakemodem->patterns->len) {
     GError *error = NULL;
-    pat = g_malloc (sizeof (*pat));
-    pat->command = g_regex_new (command,
-                                G_REGEX_ANCHORED |
-                                G_REGEX_CASELESS |
-                                G_REGEX_RAW |
-                                G_REGEX_OPTIMIZE,
-                                0,
-                                &error);
-    if (pat->command == NULL) {
+    GRegex *regex;
+    regex = compile_command (command, &error);
+    if (regex == NULL) {
       printf ("error: %s\n", error->message);
-      g_free (pat);
+      g_error_free (error);
       return FALSE;
     }
-    pat->responsetext = g_strdup (response);
-    pat->reply = g_strdup (reply);
-    g_ptr_array_add (fakemodem->patterns, pat);
+    g_ptr_array_add (fakemodem->patterns,
+                     pattern_new (regex, g_strdup (reply),
+                                  g_strdup (response)));
   }
 
   return TRUE;
@@ -584,3 +827,64 @@ remove_response (FakeModem* fakemodem, const gchar* command)
 
   return found;
 }
+
+static void
+unsolicited_free (gpointer data)
+{
+  Unsolicited *u = data;
+
+  g_source_remove (u->source);
+  g_free (u->text);
+  g_free (u);
+}
+
+static gboolean
+unsolicited_timeout (gpointer data)
+{
+  Unsolicited *u = data;
+
+  send_unsolicited (u->fakemodem, u->text);
+  if (u->staggered) {
+    u->staggered = FALSE;
+    u->source = g_timeout_add (u->interval, unsolicited_timeout, u);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Sends text every interval ms, the first time after offset ms */
+static void
+add_unsolicited (FakeModem *fakemodem, const gchar *text, guint interval,
+                 guint offset)
+{
+  Unsolicited *u;
+
+  u = g_malloc (sizeof (*u));
+  u->fakemodem = fakemodem;
+  u->text = g_strdup (text);
+  u->interval = interval;
+  u->staggered = offset != interval;
+  u->source = g_timeout_add (offset, unsolicited_timeout, u);
+  g_ptr_array_add (fakemodem->unsolicited, u);
+}
+
+static gboolean
+schedule_unsolicited (FakeModem* fakemodem, const gchar* text,
+                      guint interval_ms)
+{
+  guint i;
+
+  /* Replaces the schedule of text; an interval of 0 just cancels it */
+  for (i = 0 ; i < fakemodem->unsolicited->len; ) {
+    Unsolicited *u = g_ptr_array_index (fakemodem->unsolicited, i);
+    if (strcmp (u->text, text) == 0)
+      g_ptr_array_remove_index (fakemodem->unsolicited, i);
+    else
+      i++;
+  }
+
+  if (interval_ms)
+    add_unsolicited (fakemodem, text, interval_ms, interval_ms);
+
+  return TRUE;
+}
@@ -4,14 +4,21 @@
 
 // Application that displays graphics using OpenGL [ES] with the intent
 // of being used in functional tests.
+//
+// With --timeline it instead replays a scripted window manager workload:
+// windows are opened, closed, moved, resized and damaged as the timeline file
+// says, and the time to composite every frame is reported as percentiles.
 
 #include <gflags/gflags.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include <cmath>
+#include <fstream>
+#include <sstream>
 
 #include "glinterface.h"
 #include "main.h"
@@ -28,32 +35,68 @@ GLuint GenerateAndBindTexture() {
   return name;
 }
 
-unsigned char* CreateBitmap(int w, int h) {
-  unsigned char* bitmap = new unsigned char[4 * w * h];
-  unsigned char* pixel = bitmap;
-  float w2 = 0.5f * w;
-  float h2 = 0.5f * h;
+typedef float float4 __attribute__((vector_size(16)));
+typedef int32_t int4 __attribute__((vector_size(16)));
+
+// Fills |pixels| with a soft white ellipse, as RGBA.
+//
+// The squared distance dx^2 + dy^2 is separable, so dx^2 is computed once per
+// column and each row is then filled four pixels at a time with vector math.
+void FillSoftEllipse(uint32_t* pixels, int w, int h) {
+  const float w2 = 0.5f * w;
+  const float h2 = 0.5f * h;
+  const float4 one = {1.f, 1.f, 1.f, 1.f};
+  std::vector<float> dx2(w);
+  for (int x = 0; x < w; x++) {
+    float dx = (x - w2) / w2;
+    dx2[x] = dx * dx;
+  }
+
   for (int y = 0; y < h; y++) {
-    for (int x = 0; x < w; x++) {
-      // Fill with soft ellipse
-      float dx = fabs((x - w2) / w2);
-      float dy = fabs((y - h2) / h2);
-      float dist2 = dx * dx + dy * dy;
-      if (dist2 > 1.f)
-        dist2 = 1.f;
-      *pixel = (1.f - dist2) * 255.f;
-      pixel++;
-      *pixel = (1.f - dist2) * 255.f;
-      pixel++;
-      *pixel = (1.f - dist2) * 255.f;
-      pixel++;
-      *pixel = 0;
-      pixel++;
+    float dy = (y - h2) / h2;
+    float dy2 = dy * dy;
+    float4 dy2v = {dy2, dy2, dy2, dy2};
+    uint32_t* row = pixels + y * w;
+    int x = 0;
+    for (; x + 4 <= w; x += 4) {
+      float4 dist2;
+      memcpy(&dist2, &dx2[x], sizeof(dist2));
+      dist2 += dy2v;
+      // dist2 = min(dist2, 1) with a mask, which every compiler supports.
+      int4 over = dist2 > one;
+      dist2 = (float4)(((int4)dist2 & ~over) | ((int4)one & over));
+      float4 value = (one - dist2) * 255.f;
+      int4 gray = __builtin_convertvector(value, int4);
+      // Little endian RGBA with R = G = B = gray and A = 0.
+      int4 rgba = gray * 0x010101;
+      memcpy(&row[x], &rgba, sizeof(rgba));
+    }
+    for (; x < w; x++) {
+      float dist2 = std::min(dx2[x] + dy2, 1.f);
+      uint32_t gray = static_cast<unsigned char>((1.f - dist2) * 255.f);
+      row[x] = gray * 0x010101;
     }
   }
+}
+
+unsigned char* CreateBitmap(int w, int h) {
+  unsigned char* bitmap = new unsigned char[4 * w * h];
+  FillSoftEllipse(reinterpret_cast<uint32_t*>(bitmap), w, h);
   return bitmap;
 }
 
+// Returns the soft ellipse bitmap of the given size. Bitmaps are cached, so
+// windows resized back and forth don't regenerate them.
+const uint32_t* GetSoftEllipse(int w, int h) {
+  static std::map<std::pair<int, int>, std::vector<uint32_t>> cache;
+  std::vector<uint32_t>& bitmap = cache[std::make_pair(w, h)];
+  if (bitmap.empty()) {
+    bitmap.resize(w * h);
+    FillSoftEllipse(bitmap.data(), w, h);
+  }
+  return bitmap.data();
+}
+
 const char kVertexShader[] =
     "attribute vec4 vertices;"
     "varying vec2 v1;"
@@ -76,6 +119,235 @@ DEFINE_double(screenshot2_sec, 1.f, "seconds delay before screenshot2_cmd");
 DEFINE_string(screenshot1_cmd, "", "system command to take a screen shot 1");
 DEFINE_string(screenshot2_cmd, "", "system command to take a screen shot 2");
 DEFINE_double(cooldown_sec, 1.f, "seconds delay after all screenshots");
+DEFINE_string(timeline, "", "replay the window manager events of this file");
+DEFINE_double(frame_ms, 1000.0 / 60, "timeline time advanced per frame");
+
+// Shaders for the replay: every window is a textured quad at |rect|, given as
+// (left, bottom, right, top) in normalized device coordinates.
+const char kWindowVertexShader[] =
+    "attribute vec4 vertices;"
+    "uniform vec4 rect;"
+    "varying vec2 v1;"
+    "void main() {"
+    "    gl_Position = vec4(mix(rect.xy, rect.zw, vertices.xy), 0.0, 1.0);"
+    "    v1 = vertices.xy;"
+    "}";
+
+struct TimelineEvent {
+  double time_ms;
+  std::string type;  // open, close, move, resize, damage or end
+  int window;
+  int args[4];
+};
+
+// Reads a timeline: one event per line, as "<time_ms> <type> ...":
+//   <time_ms> open <window> <x> <y> <width> <height>
+//   <time_ms> close <window>
+//   <time_ms> move <window> <x> <y>
+//   <time_ms> resize <window> <width> <height>
+//   <time_ms> damage <window> <x> <y> <width> <height>
+//   <time_ms> end
+// Positions are in pixels from the top left of the screen, damage rectangles
+// from the top left of the window. Lines starting with # are comments.
+bool ReadTimeline(const char* path, std::vector<TimelineEvent>* events) {
+  std::ifstream file(path);
+  if (!file) {
+    printf("# Error: cannot open %s\n", path);
+    return false;
+  }
+  std::string line;
+  for (int number = 1; std::getline(file, line); number++) {
+    trim(line);
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream fields(line);
+    TimelineEvent event = {};
+    fields >> event.time_ms >> event.type;
+    int arg_count = -1;
+    if (event.type == "end")
+      arg_count = 0;
+    else if (event.type == "close")
+      arg_count = 1;
+    else if (event.type == "move" || event.type == "resize")
+      arg_count = 3;
+    else if (event.type == "open" || event.type == "damage")
+      arg_count = 5;
+    if (arg_count > 0)
+      fields >> event.window;
+    for (int i = 0; i < arg_count - 1; i++)
+      fields >> event.args[i];
+    if (arg_count < 0 || fields.fail() ||
+        (!events->empty() && event.time_ms < events->back().time_ms)) {
+      printf("# Error: %s:%d: bad event: %s\n", path, number, line.c_str());
+      return false;
+    }
+    events->push_back(event);
+  }
+  return true;
+}
+
+struct ReplayWindow {
+  int x, y, width, height;
+  GLuint texture;
+};
+
+void UploadWindow(ReplayWindow* window) {
+  glBindTexture(GL_TEXTURE_2D, window->texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, window->width, window->height, 0,
+               GL_RGBA, GL_UNSIGNED_BYTE,
+               GetSoftEllipse(window->width, window->height));
+}
+
+// Uploads the damaged part of a window, like a client redrawing it.
+void DamageWindow(const ReplayWindow& window, int x, int y, int w, int h,
+                  std::vector<uint32_t>* scratch) {
+  x = std::max(0, x);
+  y = std::max(0, y);
+  w = std::min(w, window.width - x);
+  h = std::min(h, window.height - y);
+  if (w <= 0 || h <= 0)
+    return;
+  // GLES2 has no GL_UNPACK_ROW_LENGTH, so the rows are packed first.
+  const uint32_t* bitmap = GetSoftEllipse(window.width, window.height);
+  scratch->resize(w * h);
+  for (int row = 0; row < h; row++)
+    memcpy(&(*scratch)[row * w], bitmap + (y + row) * window.width + x,
+           w * sizeof(uint32_t));
+  glBindTexture(GL_TEXTURE_2D, window.texture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE,
+                  scratch->data());
+}
+
+void PrintPercentiles(const char* name, std::vector<double> samples) {
+  if (samples.empty())
+    return;
+  std::sort(samples.begin(), samples.end());
+  size_t last = samples.size() - 1;
+  const struct {
+    const char* suffix;
+    size_t index;
+  } stats[] = {{"p50", last * 50 / 100},
+               {"p90", last * 90 / 100},
+               {"p99", last * 99 / 100},
+               {"max", last}};
+  for (const auto& stat : stats) {
+    std::string result = std::string(name) + "_" + stat.suffix;
+    // Same format as glbench results, so the same parsers apply.
+    printf("@RESULT: %-46s = %10.2f %-15s [none]\n", result.c_str(),
+           samples[stat.index], "ms");
+  }
+}
+
+// Replays |events| one frame of FLAGS_frame_ms timeline time after the other,
+// so every run composites the same frames regardless of how fast they are.
+// A frame's latency runs from applying its events, including the texture
+// uploads, until the GPU finished compositing it; the swap is excluded.
+int RunReplay(const std::vector<TimelineEvent>& events) {
+  GLuint program =
+      glbench::InitShaderProgram(kWindowVertexShader, kFragmentShader);
+  if (!program) {
+    printf("# Error: cannot build the replay shaders\n");
+    return 1;
+  }
+  GLfloat vertices[8] = {0.f, 0.f, 1.f, 0.f, 0.f, 1.f, 1.f, 1.f};
+  int attribute_index = glGetAttribLocation(program, "vertices");
+  glVertexAttribPointer(attribute_index, 2, GL_FLOAT, GL_FALSE, 0, vertices);
+  glEnableVertexAttribArray(attribute_index);
+  glUniform1i(glGetUniformLocation(program, "tex"), 0);
+  int rect_uniform = glGetUniformLocation(program, "rect");
+  int color_uniform = glGetUniformLocation(program, "color");
+  // The bitmaps have no alpha: overlapping windows add up.
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+  std::map<int, ReplayWindow> windows;
+  std::vector<int> stacking;  // bottom to top
+  std::vector<uint32_t> scratch;
+  std::vector<double> submit_ms, composite_ms;
+  size_t next_event = 0;
+  bool ended = false;
+  for (uint64_t frame = 0; !ended && next_event < events.size(); frame++) {
+    const double timeline_ms = frame * FLAGS_frame_ms;
+    uint64_t start = GetUTime();
+
+    for (; next_event < events.size() &&
+           events[next_event].time_ms <= timeline_ms;
+         next_event++) {
+      const TimelineEvent& event = events[next_event];
+      if (event.type == "end") {
+        ended = true;
+        break;
+      }
+      if (event.type == "open") {
+        if (windows.count(event.window))
+          continue;
+        ReplayWindow window = {event.args[0], event.args[1], event.args[2],
+                               event.args[3], GenerateAndBindTexture()};
+        UploadWindow(&window);
+        windows[event.window] = window;
+        stacking.push_back(event.window);
+        continue;
+      }
+      auto it = windows.find(event.window);
+      if (it == windows.end())
+        continue;
+      ReplayWindow& window = it->second;
+      if (event.type == "close") {
+        glDeleteTextures(1, &window.texture);
+        windows.erase(it);
+        stacking.erase(
+            std::find(stacking.begin(), stacking.end(), event.window));
+      } else if (event.type == "move") {
+        window.x = event.args[0];
+        window.y = event.args[1];
+      } else if (event.type == "resize") {
+        window.width = event.args[0];
+        window.height = event.args[1];
+        UploadWindow(&window);
+      } else if (event.type == "damage") {
+        DamageWindow(window, event.args[0], event.args[1], event.args[2],
+                     event.args[3], &scratch);
+      }
+    }
+    if (ended)
+      break;
+
+    glClear(GL_COLOR_BUFFER_BIT);
+    for (int id : stacking) {
+      const ReplayWindow& window = windows[id];
+      GLfloat rect[4] = {
+          2.f * window.x / g_width - 1.f,
+          1.f - 2.f * (window.y + window.height) / g_height,
+          2.f * (window.x + window.width) / g_width - 1.f,
+          1.f - 2.f * window.y / g_height};
+      // Tell the windows apart.
+      GLfloat color[4] = {0.5f + 0.5f * ((id >> 0) & 1),
+                          0.5f + 0.5f * ((id >> 1) & 1),
+                          0.5f + 0.5f * ((id >> 2) & 1), 1.f};
+      glBindTexture(GL_TEXTURE_2D, window.texture);
+      glUniform4fv(rect_uniform, 1, rect);
+      glUniform4fv(color_uniform, 1, color);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    uint64_t submitted = GetUTime();
+    glFinish();
+    uint64_t composited = GetUTime();
+    g_main_gl_interface->SwapBuffers();
+
+    submit_ms.push_back((submitted - start) / 1000.0);
+    composite_ms.push_back((composited - start) / 1000.0);
+  }
+
+  for (auto& it : windows)
+    glDeleteTextures(1, &it.second.texture);
+  glDeleteProgram(program);
+
+  printf("@RESULT: %-46s = %10.2f %-15s [none]\n", "wm_replay_frames",
+         static_cast<double>(composite_ms.size()), "frames");
+  PrintPercentiles("wm_replay_submit", submit_ms);
+  PrintPercentiles("wm_replay_composite", composite_ms);
+  return 0;
+}
 
 int main(int argc, char* argv[]) {
   // Configure full screen
@@ -99,6 +371,15 @@ int main(int argc, char* argv[]) {
   }
   glViewport(0, 0, g_width, g_height);
 
+  if (!FLAGS_timeline.empty()) {
+    std::vector<TimelineEvent> events;
+    int ret = ReadTimeline(FLAGS_timeline.c_str(), &events)
+                  ? RunReplay(events)
+                  : 1;
+    g_main_gl_interface->Cleanup();
+    return ret;
+  }
+
   unsigned char* bitmap = CreateBitmap(g_height, g_width);
   GLuint texture = GenerateAndBindTexture();
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, g_height, g_width, 0, GL_RGBA,
@@ -3,7 +3,7 @@
 import os, common
 from autotest_lib.client.bin import utils
 
-version = 1
+version = 2
 
 def setup(topdir):
     srcdir = os.path.join(topdir, 'src')
@@ -2,11 +2,22 @@
  * This is a stripped down version of the iw tool designed for
  * programmatically checking driver/hw capabilities.
  *
+ *	iwcap phyX check...
+ *	iwcap -b
+ *
+ * All wiphys are read with a single NL80211_CMD_GET_WIPHY dump, split
+ * into several messages per wiphy by kernels that support it, and the
+ * checks are answered from what it returned. With -b (batch mode) iwcap
+ * keeps its netlink socket and the dump, and answers one "phyX check..."
+ * query per line of stdin, each answer ending with a line holding a
+ * single ".". A "refresh" line dumps the wiphys again.
+ *
  * Copyright 2007, 2008	Johannes Berg <johannes@sipsolutions.net>
  */
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <net/if.h>
 #include <sys/types.h>
@@ -39,21 +50,14 @@ static inline void nl_socket_free(struct nl_sock *h)
 	nl_handle_destroy(h);
 }
 
-static inline int __genl_ctrl_alloc_cache(struct nl_sock *h, struct nl_cache **cache)
-{
-	struct nl_cache *tmp = genl_ctrl_alloc_cache(h);
-	if (!tmp)
-		return -ENOMEM;
-	*cache = tmp;
-	return 0;
-}
-#define genl_ctrl_alloc_cache __genl_ctrl_alloc_cache
 #endif /* CONFIG_LIBNL20 */
 
+/* Newer than our nl80211.h; older kernels ignore it and do not split. */
+#define NL80211_ATTR_SPLIT_WIPHY_DUMP_COMPAT	174
+
 struct nl80211_state {
 	struct nl_sock *nl_sock;
-	struct nl_cache *nl_cache;
-	struct genl_family *nl80211;
+	int nl80211_id;
 };
 
 static int nl80211_init(struct nl80211_state *state)
@@ -72,23 +76,16 @@ static int nl80211_init(struct nl80211_state *state)
 		goto out_handle_destroy;
 	}
 
-	if (genl_ctrl_alloc_cache(state->nl_sock, &state->nl_cache)) {
-		fprintf(stderr, "Failed to allocate generic netlink cache.\n");
-		err = -ENOMEM;
-		goto out_handle_destroy;
-	}
-
-	state->nl80211 = genl_ctrl_search_by_name(state->nl_cache, "nl80211");
-	if (!state->nl80211) {
+	/* Only nl80211 is needed, so skip caching every family. */
+	state->nl80211_id = genl_ctrl_resolve(state->nl_sock, "nl80211");
+	if (state->nl80211_id < 0) {
 		fprintf(stderr, "nl80211 not found.\n");
 		err = -ENOENT;
-		goto out_cache_free;
+		goto out_handle_destroy;
 	}
 
 	return 0;
 
- out_cache_free:
-	nl_cache_free(state->nl_cache);
  out_handle_destroy:
 	nl_socket_free(state->nl_sock);
 	return err;
@@ -96,30 +93,11 @@ static int nl80211_init(struct nl80211_state *state)
 
 static void nl80211_cleanup(struct nl80211_state *state)
 {
-	genl_family_put(state->nl80211);
-	nl_cache_free(state->nl_cache);
 	nl_socket_free(state->nl_sock);
 }
 
 static const char *argv0;
 
-static int phy_lookup(char *name)
-{
-	char buf[200];
-	int fd, pos;
-
-	snprintf(buf, sizeof(buf), "/sys/class/ieee80211/%s/index", name);
-
-	fd = open(buf, O_RDONLY);
-	if (fd < 0)
-		return -1;
-	pos = read(fd, buf, sizeof(buf) - 1);
-	if (pos < 0)
-		return -1;
-	buf[pos] = '\0';
-	return atoi(buf);
-}
-
 enum {
 	CHECK_IS_HT20		= 0x00000001,
 	CHECK_IS_HT40		= 0x00000002,
@@ -218,18 +196,52 @@ static const struct check *find_check_bybits(int bits)
 }
 #endif
 
-static int check_iftype(struct nlattr *tb_msg[], int nl_type)
+#define MAX_FREQS	256
+
+/* What the dump told about a wiphy, merged over its bands and messages. */
+struct phy_info {
+	int index;
+	char name[IFNAMSIZ];
+	int phy_caps;
+	int amsdu_len, ampdu_fact, ampdu_dens, max_mcs, max_rate;
+	unsigned int iftypes;		/* 1 << NL80211_IFTYPE_* */
+	int nfreqs;
+	uint32_t freqs[MAX_FREQS];
+};
+
+struct phy_cache {
+	struct phy_info *phys;
+	int nphys;
+};
+
+static struct phy_info *find_phy(struct phy_cache *cache, int index)
 {
-	struct nlattr *nl_mode;
-	int rem_mode;
+	struct phy_info *phy;
+	int i;
+
+	for (i = 0; i < cache->nphys; i++)
+		if (cache->phys[i].index == index)
+			return &cache->phys[i];
+
+	phy = realloc(cache->phys, (cache->nphys + 1) * sizeof(*phy));
+	if (!phy)
+		return NULL;
+	cache->phys = phy;
+	phy = &cache->phys[cache->nphys++];
+	memset(phy, 0, sizeof(*phy));
+	phy->index = index;
+	return phy;
+}
 
-	if (!tb_msg[NL80211_ATTR_SUPPORTED_IFTYPES])
-		return 0;
+static struct phy_info *find_phy_byname(struct phy_cache *cache,
+					const char *name)
+{
+	int i;
 
-	nla_for_each_nested(nl_mode, tb_msg[NL80211_ATTR_SUPPORTED_IFTYPES], rem_mode)
-		if (nl_mode->nla_type == nl_type)
-			return 1;
-	return 0;
+	for (i = 0; i < cache->nphys; i++)
+		if (strcmp(cache->phys[i].name, name) == 0)
+			return &cache->phys[i];
+	return NULL;
 }
 
 static unsigned int get_max_mcs(unsigned char *mcs)
@@ -268,12 +280,8 @@ static void prate(const char *tag, int v)
 	printf("%s: %2.1f\n", tag, 0.1*v);
 }
 
-static int check_phy_handler(struct nl_msg *msg, void *arg)
+static void parse_band(struct phy_info *phy, struct nlattr *nl_band)
 {
-	struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
-	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
-	uintptr_t checks = (uintptr_t) arg;
-
 	struct nlattr *tb_band[NL80211_BAND_ATTR_MAX + 1];
 
 	struct nlattr *tb_freq[NL80211_FREQUENCY_ATTR_MAX + 1];
@@ -292,96 +300,127 @@ static int check_phy_handler(struct nl_msg *msg, void *arg)
 		[NL80211_BITRATE_ATTR_2GHZ_SHORTPREAMBLE] = { .type = NLA_FLAG },
 	};
 
-	struct nlattr *nl_band;
 	struct nlattr *nl_freq;
 	struct nlattr *nl_rate;
-	int rem_band, rem_freq, rem_rate, phy_caps;
-	int amsdu_len, ampdu_fact, ampdu_dens, max_mcs, max_rate;
+	int rem_freq, rem_rate;
+
+	nla_parse(tb_band, NL80211_BAND_ATTR_MAX, nla_data(nl_band),
+		  nla_len(nl_band), NULL);
+
+	if (tb_band[NL80211_BAND_ATTR_HT_CAPA]) {
+		unsigned short caps = nla_get_u16(tb_band[NL80211_BAND_ATTR_HT_CAPA]);
+		int len;
+
+		/* XXX not quite right but close enough */
+		phy->phy_caps |= CHECK_IS_11N | caps;
+		len = 0xeff + ((caps & 0x0800) << 1);
+		if (len > phy->amsdu_len)
+			phy->amsdu_len = len;
+	}
+	if (tb_band[NL80211_BAND_ATTR_HT_AMPDU_FACTOR]) {
+		unsigned char factor = nla_get_u8(tb_band[NL80211_BAND_ATTR_HT_AMPDU_FACTOR]);
+		int fact = (1<<(13+factor))-1;
+		if (fact > phy->ampdu_fact)
+			phy->ampdu_fact = fact;
+	}
+	if (tb_band[NL80211_BAND_ATTR_HT_AMPDU_DENSITY]) {
+		unsigned char dens = nla_get_u8(tb_band[NL80211_BAND_ATTR_HT_AMPDU_DENSITY]);
+		if (dens > phy->ampdu_dens)
+			phy->ampdu_dens = dens;
+	}
+	if (tb_band[NL80211_BAND_ATTR_HT_MCS_SET] &&
+	    nla_len(tb_band[NL80211_BAND_ATTR_HT_MCS_SET]) == 16) {
+		/* As defined in 7.3.2.57.4 Supported MCS Set field */
+		unsigned char *mcs = nla_data(tb_band[NL80211_BAND_ATTR_HT_MCS_SET]);
+		int max = get_max_mcs(&mcs[0]);
+		if (max > phy->max_mcs)
+			phy->max_mcs = max;
+	}
+
+	/* NB: a split dump sends the freqs of a band over several messages */
+	nla_for_each_nested(nl_freq, tb_band[NL80211_BAND_ATTR_FREQS], rem_freq) {
+		uint32_t freq;
+
+		nla_parse(tb_freq, NL80211_FREQUENCY_ATTR_MAX,
+		    nla_data(nl_freq), nla_len(nl_freq),
+		    freq_policy);
+		if (!tb_freq[NL80211_FREQUENCY_ATTR_FREQ])
+			continue;
+#if 0
+		/* NB: we care about device caps, not regulatory */
+		if (tb_freq[NL80211_FREQUENCY_ATTR_DISABLED])
+			continue;
+#endif
+		freq = nla_get_u32(
+		    tb_freq[NL80211_FREQUENCY_ATTR_FREQ]);
+		if (phy->nfreqs < MAX_FREQS)
+			phy->freqs[phy->nfreqs++] = freq;
+
+		/* NB: approximate band boundaries, we get no help */
+		if (2000 <= freq && freq <= 3000)
+			phy->phy_caps |= CHECK_IS_24GHZ;
+		else if (4000 <= freq && freq <= 6000)
+			phy->phy_caps |= CHECK_IS_5GHZ;
+	}
+
+	nla_for_each_nested(nl_rate, tb_band[NL80211_BAND_ATTR_RATES], rem_rate) {
+		int rate;
+
+		nla_parse(tb_rate, NL80211_BITRATE_ATTR_MAX, nla_data(nl_rate),
+			  nla_len(nl_rate), rate_policy);
+		if (!tb_rate[NL80211_BITRATE_ATTR_RATE])
+			continue;
+		rate = nla_get_u32(tb_rate[NL80211_BITRATE_ATTR_RATE]);
+		if (rate > phy->max_rate)
+			phy->max_rate = rate;
+	}
+}
+
+static int wiphy_dump_handler(struct nl_msg *msg, void *arg)
+{
+	struct nlattr *tb_msg[NL80211_ATTR_MAX + 1];
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct phy_cache *cache = arg;
+	struct phy_info *phy;
+	struct nlattr *nl_band;
+	struct nlattr *nl_mode;
+	int rem_band, rem_mode;
 
 	nla_parse(tb_msg, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
 		  genlmsg_attrlen(gnlh, 0), NULL);
 
-	if (!tb_msg[NL80211_ATTR_WIPHY_BANDS])
+	if (!tb_msg[NL80211_ATTR_WIPHY])
 		return NL_SKIP;
+	phy = find_phy(cache, nla_get_u32(tb_msg[NL80211_ATTR_WIPHY]));
+	if (!phy)
+		return NL_STOP;
+
+	if (tb_msg[NL80211_ATTR_WIPHY_NAME])
+		snprintf(phy->name, sizeof(phy->name), "%s",
+			 nla_get_string(tb_msg[NL80211_ATTR_WIPHY_NAME]));
+
+	if (tb_msg[NL80211_ATTR_SUPPORTED_IFTYPES])
+		nla_for_each_nested(nl_mode, tb_msg[NL80211_ATTR_SUPPORTED_IFTYPES], rem_mode)
+			if (nl_mode->nla_type < 32)
+				phy->iftypes |= 1U << nl_mode->nla_type;
 
-	phy_caps = 0;
-	amsdu_len = 0;
-	ampdu_fact = 0;
-	ampdu_dens = 0;
-	max_mcs = 0;
-	max_rate = 0;
 	/* NB: merge each band's findings; this stuff is silly */
-	nla_for_each_nested(nl_band, tb_msg[NL80211_ATTR_WIPHY_BANDS], rem_band) {
-		nla_parse(tb_band, NL80211_BAND_ATTR_MAX, nla_data(nl_band),
-			  nla_len(nl_band), NULL);
-
-		if (tb_band[NL80211_BAND_ATTR_HT_CAPA]) {
-			unsigned short caps = nla_get_u16(tb_band[NL80211_BAND_ATTR_HT_CAPA]);
-			int len;
-
-			/* XXX not quite right but close enough */
-			phy_caps |= CHECK_IS_11N | caps;
-			len = 0xeff + ((caps & 0x0800) << 1);
-			if (len > amsdu_len)
-				amsdu_len = len;
-		}
-		if (tb_band[NL80211_BAND_ATTR_HT_AMPDU_FACTOR]) {
-			unsigned char factor = nla_get_u8(tb_band[NL80211_BAND_ATTR_HT_AMPDU_FACTOR]);
-			int fact = (1<<(13+factor))-1;
-			if (fact > ampdu_fact)
-				ampdu_fact = fact;
-		}
-		if (tb_band[NL80211_BAND_ATTR_HT_AMPDU_DENSITY]) {
-			unsigned char dens = nla_get_u8(tb_band[NL80211_BAND_ATTR_HT_AMPDU_DENSITY]);
-			if (dens > ampdu_dens)
-				ampdu_dens = dens;
-		}
-		if (tb_band[NL80211_BAND_ATTR_HT_MCS_SET] &&
-		    nla_len(tb_band[NL80211_BAND_ATTR_HT_MCS_SET]) == 16) {
-			/* As defined in 7.3.2.57.4 Supported MCS Set field */
-			unsigned char *mcs = nla_data(tb_band[NL80211_BAND_ATTR_HT_MCS_SET]);
-			int max = get_max_mcs(&mcs[0]);
-			if (max > max_mcs)
-				max_mcs = max;
-		}
+	if (tb_msg[NL80211_ATTR_WIPHY_BANDS])
+		nla_for_each_nested(nl_band, tb_msg[NL80211_ATTR_WIPHY_BANDS], rem_band)
+			parse_band(phy, nl_band);
 
-		nla_for_each_nested(nl_freq, tb_band[NL80211_BAND_ATTR_FREQS], rem_freq) {
-			uint32_t freq;
+	return NL_SKIP;
+}
 
-			nla_parse(tb_freq, NL80211_FREQUENCY_ATTR_MAX,
-			    nla_data(nl_freq), nla_len(nl_freq),
-			    freq_policy);
-			if (!tb_freq[NL80211_FREQUENCY_ATTR_FREQ])
-				continue;
-#if 0
-			/* NB: we care about device caps, not regulatory */
-			if (tb_freq[NL80211_FREQUENCY_ATTR_DISABLED])
-				continue;
-#endif
-			freq = nla_get_u32(
-			    tb_freq[NL80211_FREQUENCY_ATTR_FREQ]);
-			if (checks & CHECK_FREQS)
-				pint("freq", freq);
-
-			/* NB: approximate band boundaries, we get no help */
-			if (2000 <= freq && freq <= 3000)
-				phy_caps |= CHECK_IS_24GHZ;
-			else if (4000 <= freq && freq <= 6000)
-				phy_caps |= CHECK_IS_5GHZ;
-		}
+static void print_phy_caps(const struct phy_info *phy, int checks)
+{
+	int phy_caps = phy->phy_caps;
+	int i;
 
-		nla_for_each_nested(nl_rate, tb_band[NL80211_BAND_ATTR_RATES], rem_rate) {
-			int rate;
+	if (checks & CHECK_FREQS)
+		for (i = 0; i < phy->nfreqs; i++)
+			pint("freq", phy->freqs[i]);
 
-			nla_parse(tb_rate, NL80211_BITRATE_ATTR_MAX, nla_data(nl_rate),
-				  nla_len(nl_rate), rate_policy);
-			if (!tb_rate[NL80211_BITRATE_ATTR_RATE])
-				continue;
-			rate = nla_get_u32(tb_rate[NL80211_BITRATE_ATTR_RATE]);
-			if (rate > max_rate)
-				max_rate = rate;
-		}
-	}
 #if 0
 	/* NB: 11n =>'s legacy support */
 	if (phy_caps & CHECK_IS_11N) {
@@ -428,46 +467,37 @@ static int check_phy_handler(struct nl_msg *msg, void *arg)
 #endif
 #undef PBOOL
 	if (checks & CHECK_AMSDU_LEN)
-		pint("amsdu_len", amsdu_len);
+		pint("amsdu_len", phy->amsdu_len);
 	if (checks & CHECK_AMPDU_FACT)
-		pint("ampdu_fact", ampdu_fact);
+		pint("ampdu_fact", phy->ampdu_fact);
 	if (checks & CHECK_AMPDU_DENS)
-		pint("ampdu_dens", ampdu_dens);
+		pint("ampdu_dens", phy->ampdu_dens);
 	if (checks & CHECK_RATES)
-		prate("rate", max_rate);
+		prate("rate", phy->max_rate);
 	if (checks & CHECK_MCS)
-		pint("mcs", max_mcs);
-
-	if (checks & CHECK_IS_STA)
-		pbool("sta", check_iftype(tb_msg, NL80211_IFTYPE_STATION));
-	if (checks & CHECK_IS_IBSS)
-		pbool("ibss", check_iftype(tb_msg, NL80211_IFTYPE_ADHOC));
-	if (checks & CHECK_IS_AP)
-		pbool("ap", check_iftype(tb_msg, NL80211_IFTYPE_AP));
-	if (checks & CHECK_IS_MBSS)
-		pbool("mbss", check_iftype(tb_msg, NL80211_IFTYPE_MESH_POINT));
-	if (checks & CHECK_IS_MONITOR)
-		pbool("mon", check_iftype(tb_msg, NL80211_IFTYPE_MONITOR));
-
-	return NL_SKIP;
+		pint("mcs", phy->max_mcs);
+
+#define	PIFTYPE(c, type, name) \
+	if (checks & (c)) pbool(name, phy->iftypes & (1U << (type)))
+	PIFTYPE(CHECK_IS_STA, NL80211_IFTYPE_STATION, "sta");
+	PIFTYPE(CHECK_IS_IBSS, NL80211_IFTYPE_ADHOC, "ibss");
+	PIFTYPE(CHECK_IS_AP, NL80211_IFTYPE_AP, "ap");
+	PIFTYPE(CHECK_IS_MBSS, NL80211_IFTYPE_MESH_POINT, "mbss");
+	PIFTYPE(CHECK_IS_MONITOR, NL80211_IFTYPE_MONITOR, "mon");
+#undef PIFTYPE
 }
 
-static int check_phy_caps(struct nl80211_state *state,
-		       struct nl_cb *cb,
-		       struct nl_msg *msg,
-		       int argc, char **argv)
+static int parse_checks(int argc, char **argv, int *checks)
 {
-	int checks = 0;
+	*checks = 0;
 	for (; argc > 0; argc--, argv++) {
 		const struct check *p = find_check_byname(argv[0]);
 		if (p == NULL) {
 			fprintf(stderr, "invalid check %s\n", argv[0]);
 			return 3;		/* XXX whatever? */
 		}
-		checks |= p->bits;
+		*checks |= p->bits;
 	}
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, check_phy_handler,
-	    (void *)(uintptr_t) checks);
 	return 0;
 }
 
@@ -493,19 +523,21 @@ static int ack_handler(struct nl_msg *msg, void *arg)
 	return NL_STOP;
 }
 
-static int __handle_cmd(struct nl80211_state *state, int argc, char **argv)
+static void free_phys(struct phy_cache *cache)
+{
+	free(cache->phys);
+	cache->phys = NULL;
+	cache->nphys = 0;
+}
+
+/* Replace the cache with a fresh dump of all wiphys. */
+static int dump_phys(struct nl80211_state *state, struct phy_cache *cache)
 {
 	struct nl_cb *cb;
 	struct nl_msg *msg;
-	int devidx, err;
-
-	if (argc <= 1)
-		return 1;
+	int err;
 
-	devidx = phy_lookup(*argv);
-	if (devidx < 0)
-		return -errno;
-	argc--, argv++;
+	free_phys(cache);
 
 	msg = nlmsg_alloc();
 	if (!msg) {
@@ -520,13 +552,11 @@ static int __handle_cmd(struct nl80211_state *state, int argc, char **argv)
 		goto out_free_msg;
 	}
 
-	genlmsg_put(msg, 0, 0, genl_family_get_id(state->nl80211), 0,
-		    0, NL80211_CMD_GET_WIPHY, 0);
-	NLA_PUT_U32(msg, NL80211_ATTR_WIPHY, devidx);
+	genlmsg_put(msg, 0, 0, state->nl80211_id, 0,
+		    NLM_F_DUMP, NL80211_CMD_GET_WIPHY, 0);
+	NLA_PUT_FLAG(msg, NL80211_ATTR_SPLIT_WIPHY_DUMP_COMPAT);
 
-	err = check_phy_caps(state, cb, msg, argc, argv);
-	if (err)
-		goto out;
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, wiphy_dump_handler, cache);
 
 	err = nl_send_auto_complete(state->nl_sock, msg);
 	if (err < 0)
@@ -547,30 +577,96 @@ static int __handle_cmd(struct nl80211_state *state, int argc, char **argv)
 	return err;
  nla_put_failure:
 	fprintf(stderr, "building message failed\n");
+	nlmsg_free(msg);
 	return 2;
 }
 
+/* Answer "phyX check..." from the cache. */
+static int __handle_cmd(struct phy_cache *cache, int argc, char **argv)
+{
+	const struct phy_info *phy;
+	int checks, err;
+
+	if (argc <= 1)
+		return 1;
+
+	phy = find_phy_byname(cache, *argv);
+	if (!phy)
+		return -ENODEV;
+	argc--, argv++;
+
+	err = parse_checks(argc, argv, &checks);
+	if (err)
+		return err;
+	print_phy_caps(phy, checks);
+	return 0;
+}
+
+static void report_err(FILE *f, int err)
+{
+	if (err < 0)
+		fprintf(f, "command failed: %s (%d)\n", strerror(-err), err);
+	else if (err)
+		fprintf(f, "command failed: err %d\n", err);
+}
+
+static int batch(struct nl80211_state *state, struct phy_cache *cache)
+{
+	char line[1024];
+	char *args[64];
+	char *p;
+	int argc, err;
+
+	while (fgets(line, sizeof(line), stdin)) {
+		argc = 0;
+		for (p = strtok(line, " \t\n"); p && argc < 64;
+		     p = strtok(NULL, " \t\n"))
+			args[argc++] = p;
+		if (argc == 0)
+			continue;
+
+		if (strcmp(args[0], "refresh") == 0 && argc == 1)
+			err = dump_phys(state, cache);
+		else
+			err = __handle_cmd(cache, argc, args);
+		if (err) {
+			fputs("error: ", stdout);
+			report_err(stdout, err);
+		}
+		printf(".\n");
+		fflush(stdout);
+	}
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	struct nl80211_state nlstate;
-	int err;
+	struct phy_cache cache = { NULL, 0 };
+	int batch_mode, err;
 
 	argc--;
 	argv0 = *argv++;
 
+	batch_mode = argc == 1 && strcmp(*argv, "-b") == 0;
+	if (!batch_mode && !(argc > 1 && strncmp(*argv, "phy", 3) == 0)) {
+		fprintf(stderr, "usage: %s phyX [args]\n"
+			"       %s -b\n", argv0, argv0);
+		return 1;
+	}
+
 	err = nl80211_init(&nlstate);
 	if (err == 0) {
-		if (argc > 1 && strncmp(*argv, "phy", 3) == 0) {
-			err = __handle_cmd(&nlstate, argc, argv);
-			if (err < 0)
-				fprintf(stderr, "command failed: %s (%d)\n",
-				    strerror(-err), err);
-			else if (err)
-				fprintf(stderr, "command failed: err %d\n", err);
-		} else {
-			fprintf(stderr, "usage: %s phyX [args]\n", argv0);
-			err = 1;
+		err = dump_phys(&nlstate, &cache);
+		if (err)
+			report_err(stderr, err);
+		else if (batch_mode)
+			err = batch(&nlstate, &cache);
+		else {
+			err = __handle_cmd(&cache, argc, argv);
+			report_err(stderr, err);
 		}
+		free_phys(&cache);
 		nl80211_cleanup(&nlstate);
 	}
 	return err;
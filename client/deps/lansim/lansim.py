@@ -7,7 +7,7 @@ import os
 import common
 from autotest_lib.client.bin import utils
 
-version = 1
+version = 2
 
 def setup(topdir):
     srcdir = os.path.join(topdir, 'src')
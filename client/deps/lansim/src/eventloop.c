@@ -0,0 +1,588 @@
+/* Copyright (c) 2013 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Event loop core for the lansim Simulator.
+ *
+ * Simulated hosts schedule thousands of timeouts (ARP, TCP forwarding) and
+ * the Simulator waits on a few fds. Keeping the timeouts in a dict and
+ * rebuilding the select() lists on every iteration costs O(n) per packet.
+ * EventLoop instead provides:
+ *
+ *   - epoll for the fds: register(fd, events), modify(), unregister().
+ *   - a hierarchical timer wheel: add_timeout(delay, callback) and
+ *     remove_timeout(callback) are O(1) per timer, run_timers() fires the
+ *     expired ones in expiration order.
+ *   - an eventfd to wake up wait() from any thread: wakeup().
+ *
+ * wait(max_timeout) releases the GIL while blocked in epoll_wait() and
+ * returns the list of (fd, events) that are ready.
+ */
+
+#include <Python.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define WHEEL_BITS 8
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4  /* 2^32 ticks: 49 days at the default 1ms tick */
+#define MAX_EVENTS 64
+
+/* Intrusive doubly linked list. */
+struct list_head {
+  struct list_head *next, *prev;
+};
+
+static void list_init(struct list_head *h) {
+  h->next = h->prev = h;
+}
+
+static int list_empty(const struct list_head *h) {
+  return h->next == h;
+}
+
+static void list_add_tail(struct list_head *n, struct list_head *h) {
+  n->prev = h->prev;
+  n->next = h;
+  h->prev->next = n;
+  h->prev = n;
+}
+
+static void list_del(struct list_head *n) {
+  n->prev->next = n->next;
+  n->next->prev = n->prev;
+  list_init(n);
+}
+
+/* Moves all the entries of |from| to the empty list |to|. */
+static void list_splice_init(struct list_head *from, struct list_head *to) {
+  list_init(to);
+  if (list_empty(from))
+    return;
+  to->next = from->next;
+  to->prev = from->prev;
+  to->next->prev = to;
+  to->prev->next = to;
+  list_init(from);
+}
+
+/* Moves all the entries of |from| to the front of |to|. */
+static void list_splice_head(struct list_head *from, struct list_head *to) {
+  if (list_empty(from))
+    return;
+  from->prev->next = to->next;
+  to->next->prev = from->prev;
+  to->next = from->next;
+  from->next->prev = to;
+  list_init(from);
+}
+
+#define container_of(ptr, type, member) \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct timer {
+  struct list_head slot;      /* wheel slot or list being expired */
+  struct list_head siblings;  /* other timers with the same callback */
+  uint64_t expires;           /* in ticks */
+  PyObject *callback;
+};
+
+typedef struct {
+  PyObject_HEAD
+  int epfd;
+  int wakefd;
+  double tick;          /* seconds per tick */
+  uint64_t start_ns;    /* CLOCK_MONOTONIC at creation */
+  uint64_t now;         /* current tick of the wheel */
+  Py_ssize_t count;     /* scheduled timers */
+  int running_timers;
+  struct list_head wheel[WHEEL_LEVELS][WHEEL_SIZE];
+  /* callback -> address of the list_head chaining its timers. */
+  PyObject *callbacks;
+} EventLoop;
+
+static uint64_t monotonic_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t current_tick(EventLoop *self) {
+  return (monotonic_ns() - self->start_ns) / (self->tick * 1e9);
+}
+
+static void wheel_insert(EventLoop *self, struct timer *t) {
+  uint64_t delta = t->expires > self->now ? t->expires - self->now : 0;
+  uint64_t expires = t->expires > self->now ? t->expires : self->now;
+  int level;
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (1ULL << (WHEEL_BITS * (level + 1))))
+      break;
+  list_add_tail(&t->slot, &self->wheel[level]
+                [(expires >> (WHEEL_BITS * level)) & WHEEL_MASK]);
+}
+
+/* Re-inserts the timers of the current slot of |level| one level lower. */
+static int wheel_cascade(EventLoop *self, int level) {
+  int index = (self->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  struct list_head pending;
+
+  list_splice_init(&self->wheel[level][index], &pending);
+  while (!list_empty(&pending)) {
+    struct timer *t = container_of(pending.next, struct timer, slot);
+    list_del(&t->slot);
+    wheel_insert(self, t);
+  }
+  return index;
+}
+
+/* Unlinks |t| from its callback's chain, dropping the chain when empty. */
+static void timer_unchain(EventLoop *self, struct timer *t) {
+  struct list_head *next = t->siblings.next;
+
+  if (next == &t->siblings) {
+    PyDict_DelItem(self->callbacks, t->callback);
+  } else {
+    PyObject *head = PyLong_FromVoidPtr(next);
+    list_del(&t->siblings);
+    if (head) {
+      PyDict_SetItem(self->callbacks, t->callback, head);
+      Py_DECREF(head);
+    }
+  }
+}
+
+static void free_timers(EventLoop *self) {
+  int level, i;
+
+  for (level = 0; level < WHEEL_LEVELS; level++) {
+    for (i = 0; i < WHEEL_SIZE; i++) {
+      struct list_head *slot = &self->wheel[level][i];
+      if (!slot->next)
+        continue;  /* never initialized */
+      while (!list_empty(slot)) {
+        struct timer *t = container_of(slot->next, struct timer, slot);
+        list_del(&t->slot);
+        Py_DECREF(t->callback);
+        PyMem_Free(t);
+      }
+    }
+  }
+  self->count = 0;
+}
+
+/* Callbacks often reference the object owning the loop, so the loop takes
+ * part in garbage collection to break those cycles. */
+static int EventLoop_traverse(EventLoop *self, visitproc visit, void *arg) {
+  struct list_head *pos;
+  int level, i;
+
+  for (level = 0; level < WHEEL_LEVELS; level++) {
+    for (i = 0; i < WHEEL_SIZE; i++) {
+      struct list_head *slot = &self->wheel[level][i];
+      if (!slot->next)
+        continue;
+      for (pos = slot->next; pos != slot; pos = pos->next)
+        Py_VISIT(container_of(pos, struct timer, slot)->callback);
+    }
+  }
+  Py_VISIT(self->callbacks);
+  return 0;
+}
+
+static int EventLoop_clear(EventLoop *self) {
+  free_timers(self);
+  Py_CLEAR(self->callbacks);
+  return 0;
+}
+
+static void EventLoop_dealloc(EventLoop *self) {
+  PyObject_GC_UnTrack(self);
+  EventLoop_clear(self);
+  if (self->epfd >= 0)
+    close(self->epfd);
+  if (self->wakefd >= 0)
+    close(self->wakefd);
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *EventLoop_new(PyTypeObject *type, PyObject *args,
+                               PyObject *kwds) {
+  EventLoop *self = (EventLoop *)type->tp_alloc(type, 0);
+
+  if (self) {
+    self->epfd = -1;
+    self->wakefd = -1;
+  }
+  return (PyObject *)self;
+}
+
+static int EventLoop_init(EventLoop *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"tick", NULL};
+  struct epoll_event ev;
+  int level, i;
+
+  self->tick = 0.001;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|d", kwlist, &self->tick))
+    return -1;
+  if (self->tick <= 0) {
+    PyErr_SetString(PyExc_ValueError, "tick must be positive");
+    return -1;
+  }
+  if (self->epfd >= 0) {
+    PyErr_SetString(PyExc_RuntimeError, "EventLoop already initialized");
+    return -1;
+  }
+  self->epfd = epoll_create1(EPOLL_CLOEXEC);
+  self->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (self->epfd < 0 || self->wakefd < 0) {
+    PyErr_SetFromErrno(PyExc_OSError);
+    return -1;
+  }
+  ev.events = EPOLLIN;
+  ev.data.fd = self->wakefd;
+  if (epoll_ctl(self->epfd, EPOLL_CTL_ADD, self->wakefd, &ev)) {
+    PyErr_SetFromErrno(PyExc_OSError);
+    return -1;
+  }
+  self->callbacks = PyDict_New();
+  if (!self->callbacks)
+    return -1;
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (i = 0; i < WHEEL_SIZE; i++)
+      list_init(&self->wheel[level][i]);
+  self->start_ns = monotonic_ns();
+  self->now = 0;
+  return 0;
+}
+
+static PyObject *epoll_op(EventLoop *self, PyObject *args, int op) {
+  struct epoll_event ev;
+  unsigned int events = 0;
+  int fd;
+
+  if (!PyArg_ParseTuple(args, op == EPOLL_CTL_DEL ? "i" : "iI",
+                        &fd, &events))
+    return NULL;
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(self->epfd, op, fd, &ev))
+    return PyErr_SetFromErrno(PyExc_OSError);
+  Py_RETURN_NONE;
+}
+
+static PyObject *EventLoop_register(EventLoop *self, PyObject *args) {
+  return epoll_op(self, args, EPOLL_CTL_ADD);
+}
+
+static PyObject *EventLoop_modify(EventLoop *self, PyObject *args) {
+  return epoll_op(self, args, EPOLL_CTL_MOD);
+}
+
+static PyObject *EventLoop_unregister(EventLoop *self, PyObject *args) {
+  return epoll_op(self, args, EPOLL_CTL_DEL);
+}
+
+static PyObject *EventLoop_add_timeout(EventLoop *self, PyObject *args) {
+  PyObject *callback, *head, *addr;
+  struct timer *t;
+  double delay;
+
+  if (!PyArg_ParseTuple(args, "dO", &delay, &callback))
+    return NULL;
+  if (!PyCallable_Check(callback)) {
+    PyErr_SetString(PyExc_TypeError, "callback must be callable");
+    return NULL;
+  }
+  t = PyMem_Malloc(sizeof(*t));
+  if (!t)
+    return PyErr_NoMemory();
+  /* Never early: round the delay up and add the part of the current tick. */
+  t->expires = current_tick(self);
+  if (delay > 0)
+    t->expires += ceil(delay / self->tick) + 1;
+  t->callback = callback;
+  list_init(&t->siblings);
+
+  head = PyDict_GetItem(self->callbacks, callback);  /* borrowed */
+  if (head) {
+    list_add_tail(&t->siblings,
+                  (struct list_head *)PyLong_AsVoidPtr(head));
+  } else {
+    addr = PyLong_FromVoidPtr(&t->siblings);
+    if (!addr || PyDict_SetItem(self->callbacks, callback, addr)) {
+      Py_XDECREF(addr);
+      PyMem_Free(t);
+      return NULL;
+    }
+    Py_DECREF(addr);
+  }
+  Py_INCREF(callback);
+  wheel_insert(self, t);
+  self->count++;
+  Py_RETURN_NONE;
+}
+
+static PyObject *EventLoop_remove_timeout(EventLoop *self, PyObject *args) {
+  struct list_head *chain;
+  PyObject *callback, *head;
+
+  if (!PyArg_ParseTuple(args, "O", &callback))
+    return NULL;
+  head = PyDict_GetItem(self->callbacks, callback);
+  if (!head)
+    Py_RETURN_FALSE;
+  chain = PyLong_AsVoidPtr(head);
+  /* Keep |callback| alive until the dict entry is gone. */
+  Py_INCREF(callback);
+  PyDict_DelItem(self->callbacks, callback);
+  for (;;) {
+    struct timer *t = container_of(chain, struct timer, siblings);
+    struct list_head *next = chain->next;
+    int last = next == chain;
+    list_del(&t->siblings);
+    list_del(&t->slot);
+    Py_DECREF(t->callback);
+    PyMem_Free(t);
+    self->count--;
+    if (last)
+      break;
+    chain = next;
+  }
+  Py_DECREF(callback);
+  Py_RETURN_TRUE;
+}
+
+static PyObject *EventLoop_run_timers(EventLoop *self, PyObject *unused) {
+  uint64_t target = current_tick(self);
+  struct list_head expired;
+  Py_ssize_t fired = 0;
+  int level;
+
+  if (self->running_timers) {
+    PyErr_SetString(PyExc_RuntimeError, "run_timers() is not reentrant");
+    return NULL;
+  }
+  self->running_timers = 1;
+  list_init(&expired);
+  for (;;) {
+    list_splice_init(&self->wheel[0][self->now & WHEEL_MASK], &expired);
+    /* Callbacks may add and remove timers, including those in |expired|.
+     * Timers added already expired go to the current slot and fire on the
+     * next call. */
+    while (!list_empty(&expired)) {
+      struct timer *t = container_of(expired.next, struct timer, slot);
+      PyObject *callback = t->callback, *ret;
+      list_del(&t->slot);
+      timer_unchain(self, t);
+      PyMem_Free(t);
+      self->count--;
+      fired++;
+      ret = PyObject_CallObject(callback, NULL);
+      Py_DECREF(callback);
+      if (!ret) {
+        /* Leave the rest of the slot to be fired on the next call. */
+        list_splice_head(&expired, &self->wheel[0][self->now & WHEEL_MASK]);
+        self->running_timers = 0;
+        return NULL;
+      }
+      Py_DECREF(ret);
+    }
+    if (self->now >= target)
+      break;
+    self->now++;
+    if (!(self->now & WHEEL_MASK))
+      for (level = 1; level < WHEEL_LEVELS; level++)
+        if (wheel_cascade(self, level))
+          break;
+  }
+  self->running_timers = 0;
+  return PyInt_FromSsize_t(fired);
+}
+
+/* Earliest expiration of the timers in |slot|. */
+static uint64_t slot_min_expires(struct list_head *slot) {
+  uint64_t expires = UINT64_MAX;
+  struct list_head *pos;
+
+  for (pos = slot->next; pos != slot; pos = pos->next) {
+    struct timer *t = container_of(pos, struct timer, slot);
+    if (t->expires < expires)
+      expires = t->expires;
+  }
+  return expires;
+}
+
+/* Seconds until the next timer expires, or -1 if there are no timers. */
+static double next_timeout(EventLoop *self) {
+  uint64_t now = current_tick(self), next = UINT64_MAX, expires;
+  int level, i;
+
+  if (!self->count)
+    return -1;
+  /* Slots hold increasing ranges of expiration ticks on each level, but the
+   * ranges of different levels overlap: check the first busy slot of each.
+   * The current slot of the upper levels only holds timers a whole turn
+   * ahead, so it is checked but the scan goes on to the next busy slot. */
+  for (level = 0; level < WHEEL_LEVELS; level++) {
+    int shift = WHEEL_BITS * level;
+    for (i = 0; i < WHEEL_SIZE; i++) {
+      struct list_head *slot = &self->wheel[level]
+          [((self->now >> shift) + i) & WHEEL_MASK];
+      if (!list_empty(slot)) {
+        expires = slot_min_expires(slot);
+        if (expires < next)
+          next = expires;
+        if (i || !level)
+          break;
+      }
+    }
+  }
+  return next > now ? (next - now) * self->tick : 0;
+}
+
+static PyObject *EventLoop_next_timeout(EventLoop *self, PyObject *unused) {
+  double timeout = next_timeout(self);
+
+  if (timeout < 0)
+    Py_RETURN_NONE;
+  return PyFloat_FromDouble(timeout);
+}
+
+static PyObject *EventLoop_wait(EventLoop *self, PyObject *args) {
+  struct epoll_event events[MAX_EVENTS];
+  PyObject *max_obj = Py_None, *ret, *item;
+  double timeout, next;
+  int n, i, ms;
+  uint64_t value;
+
+  if (!PyArg_ParseTuple(args, "|O", &max_obj))
+    return NULL;
+  timeout = max_obj == Py_None ? -1 : PyFloat_AsDouble(max_obj);
+  if (PyErr_Occurred())
+    return NULL;
+  next = next_timeout(self);
+  if (next >= 0 && (timeout < 0 || next < timeout))
+    timeout = next;
+  if (timeout < 0)
+    ms = -1;
+  else if (timeout * 1000 + 0.999 >= INT_MAX)
+    ms = INT_MAX;
+  else
+    ms = (int)(timeout * 1000 + 0.999);
+
+  Py_BEGIN_ALLOW_THREADS
+  n = epoll_wait(self->epfd, events, MAX_EVENTS, ms);
+  Py_END_ALLOW_THREADS
+  if (n < 0) {
+    if (errno != EINTR)
+      return PyErr_SetFromErrno(PyExc_OSError);
+    n = 0;
+  }
+
+  ret = PyList_New(0);
+  if (!ret)
+    return NULL;
+  for (i = 0; i < n; i++) {
+    if (events[i].data.fd == self->wakefd) {
+      if (read(self->wakefd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        Py_DECREF(ret);
+        return PyErr_SetFromErrno(PyExc_OSError);
+      }
+      continue;
+    }
+    item = Py_BuildValue("(iI)", events[i].data.fd, events[i].events);
+    if (!item || PyList_Append(ret, item)) {
+      Py_XDECREF(item);
+      Py_DECREF(ret);
+      return NULL;
+    }
+    Py_DECREF(item);
+  }
+  return ret;
+}
+
+static PyObject *EventLoop_wakeup(EventLoop *self, PyObject *unused) {
+  uint64_t one = 1;
+
+  if (write(self->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    return PyErr_SetFromErrno(PyExc_OSError);
+  Py_RETURN_NONE;
+}
+
+static Py_ssize_t EventLoop_len(EventLoop *self) {
+  return self->count;
+}
+
+static PyMethodDef EventLoop_methods[] = {
+  {"register", (PyCFunction)EventLoop_register, METH_VARARGS,
+   "register(fd, events): watches |fd| for the EPOLL* |events|."},
+  {"modify", (PyCFunction)EventLoop_modify, METH_VARARGS,
+   "modify(fd, events): changes the events watched on |fd|."},
+  {"unregister", (PyCFunction)EventLoop_unregister, METH_VARARGS,
+   "unregister(fd): stops watching |fd|."},
+  {"add_timeout", (PyCFunction)EventLoop_add_timeout, METH_VARARGS,
+   "add_timeout(delay, callback): calls |callback| from run_timers() once\n"
+   "|delay| seconds passed."},
+  {"remove_timeout", (PyCFunction)EventLoop_remove_timeout, METH_VARARGS,
+   "remove_timeout(callback): cancels every scheduled call to |callback|.\n"
+   "Returns whether any was scheduled."},
+  {"run_timers", (PyCFunction)EventLoop_run_timers, METH_NOARGS,
+   "run_timers(): fires the expired timers, returns how many fired."},
+  {"next_timeout", (PyCFunction)EventLoop_next_timeout, METH_NOARGS,
+   "next_timeout(): seconds until the next timer, or None."},
+  {"wait", (PyCFunction)EventLoop_wait, METH_VARARGS,
+   "wait(max_timeout=None): blocks until an fd is ready, the next timer\n"
+   "expires, wakeup() is called or |max_timeout| seconds passed. Returns\n"
+   "the list of ready (fd, events)."},
+  {"wakeup", (PyCFunction)EventLoop_wakeup, METH_NOARGS,
+   "wakeup(): makes wait() return. Can be called from any thread."},
+  {NULL, NULL, 0, NULL}
+};
+
+static PySequenceMethods EventLoop_as_sequence = {
+  (lenfunc)EventLoop_len,         /* sq_length: number of timers */
+};
+
+static PyTypeObject EventLoopType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "pyiftun.EventLoop",            /* tp_name */
+  sizeof(EventLoop),              /* tp_basicsize */
+  0,                              /* tp_itemsize */
+  (destructor)EventLoop_dealloc,  /* tp_dealloc */
+  0, 0, 0, 0, 0, 0,
+  &EventLoop_as_sequence,         /* tp_as_sequence */
+  0, 0, 0, 0, 0, 0, 0,
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+  "epoll and timer wheel event loop core for the Simulator.", /* tp_doc */
+  (traverseproc)EventLoop_traverse, /* tp_traverse */
+  (inquiry)EventLoop_clear,       /* tp_clear */
+  0, 0, 0, 0,
+  EventLoop_methods,              /* tp_methods */
+  0, 0, 0, 0, 0, 0, 0,
+  (initproc)EventLoop_init,       /* tp_init */
+  0,
+  EventLoop_new,                  /* tp_new */
+};
+
+void _init_eventloop(PyObject *m) {
+  if (PyType_Ready(&EventLoopType) < 0)
+    return;
+  Py_INCREF(&EventLoopType);
+  PyModule_AddObject(m, "EventLoop", (PyObject *)&EventLoopType);
+
+  PyModule_AddIntMacro(m, EPOLLIN);
+  PyModule_AddIntMacro(m, EPOLLOUT);
+  PyModule_AddIntMacro(m, EPOLLERR);
+  PyModule_AddIntMacro(m, EPOLLHUP);
+}
@@ -3,14 +3,20 @@
 # found in the LICENSE file.
 
 import dpkt
+import fcntl
 import os
-import select
 import struct
 import sys
 import threading
 import time
 import traceback
 
+from lansim import pyiftun
+
+# Size of the packet information header (flags, proto) the TUN/TAP driver
+# prepends to each packet.
+PI_HEADER_SIZE = 4
+
 
 class SimulatorError(Exception):
     "A Simulator generic error."
@@ -35,33 +41,37 @@ class Simulator(object):
     to simplify these implementations.
     """
 
-    def __init__(self, iface):
+    def __init__(self, iface, fast_path=True):
         """Initialize the instance.
 
         @param tuntap.TunTap iface: the interface over which this interface
         runs. Should not be shared with other modules.
+        @param fast_path: Whether to use the native pyiftun fast path, which
+        reads and writes packets in batches and evaluates the dict rules passed
+        to add_match() in C. Only packets matching a rule are parsed in Python.
         """
         self._iface = iface
+        # Bytes before the Ethernet header: the PI header and, if the interface
+        # was created with IFF_VNET_HDR, the virtio_net_hdr.
+        self._hdr_size = PI_HEADER_SIZE + getattr(iface, 'vnet_hdr_len', 0)
+        # List of (rule, callback, fast_id) tuples. |fast_id| is the id of the
+        # rule in self._matcher, or None if |rule| needs to run in Python.
         self._rules = []
-        # _events holds a lists of events that need to be fired for each
-        # timestamp stored on the key. The event list is a list of callback
-        # functions that will be called if the simulation reaches that
-        # timestamp. This is used to fire time-based events.
-        self._events = {}
+        self._py_rules = 0
+        self._matcher = None
+        if fast_path:
+            self._matcher = pyiftun.Matcher(self._hdr_size)
+        # The event loop waits on the interface fds and holds the time-based
+        # events in a timer wheel. It can be woken up from a different thread
+        # calling stop(). See the stop() method for details.
+        self._loop = pyiftun.EventLoop()
         self._write_queue = []
-        # A pipe used to wake up the run() method from a diffent thread calling
-        # stop(). See the stop() method for details.
-        self._pipe_rd, self._pipe_wr = os.pipe()
         self._running = False
-        # Lock object used for _events if multithreading is required.
+        self._stop = False
+        # Lock object used for the timeouts if multithreading is required.
         self._lock = NullContext()
 
 
-    def __del__(self):
-        os.close(self._pipe_rd)
-        os.close(self._pipe_wr)
-
-
     def add_match(self, rule, callback):
         """Add a new match rule to the outbound traffic.
 
@@ -84,13 +94,24 @@ class Simulator(object):
         if not callable(callback):
             raise SimulatorError("|callback| must be a callable object.")
 
+        fast_id = None
         if callable(rule):
-            self._rules.append((rule, callback))
-        if isinstance(rule, dict):
+            self._py_rules += 1
+        elif isinstance(rule, dict):
             rule = dict(rule) # Makes a copy of the dict, but not the contents.
-            self._rules.append((lambda p: self._dict_rule(rule, p), callback))
+            if self._matcher:
+                try:
+                    self._matcher.add(len(self._rules), rule)
+                    fast_id = len(self._rules)
+                except ValueError:
+                    pass # Not supported natively; evaluated in Python.
+            if fast_id is None:
+                self._py_rules += 1
+            rule_dict = rule
+            rule = lambda p: self._dict_rule(rule_dict, p)
         else:
             raise SimulatorError("Unknown rule format: %r" % rule)
+        self._rules.append((rule, callback, fast_id))
 
 
     def add_timeout(self, timeout, callback):
@@ -106,12 +127,8 @@ class Simulator(object):
         """
         if not callable(callback):
             raise SimulatorError("|callback| must be a callable object.")
-        timestamp = time.time() + timeout
         with self._lock:
-            if timestamp not in self._events:
-                self._events[timestamp] = [callback]
-            else:
-                self._events[timestamp].append(callback)
+            self._loop.add_timeout(timeout, callback)
 
 
     def remove_timeout(self, callback):
@@ -124,15 +141,8 @@ class Simulator(object):
         @param callback: The callable object passed to add_timeout().
         @return: Wether the callback was found and removed at least once.
         """
-        removed = False
-        for _ts, ev_list in self._events.iteritems():
-            try:
-                while True:
-                    ev_list.remove(callback)
-                    removed = True
-            except ValueError:
-                pass
-        return removed
+        with self._lock:
+            return self._loop.remove_timeout(callback)
 
 
     def _dict_rule(self, rules, pkt):
@@ -157,8 +167,30 @@ class Simulator(object):
 
         @param pkt: The dpkt.Packet to be received on the network interface.
         """
-        # Converts the dpkt packet to: flags, proto, buffer.
-        self._write_queue.append(struct.pack("!HH", 0, pkt.type) + str(pkt))
+        # Converts the dpkt packet to: flags, proto, [vnet header,] buffer.
+        self._write_queue.append(struct.pack("!HH", 0, pkt.type) +
+                                 '\0' * (self._hdr_size - PI_HEADER_SIZE) +
+                                 str(pkt))
+
+
+    def _dispatch(self, raw, fast_ids=()):
+        """Calls the callbacks of the rules matching a packet read.
+
+        @param raw: The packet read from the interface, with its headers.
+        @param fast_ids: The ids of the native rules that matched |raw|.
+        """
+        pkt = None
+        for rule, callback, fast_id in self._rules:
+            if fast_id is not None:
+                if fast_id not in fast_ids:
+                    continue
+            else:
+                if pkt is None:
+                    pkt = dpkt.ethernet.Ethernet(raw[self._hdr_size:])
+                if not rule(pkt):
+                    continue
+            # Parse again the packet to allow callbacks to modify it.
+            callback(dpkt.ethernet.Ethernet(raw[self._hdr_size:]))
 
 
     def run(self, timeout=None, until=None):
@@ -187,84 +219,95 @@ class Simulator(object):
 
         self._running = True
         iface_fd = self._iface.fileno()
-        # Check the until function.
-        while not (until and until()):
-            # The main purpose of this loop is to wait (block) until the next
-            # event is required to be fired. There are four kinds of events:
-            #  * a packet is received.
-            #  * a packet waiting to be sent can now be sent.
-            #  * a time-based event needs to be fired.
-            #  * the simulator was stopped from a different thread.
-            # To achieve this we use select.select() to wait simultaneously on
-            # all those event sources.
-
-            # Fires all the time-based events that need to be fired and computes
-            # the timeout for the next event if there's one.
-            timeout = None
-            cur_time = time.time()
-            with self._lock:
-                if self._events:
-                    # Check events that should be fired.
-                    while self._events and min(self._events) <= cur_time:
-                        key = min(self._events)
-                        lst = self._events[key]
-                        del self._events[key]
-                        for callback in lst:
-                            callback()
-                        cur_time = time.time()
-                # Check if there is an event to attend. Here we know that
-                # min(self._events) > cur_time because the previous while
-                # finished.
-                if self._events:
-                    timeout = min(self._events) - cur_time # in seconds
-
-            # Pool the until() function at least once a second.
-            if timeout is None or timeout > 1.0:
-                timeout = 1.0
-
-            # Compute the list of file descriptors that select.select() needs to
-            # monitor to attend the required events. select() will return when
-            # any of the following occurs:
-            #  * rlist: is possible to read from the interface or another
-            #           thread want's to wake up the simulator loop.
-            #  * wlist: is possible to write to network, if there's a packet
-            #           pending.
-            #  * xlist: an error on the network fd occured. Likely the TAP
-            #           interface was closed.
-            #  * timeout: The previously computed timeout was reached.
-            rlist = iface_fd, self._pipe_rd
-            wlist = tuple()
-            if self._write_queue:
-                wlist = iface_fd,
-            xlist = iface_fd,
-
-            rlist, wlist, xlist = select.select(rlist, wlist, xlist, timeout)
-
-            if self._pipe_rd in rlist:
-                msg = os.read(self._pipe_rd, 1)
-                # stop() breaks the loop sending a '*'.
-                if '*' in msg:
+        if hasattr(self._iface, 'queue_fds'):
+            read_fds = tuple(self._iface.queue_fds())
+        else:
+            read_fds = iface_fd,
+        if self._matcher:
+            # Batched reads and writes drain the fds until they would block.
+            for fd in read_fds:
+                fcntl.fcntl(fd, fcntl.F_SETFL,
+                            fcntl.fcntl(fd, fcntl.F_GETFL) | os.O_NONBLOCK)
+        # The interface fd is watched for writing only while there are packets
+        # waiting to be sent.
+        for fd in read_fds:
+            self._loop.register(fd, pyiftun.EPOLLIN)
+        if iface_fd not in read_fds:
+            self._loop.register(iface_fd, 0)
+        iface_events = pyiftun.EPOLLIN if iface_fd in read_fds else 0
+        watching_out = False
+        try:
+            # Check the until function.
+            while not (until and until()):
+                # The main purpose of this loop is to wait (block) until the
+                # next event is required to be fired. There are four kinds of
+                # events:
+                #  * a packet is received.
+                #  * a packet waiting to be sent can now be sent.
+                #  * a time-based event needs to be fired.
+                #  * the simulator was stopped from a different thread.
+                # The event loop waits simultaneously on all those event
+                # sources.
+
+                # Fires all the time-based events that need to be fired.
+                with self._lock:
+                    self._loop.run_timers()
+                if self._stop:
                     break
-                # Other messages are ignored.
-
-            if xlist:
-                break
-
-            if iface_fd in wlist:
-                self._iface.write(self._write_queue.pop(0))
-                # Attempt to send all the scheduled packets before reading more
-                continue
-
-            # Process the given packet:
-            if iface_fd in rlist:
-                raw = self._iface.read()
-                flag, proto = struct.unpack("!HH", raw[:4])
-                pkt = dpkt.ethernet.Ethernet(raw[4:])
-                for rule, callback in self._rules:
-                    if rule(pkt):
-                        # Parse again the packet to allow callbacks to modify
-                        # it.
-                        callback(dpkt.ethernet.Ethernet(raw[4:]))
+
+                if bool(self._write_queue) != watching_out:
+                    watching_out = not watching_out
+                    self._loop.modify(iface_fd, iface_events |
+                            (pyiftun.EPOLLOUT if watching_out else 0))
+
+                # wait() returns when any of the following occurs:
+                #  * EPOLLIN: is possible to read from the interface.
+                #  * EPOLLOUT: is possible to write to network, if there's a
+                #              packet pending.
+                #  * EPOLLERR, EPOLLHUP: an error on the network fd occured.
+                #              Likely the TAP interface was closed.
+                #  * the next time-based event is due, or another thread
+                #    called wakeup().
+                # Pool the until() function at least once a second.
+                ready = dict(self._loop.wait(1.0))
+                if self._stop:
+                    break
+
+                if any(events & (pyiftun.EPOLLERR | pyiftun.EPOLLHUP)
+                       for events in ready.itervalues()):
+                    break
+
+                if ready.get(iface_fd, 0) & pyiftun.EPOLLOUT:
+                    if self._matcher:
+                        written = pyiftun.write_batch(iface_fd,
+                                                      self._write_queue)
+                        del self._write_queue[:written]
+                    else:
+                        self._iface.write(self._write_queue.pop(0))
+                    # Attempt to send all the scheduled packets before reading
+                    # more.
+                    continue
+
+                # Process the given packets:
+                for fd in read_fds:
+                    if not ready.get(fd, 0) & pyiftun.EPOLLIN:
+                        continue
+                    if not self._matcher:
+                        self._dispatch(self._iface.read(fd))
+                        continue
+                    # Packets no rule can match are only returned if there are
+                    # rules that must be evaluated in Python.
+                    for raw, fast_ids in self._matcher.read_batch(
+                            fd, self._py_rules > 0):
+                        self._dispatch(raw, fast_ids)
+        finally:
+            for fd in set(read_fds + (iface_fd,)):
+                try:
+                    self._loop.unregister(fd)
+                except OSError:
+                    pass # Closed fds are removed from the loop already.
+            # A stop() request is consumed by the run() it stopped.
+            self._stop = False
 
         if stop_callback:
             self.remove_timeout(stop_callback)
@@ -273,7 +316,8 @@ class Simulator(object):
 
     def stop(self):
         """Stops the run() method if it is running."""
-        os.write(self._pipe_wr, '*')
+        self._stop = True
+        self._loop.wakeup()
 
 
 class SimulatorThread(threading.Thread, Simulator):
@@ -319,8 +363,8 @@ class SimulatorThread(threading.Thread, Simulator):
         @param callback: A callback function without arguments.
         """
         self.add_timeout(0, callback)
-        # Wake up the main loop with an ignored message.
-        os.write(self._pipe_wr, ' ')
+        # Wake up the main loop to fire the callback.
+        self._loop.wakeup()
 
 
     def wait_for_condition(self, condition, timeout=None):
@@ -22,6 +22,9 @@ class TunTapError(Exception):
 
 ETHERNET_HEADER_SIZE = 18
 
+# Size of struct virtio_net_hdr, prepended to packets with IFF_VNET_HDR.
+VIRTIO_NET_HDR_SIZE = 10
+
 
 STRUCT_IFREQ_FMT = {
     "ifr_flags": "h", # short ifr_flags
@@ -79,7 +82,8 @@ class TunTap(object):
     }
 
 
-    def __init__(self, mode=pyiftun.IFF_TUN, name=None, tundev='/dev/net/tun'):
+    def __init__(self, mode=pyiftun.IFF_TUN, name=None, tundev='/dev/net/tun',
+                 queues=1):
         """Creates or re-opens a TUN/TAP interface.
 
         @param mode: This argument is passed to the TUNSETIFF ioctl() to create
@@ -91,11 +95,15 @@ class TunTap(object):
         the name will be appended with '%d'.
         @param tundev: The path to the kerner interface to the tun driver which
         defaults to the standard '/dev/net/tun' if not specified.
+        @param queues: The number of queues (file descriptors) to open. More
+        than one creates a multi-queue interface; see queue_fds().
         """
         tun_type = mode & pyiftun.TUN_TYPE_MASK
         if tun_type not in self.DEFAULT_DEV_NAME:
             raise TunTapError("mode (%r) not supported" % mode)
 
+        if queues > 1:
+            mode |= pyiftun.IFF_MULTI_QUEUE
         self.mode = mode
 
         # The interface name can have a "%d" that the kernel will replace with
@@ -108,11 +116,15 @@ class TunTap(object):
         # Create the TUN/TAP interface.
         fd = os.open(tundev, os.O_RDWR)
         self._fd = fd
+        self._queue_fds = [fd]
 
         ifs = fcntl.ioctl(fd, pyiftun.TUNSETIFF,
             pack_struct_ifreq(name, 'ifr_flags', mode))
         ifs_name, ifs_mode = struct.unpack(IFNAMSIZ_FMT + "H", ifs)
         self.name = ifs_name.rstrip('\0')
+        if queues > 1:
+            self._queue_fds += pyiftun.tun_open(self.name, mode, queues - 1,
+                                                tundev)
 
         # Socket used for ioctl() operations over the network device.
         self._sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
@@ -121,8 +133,8 @@ class TunTap(object):
 
 
     def __del__(self):
-        if hasattr(self, '_fd'):
-            os.close(self._fd)
+        for fd in getattr(self, '_queue_fds', []):
+            os.close(fd)
 
 
     def _get_mtu(self):
@@ -226,16 +238,20 @@ class TunTap(object):
         return (self._get_flags() & pyiftun.IFF_UP) != 0
 
 
-    def read(self):
+    def read(self, fd=None):
         """Reads a 'sent' frame from the interface.
 
         The frame format depends on the interface type: Ethernet frame for TAP
         interfaces and IP frame for TUN interfaces. This function blocks until
         a new frame is available.
 
+        @param fd: The queue fd to read from, one of queue_fds(). Defaults to
+        the first queue.
         @return string: A single frame sent to the interface.
         """
-        return os.read(self._fd, self.mtu + ETHERNET_HEADER_SIZE)
+        if fd is None:
+            fd = self._fd
+        return os.read(fd, self.mtu + ETHERNET_HEADER_SIZE)
 
 
     def write(self, data):
@@ -253,3 +269,14 @@ class TunTap(object):
     def fileno(self):
         """Returns a file descriptor suitable to be used with select()."""
         return self._fd
+
+
+    def queue_fds(self):
+        """Returns the file descriptors of all the queues, fileno() first."""
+        return list(self._queue_fds)
+
+
+    @property
+    def vnet_hdr_len(self):
+        """Size of the virtio_net_hdr prepended to packets (IFF_VNET_HDR)."""
+        return VIRTIO_NET_HDR_SIZE if self.mode & pyiftun.IFF_VNET_HDR else 0
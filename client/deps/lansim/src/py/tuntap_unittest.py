@@ -2,8 +2,11 @@
 # Use of this source code is governed by a BSD-style license that can be
 # found in the LICENSE file.
 
+import fcntl
+import os
 import unittest
 
+from lansim import pyiftun
 from lansim import tuntap
 
 
@@ -67,6 +70,22 @@ class TunTapTest(unittest.TestCase):
         self.assertFalse(tap.is_up())
 
 
+    def testTunOpenQueuesShareInterface(self):
+        """Tests that every queue tun_open() opens is on one interface."""
+        fds = pyiftun.tun_open('faketun%d', pyiftun.IFF_TUN | pyiftun.IFF_NO_PI,
+                               2)
+        try:
+            self.assertEqual(len(fds), 2)
+            names = [fcntl.ioctl(fd, pyiftun.TUNGETIFF,
+                                 '\0' * 40)[:16].rstrip('\0')
+                     for fd in fds]
+            self.assertTrue(names[0].startswith('faketun'))
+            self.assertEqual(names[0], names[1])
+        finally:
+            for fd in fds:
+                os.close(fd)
+
+
 if __name__ == '__main__':
     unittest.main()
 
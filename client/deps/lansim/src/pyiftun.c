@@ -9,6 +9,9 @@
  *
  * Some of these constants are architecture specific and can't be implemented
  * in pure Python, like the ioctl() call numbers.
+ *
+ * It also provides a native fast path for the Simulator's packet I/O and rule
+ * matching, see fastpath.c, and its event loop core, see eventloop.c.
  */
 
 #include <Python.h>
@@ -17,6 +20,8 @@
 void _init_linux_if_h(PyObject *m);
 void _init_linux_if_tun_h(PyObject *m);
 void _init_sys_ioctl_h(PyObject *m);
+void _init_fastpath(PyObject *m);
+void _init_eventloop(PyObject *m);
 
 /* Module initialization */
 static PyMethodDef pyiftun_methods[] = {
@@ -33,4 +38,8 @@ initpyiftun(void) {
   _init_linux_if_h(m);
   _init_linux_if_tun_h(m);
   _init_sys_ioctl_h(m);
+
+  /* Native fast path */
+  _init_fastpath(m);
+  _init_eventloop(m);
 }
@@ -2,8 +2,28 @@
 # Use of this source code is governed by a BSD-style license that can be
 # found in the LICENSE file.
 
+import os
+import socket
+import struct
+import time
 import unittest
 
+# A broadcast ARP request for 10.0.0.1, preceded by a 4-byte PI header.
+_PI = struct.pack('!HH', 0, 0x0806)
+_ARP_REQUEST = (
+    '\xff' * 6 + '\x02\x00\x00\x00\x00\x01' + '\x08\x06' +
+    struct.pack('!HHBBH', 1, 0x0800, 6, 4, 1) +
+    '\x02\x00\x00\x00\x00\x01' + socket.inet_aton('10.0.0.2') +
+    '\x00' * 6 + socket.inet_aton('10.0.0.1'))
+# A UDP datagram from 10.0.0.2:5353 to 10.0.0.1:53.
+_UDP = (
+    '\x02\x00\x00\x00\x00\x02' + '\x02\x00\x00\x00\x00\x01' +
+    '\x08\x00' +
+    struct.pack('!BBHHHBBH', 0x45, 0, 28, 0, 0, 64, 17, 0) +
+    socket.inet_aton('10.0.0.2') + socket.inet_aton('10.0.0.1') +
+    struct.pack('!HHHH', 5353, 53, 8, 0))
+
+
 class PyIfTunTest(unittest.TestCase):
   """Simple tests to validate that pyiftun is compiled and installed."""
 
@@ -20,5 +40,140 @@ class PyIfTunTest(unittest.TestCase):
     from lansim import pyiftun
     self.assertTrue(hasattr(pyiftun, 'TUNSETIFF'))
 
+
+class MatcherTest(unittest.TestCase):
+  """Tests for the native rule matcher and batched reads."""
+
+  def setUp(self):
+    from lansim import pyiftun
+    self._matcher = pyiftun.Matcher(len(_PI), batch=4, bufsize=2048)
+    self._matcher.add(1, {'dst': '\xff' * 6, 'arp.pln': 4, 'arp.op': 1,
+                          'arp.tpa': socket.inet_aton('10.0.0.1')})
+    self._matcher.add(2, {'ip.dst': socket.inet_aton('10.0.0.1'),
+                          'ip.udp.dport': 53})
+    self._matcher.add(3, {'ip.tcp.dport': 53})
+
+  def testMatch(self):
+    """Tests packets match exactly the rules dpkt would match."""
+    self.assertEqual((1,), self._matcher.match(_PI + _ARP_REQUEST))
+    self.assertEqual((2,), self._matcher.match(_PI + _UDP))
+    self.assertEqual((), self._matcher.match(_PI + _UDP[:20]))
+    self.assertEqual((), self._matcher.match(''))
+
+  def testManyMatchingRules(self):
+    """Tests every matching rule is returned, however many there are."""
+    for rule_id in range(4, 204):
+      self._matcher.add(rule_id, {'ip.udp.dport': 53})
+    self.assertEqual((2,) + tuple(range(4, 204)),
+                     self._matcher.match(_PI + _UDP))
+
+  def testUnsupportedRule(self):
+    """Tests rules the matcher can't compile are rejected."""
+    self.assertRaises(ValueError, self._matcher.add, 4, {'ip.ttl': 64})
+    self.assertRaises(ValueError, self._matcher.add, 4, {'ip.dst': 'x'})
+    self.assertRaises(ValueError, self._matcher.add, 4, {'ip.p': 'x'})
+
+  def testReadWriteBatch(self):
+    """Tests batched I/O over a packet socket, keeping packet boundaries."""
+    from lansim import pyiftun
+    rd, wr = socket.socketpair(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+    rd.setblocking(False)
+    packets = [_PI + _ARP_REQUEST, _PI + '\x00' * 60, _PI + _UDP] * 2
+    self.assertEqual(len(packets),
+                     pyiftun.write_batch(wr.fileno(), packets))
+    # Only the matching packets are returned; the batch size limits a read.
+    self.assertEqual([(_PI + _ARP_REQUEST, (1,)), (_PI + _UDP, (2,)),
+                      (_PI + _ARP_REQUEST, (1,))],
+                     self._matcher.read_batch(rd.fileno()))
+    self.assertEqual([(_PI + '\x00' * 60, ()), (_PI + _UDP, (2,))],
+                     self._matcher.read_batch(rd.fileno(), True))
+    self.assertEqual([], self._matcher.read_batch(rd.fileno()))
+
+
+class EventLoopTest(unittest.TestCase):
+  """Tests for the native event loop and its timer wheel."""
+
+  def setUp(self):
+    from lansim import pyiftun
+    self._pyiftun = pyiftun
+    self._loop = pyiftun.EventLoop()
+    self._fired = []
+
+  def _callback(self, name):
+    return lambda: self._fired.append(name)
+
+  def testTimersFireInOrder(self):
+    """Tests timers fire once, by expiration and then insertion order."""
+    self._loop.add_timeout(0.02, self._callback('late'))
+    self._loop.add_timeout(0, self._callback('first'))
+    self._loop.add_timeout(0, self._callback('second'))
+    self._loop.add_timeout(3600, self._callback('never'))
+    self.assertEqual(4, len(self._loop))
+    self._loop.wait(0.01)
+    self._loop.run_timers()
+    self.assertEqual(['first', 'second'], self._fired)
+    # wait() returns when the next timer is due.
+    self.assertEqual([], self._loop.wait(10))
+    self._loop.run_timers()
+    self.assertEqual(['first', 'second', 'late'], self._fired)
+    self.assertEqual(1, len(self._loop))
+    self.assertTrue(3590 < self._loop.next_timeout() <= 3600)
+
+  def testWaitForWrappedTimer(self):
+    """Tests wait() returns for a timer a whole level 0 turn ahead.
+
+    A timer due just under 2^16 ticks ahead lands in the current slot of level
+    1 unless the wheel sits at the start of a level 0 turn, so a few tries
+    cover it.
+    """
+    loop = self._pyiftun.EventLoop(tick=1e-7)
+    for _ in range(32):
+      loop.run_timers()
+      loop.add_timeout((2 ** 16 - 64) * 1e-7, self._callback('wrapped'))
+      start = time.time()
+      self.assertEqual([], loop.wait(1))
+      self.assertTrue(time.time() - start < 0.5)
+    loop.run_timers()
+    self.assertEqual(['wrapped'] * 32, self._fired)
+
+  def testRemoveTimeout(self):
+    """Tests every call scheduled for a callback is removed."""
+    callback = self._callback('removed')
+    self._loop.add_timeout(0, callback)
+    self._loop.add_timeout(0, self._callback('kept'))
+    self._loop.add_timeout(300, callback)
+    self.assertTrue(self._loop.remove_timeout(callback))
+    self.assertFalse(self._loop.remove_timeout(callback))
+    self._loop.run_timers()
+    self.assertEqual(['kept'], self._fired)
+    self.assertEqual(None, self._loop.next_timeout())
+
+  def testCallbackReschedules(self):
+    """Tests callbacks can add and remove timers while they run."""
+    other = self._callback('other')
+    def callback():
+      self._fired.append('callback')
+      self._loop.remove_timeout(other)
+      self._loop.add_timeout(0, self._callback('again'))
+    self._loop.add_timeout(0, callback)
+    self._loop.add_timeout(0, other)
+    self._loop.run_timers()
+    self._loop.run_timers()
+    self.assertEqual(['callback', 'again'], self._fired)
+
+  def testWaitFds(self):
+    """Tests wait() reports the ready fds and returns on wakeup()."""
+    rd, wr = os.pipe()
+    self._loop.register(rd, self._pyiftun.EPOLLIN)
+    self.assertEqual([], self._loop.wait(0))
+    os.write(wr, 'x')
+    self.assertEqual([(rd, self._pyiftun.EPOLLIN)], self._loop.wait(1))
+    self._loop.unregister(rd)
+    os.close(rd)
+    os.close(wr)
+    self._loop.wakeup()
+    self.assertEqual([], self._loop.wait(10))
+
+
 if __name__ == '__main__':
   unittest.main()
@@ -11,6 +11,8 @@ PYIFTUN_SRC = [
     'wrapper_linux_if.c',
     'wrapper_linux_if_tun.c',
     'wrapper_sys_ioctl.c',
+    'fastpath.c',
+    'eventloop.c',
 ]
 PYIFTUN_DEPS = DEPS + PYIFTUN_SRC
 
@@ -0,0 +1,29 @@
+#!/usr/bin/python
+
+# Copyright 2015 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+"""Builds liblatency_hist.a, the log-linear latency histograms shared by the
+C latency tests (cyclictest, signaltest, aiostress, hackbench,
+monotonic_time). fakemodem builds it in from this source instead.
+
+Tests link it with -I<dep>/include and -L<dep>/lib -llatency_hist, and read
+what it exports with autotest_lib.client.bin.latency_hist.
+"""
+
+import common, os
+from autotest_lib.client.bin import utils
+
+version = 1
+
+def setup(topdir):
+    srcdir = os.path.join(topdir, 'src')
+    os.chdir(srcdir)
+    utils.make('clean')
+    utils.make()
+    utils.make('DESTDIR=%s install' % topdir)
+    os.chdir(topdir)
+
+pwd = os.getcwd()
+utils.update_version(pwd + '/src', True, version, setup, pwd)
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "latency_hist.h"
+
+/*
+ * A binary record is, in little endian:
+ *	u32 magic, u8 version, u8 sub_bits, u8 name_len, u8 unit_len,
+ *	u64 count, u64 sum, u64 min, u64 max, u32 nbuckets,
+ *	name, unit, and nbuckets non-empty buckets of (u16 index, u64 count).
+ */
+#define	RECORD_MAGIC	0x5453484c	/* "LHST" */
+#define	RECORD_VERSION	1
+#define	MAX_STRING	255
+
+
+void latency_hist_reset(latency_hist_t *hist)
+{
+	memset(hist, 0, sizeof *hist);
+}
+
+
+uint64_t latency_hist_bucket_low(int bucket)
+{
+	int	shift;
+
+	if (bucket < 2 * LATENCY_HIST_SUB_BUCKETS)
+		return bucket;
+
+	shift = bucket / LATENCY_HIST_SUB_BUCKETS - 1;
+	return (uint64_t)(LATENCY_HIST_SUB_BUCKETS +
+			  bucket % LATENCY_HIST_SUB_BUCKETS) << shift;
+}
+
+
+uint64_t latency_hist_bucket_high(int bucket)
+{
+	int	shift;
+
+	if (bucket < 2 * LATENCY_HIST_SUB_BUCKETS)
+		return bucket;
+
+	shift = bucket / LATENCY_HIST_SUB_BUCKETS - 1;
+	return latency_hist_bucket_low(bucket) + ((uint64_t)1 << shift) - 1;
+}
+
+
+void latency_hist_merge(latency_hist_t *total, const latency_hist_t *hist)
+{
+	int	i;
+
+	if (hist->count == 0)
+		return;
+
+	if (total->count == 0 || hist->min < total->min)
+		total->min = hist->min;
+	if (hist->max > total->max)
+		total->max = hist->max;
+	total->count += hist->count;
+	total->sum += hist->sum;
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++)
+		total->buckets[i] += hist->buckets[i];
+}
+
+
+void latency_hist_reset_shared(latency_hist_t *total)
+{
+	memset(total, 0, sizeof *total);
+	total->min = UINT64_MAX;
+}
+
+
+void latency_hist_merge_atomic(latency_hist_t *total,
+			       const latency_hist_t *hist)
+{
+	uint64_t	old;
+	int		i;
+
+	if (hist->count == 0)
+		return;
+
+	old = __atomic_load_n(&total->min, __ATOMIC_RELAXED);
+	while (hist->min < old &&
+	       !__atomic_compare_exchange_n(&total->min, &old, hist->min, 0,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	old = __atomic_load_n(&total->max, __ATOMIC_RELAXED);
+	while (hist->max > old &&
+	       !__atomic_compare_exchange_n(&total->max, &old, hist->max, 0,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++)
+		if (hist->buckets[i])
+			__atomic_fetch_add(&total->buckets[i], hist->buckets[i],
+					   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&total->sum, hist->sum, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&total->count, hist->count, __ATOMIC_RELEASE);
+}
+
+
+uint64_t latency_hist_percentile(const latency_hist_t *hist,
+				 double percentile)
+{
+	double		exact;
+	uint64_t	rank;
+	uint64_t	seen	= 0;
+	uint64_t	value;
+	int		i;
+
+	if (hist->count == 0)
+		return 0;
+
+	exact = percentile / 100 * hist->count;
+	rank = (uint64_t)exact;
+	if (rank < exact)
+		rank++;
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+	if (i == LATENCY_HIST_BUCKETS)
+		return hist->max;
+
+	value = latency_hist_bucket_high(i);
+	if (value < hist->min)
+		value = hist->min;
+	if (value > hist->max)
+		value = hist->max;
+	return value;
+}
+
+
+double latency_hist_mean(const latency_hist_t *hist)
+{
+	return hist->count ? (double)hist->sum / hist->count : 0;
+}
+
+
+int latency_hist_write_text(const latency_hist_t *hist, FILE *f,
+			    const char *name, const char *unit)
+{
+	const char	*sep	= "";
+	int		i;
+
+	fprintf(f, "latency_hist: name=%s unit=%s sub_bits=%d count=%" PRIu64
+		" sum=%" PRIu64 " min=%" PRIu64 " max=%" PRIu64 " buckets=",
+		name, unit, LATENCY_HIST_SUB_BITS, hist->count, hist->sum,
+		hist->count ? hist->min : 0, hist->max);
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+		if (hist->buckets[i]) {
+			fprintf(f, "%s%d:%" PRIu64, sep, i, hist->buckets[i]);
+			sep = ",";
+		}
+	}
+	fputc('\n', f);
+
+	return ferror(f) ? -1 : 0;
+}
+
+
+static void put_le(FILE *f, uint64_t value, int size)
+{
+	int	i;
+
+	for (i = 0; i < size; i++)
+		fputc((value >> (8 * i)) & 0xff, f);
+}
+
+
+int latency_hist_write_binary(const latency_hist_t *hist, FILE *f,
+			      const char *name, const char *unit)
+{
+	size_t		name_len	= strlen(name);
+	size_t		unit_len	= strlen(unit);
+	uint32_t	nbuckets	= 0;
+	int		i;
+
+	if (name_len > MAX_STRING)
+		name_len = MAX_STRING;
+	if (unit_len > MAX_STRING)
+		unit_len = MAX_STRING;
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++)
+		if (hist->buckets[i])
+			nbuckets++;
+
+	put_le(f, RECORD_MAGIC, 4);
+	put_le(f, RECORD_VERSION, 1);
+	put_le(f, LATENCY_HIST_SUB_BITS, 1);
+	put_le(f, name_len, 1);
+	put_le(f, unit_len, 1);
+	put_le(f, hist->count, 8);
+	put_le(f, hist->sum, 8);
+	put_le(f, hist->count ? hist->min : 0, 8);
+	put_le(f, hist->max, 8);
+	put_le(f, nbuckets, 4);
+	fwrite(name, 1, name_len, f);
+	fwrite(unit, 1, unit_len, f);
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+		if (hist->buckets[i]) {
+			put_le(f, i, 2);
+			put_le(f, hist->buckets[i], 8);
+		}
+	}
+
+	return ferror(f) ? -1 : 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LATENCY_HIST_H_
+#define LATENCY_HIST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A log-linear histogram of 64 bit values. Values below
+ * LATENCY_HIST_SUB_BUCKETS get a bucket each, and every power of two
+ * above that is split into LATENCY_HIST_SUB_BUCKETS buckets, so a bucket
+ * is never wider than 1/LATENCY_HIST_SUB_BUCKETS of the values in it.
+ */
+#define LATENCY_HIST_SUB_BITS		5
+#define LATENCY_HIST_SUB_BUCKETS	(1 << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_BUCKETS		((64 - LATENCY_HIST_SUB_BITS + 1) * \
+					 LATENCY_HIST_SUB_BUCKETS)
+
+/*
+ * A zeroed histogram is empty. Each histogram has a single writer and
+ * needs no locking: it is meant to be kept per thread and merged. Other
+ * threads may read it while it is written, and see it a few values late.
+ */
+typedef struct latency_hist {
+	uint64_t	count;
+	uint64_t	sum;
+	uint64_t	min;
+	uint64_t	max;
+	uint64_t	buckets[LATENCY_HIST_BUCKETS];
+} latency_hist_t;
+
+
+static inline int latency_hist_bucket(uint64_t value)
+{
+	int	msb;
+
+	if (value < LATENCY_HIST_SUB_BUCKETS)
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+	return (msb - LATENCY_HIST_SUB_BITS + 1) * LATENCY_HIST_SUB_BUCKETS +
+		(int)(value >> (msb - LATENCY_HIST_SUB_BITS)) -
+		LATENCY_HIST_SUB_BUCKETS;
+}
+
+
+#define LATENCY_HIST_SET(field, value) \
+	__atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+static inline void latency_hist_record(latency_hist_t *hist, uint64_t value)
+{
+	uint64_t	*bucket = &hist->buckets[latency_hist_bucket(value)];
+
+	if (hist->count == 0 || value < hist->min)
+		LATENCY_HIST_SET(hist->min, value);
+	if (value > hist->max)
+		LATENCY_HIST_SET(hist->max, value);
+	LATENCY_HIST_SET(*bucket, *bucket + 1);
+	LATENCY_HIST_SET(hist->sum, hist->sum + value);
+	LATENCY_HIST_SET(hist->count, hist->count + 1);
+}
+
+#undef LATENCY_HIST_SET
+
+
+void latency_hist_reset(latency_hist_t *hist);
+
+/* The range of values that fall into a bucket. */
+uint64_t latency_hist_bucket_low(int bucket);
+uint64_t latency_hist_bucket_high(int bucket);
+
+/* Add hist to total. */
+void latency_hist_merge(latency_hist_t *total, const latency_hist_t *hist);
+
+/*
+ * Add hist to total with atomic operations, for a total that several
+ * threads or processes (in shared memory) merge into at the same time.
+ * Such a total starts out from latency_hist_reset_shared() rather than
+ * zeroed, so that its min needs no lock.
+ */
+void latency_hist_reset_shared(latency_hist_t *total);
+void latency_hist_merge_atomic(latency_hist_t *total,
+			       const latency_hist_t *hist);
+
+/*
+ * The value below which percentile percent of the values fall, as the
+ * upper end of its bucket clamped to [min, max]. 0 if hist is empty.
+ */
+uint64_t latency_hist_percentile(const latency_hist_t *hist,
+				 double percentile);
+
+double latency_hist_mean(const latency_hist_t *hist);
+
+/*
+ * Export hist as one "latency_hist:" line of text, or as a binary record;
+ * several records can follow each other in a file. Both are read by
+ * autotest_lib.client.bin.latency_hist. Return 0, or -1 on write errors.
+ */
+int latency_hist_write_text(const latency_hist_t *hist, FILE *f,
+			    const char *name, const char *unit);
+int latency_hist_write_binary(const latency_hist_t *hist, FILE *f,
+			      const char *name, const char *unit);
+
+#endif /* LATENCY_HIST_H_ */
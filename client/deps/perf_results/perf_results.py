@@ -0,0 +1,28 @@
+#!/usr/bin/python
+
+# Copyright 2015 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+"""Builds libperf_results.a, which lets native benchmarks report their perf
+values as JSON lines instead of text for their wrappers to scrape.
+
+Tests link it with -I<dep>/include and -L<dep>/lib -lperf_results, and read
+the values back with autotest_lib.client.bin.perf_results.
+"""
+
+import common, os
+from autotest_lib.client.bin import utils
+
+version = 1
+
+def setup(topdir):
+    srcdir = os.path.join(topdir, 'src')
+    os.chdir(srcdir)
+    utils.make('clean')
+    utils.make()
+    utils.make('DESTDIR=%s install' % topdir)
+    os.chdir(topdir)
+
+pwd = os.getcwd()
+utils.update_version(pwd + '/src', True, version, setup, pwd)
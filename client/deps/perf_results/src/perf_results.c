@@ -0,0 +1,172 @@
+/*
+ * Copyright 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "perf_results.h"
+
+/* A line being formatted; data is NULL once an allocation failed. */
+struct line {
+	char	*data;
+	size_t	len;
+	size_t	size;
+};
+
+/* -2 until the environment has been read, -1 if results are not wanted. */
+static int results_fd = -2;
+
+
+int perf_results_enabled(void)
+{
+	const char	*env;
+	char		*end;
+	long		fd;
+
+	if (results_fd == -2) {
+		results_fd = -1;
+		env = getenv(PERF_RESULTS_FD_ENV);
+		if (env && *env) {
+			fd = strtol(env, &end, 10);
+			if (!*end && fd >= 0 && fd <= INT_MAX)
+				results_fd = fd;
+		}
+	}
+	return results_fd >= 0;
+}
+
+
+static void append(struct line *line, const char *fmt, ...)
+{
+	va_list	ap;
+	char	*data;
+	int	n;
+
+	if (!line->data)
+		return;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(line->data + line->len, line->size - line->len,
+			      fmt, ap);
+		va_end(ap);
+		if (n < 0) {
+			free(line->data);
+			line->data = NULL;
+			return;
+		}
+		if ((size_t)n < line->size - line->len)
+			break;
+
+		line->size = 2 * (line->len + n + 1);
+		data = realloc(line->data, line->size);
+		if (!data) {
+			free(line->data);
+			line->data = NULL;
+			return;
+		}
+		line->data = data;
+	}
+	line->len += n;
+}
+
+
+static void append_string(struct line *line, const char *s)
+{
+	append(line, "\"");
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			append(line, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			append(line, "\\u%04x", *s);
+		else
+			append(line, "%c", *s);
+	}
+	append(line, "\"");
+}
+
+
+static int write_line(const struct line *line)
+{
+	size_t	done	= 0;
+	ssize_t	n;
+
+	while (done < line->len) {
+		n = write(results_fd, line->data + done, line->len - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+
+static int report(const char *description, const double *values,
+		  size_t count, int distribution, const char *units,
+		  int higher_is_better)
+{
+	struct line	line;
+	size_t		i;
+	int		ret;
+
+	if (!perf_results_enabled())
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		if (!isfinite(values[i])) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	line.len = 0;
+	line.size = 256;
+	line.data = malloc(line.size);
+
+	append(&line, "{\"description\": ");
+	append_string(&line, description);
+	append(&line, ", \"value\": ");
+	if (distribution)
+		append(&line, "[");
+	for (i = 0; i < count; i++)
+		append(&line, "%s%.15g", i ? ", " : "", values[i]);
+	if (distribution)
+		append(&line, "]");
+	append(&line, ", \"units\": ");
+	append_string(&line, units);
+	append(&line, ", \"higher_is_better\": %s}\n",
+	       higher_is_better ? "true" : "false");
+
+	if (!line.data) {
+		errno = ENOMEM;
+		return -1;
+	}
+	ret = write_line(&line);
+	free(line.data);
+	return ret;
+}
+
+
+int perf_result(const char *description, double value, const char *units,
+		int higher_is_better)
+{
+	return report(description, &value, 1, 0, units, higher_is_better);
+}
+
+
+int perf_result_values(const char *description, const double *values,
+		       size_t count, const char *units, int higher_is_better)
+{
+	return report(description, values, count, 1, units, higher_is_better);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef PERF_RESULTS_H_
+#define PERF_RESULTS_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Perf values for autotest. When the environment variable below names an
+ * open file descriptor, every perf_result*() call writes one line of JSON
+ * to it,
+ *	{"description": "fps", "value": 59.9, "units": "fps",
+ *	 "higher_is_better": true}
+ * with a list of numbers as the value for a distribution. The keys are the
+ * arguments of test.output_perf_value(), and the lines are read back with
+ * autotest_lib.client.bin.perf_results. Without the variable the calls do
+ * nothing, so tools can report unconditionally.
+ */
+#define PERF_RESULTS_FD_ENV	"AUTOTEST_PERF_RESULTS_FD"
+
+#define PERF_RESULTS_LOWER_IS_BETTER	0
+#define PERF_RESULTS_HIGHER_IS_BETTER	1
+
+/* Whether results are being collected. */
+int perf_results_enabled(void);
+
+/*
+ * Report one value, or count values of the same measurement. Each line is
+ * written with a single write(), so threads and processes sharing the
+ * descriptor do not interleave. Return 0, or -1 with errno set on write
+ * errors or values that are not finite.
+ */
+int perf_result(const char *description, double value, const char *units,
+		int higher_is_better);
+int perf_result_values(const char *description, const double *values,
+		       size_t count, const char *units, int higher_is_better);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERF_RESULTS_H_ */
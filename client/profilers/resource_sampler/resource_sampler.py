@@ -0,0 +1,148 @@
+# Copyright 2015 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+"""
+Samples system CPU, memory and pressure counters at a fine interval with a
+native sampler, into a ring file that is turned into a CSV file at report
+time.
+
+Defaults options:
+job.profilers.add('resource_sampler', interval_ms=50, cgroups=())
+
+The sampler rereads /proc/stat, /proc/meminfo, /proc/vmstat,
+/proc/pressure/* and the usage files of the given cgroup directories
+through open descriptors, and writes fixed size records into a memory
+mapped file, so it stays well under 1% of a CPU at 50 ms. Records are
+marked start and stop at the profiler's start() and stop(), and mark()
+adds a mark record to line up phases of a test.
+"""
+
+import logging, os, signal, struct, subprocess
+from autotest_lib.client.bin import profiler, utils
+from autotest_lib.client.common_lib import error
+
+RING_MAGIC = 0x504d5352
+RING_VERSION = 1
+RING_HEADER = struct.Struct('=6I6Q')
+RECORD_HEADER = struct.Struct('=QII')
+NAME_SIZE = 32
+RECORD_TYPES = ('sample', 'start', 'stop', 'mark')
+
+
+def read_ring(path):
+    """
+    Reads the ring file written by the sampler.
+
+    @param path: The ring file.
+    @return A tuple of a dict of the header fields, the list of field
+            names, and the records in the ring, oldest first. Each record
+            is a tuple of (time_ns, type, mark, values).
+    @raises ValueError: if the file is not a ring file.
+    """
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < RING_HEADER.size:
+        raise ValueError('%s: too short for a ring file' % path)
+    (magic, version, header_size, record_size, capacity, nfields,
+     interval_ns, head, start_ns, stop_ns, cpu_ns,
+     missed) = RING_HEADER.unpack_from(data)
+    if magic != RING_MAGIC or version != RING_VERSION:
+        raise ValueError('%s: not a version %d ring file' %
+                         (path, RING_VERSION))
+    if len(data) < header_size + capacity * record_size:
+        raise ValueError('%s: truncated ring file' % path)
+
+    names = []
+    for i in xrange(nfields):
+        offset = RING_HEADER.size + i * NAME_SIZE
+        names.append(data[offset:offset + NAME_SIZE].rstrip('\0'))
+
+    values = struct.Struct('=%dQ' % nfields)
+    records = []
+    for i in xrange(max(0, head - capacity), head):
+        offset = header_size + (i % capacity) * record_size
+        time_ns, record_type, mark = RECORD_HEADER.unpack_from(data, offset)
+        records.append((time_ns, RECORD_TYPES[record_type], mark,
+                        values.unpack_from(data,
+                                           offset + RECORD_HEADER.size)))
+
+    header = {'interval_ns': interval_ns, 'head': head, 'capacity': capacity,
+              'start_ns': start_ns, 'stop_ns': stop_ns, 'cpu_ns': cpu_ns,
+              'missed': missed}
+    return header, names, records
+
+
+class resource_sampler(profiler.profiler):
+    version = 1
+    preserve_srcdir = True
+
+
+    def setup(self, *args, **dargs):
+        os.chdir(self.srcdir)
+        utils.make('clean')
+        utils.make()
+
+
+    def initialize(self, interval_ms=50, cgroups=(), capacity=16384):
+        """
+        @param interval_ms: Sampling interval, in milliseconds.
+        @param cgroups: Cgroup directories whose CPU and memory usage to
+                        sample too.
+        @param capacity: Number of records the ring holds; older ones are
+                         overwritten.
+        """
+        self.interval_ms = interval_ms
+        self.cgroups = cgroups
+        self.capacity = capacity
+
+
+    def start(self, test):
+        self._ring = os.path.join(test.profdir, 'resource_sampler.ring')
+        cmd = [os.path.join(self.srcdir, 'resource_sampler'),
+               '-i', str(self.interval_ms), '-n', str(self.capacity),
+               '-o', self._ring]
+        for cgroup in self.cgroups:
+            cmd += ['-c', cgroup]
+        self._log = open(os.path.join(test.profdir, 'resource_sampler.log'),
+                         'w')
+        self._process = subprocess.Popen(cmd, stdout=subprocess.PIPE,
+                                         stderr=self._log, close_fds=True)
+        # The start record is written before this line, so that it marks
+        # the start of the test rather than of the sampler.
+        if self._process.stdout.readline().strip() != 'started':
+            self._process.wait()
+            self._log.close()
+            raise error.TestError('resource_sampler failed to start')
+
+
+    def mark(self):
+        """Adds a record marked mark, e.g. between phases of a test."""
+        os.kill(self._process.pid, signal.SIGUSR1)
+
+
+    def stop(self, test):
+        os.kill(self._process.pid, signal.SIGTERM)
+        self._process.wait()
+        self._process.stdout.close()
+        self._log.close()
+
+
+    def report(self, test):
+        header, names, records = read_ring(self._ring)
+        with open(os.path.join(test.profdir, 'resource_sampler.csv'),
+                  'w') as f:
+            f.write(','.join(['time_ms', 'type', 'mark'] + names) + '\n')
+            for time_ns, record_type, mark, values in records:
+                f.write(','.join(
+                        ['%.3f' % ((time_ns - header['start_ns']) / 1e6),
+                         record_type, str(mark)] +
+                        [str(value) for value in values]) + '\n')
+
+        elapsed_ns = header['stop_ns'] - header['start_ns']
+        if elapsed_ns > 0:
+            logging.info('resource_sampler: %d records, %d dropped from the '
+                         'ring, %d samples missed, sampler CPU %.2f%%',
+                         header['head'], header['head'] - len(records),
+                         header['missed'],
+                         100.0 * header['cpu_ns'] / elapsed_ns)
@@ -0,0 +1,512 @@
+/*
+ * Copyright 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * resource_sampler - samples system CPU, memory and pressure counters into
+ * a memory mapped ring file.
+ *
+ * Every interval it reads /proc/stat, /proc/meminfo, /proc/vmstat,
+ * /proc/pressure/{cpu,memory,io} and the CPU and memory usage of the given
+ * cgroups, keeping each file open and rereading it with pread(). Each
+ * sample is one fixed size record in the ring; a reader finds the newest
+ * records from the header alone, also while the sampler is running.
+ *
+ * The first record is marked start and is written before "started" is
+ * printed, the last is marked stop and is written on SIGTERM or SIGINT,
+ * and SIGUSR1 adds a record marked mark, so that phases of a test can be
+ * lined up with the samples.
+ *
+ * Ring file layout, in native byte order:
+ *	struct ring_header
+ *	nfields field names of NAME_SIZE bytes, NUL padded
+ *	padding up to header_size
+ *	capacity records of record_size bytes: struct record, then nfields
+ *	u64 values. Record i is at index i % capacity.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define RING_MAGIC	0x504d5352	/* "RSMP" */
+#define RING_VERSION	1
+#define NAME_SIZE	32
+#define MAX_FIELDS	256
+#define MAX_CGROUPS	16
+#define READ_SIZE	(128 * 1024)
+
+enum record_type {
+	RECORD_SAMPLE	= 0,
+	RECORD_START	= 1,
+	RECORD_STOP	= 2,
+	RECORD_MARK	= 3,
+};
+
+struct ring_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	header_size;
+	uint32_t	record_size;
+	uint32_t	capacity;
+	uint32_t	nfields;
+	uint64_t	interval_ns;
+	uint64_t	head;		/* records written, updated last */
+	uint64_t	start_ns;	/* CLOCK_MONOTONIC */
+	uint64_t	stop_ns;	/* 0 while running */
+	uint64_t	cpu_ns;		/* used by the sampler, set at stop */
+	uint64_t	missed;		/* samples skipped for being late */
+};
+
+struct record {
+	uint64_t	time_ns;	/* CLOCK_MONOTONIC */
+	uint32_t	type;
+	uint32_t	mark;		/* marks written before this record */
+	uint64_t	values[];
+};
+
+/*
+ * A key in a "name value..." file, and how many values after it to take.
+ * If prefix is set, the value follows prefix somewhere in the line.
+ */
+struct key {
+	const char	*name;
+	const char	*prefix;
+	int		count;
+};
+
+/* A file to sample. Without keys it holds a single number. */
+struct source {
+	const char		*path;
+	const struct key	*keys;
+	int			nkeys;
+	const char *const	*fields;
+	uint64_t		divisor;
+	int			fd;
+	int			first;
+};
+
+static const struct key stat_keys[] = {
+	{ "cpu",		NULL, 8 },
+	{ "ctxt",		NULL, 1 },
+	{ "intr",		NULL, 1 },
+	{ "procs_running",	NULL, 1 },
+	{ "procs_blocked",	NULL, 1 },
+};
+static const char *const stat_fields[] = {
+	"cpu_user", "cpu_nice", "cpu_system", "cpu_idle", "cpu_iowait",
+	"cpu_irq", "cpu_softirq", "cpu_steal", "ctxt", "intr",
+	"procs_running", "procs_blocked",
+};
+
+static const struct key meminfo_keys[] = {
+	{ "MemFree",		NULL, 1 },
+	{ "MemAvailable",	NULL, 1 },
+	{ "Buffers",		NULL, 1 },
+	{ "Cached",		NULL, 1 },
+	{ "SwapFree",		NULL, 1 },
+	{ "Dirty",		NULL, 1 },
+	{ "Writeback",		NULL, 1 },
+	{ "AnonPages",		NULL, 1 },
+	{ "Shmem",		NULL, 1 },
+};
+static const char *const meminfo_fields[] = {
+	"mem_free_kb", "mem_available_kb", "buffers_kb", "cached_kb",
+	"swap_free_kb", "dirty_kb", "writeback_kb", "anon_kb", "shmem_kb",
+};
+
+static const struct key vmstat_keys[] = {
+	{ "pgpgin",		NULL, 1 },
+	{ "pgpgout",		NULL, 1 },
+	{ "pswpin",		NULL, 1 },
+	{ "pswpout",		NULL, 1 },
+	{ "pgfault",		NULL, 1 },
+	{ "pgmajfault",		NULL, 1 },
+};
+static const char *const vmstat_fields[] = {
+	"pgpgin", "pgpgout", "pswpin", "pswpout", "pgfault", "pgmajfault",
+};
+
+static const struct key pressure_keys[] = {
+	{ "some",		"total=", 1 },
+	{ "full",		"total=", 1 },
+};
+static const char *const cpu_pressure_fields[] = {
+	"cpu_some_us", "cpu_full_us",
+};
+static const char *const memory_pressure_fields[] = {
+	"memory_some_us", "memory_full_us",
+};
+static const char *const io_pressure_fields[] = {
+	"io_some_us", "io_full_us",
+};
+
+static const struct key cgroup_cpu_keys[] = {
+	{ "usage_usec",		NULL, 1 },
+};
+
+#define KEYED(path, keys, fields) \
+	{ path, keys, sizeof(keys) / sizeof(keys[0]), fields, 1, -1, 0 }
+
+#define PROC_SOURCES	6
+
+static struct source sources[PROC_SOURCES + 2 * MAX_CGROUPS] = {
+	KEYED("/proc/stat", stat_keys, stat_fields),
+	KEYED("/proc/meminfo", meminfo_keys, meminfo_fields),
+	KEYED("/proc/vmstat", vmstat_keys, vmstat_fields),
+	KEYED("/proc/pressure/cpu", pressure_keys, cpu_pressure_fields),
+	KEYED("/proc/pressure/memory", pressure_keys, memory_pressure_fields),
+	KEYED("/proc/pressure/io", pressure_keys, io_pressure_fields),
+};
+static int nsources = PROC_SOURCES;
+
+static const char	*field_names[MAX_FIELDS];
+static int		nfields;
+
+static struct ring_header	*ring;
+static size_t			ring_size;
+static char			*read_buf;
+
+static volatile sig_atomic_t	stopping;
+static volatile sig_atomic_t	marks_requested;
+static uint32_t			marks_written;
+
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: resource_sampler [-i interval_ms] [-n records] "
+		"[-c cgroup_dir]... -o ring_file\n"
+		"  -i  sampling interval in ms (default 50)\n"
+		"  -n  number of records the ring holds (default 16384)\n"
+		"  -c  also sample the CPU and memory usage of a cgroup\n"
+		"  -o  the ring file to create\n");
+	exit(1);
+}
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void handle_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		marks_requested++;
+	else
+		stopping = 1;
+}
+
+
+/* Open a source and give its values fields in the records. */
+static void add_source(struct source *source)
+{
+	int	count = 0;
+	int	i;
+
+	source->fd = open(source->path, O_RDONLY | O_CLOEXEC);
+	if (source->fd < 0) {
+		/* Pressure needs CONFIG_PSI, so missing files are fine. */
+		fprintf(stderr, "resource_sampler: not sampling %s: %s\n",
+			source->path, strerror(errno));
+		return;
+	}
+
+	if (source->keys) {
+		for (i = 0; i < source->nkeys; i++)
+			count += source->keys[i].count;
+	} else {
+		count = 1;
+	}
+	if (nfields + count > MAX_FIELDS) {
+		fprintf(stderr, "resource_sampler: too many fields\n");
+		exit(1);
+	}
+
+	source->first = nfields;
+	for (i = 0; i < count; i++)
+		field_names[nfields++] = source->fields[i];
+}
+
+
+/*
+ * Sample the CPU and memory usage of a cgroup, from its cgroup v2 files
+ * or, failing that, its v1 ones.
+ */
+static void add_cgroup(const char *dir)
+{
+	static const char *const suffixes[] = { "cpu_us", "memory_bytes" };
+	const char	*label;
+	struct source	*source;
+	char		name[NAME_SIZE];
+	char		**fields;
+	char		*path;
+	int		i;
+
+	if (nsources + 2 > (int)(sizeof(sources) / sizeof(sources[0]))) {
+		fprintf(stderr, "resource_sampler: too many cgroups\n");
+		exit(1);
+	}
+	label = strrchr(dir, '/');
+	label = label && label[1] ? label + 1 : dir;
+
+	for (i = 0; i < 2; i++) {
+		source = &sources[nsources];
+		fields = malloc(sizeof(*fields));
+		snprintf(name, sizeof(name), "%s.%s", label, suffixes[i]);
+		fields[0] = strdup(name);
+		source->fields = (const char *const *)fields;
+		source->divisor = 1;
+
+		if (i == 0) {
+			if (asprintf(&path, "%s/cpu.stat", dir) < 0)
+				exit(1);
+			source->keys = cgroup_cpu_keys;
+			source->nkeys = 1;
+			if (access(path, R_OK)) {
+				free(path);
+				if (asprintf(&path, "%s/cpuacct.usage",
+					     dir) < 0)
+					exit(1);
+				source->keys = NULL;
+				source->nkeys = 0;
+				source->divisor = 1000;
+			}
+		} else {
+			if (asprintf(&path, "%s/memory.current", dir) < 0)
+				exit(1);
+			if (access(path, R_OK)) {
+				free(path);
+				if (asprintf(&path, "%s/memory.usage_in_bytes",
+					     dir) < 0)
+					exit(1);
+			}
+		}
+		source->path = path;
+		source->fd = -1;
+		nsources++;
+	}
+}
+
+
+/* Parse the keyed values of one line into values. */
+static void parse_line(const struct source *source, char *line,
+		       uint64_t *values)
+{
+	const struct key	*key;
+	size_t			len;
+	char			*p;
+	int			index	= source->first;
+	int			i, j;
+
+	for (i = 0; i < source->nkeys; index += source->keys[i].count, i++) {
+		key = &source->keys[i];
+		len = strlen(key->name);
+		if (strncmp(line, key->name, len) ||
+		    (line[len] != ' ' && line[len] != ':'))
+			continue;
+
+		p = line + len + 1;
+		if (key->prefix) {
+			p = strstr(p, key->prefix);
+			if (!p)
+				return;
+			p += strlen(key->prefix);
+		}
+		for (j = 0; j < key->count; j++)
+			values[index + j] = strtoull(p, &p, 10);
+		return;
+	}
+}
+
+
+static void read_source(const struct source *source, uint64_t *values)
+{
+	ssize_t	len;
+	char	*line, *end;
+
+	if (source->fd < 0)
+		return;
+	len = pread(source->fd, read_buf, READ_SIZE - 1, 0);
+	if (len <= 0)
+		return;
+	read_buf[len] = '\0';
+
+	if (!source->keys) {
+		values[source->first] =
+			strtoull(read_buf, NULL, 10) / source->divisor;
+		return;
+	}
+	for (line = read_buf; line < read_buf + len; line = end + 1) {
+		end = strchrnul(line, '\n');
+		*end = '\0';
+		parse_line(source, line, values);
+	}
+}
+
+
+static void write_record(enum record_type type)
+{
+	struct record	*record;
+	uint64_t	head	= ring->head;
+	int		i;
+
+	record = (struct record *)((char *)ring + ring->header_size +
+				   (size_t)(head % ring->capacity) *
+				   ring->record_size);
+	memset(record, 0, ring->record_size);
+	record->time_ns = now_ns();
+	record->type = type;
+	record->mark = marks_written;
+	for (i = 0; i < nsources; i++)
+		read_source(&sources[i], record->values);
+
+	/* Readers may copy the ring while it is written. */
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+static void create_ring(const char *path, uint32_t capacity,
+			uint64_t interval_ns)
+{
+	uint32_t	header_size, record_size;
+	int		fd;
+	int		i;
+
+	header_size = sizeof(*ring) + nfields * NAME_SIZE;
+	header_size = (header_size + 63) & ~63;
+	record_size = sizeof(struct record) + nfields * sizeof(uint64_t);
+	ring_size = header_size + (size_t)capacity * record_size;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate(fd, ring_size)) {
+		perror(path);
+		exit(1);
+	}
+	ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	close(fd);
+
+	ring->magic = RING_MAGIC;
+	ring->version = RING_VERSION;
+	ring->header_size = header_size;
+	ring->record_size = record_size;
+	ring->capacity = capacity;
+	ring->nfields = nfields;
+	ring->interval_ns = interval_ns;
+	for (i = 0; i < nfields; i++)
+		strncpy((char *)(ring + 1) + i * NAME_SIZE, field_names[i],
+			NAME_SIZE - 1);
+}
+
+
+/* Sleep until deadline, or until a signal arrives. */
+static int sleep_until(uint64_t deadline)
+{
+	struct timespec	ts;
+
+	ts.tv_sec = deadline / 1000000000;
+	ts.tv_nsec = deadline % 1000000000;
+	return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+
+int main(int argc, char **argv)
+{
+	struct sigaction	sa;
+	struct timespec		cpu;
+	const char		*ring_path	= NULL;
+	uint64_t		interval_ns	= 50 * 1000000ULL;
+	uint64_t		capacity	= 16384;
+	uint64_t		next, now, late;
+	int			opt;
+	int			i;
+
+	read_buf = malloc(READ_SIZE);
+	if (!read_buf)
+		exit(1);
+
+	while ((opt = getopt(argc, argv, "i:n:c:o:")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval_ns = strtoull(optarg, NULL, 10) * 1000000;
+			break;
+		case 'n':
+			capacity = strtoull(optarg, NULL, 10);
+			break;
+		case 'c':
+			add_cgroup(optarg);
+			break;
+		case 'o':
+			ring_path = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!ring_path || !interval_ns || !capacity || capacity > UINT32_MAX ||
+	    optind != argc)
+		usage();
+
+	for (i = 0; i < nsources; i++)
+		add_source(&sources[i]);
+	create_ring(ring_path, capacity, interval_ns);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	ring->start_ns = now_ns();
+	write_record(RECORD_START);
+	printf("started\n");
+	fflush(stdout);
+
+	next = ring->start_ns + interval_ns;
+	while (!stopping) {
+		while (marks_written != (uint32_t)marks_requested) {
+			marks_written++;
+			write_record(RECORD_MARK);
+		}
+		if (sleep_until(next) == EINTR)
+			continue;
+
+		write_record(RECORD_SAMPLE);
+		next += interval_ns;
+		now = now_ns();
+		if (next <= now) {
+			/* Keep to the grid rather than sampling in bursts. */
+			late = (now - next) / interval_ns + 1;
+			ring->missed += late;
+			next += late * interval_ns;
+		}
+	}
+
+	write_record(RECORD_STOP);
+	ring->stop_ns = now_ns();
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	ring->cpu_ns = (uint64_t)cpu.tv_sec * 1000000000 + cpu.tv_nsec;
+	msync(ring, ring_size, MS_SYNC);
+	munmap(ring, ring_size);
+	return 0;
+}
@@ -13,7 +13,7 @@ from autotest_lib.client.cros.video import device_capability
 
 
 class camera_V4L2(test.test):
-    version = 1
+    version = 3
     preserve_srcdir = True
     v4l2_major_dev_num = 81
     v4l2_minor_dev_num_min = 0
@@ -96,7 +96,9 @@ class camera_V4L2(test.test):
         stdout = utils.system_output(cmd, retain_output=True)
 
     def run_v4l2_capture_test(self, device):
-        options = ["--device=%s" % device, "--usb-info=%s" % self.usb_info]
+        options = ["--device=%s" % device, "--usb-info=%s" % self.usb_info,
+                   "--characteristics-cache=%s" %
+                   os.path.join(self.tmpdir, "camera_characteristics.cache")]
         if self.test_list:
             options += ["--test-list=%s" % self.test_list]
 
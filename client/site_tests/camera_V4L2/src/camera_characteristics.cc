@@ -6,25 +6,49 @@
 
 #include "camera_characteristics.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#include <array>
 #include <fstream>
-#include <map>
-#include <set>
-#include <sstream>
+#include <limits>
 #include <utility>
 #include <vector>
 
 #include <base/files/file_util.h>
+#include <base/files/important_file_writer.h>
+#include <base/files/memory_mapped_file.h>
 #include <base/strings/string_split.h>
 #include <base/strings/string_util.h>
-#include <re2/re2.h>
+#include <base/strings/stringprintf.h>
 
 // TODO(shik): Should we replace the custom format by proto/json/yaml/toml/xml?
 
 namespace {
 
+void ParseNumber(const std::string& value, float* result) {
+  char* end;
+  *result = strtof(value.c_str(), &end);
+  CHECK(!value.empty() && *end == '\0') << "Failed to parse " << value;
+}
+
+template <typename T>
+void ParseNumber(const std::string& value, T* result) {
+  char* end;
+  long long number = strtoll(value.c_str(), &end, 10);
+  CHECK(!value.empty() && *end == '\0') << "Failed to parse " << value;
+  CHECK(number >= std::numeric_limits<T>::min() &&
+        number <= std::numeric_limits<T>::max())
+      << value << " is out of range";
+  *result = static_cast<T>(number);
+}
+
 template <typename T>
 void ParseSize(const std::string& value, T* width, T* height) {
-  CHECK(RE2::FullMatch(value, "(.*)x(.*)", width, height));
+  size_t x = value.find('x');
+  CHECK(x != std::string::npos) << "Failed to parse size " << value;
+  ParseNumber(value.substr(0, x), width);
+  ParseNumber(value.substr(x + 1), height);
 }
 
 template <typename T>
@@ -34,56 +58,261 @@ std::vector<T> ParseCommaSeparated(const std::string& value) {
   size_t n = values.size();
   std::vector<T> res(n);
   for (size_t i = 0; i < n; i++) {
-    CHECK(std::istringstream(values[i]) >> res[i])
-        << "Failed to parse " << values[i];
+    ParseNumber(values[i], &res[i]);
   }
   return res;
 }
 
+// Parses a 4 digit hex usb id.
+bool ParseUsbId(const std::string& value, uint32_t* id) {
+  if (value.size() != 4) {
+    return false;
+  }
+  *id = 0;
+  for (char c : value) {
+    if (!base::IsHexDigit(c)) {
+      return false;
+    }
+    *id = *id << 4 | base::HexDigitToInt(c);
+  }
+  return true;
+}
+
+bool PackVidPid(const std::string& vid,
+                const std::string& pid,
+                uint32_t* vid_pid) {
+  uint32_t v, p;
+  if (!ParseUsbId(vid, &v) || !ParseUsbId(pid, &p)) {
+    return false;
+  }
+  *vid_pid = v << 16 | p;
+  return true;
+}
+
+uint32_t HashVidPid(uint32_t vid_pid) {
+  uint32_t hash = vid_pid * 0x9e3779b1u;
+  return hash ^ hash >> 16;
+}
+
+struct KeyHandler {
+  const char* key;
+  void (*set)(const std::string& value, DeviceInfo* info);
+};
+
+// Follow the same order as defined in common_types.h
+const KeyHandler kKeyHandlers[] = {
+    {"usb_vid_pid",
+     [](const std::string& value, DeviceInfo* info) {
+       uint32_t vid_pid;
+       CHECK(value.size() == 9 && value[4] == ':' &&
+             PackVidPid(value.substr(0, 4), value.substr(5), &vid_pid))
+           << "Invalid usb_vid_pid " << value;
+       info->usb_vid = value.substr(0, 4);
+       info->usb_pid = value.substr(5);
+     }},
+    {"frames_to_skip_after_streamon",
+     [](const std::string& value, DeviceInfo* info) {
+       ParseNumber(value, &info->frames_to_skip_after_streamon);
+     }},
+    {"constant_framerate_unsupported",
+     [](const std::string& value, DeviceInfo* info) {
+       if (value == "true") {
+         info->constant_framerate_unsupported = true;
+       } else if (value == "false") {
+         info->constant_framerate_unsupported = false;
+       } else {
+         LOGF(WARNING) << "Invalid boolean value: " << value;
+       }
+     }},
+    {"lens_facing",
+     [](const std::string& value, DeviceInfo* info) {
+       ParseNumber(value, &info->lens_facing);
+     }},
+    {"sensor_orientation",
+     [](const std::string& value, DeviceInfo* info) {
+       ParseNumber(value, &info->sensor_orientation);
+     }},
+    {"lens_info_available_apertures",
+     [](const std::string& value, DeviceInfo* info) {
+       info->lens_info_available_apertures = ParseCommaSeparated<float>(value);
+     }},
+    {"lens_info_available_focal_lengths",
+     [](const std::string& value, DeviceInfo* info) {
+       info->lens_info_available_focal_lengths =
+           ParseCommaSeparated<float>(value);
+     }},
+    {"lens_info_minimum_focus_distance",
+     [](const std::string& value, DeviceInfo* info) {
+       ParseNumber(value, &info->lens_info_minimum_focus_distance);
+     }},
+    {"lens_info_optimal_focus_distance",
+     [](const std::string& value, DeviceInfo* info) {
+       ParseNumber(value, &info->lens_info_optimal_focus_distance);
+     }},
+    {"sensor_info_physical_size",
+     [](const std::string& value, DeviceInfo* info) {
+       ParseSize(value, &info->sensor_info_physical_size_width,
+                 &info->sensor_info_physical_size_height);
+     }},
+    {"sensor_info_pixel_array_size",
+     [](const std::string& value, DeviceInfo* info) {
+       ParseSize(value, &info->sensor_info_pixel_array_size_width,
+                 &info->sensor_info_pixel_array_size_height);
+     }},
+    {"horizontal_view_angle_16_9",
+     [](const std::string& value, DeviceInfo* info) {
+       ParseNumber(value, &info->horizontal_view_angle_16_9);
+     }},
+    {"horizontal_view_angle_4_3",
+     [](const std::string& value, DeviceInfo* info) {
+       ParseNumber(value, &info->horizontal_view_angle_4_3);
+     }},
+    {"vertical_view_angle_16_9",
+     [](const std::string& value, DeviceInfo* info) {
+       ParseNumber(value, &info->vertical_view_angle_16_9);
+     }},
+    {"vertical_view_angle_4_3",
+     [](const std::string& value, DeviceInfo* info) {
+       ParseNumber(value, &info->vertical_view_angle_4_3);
+     }},
+};
+
+// Keys shorter than this are unknown, every key above is at least as long.
+const size_t kMinKeyLength = 11;
+const size_t kKeySlots = 32;
+
+// A perfect hash of the keys in |kKeyHandlers|. A new key that collides
+// with an existing one trips the CHECK in GetKeyHandler(), and needs other
+// character positions or multipliers picked here.
+size_t HashKey(const std::string& key) {
+  return (key.size() * 4 + key[10] + key[key.size() - 4]) % kKeySlots;
+}
+
+const KeyHandler* GetKeyHandler(const std::string& key) {
+  static const std::array<const KeyHandler*, kKeySlots> table = [] {
+    std::array<const KeyHandler*, kKeySlots> t{};
+    for (const KeyHandler& handler : kKeyHandlers) {
+      const KeyHandler*& slot = t[HashKey(handler.key)];
+      CHECK(slot == nullptr) << "Key hash collision between " << slot->key
+                             << " and " << handler.key;
+      slot = &handler;
+    }
+    return t;
+  }();
+
+  if (key.size() < kMinKeyLength) {
+    return nullptr;
+  }
+  const KeyHandler* handler = table[HashKey(key)];
+  return handler != nullptr && key == handler->key ? handler : nullptr;
+}
+
 void SetEntry(const std::string& key,
               const std::string& value,
               DeviceInfo* info) {
-  // Follow the same order as defined in common_types.h
-  if (key == "usb_vid_pid") {
-    CHECK(RE2::FullMatch(value, "([0-9a-f]{4}):([0-9a-f]{4})", &info->usb_vid,
-                         &info->usb_pid));
-  } else if (key == "frames_to_skip_after_streamon") {
-    info->frames_to_skip_after_streamon = stoi(value);
-  } else if (key == "constant_framerate_unsupported") {
-    std::istringstream(value) >> std::boolalpha >>
-        info->constant_framerate_unsupported;
-  } else if (key == "lens_facing") {
-    info->lens_facing = stoi(value);
-  } else if (key == "sensor_orientation") {
-    info->sensor_orientation = stoi(value);
-  } else if (key == "lens_info_available_apertures") {
-    info->lens_info_available_apertures = ParseCommaSeparated<float>(value);
-  } else if (key == "lens_info_available_focal_lengths") {
-    info->lens_info_available_focal_lengths = ParseCommaSeparated<float>(value);
-  } else if (key == "lens_info_minimum_focus_distance") {
-    info->lens_info_minimum_focus_distance = stof(value);
-  } else if (key == "lens_info_optimal_focus_distance") {
-    info->lens_info_optimal_focus_distance = stof(value);
-  } else if (key == "sensor_info_physical_size") {
-    ParseSize(value, &info->sensor_info_physical_size_width,
-              &info->sensor_info_physical_size_height);
-  } else if (key == "sensor_info_pixel_array_size") {
-    ParseSize(value, &info->sensor_info_pixel_array_size_width,
-              &info->sensor_info_pixel_array_size_height);
-  } else if (key == "horizontal_view_angle_16_9") {
-    info->horizontal_view_angle_16_9 = stof(value);
-  } else if (key == "horizontal_view_angle_4_3") {
-    info->horizontal_view_angle_4_3 = stof(value);
-  } else if (key == "vertical_view_angle_16_9") {
-    info->vertical_view_angle_16_9 = stof(value);
-  } else if (key == "vertical_view_angle_4_3") {
-    info->vertical_view_angle_4_3 = stof(value);
+  const KeyHandler* handler = GetKeyHandler(key);
+  if (handler != nullptr) {
+    handler->set(value, info);
   } else {
     LOGF(WARNING) << "Unknown or deprecated key: " << key << " value: "
                   << value;
   }
 }
 
+// Consumes |prefix| followed by a decimal index from |line| at |*pos|.
+bool ConsumeIndex(const std::string& line,
+                  const char* prefix,
+                  size_t* pos,
+                  size_t* index) {
+  size_t len = strlen(prefix);
+  if (line.compare(*pos, len, prefix) != 0) {
+    return false;
+  }
+  size_t i = *pos + len;
+  if (i >= line.size() || !base::IsAsciiDigit(line[i])) {
+    return false;
+  }
+  for (*index = 0; i < line.size() && base::IsAsciiDigit(line[i]); i++) {
+    *index = *index * 10 + (line[i] - '0');
+  }
+  *pos = i;
+  return true;
+}
+
+// The cache file is a CacheHeader, followed by |num_infos| CachedInfos each
+// followed by its apertures and focal lengths. Only modules with a usb
+// vid:pid are kept, and the ids are stored packed.
+const uint32_t kCacheMagic = 0x43414d43;  // "CMAC"
+const uint32_t kCacheVersion = 1;
+
+struct CacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  int64_t config_mtime;
+  int64_t config_size;
+  uint32_t num_infos;
+  uint32_t reserved;
+};
+
+struct CachedInfo {
+  int32_t camera_id;
+  uint32_t vid_pid;
+  uint32_t frames_to_skip_after_streamon;
+  uint32_t constant_framerate_unsupported;
+  uint32_t lens_facing;
+  int32_t sensor_orientation;
+  float lens_info_minimum_focus_distance;
+  float lens_info_optimal_focus_distance;
+  int32_t sensor_info_pixel_array_size_width;
+  int32_t sensor_info_pixel_array_size_height;
+  float sensor_info_physical_size_width;
+  float sensor_info_physical_size_height;
+  float horizontal_view_angle_16_9;
+  float horizontal_view_angle_4_3;
+  float vertical_view_angle_16_9;
+  float vertical_view_angle_4_3;
+  uint32_t num_apertures;
+  uint32_t num_focal_lengths;
+};
+
+static_assert(sizeof(CacheHeader) == 32, "CacheHeader must not be padded");
+static_assert(sizeof(CachedInfo) == 72, "CachedInfo must not be padded");
+
+// Reads from a mapped cache file, failing on any read past its end.
+class CacheReader {
+ public:
+  CacheReader(const uint8_t* data, size_t length)
+      : pos_(data), end_(data + length) {}
+
+  bool Read(void* out, size_t size) {
+    if (static_cast<size_t>(end_ - pos_) < size) {
+      return false;
+    }
+    memcpy(out, pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+  bool ReadFloats(uint32_t n, std::vector<float>* out) {
+    if (n > static_cast<size_t>(end_ - pos_) / sizeof(float)) {
+      return false;
+    }
+    out->resize(n);
+    return Read(out->data(), n * sizeof(float));
+  }
+
+  bool AtEnd() const { return pos_ == end_; }
+
+ private:
+  const uint8_t* pos_;
+  const uint8_t* end_;
+};
+
+void AppendFloats(const std::vector<float>& values, std::string* out) {
+  out->append(reinterpret_cast<const char*>(values.data()),
+              values.size() * sizeof(float));
+}
+
 }  // namespace
 
 // static
@@ -93,18 +322,44 @@ bool CameraCharacteristics::ConfigFileExists() {
 
 CameraCharacteristics::CameraCharacteristics() {
   if (ConfigFileExists()) {
-    InitFrom(kCameraCharacteristicsConfigFile);
+    InitFrom(kCameraCharacteristicsConfigFile, base::FilePath());
   }
 }
 
 CameraCharacteristics::CameraCharacteristics(
     const base::FilePath& config_file) {
-  InitFrom(config_file);
+  InitFrom(config_file, base::FilePath());
+}
+
+CameraCharacteristics::CameraCharacteristics(
+    const base::FilePath& config_file,
+    const base::FilePath& cache_file) {
+  InitFrom(config_file, cache_file);
 }
 
-void CameraCharacteristics::InitFrom(const base::FilePath& config_file) {
+void CameraCharacteristics::InitFrom(const base::FilePath& config_file,
+                                     const base::FilePath& cache_file) {
   CHECK(base::PathExists(config_file))
       << config_file.value() << " does not exist";
+
+  // Stat before reading, so that a config changed while it is parsed leaves
+  // a cache that does not match it.
+  base::File::Info config_info;
+  bool use_cache = !cache_file.empty() &&
+                   base::GetFileInfo(config_file, &config_info);
+
+  if (use_cache && LoadCache(cache_file, config_info)) {
+    VLOGF(1) << "Loaded camera characteristics from " << cache_file.value();
+  } else {
+    ParseConfig(config_file);
+    if (use_cache) {
+      WriteCache(cache_file, config_info);
+    }
+  }
+  BuildIndex();
+}
+
+void CameraCharacteristics::ParseConfig(const base::FilePath& config_file) {
   std::ifstream ifs(config_file.value());
   CHECK(ifs.good()) << "Can't open file " << config_file.value();
 
@@ -122,12 +377,25 @@ void CameraCharacteristics::InitFrom(const base::FilePath& config_file) {
       continue;
     }
 
-    size_t camera_id, module_id;
-    std::string key, value;
+    // camera{x}.{key}={value} or camera{x}.module{y}.{key}={value}
+    size_t pos = 0, camera_id, module_id;
+    size_t eq = line.find('=');
+    CHECK(eq != std::string::npos && eq + 1 < line.size() &&
+          ConsumeIndex(line, "camera", &pos, &camera_id) && line[pos] == '.')
+        << "Failed to parse: " << line;
+    pos++;
+    size_t module_pos = pos;
+    bool is_module = ConsumeIndex(line, "module", &module_pos, &module_id) &&
+                     line[module_pos] == '.';
+    if (is_module) {
+      pos = module_pos + 1;
+    }
+    std::string key = line.substr(pos, eq - pos);
+    std::string value = line.substr(eq + 1);
+    CHECK(!key.empty() && key.find('.') == std::string::npos)
+        << "Failed to parse: " << line;
 
-    if (RE2::FullMatch(line, R"(camera(\d+)\.([^.=]+)=(.+))", &camera_id, &key,
-                       &value)) {
-      // camera{x}.{key}={value}
+    if (!is_module) {
       if (camera_id == per_camera_infos.size()) {
         per_camera_infos.push_back({.camera_id = static_cast<int>(camera_id)});
         per_module_infos.push_back({});
@@ -139,9 +407,9 @@ void CameraCharacteristics::InitFrom(const base::FilePath& config_file) {
              "specific ones";
 
       SetEntry(key, value, &per_camera_infos[camera_id]);
-    } else if (RE2::FullMatch(line, R"(camera(\d+)\.module(\d+).([^.=]+)=(.+))",
-                              &camera_id, &module_id, &key, &value)) {
-      // camera{x}.module{y}.{key}={value}
+    } else {
+      CHECK(camera_id < per_module_infos.size())
+          << "Invalid camera id " << camera_id;
       DeviceInfos& module_infos = per_module_infos[camera_id];
       if (module_id == module_infos.size()) {
         module_infos.push_back(per_camera_infos[camera_id]);
@@ -150,31 +418,169 @@ void CameraCharacteristics::InitFrom(const base::FilePath& config_file) {
           << "Invalid module id " << module_id;
 
       SetEntry(key, value, &module_infos[module_id]);
-    } else {
-      LOGF(FATAL) << "Failed to parse: " << line;
     }
   }
 
-  for (const auto& camera_infos : per_module_infos) {
-    for (const auto& module_info : camera_infos) {
-      auto ret = camera_module_infos_.insert(
-          {{module_info.usb_vid, module_info.usb_pid}, module_info});
-      CHECK(ret.second) << "Duplicate vid:pid in config";
+  for (auto& camera_infos : per_module_infos) {
+    for (auto& module_info : camera_infos) {
+      if (module_info.usb_vid.empty()) {
+        LOGF(WARNING) << "Ignoring a module of camera" << module_info.camera_id
+                      << " without usb_vid_pid";
+        continue;
+      }
+      module_infos_.push_back(std::move(module_info));
+    }
+  }
+}
+
+bool CameraCharacteristics::LoadCache(const base::FilePath& cache_file,
+                                      const base::File::Info& config_info) {
+  base::MemoryMappedFile mapped;
+  if (!base::PathExists(cache_file) || !mapped.Initialize(cache_file)) {
+    return false;
+  }
+  CacheReader reader(mapped.data(), mapped.length());
+
+  CacheHeader header;
+  if (!reader.Read(&header, sizeof(header)) || header.magic != kCacheMagic ||
+      header.version != kCacheVersion ||
+      header.config_mtime != config_info.last_modified.ToInternalValue() ||
+      header.config_size != config_info.size) {
+    VLOGF(1) << cache_file.value() << " is stale";
+    return false;
+  }
+
+  std::vector<DeviceInfo> infos(header.num_infos);
+  for (DeviceInfo& info : infos) {
+    CachedInfo cached;
+    if (!reader.Read(&cached, sizeof(cached)) ||
+        !reader.ReadFloats(cached.num_apertures,
+                           &info.lens_info_available_apertures) ||
+        !reader.ReadFloats(cached.num_focal_lengths,
+                           &info.lens_info_available_focal_lengths)) {
+      LOGF(WARNING) << cache_file.value() << " is truncated";
+      return false;
+    }
+    info.camera_id = cached.camera_id;
+    info.usb_vid = base::StringPrintf("%04x", cached.vid_pid >> 16);
+    info.usb_pid = base::StringPrintf("%04x", cached.vid_pid & 0xffff);
+    info.frames_to_skip_after_streamon = cached.frames_to_skip_after_streamon;
+    info.constant_framerate_unsupported =
+        cached.constant_framerate_unsupported != 0;
+    info.lens_facing = cached.lens_facing;
+    info.sensor_orientation = cached.sensor_orientation;
+    info.lens_info_minimum_focus_distance =
+        cached.lens_info_minimum_focus_distance;
+    info.lens_info_optimal_focus_distance =
+        cached.lens_info_optimal_focus_distance;
+    info.sensor_info_pixel_array_size_width =
+        cached.sensor_info_pixel_array_size_width;
+    info.sensor_info_pixel_array_size_height =
+        cached.sensor_info_pixel_array_size_height;
+    info.sensor_info_physical_size_width =
+        cached.sensor_info_physical_size_width;
+    info.sensor_info_physical_size_height =
+        cached.sensor_info_physical_size_height;
+    info.horizontal_view_angle_16_9 = cached.horizontal_view_angle_16_9;
+    info.horizontal_view_angle_4_3 = cached.horizontal_view_angle_4_3;
+    info.vertical_view_angle_16_9 = cached.vertical_view_angle_16_9;
+    info.vertical_view_angle_4_3 = cached.vertical_view_angle_4_3;
+  }
+  if (!reader.AtEnd()) {
+    LOGF(WARNING) << cache_file.value() << " has trailing data";
+    return false;
+  }
+
+  module_infos_ = std::move(infos);
+  return true;
+}
+
+void CameraCharacteristics::WriteCache(
+    const base::FilePath& cache_file,
+    const base::File::Info& config_info) const {
+  CacheHeader header = {};
+  header.magic = kCacheMagic;
+  header.version = kCacheVersion;
+  header.config_mtime = config_info.last_modified.ToInternalValue();
+  header.config_size = config_info.size;
+  header.num_infos = module_infos_.size();
+
+  std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const DeviceInfo& info : module_infos_) {
+    CachedInfo cached = {};
+    CHECK(PackVidPid(info.usb_vid, info.usb_pid, &cached.vid_pid));
+    cached.camera_id = info.camera_id;
+    cached.frames_to_skip_after_streamon = info.frames_to_skip_after_streamon;
+    cached.constant_framerate_unsupported = info.constant_framerate_unsupported;
+    cached.lens_facing = info.lens_facing;
+    cached.sensor_orientation = info.sensor_orientation;
+    cached.lens_info_minimum_focus_distance =
+        info.lens_info_minimum_focus_distance;
+    cached.lens_info_optimal_focus_distance =
+        info.lens_info_optimal_focus_distance;
+    cached.sensor_info_pixel_array_size_width =
+        info.sensor_info_pixel_array_size_width;
+    cached.sensor_info_pixel_array_size_height =
+        info.sensor_info_pixel_array_size_height;
+    cached.sensor_info_physical_size_width =
+        info.sensor_info_physical_size_width;
+    cached.sensor_info_physical_size_height =
+        info.sensor_info_physical_size_height;
+    cached.horizontal_view_angle_16_9 = info.horizontal_view_angle_16_9;
+    cached.horizontal_view_angle_4_3 = info.horizontal_view_angle_4_3;
+    cached.vertical_view_angle_16_9 = info.vertical_view_angle_16_9;
+    cached.vertical_view_angle_4_3 = info.vertical_view_angle_4_3;
+    cached.num_apertures = info.lens_info_available_apertures.size();
+    cached.num_focal_lengths = info.lens_info_available_focal_lengths.size();
+
+    data.append(reinterpret_cast<const char*>(&cached), sizeof(cached));
+    AppendFloats(info.lens_info_available_apertures, &data);
+    AppendFloats(info.lens_info_available_focal_lengths, &data);
+  }
+
+  // The cache is only an optimization, so failing to write it is fine.
+  if (!base::CreateDirectory(cache_file.DirName()) ||
+      !base::ImportantFileWriter::WriteFileAtomically(cache_file, data)) {
+    LOGF(WARNING) << "Failed to write " << cache_file.value();
+  }
+}
+
+void CameraCharacteristics::BuildIndex() {
+  // Keep the table at most half full, so probe sequences stay short.
+  size_t size = 4;
+  while (size < module_infos_.size() * 2) {
+    size *= 2;
+  }
+  index_.assign(size, {0, -1});
+
+  for (size_t i = 0; i < module_infos_.size(); i++) {
+    uint32_t vid_pid;
+    CHECK(PackVidPid(module_infos_[i].usb_vid, module_infos_[i].usb_pid,
+                     &vid_pid));
+    size_t slot = HashVidPid(vid_pid) & (size - 1);
+    for (; index_[slot].index >= 0; slot = (slot + 1) & (size - 1)) {
+      CHECK(index_[slot].vid_pid != vid_pid) << "Duplicate vid:pid in config";
     }
+    index_[slot] = {vid_pid, static_cast<int>(i)};
   }
 }
 
 const DeviceInfo* CameraCharacteristics::Find(const std::string& vid,
                                               const std::string& pid) const {
-  auto it = camera_module_infos_.find({vid, pid});
-  if (it != camera_module_infos_.end()) {
-    const DeviceInfo& info = it->second;
-    VLOGF(1) << "Found camera" << info.camera_id << " in characteristics"
-             << " with vid:pid = " << vid << ":" << pid;
-    return &it->second;
-  } else {
-    VLOGF(1) << "No camera with vid:pid = " << vid << ":" << pid
-             << " found in characteristics";
-    return nullptr;
+  uint32_t vid_pid;
+  if (!index_.empty() && PackVidPid(vid, pid, &vid_pid)) {
+    size_t mask = index_.size() - 1;
+    for (size_t slot = HashVidPid(vid_pid) & mask; index_[slot].index >= 0;
+         slot = (slot + 1) & mask) {
+      if (index_[slot].vid_pid == vid_pid) {
+        const DeviceInfo& info = module_infos_[index_[slot].index];
+        VLOGF(1) << "Found camera" << info.camera_id << " in characteristics"
+                 << " with vid:pid = " << vid << ":" << pid;
+        return &info;
+      }
+    }
   }
+  VLOGF(1) << "No camera with vid:pid = " << vid << ":" << pid
+           << " found in characteristics";
+  return nullptr;
 }
@@ -7,9 +7,10 @@
 #ifndef CAMERA_CHARACTERISTICS_H_
 #define CAMERA_CHARACTERISTICS_H_
 
-#include <map>
+#include <stdint.h>
+
 #include <string>
-#include <utility>
+#include <vector>
 
 #include <base/files/file.h>
 #include <base/macros.h>
@@ -47,21 +48,44 @@ class CameraCharacteristics {
   static bool ConfigFileExists();
 
   // Initialize camera characteristics from |kCameraCharacteristicsConfigFile|.
-  // If the file does not exist, |camera_module_infos_| would be empty.
+  // If the file does not exist, |module_infos_| would be empty.
   CameraCharacteristics();
 
   // Initialize camera characteristics from |config_file|.
   explicit CameraCharacteristics(const base::FilePath& config_file);
 
+  // Initialize camera characteristics from |config_file|, reading and
+  // refreshing a binary copy of the parsed config in |cache_file|, which is
+  // used instead of parsing the config again as long as the config keeps its
+  // mtime and size. The caller owns |cache_file|; it is not used if empty.
+  CameraCharacteristics(const base::FilePath& config_file,
+                        const base::FilePath& cache_file);
+
   // Get the device information by vid and pid. Returns |nullptr| if not found.
   const DeviceInfo* Find(const std::string& vid, const std::string& pid) const;
 
  private:
-  void InitFrom(const base::FilePath& config_file);
+  // A slot of |index_|, mapping a packed usb vid:pid to |module_infos_|.
+  struct Slot {
+    uint32_t vid_pid;
+    int index;
+  };
+
+  // |cache_file| is not used if it is empty.
+  void InitFrom(const base::FilePath& config_file,
+                const base::FilePath& cache_file);
+  void ParseConfig(const base::FilePath& config_file);
+  bool LoadCache(const base::FilePath& cache_file,
+                 const base::File::Info& config_info);
+  void WriteCache(const base::FilePath& cache_file,
+                  const base::File::Info& config_info) const;
+  void BuildIndex();
+
+  std::vector<DeviceInfo> module_infos_;
 
-  // The key is a pair of usb (vid, pid).
-  std::map<std::pair<std::string, std::string>, DeviceInfo>
-      camera_module_infos_;
+  // Open addressing hash table over |module_infos_|, with a power of two
+  // number of slots.
+  std::vector<Slot> index_;
 
   DISALLOW_COPY_AND_ASSIGN(CameraCharacteristics);
 };
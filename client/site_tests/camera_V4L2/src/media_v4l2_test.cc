@@ -64,7 +64,9 @@ static void PrintUsage(int argc, char** argv) {
          "--device=DEVICE_NAME Video device name [/dev/video]\n"
          "--usb-info=VID:PID   Device vendor id and product id\n"
          "--test-list=TEST     Select different test list\n"
-         "                     [%s | %s | %s]\n",
+         "                     [%s | %s | %s]\n"
+         "--characteristics-cache=FILE\n"
+         "                     Cache the parsed camera config in FILE\n",
          argv[0], kDefaultTestList, kHalv3TestList,
          kCertificationTestList);
 }
@@ -577,21 +579,26 @@ bool TestMaximumSupportedResolution(const std::string& dev_name,
 
 const TestProfile GetTestProfile(const std::string& dev_name,
                                  const std::string& usb_info,
-                                 const std::string& test_list) {
+                                 const std::string& test_list,
+                                 const base::FilePath& cache_file) {
   const int VID_PID_LENGTH = 9;  // 0123:abcd format
   const DeviceInfo* device_info = nullptr;
-  CameraCharacteristics characteristics;
+  std::unique_ptr<CameraCharacteristics> characteristics(
+      CameraCharacteristics::ConfigFileExists()
+          ? new CameraCharacteristics(kCameraCharacteristicsConfigFile,
+                                      cache_file)
+          : new CameraCharacteristics());
   if (!usb_info.empty()) {
     if (usb_info.length() != VID_PID_LENGTH) {
       printf("[Error] Invalid usb info: %s\n", usb_info.c_str());
       exit(EXIT_FAILURE);
     }
-    device_info = characteristics.Find(usb_info.substr(0, 4),
-                                       usb_info.substr(5, 9));
+    device_info = characteristics->Find(usb_info.substr(0, 4),
+                                        usb_info.substr(5, 9));
   }
 
   if (test_list != kDefaultTestList) {
-    if (!characteristics.ConfigFileExists()) {
+    if (!CameraCharacteristics::ConfigFileExists()) {
       printf("[Error] %s test list needs camera config file\n",
           test_list.c_str());
       exit(EXIT_FAILURE);
@@ -602,7 +609,7 @@ const TestProfile GetTestProfile(const std::string& dev_name,
       exit(EXIT_FAILURE);
     }
   } else {
-    if (!characteristics.ConfigFileExists()) {
+    if (!CameraCharacteristics::ConfigFileExists()) {
       printf("[Info] Camera config file doesn't exist\n");
     } else if (device_info == nullptr) {
       printf("[Info] %s is not described in camera config file\n",
@@ -705,6 +712,7 @@ int main(int argc, char** argv) {
   std::string dev_name = "/dev/video";
   std::string usb_info = "";
   std::string test_list = kDefaultTestList;
+  base::FilePath cache_file;
 
   base::CommandLine::SwitchMap switches = cmd_line->GetSwitches();
   for (base::CommandLine::SwitchMap::const_iterator it = switches.begin();
@@ -725,13 +733,17 @@ int main(int argc, char** argv) {
       test_list = it->second;
       continue;
     }
+    if (it->first == "characteristics-cache") {
+      cache_file = base::FilePath(it->second);
+      continue;
+    }
 
     PrintUsage(argc, argv);
     LOGF(ERROR) << "Unexpected switch: " << it->first << ":" << it->second;
     return EXIT_FAILURE;
   }
 
-  g_profile = GetTestProfile(dev_name, usb_info, test_list);
+  g_profile = GetTestProfile(dev_name, usb_info, test_list, cache_file);
 
   return RUN_ALL_TESTS();
 }
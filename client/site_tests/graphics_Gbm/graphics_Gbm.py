@@ -15,6 +15,10 @@ class graphics_Gbm(graphics_utils.GraphicsTest):
     """
     version = 1
     preserve_srcdir = True
+    # gbmtest -b metric -> perf value units.
+    _BENCH_UNITS = {'us_per_op': 'us', 'mb_per_s': 'MB_per_sec',
+                    'hit_pct': 'percent', 'peak_cached_mb': 'MB'}
+    _BENCH_HIGHER_IS_BETTER = ('mb_per_s', 'hit_pct')
 
     def setup(self):
         os.chdir(self.srcdir)
@@ -28,7 +32,15 @@ class graphics_Gbm(graphics_utils.GraphicsTest):
         super(graphics_Gbm, self).cleanup()
 
     @graphics_utils.GraphicsTest.failure_report_decorator('graphics_Gbm')
-    def run_once(self):
+    def run_once(self, benchmark=False):
+        """Runs gbmtest.
+
+        @param benchmark: instead of the correctness tests, time buffer
+                allocation, mapping and dma-buf CPU access on vgem.
+        """
+        if benchmark:
+            self.run_benchmark()
+            return
         cmd = os.path.join(self.srcdir, 'gbmtest')
         result = utils.run(cmd,
                            stderr_is_expected=False,
@@ -39,3 +51,24 @@ class graphics_Gbm(graphics_utils.GraphicsTest):
         if not report:
             raise error.TestFail('Failed: Gbm test failed (' + result.stdout +
                                  ')')
+
+    def run_benchmark(self):
+        """Runs gbmtest -b and reports each of its results as a perf value."""
+        if not os.path.exists('/sys/bus/platform/devices/vgem'):
+            raise error.TestNAError('vgem module is not loaded')
+        cmd = '%s -b' % os.path.join(self.srcdir, 'gbmtest')
+        output = utils.system_output(cmd, retain_output=True)
+        result_re = re.compile(r'^gbm_bench: (\w+) (.*) (\w+)=([\d.]+)$',
+                               re.MULTILINE)
+        results = result_re.findall(output)
+        if not results:
+            raise error.TestFail('Failed: no benchmark results in output')
+        for name, params, metric, value in results:
+            # e.g. 'format=AR24 size=64x64' -> 'AR24_64x64'. A line of
+            # parameters can have several metrics, so name them too.
+            tags = '_'.join(p.split('=')[1] for p in params.split())
+            self.output_perf_value(
+                    description='%s_%s_%s' % (name, tags, metric),
+                    value=float(value),
+                    units=self._BENCH_UNITS[metric],
+                    higher_is_better=metric in self._BENCH_HIGHER_IS_BETTER)
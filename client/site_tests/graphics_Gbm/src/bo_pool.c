@@ -0,0 +1,227 @@
+/*
+ * Copyright 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bo_pool.h"
+
+#define BUCKET_HASH_SIZE 64
+
+/* Released buffers of one (width, height, format, usage) key. */
+struct bo_pool_bucket {
+	uint32_t width, height, format, usage;
+	struct bo_pool_buffer *free;	/* most recently released first */
+	struct bo_pool_bucket *next;	/* hash chain */
+};
+
+struct bo_pool {
+	struct gbm_device *gbm;
+	size_t max_bytes;
+	int exact;
+	struct bo_pool_bucket *buckets[BUCKET_HASH_SIZE];
+	/* All released buffers, least recently released first. */
+	struct bo_pool_buffer *lru_head, *lru_tail;
+	struct bo_pool_stats stats;
+};
+
+/* Rounds |v| up to one of eight size classes per power of two. */
+static uint32_t size_class(uint32_t v)
+{
+	uint32_t step;
+
+	if (v <= 16)
+		return v;
+	step = 1u << (31 - __builtin_clz(v - 1) - 3);
+	return (v + step - 1) & ~(step - 1);
+}
+
+static unsigned hash_key(uint32_t width, uint32_t height, uint32_t format,
+			 uint32_t usage)
+{
+	uint32_t h = width * 2654435761u;
+
+	h ^= height * 2246822519u;
+	h ^= format * 3266489917u;
+	h ^= usage * 668265263u;
+	return (h ^ (h >> 16)) % BUCKET_HASH_SIZE;
+}
+
+static struct bo_pool_bucket *find_bucket(struct bo_pool *pool, uint32_t width,
+					  uint32_t height, uint32_t format,
+					  uint32_t usage)
+{
+	unsigned h = hash_key(width, height, format, usage);
+	struct bo_pool_bucket *bucket;
+
+	for (bucket = pool->buckets[h]; bucket; bucket = bucket->next)
+		if (bucket->width == width && bucket->height == height &&
+		    bucket->format == format && bucket->usage == usage)
+			return bucket;
+
+	bucket = calloc(1, sizeof(*bucket));
+	if (!bucket)
+		return NULL;
+	bucket->width = width;
+	bucket->height = height;
+	bucket->format = format;
+	bucket->usage = usage;
+	bucket->next = pool->buckets[h];
+	pool->buckets[h] = bucket;
+	return bucket;
+}
+
+static void lru_remove(struct bo_pool *pool, struct bo_pool_buffer *buffer)
+{
+	if (buffer->lru_prev)
+		buffer->lru_prev->lru_next = buffer->lru_next;
+	else
+		pool->lru_head = buffer->lru_next;
+	if (buffer->lru_next)
+		buffer->lru_next->lru_prev = buffer->lru_prev;
+	else
+		pool->lru_tail = buffer->lru_prev;
+}
+
+static void lru_append(struct bo_pool *pool, struct bo_pool_buffer *buffer)
+{
+	buffer->lru_next = NULL;
+	buffer->lru_prev = pool->lru_tail;
+	if (pool->lru_tail)
+		pool->lru_tail->lru_next = buffer;
+	else
+		pool->lru_head = buffer;
+	pool->lru_tail = buffer;
+}
+
+/* Unlinks a released buffer from its bucket and the LRU. */
+static void take_released(struct bo_pool *pool, struct bo_pool_buffer *buffer)
+{
+	struct bo_pool_bucket *bucket = buffer->bucket;
+
+	if (buffer->prev)
+		buffer->prev->next = buffer->next;
+	else
+		bucket->free = buffer->next;
+	if (buffer->next)
+		buffer->next->prev = buffer->prev;
+	lru_remove(pool, buffer);
+	pool->stats.cached--;
+	pool->stats.cached_bytes -= buffer->size;
+}
+
+static void destroy_buffer(struct bo_pool_buffer *buffer)
+{
+	gbm_bo_destroy(buffer->bo);
+	free(buffer);
+}
+
+struct bo_pool *bo_pool_create(struct gbm_device *gbm, size_t max_bytes,
+			       int exact)
+{
+	struct bo_pool *pool = calloc(1, sizeof(*pool));
+
+	if (!pool)
+		return NULL;
+	pool->gbm = gbm;
+	pool->max_bytes = max_bytes;
+	pool->exact = exact;
+	return pool;
+}
+
+void bo_pool_destroy(struct bo_pool *pool)
+{
+	struct bo_pool_bucket *bucket, *next;
+	int i;
+
+	while (pool->lru_head) {
+		struct bo_pool_buffer *buffer = pool->lru_head;
+		take_released(pool, buffer);
+		destroy_buffer(buffer);
+	}
+	for (i = 0; i < BUCKET_HASH_SIZE; i++) {
+		for (bucket = pool->buckets[i]; bucket; bucket = next) {
+			next = bucket->next;
+			free(bucket);
+		}
+	}
+	free(pool);
+}
+
+struct bo_pool_buffer *bo_pool_get(struct bo_pool *pool, uint32_t width,
+				   uint32_t height, uint32_t format,
+				   uint32_t usage)
+{
+	struct bo_pool_bucket *bucket;
+	struct bo_pool_buffer *buffer;
+	size_t plane;
+
+	if (!pool->exact) {
+		width = size_class(width);
+		height = size_class(height);
+	}
+	bucket = find_bucket(pool, width, height, format, usage);
+	if (!bucket)
+		return NULL;
+
+	buffer = bucket->free;
+	if (buffer) {
+		take_released(pool, buffer);
+		pool->stats.hits++;
+		return buffer;
+	}
+
+	buffer = calloc(1, sizeof(*buffer));
+	if (!buffer)
+		return NULL;
+	buffer->bo = gbm_bo_create(pool->gbm, width, height, format, usage);
+	if (!buffer->bo) {
+		free(buffer);
+		return NULL;
+	}
+	buffer->bucket = bucket;
+	for (plane = 0; plane < gbm_bo_get_plane_count(buffer->bo); plane++)
+		buffer->size += gbm_bo_get_plane_size(buffer->bo, plane);
+	pool->stats.misses++;
+	return buffer;
+}
+
+void bo_pool_put(struct bo_pool *pool, struct bo_pool_buffer *buffer)
+{
+	struct bo_pool_bucket *bucket = buffer->bucket;
+
+	/* Reusing the warmest buffer first keeps its pages resident. */
+	buffer->prev = NULL;
+	buffer->next = bucket->free;
+	if (bucket->free)
+		bucket->free->prev = buffer;
+	bucket->free = buffer;
+	lru_append(pool, buffer);
+
+	pool->stats.cached++;
+	pool->stats.cached_bytes += buffer->size;
+	if (pool->stats.cached_bytes > pool->max_bytes)
+		bo_pool_trim(pool, pool->max_bytes);
+	if (pool->stats.cached_bytes > pool->stats.peak_cached_bytes)
+		pool->stats.peak_cached_bytes = pool->stats.cached_bytes;
+}
+
+void bo_pool_trim(struct bo_pool *pool, size_t max_bytes)
+{
+	struct bo_pool_buffer *buffer;
+
+	while (pool->lru_head && pool->stats.cached_bytes > max_bytes) {
+		buffer = pool->lru_head;
+		take_released(pool, buffer);
+		destroy_buffer(buffer);
+		pool->stats.evictions++;
+	}
+}
+
+void bo_pool_get_stats(struct bo_pool *pool, struct bo_pool_stats *stats)
+{
+	memcpy(stats, &pool->stats, sizeof(*stats));
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef BO_POOL_H_
+#define BO_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <gbm.h>
+
+/*
+ * A cache of gbm buffer objects for clients that allocate and release
+ * buffers at frame rate. Released buffers are kept per (width, height,
+ * format, usage) and handed out again instead of going through
+ * gbm_bo_create()/gbm_bo_destroy().
+ *
+ * Unless the pool is created exact, requested dimensions are rounded up to
+ * size classes (eight per power of two, at most 12.5% larger) so that
+ * slightly different requests, like a window being resized, share buffers.
+ * Callers must then cope with a buffer larger than requested.
+ *
+ * When the released buffers exceed the byte budget, the least recently
+ * released ones are destroyed.
+ */
+
+struct bo_pool;
+struct bo_pool_bucket;
+
+struct bo_pool_buffer {
+	struct gbm_bo *bo;	/* at least as large as requested */
+	/* Private to the pool. */
+	struct bo_pool_buffer *prev, *next;		/* bucket free list */
+	struct bo_pool_buffer *lru_prev, *lru_next;	/* pool LRU */
+	struct bo_pool_bucket *bucket;
+	size_t size;
+};
+
+struct bo_pool_stats {
+	unsigned long hits;		/* gets served from the pool */
+	unsigned long misses;		/* gets that had to create a bo */
+	unsigned long evictions;	/* released bos destroyed by trimming */
+	size_t cached;			/* released bos kept */
+	size_t cached_bytes;
+	size_t peak_cached_bytes;
+};
+
+/*
+ * Creates a pool of bos allocated from |gbm| keeping up to |max_bytes| of
+ * released buffers. |exact| disables the size classes.
+ */
+struct bo_pool *bo_pool_create(struct gbm_device *gbm, size_t max_bytes,
+			       int exact);
+
+/* Destroys the pool and the released buffers. Buffers still in use must
+ * have been released before. */
+void bo_pool_destroy(struct bo_pool *pool);
+
+/* Returns a buffer for the request, or NULL if gbm_bo_create() failed. */
+struct bo_pool_buffer *bo_pool_get(struct bo_pool *pool, uint32_t width,
+				   uint32_t height, uint32_t format,
+				   uint32_t usage);
+
+/* Gives |buffer| back to the pool, which may destroy it right away. */
+void bo_pool_put(struct bo_pool *pool, struct bo_pool_buffer *buffer);
+
+/* Destroys least recently released buffers until at most |max_bytes| are
+ * kept. */
+void bo_pool_trim(struct bo_pool *pool, size_t max_bytes);
+
+void bo_pool_get_stats(struct bo_pool *pool, struct bo_pool_stats *stats);
+
+#endif /* BO_POOL_H_ */
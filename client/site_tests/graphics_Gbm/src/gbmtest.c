@@ -19,12 +19,20 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
 #include <gbm.h>
 
+#include "bo_pool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_STREAMING_COPY 1
+#endif
+
 #define CHECK(cond) do {\
 	if (!(cond)) {\
 		printf("CHECK failed in %s() %s:%d\n", __func__, __FILE__, __LINE__);\
@@ -994,10 +1002,433 @@ static int test_gem_map_format(int format_index,
 }
 
 
+/*
+ * Benchmark mode (gbmtest -b). Runs on the vgem software device so the cost
+ * of buffer churn and CPU access can be compared without GPU hardware. Each
+ * result is printed on its own line as
+ *   gbm_bench: <test> <key>=<value>... <metric>=<value>
+ */
+#define BENCH_MIN_NS	200000000ULL	/* time each case for at least 0.2s */
+
+static const struct {
+	uint32_t width, height;
+} bench_sizes[] = {
+	{ 64, 64 },
+	{ 256, 256 },
+	{ 1024, 1024 },
+	{ 1920, 1080 },
+	{ 3840, 2160 },
+};
+
+static const uint32_t bench_formats[] = {
+	GBM_FORMAT_ARGB8888,
+	GBM_FORMAT_XRGB8888,
+	GBM_FORMAT_RGB565,
+	GBM_FORMAT_NV12,
+	GBM_FORMAT_YVU420,
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const char *fourcc(uint32_t format, char name[5])
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		name[i] = (format >> (8 * i)) & 0xff;
+	name[4] = '\0';
+	return name;
+}
+
+/*
+ * CPU copies to and from a dma-buf mapping. The "loop" variants are the plain
+ * word loops clients typically write; the "stream" variants use non-temporal
+ * stores and loads, which bypass the cache for write-combined or uncached
+ * mappings and avoid evicting the working set for cached ones.
+ */
+static void copy_loop(void *dst, const void *src, size_t len)
+{
+	volatile uint64_t *d = dst;
+	const uint64_t *s = src;
+	size_t i;
+
+	/* volatile keeps the compiler from turning this into memcpy(). */
+	for (i = 0; i < len / sizeof(*s); i++)
+		d[i] = s[i];
+}
+
+#ifdef HAVE_STREAMING_COPY
+/* i386 builds don't enable SSE2 by default; sse4.1 is checked at run time. */
+__attribute__((target("sse2")))
+static void copy_stream_to(void *dst, const void *src, size_t len)
+{
+	__m128i *d = dst;
+	const __m128i *s = src;
+	size_t i;
+
+	for (i = 0; i < len / sizeof(*s); i += 4) {
+		_mm_stream_si128(d + i, _mm_loadu_si128(s + i));
+		_mm_stream_si128(d + i + 1, _mm_loadu_si128(s + i + 1));
+		_mm_stream_si128(d + i + 2, _mm_loadu_si128(s + i + 2));
+		_mm_stream_si128(d + i + 3, _mm_loadu_si128(s + i + 3));
+	}
+	_mm_sfence();
+}
+
+__attribute__((target("sse4.1")))
+static void copy_stream_from(void *dst, const void *src, size_t len)
+{
+	__m128i *d = dst;
+	__m128i *s = (__m128i *)src;
+	size_t i;
+
+	for (i = 0; i < len / sizeof(*s); i += 4) {
+		_mm_storeu_si128(d + i, _mm_stream_load_si128(s + i));
+		_mm_storeu_si128(d + i + 1, _mm_stream_load_si128(s + i + 1));
+		_mm_storeu_si128(d + i + 2, _mm_stream_load_si128(s + i + 2));
+		_mm_storeu_si128(d + i + 3, _mm_stream_load_si128(s + i + 3));
+	}
+}
+#endif
+
+static int bench_create_destroy(uint32_t format, uint32_t width,
+				uint32_t height)
+{
+	uint64_t start, elapsed;
+	unsigned long ops = 0;
+	char name[5];
+
+	if (!gbm_device_is_format_supported(gbm, format, GBM_BO_USE_LINEAR))
+		return 1;
+
+	start = now_ns();
+	do {
+		struct gbm_bo *bo;
+		bo = gbm_bo_create(gbm, width, height, format, GBM_BO_USE_LINEAR);
+		CHECK(bo);
+		gbm_bo_destroy(bo);
+		ops++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+
+	printf("gbm_bench: create_destroy format=%s size=%ux%u "
+	       "us_per_op=%.2f\n", fourcc(format, name), width, height,
+	       elapsed / 1e3 / ops);
+	return 1;
+}
+
+static int bench_map(uint32_t width, uint32_t height)
+{
+	uint64_t start, elapsed;
+	unsigned long ops = 0;
+	struct gbm_bo *bo;
+	void *map_data, *addr;
+	uint32_t stride;
+
+	bo = gbm_bo_create(gbm, width, height, GBM_FORMAT_ARGB8888,
+			   GBM_BO_USE_LINEAR);
+	CHECK(bo);
+
+	start = now_ns();
+	do {
+		map_data = NULL;
+		addr = gbm_bo_map(bo, 0, 0, width, height,
+				  GBM_BO_TRANSFER_READ_WRITE, &stride, &map_data, 0);
+		CHECK(addr != MAP_FAILED);
+		/* Touch the mapping so that faulting it in is accounted for. */
+		*(volatile uint32_t *)addr;
+		gbm_bo_unmap(bo, map_data);
+		ops++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+
+	gbm_bo_destroy(bo);
+	printf("gbm_bench: map_unmap size=%ux%u us_per_op=%.2f\n", width, height,
+	       elapsed / 1e3 / ops);
+	return 1;
+}
+
+static int dmabuf_sync(int prime_fd, uint64_t flags)
+{
+	struct dma_buf_sync sync = { 0 };
+
+	sync.flags = flags;
+	return HANDLE_EINTR(ioctl(prime_fd, DMA_BUF_IOCTL_SYNC, &sync));
+}
+
+/*
+ * Times |copy| between a system memory buffer and the mapping of |prime_fd|,
+ * including the DMA_BUF_IOCTL_SYNC calls bracketing each access.
+ */
+static int bench_dmabuf_copy(int prime_fd, void *mapping, void *buf,
+			     size_t length, bool write, const char *method,
+			     void (*copy)(void *, const void *, size_t),
+			     uint32_t width, uint32_t height)
+{
+	uint64_t direction = write ? DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ;
+	uint64_t start, elapsed;
+	unsigned long passes = 0;
+
+	start = now_ns();
+	do {
+		CHECK(dmabuf_sync(prime_fd, DMA_BUF_SYNC_START | direction) == 0);
+		if (write)
+			copy(mapping, buf, length);
+		else
+			copy(buf, mapping, length);
+		CHECK(dmabuf_sync(prime_fd, DMA_BUF_SYNC_END | direction) == 0);
+		passes++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+
+	printf("gbm_bench: dmabuf_%s method=%s size=%ux%u mb_per_s=%.1f\n",
+	       write ? "write" : "read", method, width, height,
+	       (double)length * passes / elapsed * 1e9 / (1 << 20));
+	return 1;
+}
+
+static int bench_dmabuf(uint32_t width, uint32_t height)
+{
+	static const struct {
+		const char *name;
+		void (*to)(void *, const void *, size_t);
+		void (*from)(void *, const void *, size_t);
+	} methods[] = {
+		{ "loop", copy_loop, copy_loop },
+#ifdef HAVE_STREAMING_COPY
+		{ "stream", copy_stream_to, copy_stream_from },
+#endif
+	};
+	uint8_t *src, *dst, *mapping;
+	void *buf;
+	struct gbm_bo *bo;
+	size_t length, i;
+	int m, prime_fd;
+
+	bo = gbm_bo_create(gbm, width, height, GBM_FORMAT_ARGB8888,
+			   GBM_BO_USE_LINEAR);
+	CHECK(bo);
+	prime_fd = gbm_bo_get_fd(bo);
+	CHECK(prime_fd > 0);
+	/* The copies move 64 bytes at a time; plane sizes are page multiples. */
+	length = gbm_bo_get_plane_size(bo, 0) & ~(size_t)63;
+	mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       prime_fd, 0);
+	CHECK(mapping != MAP_FAILED);
+	CHECK(posix_memalign(&buf, 64, length) == 0);
+	src = buf;
+	CHECK(posix_memalign(&buf, 64, length) == 0);
+	dst = buf;
+	for (i = 0; i < length; i++)
+		src[i] = i * 7 + (i >> 12);
+
+	for (m = 0; m < ARRAY_SIZE(methods); m++) {
+#ifdef HAVE_STREAMING_COPY
+		if (methods[m].from == copy_stream_from &&
+		    !__builtin_cpu_supports("sse4.1"))
+			continue;
+#endif
+		CHECK(bench_dmabuf_copy(prime_fd, mapping, src, length, true,
+					methods[m].name, methods[m].to,
+					width, height));
+		memset(dst, 0, length);
+		CHECK(bench_dmabuf_copy(prime_fd, mapping, dst, length, false,
+					methods[m].name, methods[m].from,
+					width, height));
+		CHECK(memcmp(src, dst, length) == 0);
+	}
+
+	free(src);
+	free(dst);
+	CHECK(munmap(mapping, length) == 0);
+	CHECK(close(prime_fd) == 0);
+	gbm_bo_destroy(bo);
+	return 1;
+}
+
+/*
+ * A compositor-like alloc/free trace: |slots| live buffers, each step
+ * releasing one and allocating its replacement. Mostly window sized buffers
+ * jittering as windows get resized, plus icons, cursors and full screen
+ * video frames.
+ */
+#define TRACE_SLOTS	64
+#define TRACE_STEPS	20000
+#define POOL_MAX_BYTES	(64 << 20)
+
+struct trace_op {
+	int slot;
+	uint32_t width, height, format;
+};
+
+static void make_trace(struct trace_op *trace, int steps, bool nv12)
+{
+	static const uint32_t windows[][2] = {
+		{ 1280, 720 }, { 800, 600 }, { 640, 480 }, { 400, 300 },
+	};
+	uint32_t seed = 1;
+	int i, kind;
+
+	for (i = 0; i < steps; i++) {
+		seed = seed * 1103515245 + 12345;
+		trace[i].slot = (seed >> 8) % TRACE_SLOTS;
+		kind = (seed >> 20) % 10;
+		trace[i].format = GBM_FORMAT_ARGB8888;
+		if (kind < 7) {
+			const uint32_t *size = windows[(seed >> 16) % 4];
+			trace[i].width = size[0] + (seed >> 24) % 16;
+			trace[i].height = size[1] + (seed >> 12) % 16;
+			if (kind == 0)
+				trace[i].format = GBM_FORMAT_XRGB8888;
+		} else if (kind < 9) {
+			trace[i].width = trace[i].height = kind == 7 ? 64 : 128;
+		} else {
+			trace[i].width = 1920;
+			trace[i].height = 1080;
+			if (nv12)
+				trace[i].format = GBM_FORMAT_NV12;
+		}
+	}
+}
+
+/* Checks that |bo| fits |op| and isn't handed out twice. */
+static int check_trace_bo(struct gbm_bo *bo, const struct trace_op *op,
+			  struct gbm_bo **live)
+{
+	int i;
+
+	CHECK(bo);
+	CHECK(gbm_bo_get_width(bo) >= op->width);
+	CHECK(gbm_bo_get_height(bo) >= op->height);
+	CHECK(gbm_bo_get_format(bo) == op->format);
+	for (i = 0; i < TRACE_SLOTS; i++)
+		CHECK(live[i] != bo);
+	return 1;
+}
+
+static int bench_pool_replay()
+{
+	struct bo_pool_buffer *pooled[TRACE_SLOTS] = { NULL };
+	struct gbm_bo *live[TRACE_SLOTS] = { NULL };
+	struct bo_pool_stats stats;
+	struct trace_op *trace;
+	struct bo_pool *pool;
+	uint64_t start, raw_ns, pool_ns;
+	int i, slot;
+
+	trace = calloc(TRACE_STEPS, sizeof(*trace));
+	CHECK(trace);
+	make_trace(trace, TRACE_STEPS,
+		   gbm_device_is_format_supported(gbm, GBM_FORMAT_NV12,
+						  GBM_BO_USE_LINEAR));
+
+	/* The correctness checks run outside of the timed sections. */
+	raw_ns = 0;
+	for (i = 0; i < TRACE_STEPS; i++) {
+		slot = trace[i].slot;
+		start = now_ns();
+		if (live[slot])
+			gbm_bo_destroy(live[slot]);
+		live[slot] = gbm_bo_create(gbm, trace[i].width, trace[i].height,
+					   trace[i].format, GBM_BO_USE_LINEAR);
+		raw_ns += now_ns() - start;
+		CHECK(live[slot]);
+	}
+	for (slot = 0; slot < TRACE_SLOTS; slot++) {
+		if (live[slot])
+			gbm_bo_destroy(live[slot]);
+		live[slot] = NULL;
+	}
+
+	pool = bo_pool_create(gbm, POOL_MAX_BYTES, 0);
+	CHECK(pool);
+	pool_ns = 0;
+	for (i = 0; i < TRACE_STEPS; i++) {
+		slot = trace[i].slot;
+		start = now_ns();
+		if (pooled[slot])
+			bo_pool_put(pool, pooled[slot]);
+		pooled[slot] = bo_pool_get(pool, trace[i].width,
+					   trace[i].height, trace[i].format,
+					   GBM_BO_USE_LINEAR);
+		pool_ns += now_ns() - start;
+		live[slot] = NULL;
+		CHECK(pooled[slot]);
+		CHECK(check_trace_bo(pooled[slot]->bo, &trace[i], live));
+		live[slot] = pooled[slot]->bo;
+	}
+	for (slot = 0; slot < TRACE_SLOTS; slot++)
+		if (pooled[slot])
+			bo_pool_put(pool, pooled[slot]);
+	bo_pool_get_stats(pool, &stats);
+	CHECK(stats.hits + stats.misses == TRACE_STEPS);
+	CHECK(stats.cached_bytes <= POOL_MAX_BYTES);
+	bo_pool_destroy(pool);
+	free(trace);
+
+	printf("gbm_bench: pool_replay alloc=raw us_per_op=%.2f\n",
+	       raw_ns / 1e3 / TRACE_STEPS);
+	printf("gbm_bench: pool_replay alloc=pool us_per_op=%.2f\n",
+	       pool_ns / 1e3 / TRACE_STEPS);
+	printf("gbm_bench: pool_replay alloc=pool hit_pct=%.1f\n",
+	       100.0 * stats.hits / TRACE_STEPS);
+	printf("gbm_bench: pool_replay alloc=pool peak_cached_mb=%.1f\n",
+	       stats.peak_cached_bytes / (double)(1 << 20));
+	return 1;
+}
+
+static int run_benchmarks()
+{
+	int result = 1, i, j;
+
+	fd = drm_open_vgem();
+	if (fd < 0) {
+		printf("[  FAILED  ] graphics_Gbm benchmark: no vgem device\n");
+		return 0;
+	}
+	gbm = gbm_create_device(fd);
+	CHECK(gbm);
+
+	for (i = 0; i < ARRAY_SIZE(bench_formats); i++)
+		for (j = 0; j < ARRAY_SIZE(bench_sizes); j++)
+			result &= bench_create_destroy(bench_formats[i],
+						       bench_sizes[j].width,
+						       bench_sizes[j].height);
+	for (j = 0; j < ARRAY_SIZE(bench_sizes); j++) {
+		result &= bench_map(bench_sizes[j].width, bench_sizes[j].height);
+		result &= bench_dmabuf(bench_sizes[j].width,
+				       bench_sizes[j].height);
+	}
+	result &= bench_pool_replay();
+
+	gbm_device_destroy(gbm);
+	close(fd);
+	return result;
+}
+
 int main(int argc, char *argv[])
 {
 	int result, i, j;
 
+	if (argc > 1) {
+		if (argc != 2 || strcmp(argv[1], "-b")) {
+			printf("usage: %s [-b]\n"
+			       "  -b  benchmark buffer allocation and CPU access "
+			       "on vgem\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		result = run_benchmarks();
+		printf("[  %s  ] graphics_Gbm benchmark\n",
+		       result ? "PASSED" : "FAILED");
+		return result ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	result = test_init();
 	if (result == ENODISPLAY) {
 		printf("[  PASSED  ] graphics_Gbm test no connected display found\n");
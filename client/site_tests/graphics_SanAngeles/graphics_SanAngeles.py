@@ -6,7 +6,7 @@ import logging
 import os
 import re
 
-from autotest_lib.client.bin import test, utils
+from autotest_lib.client.bin import perf_results, test, utils
 from autotest_lib.client.common_lib import error
 from autotest_lib.client.cros import service_stopper
 from autotest_lib.client.cros.graphics import graphics_utils
@@ -16,16 +16,22 @@ class graphics_SanAngeles(graphics_utils.GraphicsTest):
     """
     Benchmark OpenGL object rendering.
     """
-    version = 2
+    version = 3
     preserve_srcdir = True
 
+    # Demo time in ms advanced per frame in benchmark mode. The demo lasts
+    # about 109 seconds of demo time, so this renders about 1100 frames.
+    _BENCHMARK_STEP_MS = 100
+
     def setup(self):
         os.chdir(self.srcdir)
         utils.make('clean')
-        utils.make('all')
+        utils.make('PERF_RESULTS_DIR=%s all' % self._depdir)
 
     def initialize(self):
         super(graphics_SanAngeles, self).initialize()
+        self.job.setup_dep(['perf_results'])
+        self._depdir = os.path.join(self.autodir, 'deps', 'perf_results')
         # If UI is running, we must stop it and restore later.
         self._services = service_stopper.ServiceStopper(['ui'])
         self._services.stop_services()
@@ -36,7 +42,7 @@ class graphics_SanAngeles(graphics_utils.GraphicsTest):
         super(graphics_SanAngeles, self).cleanup()
 
     @graphics_utils.GraphicsTest.failure_report_decorator('graphics_SanAngeles')
-    def run_once(self):
+    def run_once(self, benchmark=False):
         cmd_gl = os.path.join(self.srcdir, 'SanOGL')
         cmd_gles = os.path.join(self.srcdir, 'SanOGLES')
         cmd_gles_s = os.path.join(self.srcdir, 'SanOGLES_S')
@@ -52,26 +58,52 @@ class graphics_SanAngeles(graphics_utils.GraphicsTest):
                 '%s, %s or %s.  Test setup error.' %
                 (cmd_gl, cmd_gles, cmd_gles_s))
 
+        if benchmark:
+            hash_file = os.path.join(self.resultsdir, 'frame_hashes.txt')
+            cmd += ' -b %d -o %s' % (self._BENCHMARK_STEP_MS, hash_file)
+            # Kept in srcdir so that later runs start from the cache.
+            cache_file = os.path.join(self.srcdir, 'geometry.cache')
+            cache_warm = os.path.exists(cache_file)
+            cmd += ' -c ' + cache_file
         cmd += ' ' + utils.graphics_platform()
-        result = utils.run(cmd,
+        results_file = os.path.join(self.resultsdir,
+                                    'perf_results_%d.json' % self.iteration)
+        result = utils.run(perf_results.wrap_command(cmd, results_file),
                            stderr_is_expected=False,
                            stdout_tee=utils.TEE_TO_LOGS,
                            stderr_tee=utils.TEE_TO_LOGS,
                            ignore_status=True)
 
-        report = re.findall(r'frame_rate = ([0-9.]+)', result.stdout)
-        if not report:
-            raise error.TestFail('Failed: Could not find frame_rate in stdout ('
+        values = dict((r['description'], r['value']) for r in
+                      perf_results.output_perf_values(self, results_file))
+        if 'fps' not in values:
+            raise error.TestFail('Failed: Could not find fps in perf results ('
                                  + result.stdout + ') ' + result.stderr)
 
-        frame_rate = float(report[0])
+        frame_rate = values['fps']
         logging.info('frame_rate = %.1f', frame_rate)
         self.write_perf_keyval({'frames_per_sec_rate_san_angeles': frame_rate})
-        self.output_perf_value(
-            description='fps',
-            value=frame_rate,
-            units='fps',
-            higher_is_better=True)
+        if benchmark:
+            self.write_perf_keyval(
+                {'san_angeles_geometry_cache_warm': int(cache_warm)})
+            self.report_benchmark(result.stdout, values)
         if 'error' in result.stderr.lower():
             raise error.TestFail('Failed: stderr while running SanAngeles: ' +
-                                 result.stderr + ' (' + report[0] + ')')
+                                 result.stderr + ' (%.1f)' % frame_rate)
+
+    def report_benchmark(self, stdout, values):
+        """Checks the frame time percentiles of a -b run were reported, and
+        reports its image hash.
+        """
+        for name in ('cpu_frame_ms', 'gpu_frame_ms'):
+            if '%s_p50' % name not in values:
+                raise error.TestFail('Failed: Could not find %s in perf '
+                                     'results (%s)' % (name, stdout))
+
+        keyvals = {}
+        for key in ('frames', 'gpu_wait', 'image_hash'):
+            match = re.search(r'%s = (\S+)' % key, stdout)
+            if match:
+                keyvals['san_angeles_' + key] = match.group(1)
+        logging.info('benchmark: %s', keyvals)
+        self.write_perf_keyval(keyvals)
@@ -45,11 +45,15 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 #include "waffle.h"
+#include "perf_results.h"
 
 #ifdef SAN_ANGELES_OBSERVATION_GLES
 #define GL_API WAFFLE_CONTEXT_OPENGL_ES2
@@ -67,6 +71,7 @@
 
 
 int gAppAlive = 1;
+const char *gAppGeometryCache = NULL;
 static struct waffle_display *sDisplay;
 static struct waffle_window *sWindow;
 static struct waffle_config *sConfig;
@@ -81,6 +86,135 @@ static const char sAppName[] =
     "San Angeles Observation OpenGL version example (Linux)";
 #endif  // SAN_ANGELES_OBSERVATION_GLES | !SAN_ANGELES_OBSERVATION_GLES
 
+// Benchmark mode, enabled with -b: the demo advances by a fixed simulated
+// time step per frame instead of following the wall clock, so every run
+// renders exactly the same frames.
+static long sFixedStep = 0;
+static int sHashFrames = 0;
+static FILE *sHashFile = NULL;
+
+// Fences from GL_ARB_sync / GLES 3.0, looked up at run time since the
+// GLES2 headers don't have them. Without them glFinish() is used instead.
+#define SYNC_GPU_COMMANDS_COMPLETE  0x9117
+#define SYNC_FLUSH_COMMANDS_BIT     0x00000001
+#define SYNC_WAIT_FAILED            0x911D
+typedef void *(*FenceSyncProc)(GLenum condition, GLbitfield flags);
+typedef GLenum (*ClientWaitSyncProc)(void *sync, GLbitfield flags,
+                                     uint64_t timeout);
+typedef void (*DeleteSyncProc)(void *sync);
+static FenceSyncProc sFenceSync;
+static ClientWaitSyncProc sClientWaitSync;
+static DeleteSyncProc sDeleteSync;
+
+struct FrameTimes
+{
+    double *cpu;    // ms from frame start until all commands were submitted
+    double *gpu;    // ms from frame start until the GPU completed them
+    int count;
+    int size;
+};
+
+static double nowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void loadFenceProcs()
+{
+    sFenceSync = (FenceSyncProc)waffle_get_proc_address("glFenceSync");
+    sClientWaitSync =
+        (ClientWaitSyncProc)waffle_get_proc_address("glClientWaitSync");
+    sDeleteSync = (DeleteSyncProc)waffle_get_proc_address("glDeleteSync");
+    if (!sFenceSync || !sClientWaitSync || !sDeleteSync)
+        sFenceSync = NULL;
+}
+
+// Blocks until the GPU completed the commands submitted so far.
+static void waitForGPU()
+{
+    void *sync = sFenceSync ?
+        sFenceSync(SYNC_GPU_COMMANDS_COMPLETE, 0) : NULL;
+    if (!sync)
+    {
+        glFinish();
+        return;
+    }
+    if (sClientWaitSync(sync, SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX) ==
+        SYNC_WAIT_FAILED)
+        glFinish();
+    sDeleteSync(sync);
+}
+
+// FNV-1a of the rendered frame, read back before it is swapped.
+static uint64_t hashFrame(int width, int height)
+{
+    static unsigned char *pixels;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i, size = (size_t)width * height * 4;
+
+    if (!pixels)
+        pixels = malloc(size);
+    if (!pixels)
+        return 0;
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    for (i = 0; i < size; i++)
+    {
+        hash ^= pixels[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void recordFrame(struct FrameTimes *times, double cpu, double gpu)
+{
+    if (times->count == times->size)
+    {
+        times->size = times->size ? times->size * 2 : 1024;
+        times->cpu = realloc(times->cpu, times->size * sizeof(double));
+        times->gpu = realloc(times->gpu, times->size * sizeof(double));
+        if (!times->cpu || !times->gpu)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    times->cpu[times->count] = cpu;
+    times->gpu[times->count] = gpu;
+    times->count++;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void reportPercentile(const char *name, const char *stat, double ms)
+{
+    char description[64];
+
+    snprintf(description, sizeof(description), "%s_%s", name, stat);
+    perf_result(description, ms, "milliseconds",
+                PERF_RESULTS_LOWER_IS_BETTER);
+}
+
+static void printPercentiles(const char *name, double *samples, int count)
+{
+    if (!count)
+        return;
+    qsort(samples, count, sizeof(*samples), compareDouble);
+#define PCT(p) samples[(int)((p) / 100.0 * (count - 1) + 0.5)]
+    fprintf(stdout, "%s = p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+            name, PCT(50), PCT(90), PCT(99), samples[count - 1]);
+    reportPercentile(name, "p50", PCT(50));
+    reportPercentile(name, "p90", PCT(90));
+    reportPercentile(name, "p99", PCT(99));
+    reportPercentile(name, "max", samples[count - 1]);
+#undef PCT
+}
+
 static void checkGLErrors()
 {
     GLenum error = glGetError();
@@ -193,48 +327,112 @@ static struct platform_item {
     { NULL, 0 }
 };
 
+static void usage()
+{
+    fprintf(stderr,
+            "Usage: SanOGLES [-c cache_file] [-b step_ms [-H] [-o hash_file]]"
+            " <platform>\n"
+            "  -c  load the scene geometry from cache_file, or generate it\n"
+            "      and save it there if missing or stale\n"
+            "  -b  benchmark: advance step_ms of demo time per frame and\n"
+            "      report CPU and GPU frame time percentiles\n"
+            "  -H  print a hash of all the rendered frames\n"
+            "  -o  write the hash of each frame to hash_file\n");
+}
+
 int main(int argc, char *argv[])
 {
+    const char *hash_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:c:Ho:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            sFixedStep = atol(optarg);
+            break;
+        case 'c':
+            gAppGeometryCache = optarg;
+            break;
+        case 'H':
+            sHashFrames = 1;
+            break;
+        case 'o':
+            hash_path = optarg;
+            sHashFrames = 1;
+            break;
+        default:
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
     // TODO(fjhenigman): add waffle_to_string_to_enum to waffle then use it
     // to parse the platform arg.
     int32_t platform_value = WAFFLE_NONE;
     struct platform_item *p = platform_list;
-    while (argc == 2 && p->name && platform_value == WAFFLE_NONE) {
-        if (!strcasecmp(argv[1], p->name))
+    while (argc == optind + 1 && p->name && platform_value == WAFFLE_NONE) {
+        if (!strcasecmp(argv[optind], p->name))
             platform_value = p->value;
         ++p;
     }
 
-    if (platform_value == WAFFLE_NONE)
+    if (platform_value == WAFFLE_NONE || sFixedStep < 0 ||
+        (sHashFrames && !sFixedStep))
     {
-        fprintf(stderr, "Usage: SanOGLES <platform>\n");
+        usage();
         return EXIT_FAILURE;
     }
 
+    if (hash_path)
+    {
+        sHashFile = fopen(hash_path, "w");
+        if (!sHashFile)
+        {
+            perror(hash_path);
+            return EXIT_FAILURE;
+        }
+    }
+
     if (!initGraphics(platform_value))
     {
         fprintf(stderr, "Error: Graphics initialization failed.\n");
         return EXIT_FAILURE;
     }
 
+    double startup = nowMs();
     if (!appInit())
     {
         fprintf(stderr, "Error: Application initialization failed.\n");
         return EXIT_FAILURE;
     }
+    startup = nowMs() - startup;
 
     double total_time = 0.0;
     int num_frames = 0;
+    struct FrameTimes times = { NULL, NULL, 0, 0 };
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    if (sFixedStep)
+        loadFenceProcs();
 
     while (1)
     {
         struct timeval timeNow, timeAfter;
+        double frameStart = nowMs(), submitted;
 
         gettimeofday(&timeNow, NULL);
-        appRender(TIME_SPEEDUP * (timeNow.tv_sec * 1000 +
-                                  timeNow.tv_usec / 1000),
-                  sWindowWidth, sWindowHeight);
+        if (sFixedStep)
+            // appRender() takes the first tick as the start, it can't be 0.
+            appRender(1 + num_frames * sFixedStep,
+                      sWindowWidth, sWindowHeight);
+        else
+            appRender(TIME_SPEEDUP * (timeNow.tv_sec * 1000 +
+                                      timeNow.tv_usec / 1000),
+                      sWindowWidth, sWindowHeight);
         gettimeofday(&timeAfter, NULL);
+        submitted = nowMs();
 
 #ifdef SAN_ANGELES_OBSERVATION_GLES
         checkGLErrors();
@@ -243,6 +441,20 @@ int main(int argc, char *argv[])
         if (!gAppAlive)
             break;
 
+        if (sFixedStep)
+        {
+            waitForGPU();
+            recordFrame(&times, submitted - frameStart, nowMs() - frameStart);
+            if (sHashFrames)
+            {
+                uint64_t frameHash = hashFrame(sWindowWidth, sWindowHeight);
+                if (sHashFile)
+                    fprintf(sHashFile, "%d %016llx\n", num_frames,
+                            (unsigned long long)frameHash);
+                hash = (hash ^ frameHash) * 0x100000001b3ULL;
+            }
+        }
+
         if (!waffle_window_swap_buffers(sWindow))
             waffleError();
 
@@ -258,7 +470,26 @@ int main(int argc, char *argv[])
     appDeinit();
     deinitGraphics();
 
+    fprintf(stdout, "startup_ms = %.1f\n", startup);
     fprintf(stdout, "frame_rate = %.1f\n", num_frames / total_time);
+    perf_result("fps", num_frames / total_time, "fps",
+                PERF_RESULTS_HIGHER_IS_BETTER);
+    perf_result("startup", startup, "milliseconds",
+                PERF_RESULTS_LOWER_IS_BETTER);
+    if (sFixedStep)
+    {
+        fprintf(stdout, "frames = %d\n", num_frames);
+        fprintf(stdout, "gpu_wait = %s\n", sFenceSync ? "fence" : "finish");
+        printPercentiles("cpu_frame_ms", times.cpu, times.count);
+        printPercentiles("gpu_frame_ms", times.gpu, times.count);
+        if (sHashFrames)
+            fprintf(stdout, "image_hash = %016llx\n",
+                    (unsigned long long)hash);
+        free(times.cpu);
+        free(times.gpu);
+    }
+    if (sHashFile)
+        fclose(sHashFile);
 
     return EXIT_SUCCESS;
 }
@@ -52,6 +52,11 @@ extern void appRender(long tick, int width, int height);
  */
 extern int gAppAlive;
 
+/* Path of a file to cache the generated scene geometry in between runs, or
+ * NULL to always generate it. Defined by the application framework.
+ */
+extern const char *gAppGeometryCache;
+
 
 #ifdef __cplusplus
 }
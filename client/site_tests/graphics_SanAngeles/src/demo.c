@@ -29,9 +29,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
 #include <float.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef SAN_ANGELES_OBSERVATION_GLES
 #undef IMPORTGL_API
@@ -107,6 +114,9 @@ static int sCurrentCamTrack = 0;
 static long sCurrentCamTrackStartTick = 0;
 static long sNextCamTrackStartTick = 0x7fffffff;
 
+// Scene objects in the order their arrays are laid out in the VBO.
+#define SCENE_OBJECT_COUNT (SUPERSHAPE_COUNT + 2)
+
 static GLOBJECT *sSuperShapeObjects[SUPERSHAPE_COUNT] = { NULL };
 static GLOBJECT *sGroundPlane = NULL;
 static GLOBJECT *sFadeQuad = NULL;
@@ -181,24 +191,30 @@ static GLOBJECT * newGLObject(long vertices, int vertexComponents,
 }
 
 
-static void appendObjectVBO(GLOBJECT *object, GLint *offset)
+static void placeObjectVBO(GLOBJECT *object, GLint *offset)
 {
-    assert(object != NULL);
-
     object->vertexArrayOffset += *offset;
     object->colorArrayOffset += *offset;
     object->normalArrayOffset += *offset;
     *offset += object->vertexArraySize + object->colorArraySize +
                object->normalArraySize;
+}
+
 
-    glBufferSubData(GL_ARRAY_BUFFER, object->vertexArrayOffset,
-                    object->vertexArraySize, object->vertexArray);
+static void appendObjectVBO(GLOBJECT *object, GLubyte *data, GLint *offset)
+{
+    assert(object != NULL);
+
+    placeObjectVBO(object, offset);
+
+    memcpy(data + object->vertexArrayOffset, object->vertexArray,
+           object->vertexArraySize);
     if (object->colorArray)
-        glBufferSubData(GL_ARRAY_BUFFER, object->colorArrayOffset,
-                        object->colorArraySize, object->colorArray);
+        memcpy(data + object->colorArrayOffset, object->colorArray,
+               object->colorArraySize);
     if (object->normalArray)
-        glBufferSubData(GL_ARRAY_BUFFER, object->normalArrayOffset,
-                        object->normalArraySize, object->normalArray);
+        memcpy(data + object->normalArrayOffset, object->normalArray,
+               object->normalArraySize);
 
     free(object->normalArray);
     object->normalArray = NULL;
@@ -209,34 +225,53 @@ static void appendObjectVBO(GLOBJECT *object, GLint *offset)
 }
 
 
-static GLuint createVBO(GLOBJECT **superShapes, int superShapeCount,
-                        GLOBJECT *groundPlane, GLOBJECT *fadeQuad)
+static void getSceneObjects(GLOBJECT **objects)
 {
-    GLuint vbo;
+    int a;
+    for (a = 0; a < SUPERSHAPE_COUNT; ++a)
+        objects[a] = sSuperShapeObjects[a];
+    objects[SUPERSHAPE_COUNT] = sGroundPlane;
+    objects[SUPERSHAPE_COUNT + 1] = sFadeQuad;
+}
+
+
+// Packs the arrays of all scene objects into one buffer laid out as the VBO
+// and frees them. Returns the buffer and sets |size| to its size.
+static GLubyte * packSceneObjects(GLint *size)
+{
+    GLOBJECT *objects[SCENE_OBJECT_COUNT];
+    GLubyte *data;
     GLint totalSize = 0;
+    GLint offset = 0;
     int a;
-    for (a = 0; a < superShapeCount; ++a)
+
+    getSceneObjects(objects);
+    for (a = 0; a < SCENE_OBJECT_COUNT; ++a)
     {
-        assert(superShapes[a] != NULL);
-        totalSize += superShapes[a]->vertexArraySize +
-                     superShapes[a]->colorArraySize +
-                     superShapes[a]->normalArraySize;
+        assert(objects[a] != NULL);
+        totalSize += objects[a]->vertexArraySize +
+                     objects[a]->colorArraySize +
+                     objects[a]->normalArraySize;
     }
-    totalSize += groundPlane->vertexArraySize +
-                 groundPlane->colorArraySize +
-                 groundPlane->normalArraySize;
-    totalSize += fadeQuad->vertexArraySize +
-                 fadeQuad->colorArraySize +
-                 fadeQuad->normalArraySize;
+    data = malloc(totalSize);
+    if (data == NULL)
+        return NULL;
+    for (a = 0; a < SCENE_OBJECT_COUNT; ++a)
+        appendObjectVBO(objects[a], data, &offset);
+    assert(offset == totalSize);
+    *size = totalSize;
+    return data;
+}
+
+
+// Uploading everything with one glBufferData() lets the driver skip
+// allocating storage only to overwrite it piece by piece.
+static GLuint createVBO(const GLubyte *data, GLint size)
+{
+    GLuint vbo;
     glGenBuffers(1, &vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, totalSize, 0, GL_STATIC_DRAW);
-    GLint offset = 0;
-    for (a = 0; a < superShapeCount; ++a)
-        appendObjectVBO(superShapes[a], &offset);
-    appendObjectVBO(groundPlane, &offset);
-    appendObjectVBO(fadeQuad, &offset);
-    assert(offset == totalSize);
+    glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
     return vbo;
 }
 
@@ -310,12 +345,21 @@ static void vector3Sub(VECTOR3 *dest, VECTOR3 *v1, VECTOR3 *v2)
 }
 
 
-static void superShapeMap(VECTOR3 *point, float r1, float r2, float t, float p)
+// Supershape radius and direction at one longitude or latitude.
+typedef struct {
+    float angle;
+    float r;
+    double cos, sin;
+} SSANGLE;
+
+
+static void superShapeMap(VECTOR3 *point, float r1, float r2,
+                          const SSANGLE *t, const SSANGLE *p)
 {
     // sphere-mapping of supershape parameters
-    point->x = (float)(cos(t) * cos(p) / r1 / r2);
-    point->y = (float)(sin(t) * cos(p) / r1 / r2);
-    point->z = (float)(sin(p) / r2);
+    point->x = (float)(t->cos * p->cos / r1 / r2);
+    point->y = (float)(t->sin * p->cos / r1 / r2);
+    point->z = (float)(p->sin / r2);
 }
 
 
@@ -326,10 +370,52 @@ static float ssFunc(const float t, const float *p)
 }
 
 
-// Creates and returns a supershape object.
+// Tabulates angles begin..end (inclusive) of a circle divided in
+// |resolution| steps starting at |offset|. Every quad shares its corners'
+// angles with its neighbours, so this computes each ssFunc() and sin/cos
+// once instead of four times per quad, leaving plain arithmetic in the
+// per-quad loop.
+static void superShapeAngles(SSANGLE *angles, int begin, int end,
+                             float offset, int resolution, const float *params)
+{
+    int i;
+    for (i = begin; i <= end; ++i)
+    {
+        SSANGLE *angle = &angles[i - begin];
+        angle->angle = offset + i * 2 * PI / resolution;
+        angle->r = ssFunc(angle->angle, params);
+        angle->cos = cos(angle->angle);
+        angle->sin = sin(angle->angle);
+    }
+}
+
+
+// Allocates a supershape object for the given parameters. Its arrays are
+// filled by buildSuperShape().
+static GLOBJECT * newSuperShape(const float *params)
+{
+    const int resol1 = (int)params[SUPERSHAPE_PARAMS - 3];
+    const int resol2 = (int)params[SUPERSHAPE_PARAMS - 2];
+    const int latitudeCount = resol2 / 2 - resol2 / 4;
+    const long vertices = resol1 * latitudeCount * 2 * 3;
+    GLOBJECT *result;
+
+    result = newGLObject(vertices, 3, 1, 1);
+    if (result == NULL)
+        return NULL;
+#ifdef SAN_ANGELES_OBSERVATION_GLES
+    result->shaderProgram = sShaderLit.program;
+#endif  // SAN_ANGELES_OBSERVATION_GLES
+    return result;
+}
+
+
+// Fills in the arrays of a supershape object. Only touches |result|, so
+// several shapes can be built concurrently.
 // Based on Paul Bourke's POV-Ray implementation.
 // http://astronomy.swin.edu.au/~pbourke/povray/supershape/
-static GLOBJECT * createSuperShape(const float *params)
+static int buildSuperShape(GLOBJECT *result, const float *params,
+                           const float *baseColor)
 {
     const int resol1 = (int)params[SUPERSHAPE_PARAMS - 3];
     const int resol2 = (int)params[SUPERSHAPE_PARAMS - 2];
@@ -339,48 +425,45 @@ static GLOBJECT * createSuperShape(const float *params)
     const int latitudeEnd = resol2 / 2;    // non-inclusive
     const int longitudeCount = resol1;
     const int latitudeCount = latitudeEnd - latitudeBegin;
-    const long triangleCount = longitudeCount * latitudeCount * 2;
-    const long vertices = triangleCount * 3;
-    GLOBJECT *result;
-    float baseColor[3];
-    int a, longitude, latitude;
-    long currentVertex, currentQuad;
+    SSANGLE *longitudes, *latitudes;
+    int longitude, latitude;
+    long currentVertex;
 
-    result = newGLObject(vertices, 3, 1, 1);
-    if (result == NULL)
-        return NULL;
+    longitudes = malloc((longitudeCount + latitudeCount + 2) *
+                        sizeof(SSANGLE));
+    if (longitudes == NULL)
+        return 0;
+    latitudes = longitudes + longitudeCount + 1;
 
-    for (a = 0; a < 3; ++a)
-        baseColor[a] = ((randomUInt() % 155) + 100) / 255.f;
+    // longitude -pi to pi
+    superShapeAngles(longitudes, 0, longitudeCount, -PI, resol1, params);
+    // latitude 0 to pi/2
+    superShapeAngles(latitudes, latitudeBegin, latitudeEnd, -PI / 2, resol2,
+                     &params[6]);
 
-    currentQuad = 0;
     currentVertex = 0;
 
-    // longitude -pi to pi
     for (longitude = 0; longitude < longitudeCount; ++longitude)
     {
+        const SSANGLE *t1 = &longitudes[longitude];
+        const SSANGLE *t2 = &longitudes[longitude + 1];
 
-        // latitude 0 to pi/2
         for (latitude = latitudeBegin; latitude < latitudeEnd; ++latitude)
         {
-            float t1 = -PI + longitude * 2 * PI / resol1;
-            float t2 = -PI + (longitude + 1) * 2 * PI / resol1;
-            float p1 = -PI / 2 + latitude * 2 * PI / resol2;
-            float p2 = -PI / 2 + (latitude + 1) * 2 * PI / resol2;
-            float r0, r1, r2, r3;
-
-            r0 = ssFunc(t1, params);
-            r1 = ssFunc(p1, &params[6]);
-            r2 = ssFunc(t2, params);
-            r3 = ssFunc(p2, &params[6]);
+            const SSANGLE *p1 = &latitudes[latitude - latitudeBegin];
+            const SSANGLE *p2 = &latitudes[latitude - latitudeBegin + 1];
+            const float r0 = t1->r, r1 = p1->r, r2 = t2->r, r3 = p2->r;
 
             if (r0 != 0 && r1 != 0 && r2 != 0 && r3 != 0)
             {
                 VECTOR3 pa, pb, pc, pd;
                 VECTOR3 v1, v2, n;
+                GLubyte color[4];
                 float ca;
-                int i;
-                //float lenSq, invLenSq;
+                GLfloat *vertex = &result->vertexArray[currentVertex * 3];
+                GLfloat *normal = &result->normalArray[currentVertex * 3];
+                GLubyte *colors = &result->colorArray[currentVertex * 4];
+                int i, a;
 
                 superShapeMap(&pa, r0, r1, t1, p1);
                 superShapeMap(&pb, r2, r1, t2, p1);
@@ -409,74 +492,102 @@ static GLOBJECT * createSuperShape(const float *params)
                  * normalization (GL_NORMALIZE). It is enabled because the
                  * objects are scaled with glScale.
                  */
-                /*
-                lenSq = n.x * n.x + n.y * n.y + n.z * n.z;
-                invLenSq = (float)(1 / sqrt(lenSq));
-                n.x *= invLenSq;
-                n.y *= invLenSq;
-                n.z *= invLenSq;
-                */
 
                 ca = pa.z + 0.5f;
-
-                for (i = currentVertex * 3;
-                     i < (currentVertex + 6) * 3;
-                     i += 3)
+                for (a = 0; a < 3; ++a)
                 {
-                    result->normalArray[i] = n.x;
-                    result->normalArray[i + 1] = n.y;
-                    result->normalArray[i + 2] = n.z;
+                    int c = (int)(ca * baseColor[a] * 255);
+                    color[a] = (GLubyte)(c > 255 ? 255 : c);
                 }
-                for (i = currentVertex * 4;
-                     i < (currentVertex + 6) * 4;
-                     i += 4)
+                color[3] = 0;
+
+                for (i = 0; i < 6; ++i)
                 {
-                    int a, color[3];
-                    for (a = 0; a < 3; ++a)
-                    {
-                        color[a] = (int)(ca * baseColor[a] * 255);
-                        if (color[a] > 255) color[a] = 255;
-                    }
-                    result->colorArray[i] = (GLubyte)color[0];
-                    result->colorArray[i + 1] = (GLubyte)color[1];
-                    result->colorArray[i + 2] = (GLubyte)color[2];
-                    result->colorArray[i + 3] = 0;
+                    normal[i * 3] = n.x;
+                    normal[i * 3 + 1] = n.y;
+                    normal[i * 3 + 2] = n.z;
+                    memcpy(&colors[i * 4], color, 4);
                 }
-                result->vertexArray[currentVertex * 3] = pa.x;
-                result->vertexArray[currentVertex * 3 + 1] = pa.y;
-                result->vertexArray[currentVertex * 3 + 2] = pa.z;
-                ++currentVertex;
-                result->vertexArray[currentVertex * 3] = pb.x;
-                result->vertexArray[currentVertex * 3 + 1] = pb.y;
-                result->vertexArray[currentVertex * 3 + 2] = pb.z;
-                ++currentVertex;
-                result->vertexArray[currentVertex * 3] = pd.x;
-                result->vertexArray[currentVertex * 3 + 1] = pd.y;
-                result->vertexArray[currentVertex * 3 + 2] = pd.z;
-                ++currentVertex;
-                result->vertexArray[currentVertex * 3] = pb.x;
-                result->vertexArray[currentVertex * 3 + 1] = pb.y;
-                result->vertexArray[currentVertex * 3 + 2] = pb.z;
-                ++currentVertex;
-                result->vertexArray[currentVertex * 3] = pc.x;
-                result->vertexArray[currentVertex * 3 + 1] = pc.y;
-                result->vertexArray[currentVertex * 3 + 2] = pc.z;
-                ++currentVertex;
-                result->vertexArray[currentVertex * 3] = pd.x;
-                result->vertexArray[currentVertex * 3 + 1] = pd.y;
-                result->vertexArray[currentVertex * 3 + 2] = pd.z;
-                ++currentVertex;
+
+#define PUT_VERTEX(i, p) \
+                vertex[(i) * 3] = (p).x; \
+                vertex[(i) * 3 + 1] = (p).y; \
+                vertex[(i) * 3 + 2] = (p).z
+                PUT_VERTEX(0, pa);
+                PUT_VERTEX(1, pb);
+                PUT_VERTEX(2, pd);
+                PUT_VERTEX(3, pb);
+                PUT_VERTEX(4, pc);
+                PUT_VERTEX(5, pd);
+#undef PUT_VERTEX
+                currentVertex += 6;
             } // r0 && r1 && r2 && r3
-            ++currentQuad;
         } // latitude
     } // longitude
 
+    free(longitudes);
+
     // Set number of vertices in object to the actual amount created.
     result->count = currentVertex;
-#ifdef SAN_ANGELES_OBSERVATION_GLES
-    result->shaderProgram = sShaderLit.program;
-#endif  // SAN_ANGELES_OBSERVATION_GLES
-    return result;
+    return 1;
+}
+
+
+typedef struct {
+    GLOBJECT **objects;
+    float (*baseColors)[3];
+    int next;       // index of the next shape to build, taken atomically
+    int failed;
+} SUPERSHAPE_JOBS;
+
+
+static void * superShapeWorker(void *arg)
+{
+    SUPERSHAPE_JOBS *jobs = arg;
+    int a;
+    while ((a = __sync_fetch_and_add(&jobs->next, 1)) < SUPERSHAPE_COUNT)
+    {
+        if (!buildSuperShape(jobs->objects[a], sSuperShapeParams[a],
+                             jobs->baseColors[a]))
+            jobs->failed = 1;
+    }
+    return NULL;
+}
+
+
+// Creates all supershape objects, building them on all online CPUs.
+// The random base colors are drawn up front in shape order so the scene is
+// the same as when the shapes were created one after the other.
+static int createSuperShapes(GLOBJECT **objects)
+{
+    float baseColors[SUPERSHAPE_COUNT][3];
+    SUPERSHAPE_JOBS jobs = { objects, baseColors, 0, 0 };
+    pthread_t threads[SUPERSHAPE_COUNT];
+    long threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    int a, b;
+
+    for (a = 0; a < SUPERSHAPE_COUNT; ++a)
+    {
+        for (b = 0; b < 3; ++b)
+            baseColors[a][b] = ((randomUInt() % 155) + 100) / 255.f;
+        objects[a] = newSuperShape(sSuperShapeParams[a]);
+        if (objects[a] == NULL)
+            return 0;
+    }
+
+    if (threadCount > SUPERSHAPE_COUNT)
+        threadCount = SUPERSHAPE_COUNT;
+    // The calling thread is the first worker.
+    for (a = 1; a < threadCount; ++a)
+    {
+        if (pthread_create(&threads[a], NULL, superShapeWorker, &jobs))
+            break;
+    }
+    threadCount = a;
+    superShapeWorker(&jobs);
+    for (a = 1; a < threadCount; ++a)
+        pthread_join(threads[a], NULL);
+    return !jobs.failed;
 }
 
 
@@ -632,10 +743,203 @@ static void drawFadeQuad()
 }
 
 
+/* Geometry cache file: a header, the array sizes of every scene object and
+ * then the VBO contents. It is only used when it was written by a build with
+ * the same cache version and supershape parameters, so bump the version
+ * whenever the generated geometry changes.
+ */
+#define GEOMETRY_CACHE_MAGIC    0x43474153  // "SAGC"
+#define GEOMETRY_CACHE_VERSION  1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t paramsHash;
+    uint32_t objectCount;
+    uint32_t dataSize;
+} GEOMETRY_CACHE_HEADER;
+
+typedef struct {
+    int32_t count;
+    int32_t vertexComponents;
+    int32_t vertexArraySize;
+    int32_t colorArraySize;
+    int32_t normalArraySize;
+} GEOMETRY_CACHE_OBJECT;
+
+
+static uint32_t superShapeParamsHash()
+{
+    const unsigned char *p = (const unsigned char *)sSuperShapeParams;
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < sizeof(sSuperShapeParams); ++i)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+
+// Writes the packed scene |data| to the cache. The file is replaced
+// atomically so concurrent runs never see a partial one.
+static void saveGeometryCache(const char *path, const GLubyte *data,
+                              GLint size)
+{
+    GLOBJECT *objects[SCENE_OBJECT_COUNT];
+    GEOMETRY_CACHE_HEADER header;
+    GEOMETRY_CACHE_OBJECT entries[SCENE_OBJECT_COUNT];
+    char tmpPath[4096];
+    FILE *file;
+    int a, ok;
+
+    getSceneObjects(objects);
+    header.magic = GEOMETRY_CACHE_MAGIC;
+    header.version = GEOMETRY_CACHE_VERSION;
+    header.paramsHash = superShapeParamsHash();
+    header.objectCount = SCENE_OBJECT_COUNT;
+    header.dataSize = size;
+    for (a = 0; a < SCENE_OBJECT_COUNT; ++a)
+    {
+        entries[a].count = objects[a]->count;
+        entries[a].vertexComponents = objects[a]->vertexComponents;
+        entries[a].vertexArraySize = objects[a]->vertexArraySize;
+        entries[a].colorArraySize = objects[a]->colorArraySize;
+        entries[a].normalArraySize = objects[a]->normalArraySize;
+    }
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%d", path, (int)getpid());
+    file = fopen(tmpPath, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Warning: cannot write geometry cache %s\n", tmpPath);
+        return;
+    }
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(entries, sizeof(entries), 1, file) == 1 &&
+         fwrite(data, size, 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmpPath, path) != 0)
+    {
+        fprintf(stderr, "Warning: cannot write geometry cache %s\n", path);
+        unlink(tmpPath);
+    }
+}
+
+
+static GLOBJECT * newCachedGLObject(const GEOMETRY_CACHE_OBJECT *entry)
+{
+    GLOBJECT *result = calloc(1, sizeof(GLOBJECT));
+    if (result == NULL)
+        return NULL;
+    result->count = entry->count;
+    result->vertexComponents = entry->vertexComponents;
+    result->vertexArraySize = entry->vertexArraySize;
+    result->colorArraySize = entry->colorArraySize;
+    result->normalArraySize = entry->normalArraySize;
+    result->colorArrayOffset = result->vertexArraySize;
+    result->normalArrayOffset = result->colorArrayOffset +
+                                result->colorArraySize;
+    return result;
+}
+
+
+// Creates the scene objects and the VBO from the cache, mapped rather than
+// read so the data goes straight from the page cache to glBufferData().
+// Returns 0 if the cache is missing or doesn't match this build.
+static int loadGeometryCache(const char *path)
+{
+    const GEOMETRY_CACHE_HEADER *header;
+    const GEOMETRY_CACHE_OBJECT *entries;
+    const GLubyte *data;
+    GLOBJECT *objects[SCENE_OBJECT_COUNT] = { NULL };
+    struct stat st;
+    void *map;
+    size_t dataOffset = sizeof(*header) + sizeof(*entries) * SCENE_OBJECT_COUNT;
+    GLint offset = 0;
+    int fd, a, ok = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)dataOffset)
+    {
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    header = map;
+    entries = (const GEOMETRY_CACHE_OBJECT *)(header + 1);
+    data = (const GLubyte *)map + dataOffset;
+    if (header->magic != GEOMETRY_CACHE_MAGIC ||
+        header->version != GEOMETRY_CACHE_VERSION ||
+        header->paramsHash != superShapeParamsHash() ||
+        header->objectCount != SCENE_OBJECT_COUNT ||
+        (off_t)header->dataSize != st.st_size - (off_t)dataOffset)
+        goto out;
+
+    for (a = 0; a < SCENE_OBJECT_COUNT; ++a)
+    {
+        objects[a] = newCachedGLObject(&entries[a]);
+        if (objects[a] == NULL)
+            goto out;
+        placeObjectVBO(objects[a], &offset);
+    }
+    if (offset != (GLint)header->dataSize)
+        goto out;
+
+    for (a = 0; a < SUPERSHAPE_COUNT; ++a)
+        sSuperShapeObjects[a] = objects[a];
+    sGroundPlane = objects[SUPERSHAPE_COUNT];
+    sFadeQuad = objects[SUPERSHAPE_COUNT + 1];
+#ifdef SAN_ANGELES_OBSERVATION_GLES
+    for (a = 0; a < SUPERSHAPE_COUNT; ++a)
+        sSuperShapeObjects[a]->shaderProgram = sShaderLit.program;
+    sGroundPlane->shaderProgram = sShaderFlat.program;
+    sFadeQuad->shaderProgram = sShaderFade.program;
+#endif  // SAN_ANGELES_OBSERVATION_GLES
+    sVBO = createVBO(data, header->dataSize);
+    ok = 1;
+
+out:
+    if (!ok)
+        for (a = 0; a < SCENE_OBJECT_COUNT; ++a)
+            freeGLObject(objects[a]);
+    munmap(map, st.st_size);
+    return ok;
+}
+
+
+static int createGeometry()
+{
+    GLubyte *data;
+    GLint size;
+
+    if (!createSuperShapes(sSuperShapeObjects))
+        return 0;
+    sGroundPlane = createGroundPlane();
+    if (sGroundPlane == NULL)
+        return 0;
+    sFadeQuad = createFadeQuad();
+    if (sFadeQuad == NULL)
+        return 0;
+
+    data = packSceneObjects(&size);
+    if (data == NULL)
+        return 0;
+    sVBO = createVBO(data, size);
+    if (gAppGeometryCache != NULL)
+        saveGeometryCache(gAppGeometryCache, data, size);
+    free(data);
+    return 1;
+}
+
+
 // Called from the app framework.
 int appInit()
 {
-    int a;
     static GLfloat light0Diffuse[] = { 1.f, 0.4f, 0, 1.f };
     static GLfloat light1Diffuse[] = { 0.07f, 0.14f, 0.35f, 1.f };
     static GLfloat light2Diffuse[] = { 0.07f, 0.17f, 0.14f, 1.f };
@@ -666,17 +970,14 @@ int appInit()
 #endif  // SAN_ANGELES_OBSERVATION_GLES | !SAN_ANGELES_OBSERVATION_GLES
     seedRandom(15);
 
-    for (a = 0; a < SUPERSHAPE_COUNT; ++a)
+    if (gAppGeometryCache == NULL || !loadGeometryCache(gAppGeometryCache))
     {
-        sSuperShapeObjects[a] = createSuperShape(sSuperShapeParams[a]);
-        assert(sSuperShapeObjects[a] != NULL);
+        if (!createGeometry())
+        {
+            fprintf(stderr, "Error: creating the scene geometry failed\n");
+            return 0;
+        }
     }
-    sGroundPlane = createGroundPlane();
-    assert(sGroundPlane != NULL);
-    sFadeQuad = createFadeQuad();
-    assert(sFadeQuad != NULL);
-    sVBO = createVBO(sSuperShapeObjects, SUPERSHAPE_COUNT,
-                     sGroundPlane, sFadeQuad);
 
     // setup non-changing lighting parameters
 #ifdef SAN_ANGELES_OBSERVATION_GLES
@@ -69,6 +69,7 @@ int importGLInit()
     IMPORT_FUNC_GL(glDrawArrays);
     IMPORT_FUNC_GL(glEnable);
     IMPORT_FUNC_GL(glEnableVertexAttribArray);
+    IMPORT_FUNC_GL(glFinish);
     IMPORT_FUNC_GL(glGenBuffers);
     IMPORT_FUNC_GL(glGetAttribLocation);
     IMPORT_FUNC_GL(glGetError);
@@ -76,6 +77,7 @@ int importGLInit()
     IMPORT_FUNC_GL(glGetShaderInfoLog);
     IMPORT_FUNC_GL(glGetUniformLocation);
     IMPORT_FUNC_GL(glLinkProgram);
+    IMPORT_FUNC_GL(glReadPixels);
     IMPORT_FUNC_GL(glShaderSource);
     IMPORT_FUNC_GL(glUniform1f);
     IMPORT_FUNC_GL(glUniform3fv);
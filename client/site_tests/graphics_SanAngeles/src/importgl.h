@@ -78,6 +78,7 @@ FNDEF(void, glDisableVertexAttribArray, (GLuint index));
 FNDEF(void, glDrawArrays, (GLenum mode, GLint first, GLsizei count));
 FNDEF(void, glEnable, (GLenum cap));
 FNDEF(void, glEnableVertexAttribArray, (GLuint index));
+FNDEF(void, glFinish, (void));
 FNDEF(void, glGenBuffers, (GLsizei n, GLuint* buffers));
 FNDEF(int, glGetAttribLocation, (GLuint program, const char* name));
 FNDEF(GLenum, glGetError, (void));
@@ -86,6 +87,8 @@ FNDEF(void, glGetShaderInfoLog, (GLuint shader, GLsizei bufsize,
                                  GLsizei* length, char* infolog));
 FNDEF(int, glGetUniformLocation, (GLuint program, const char* name));
 FNDEF(void, glLinkProgram, (GLuint program));
+FNDEF(void, glReadPixels, (GLint x, GLint y, GLsizei width, GLsizei height,
+                           GLenum format, GLenum type, void* pixels));
 FNDEF(void, glShaderSource, (GLuint shader, GLsizei count,
                              const char** string, const GLint* length));
 FNDEF(void, glUniform1f, (GLint location, GLfloat x));
@@ -126,6 +129,7 @@ FNDEF(void, glViewport, (GLint x, GLint y, GLsizei width, GLsizei height));
 #define glDrawArrays                FNPTR(glDrawArrays)
 #define glEnable                    FNPTR(glEnable)
 #define glEnableVertexAttribArray   FNPTR(glEnableVertexAttribArray)
+#define glFinish                    FNPTR(glFinish)
 #define glGenBuffers                FNPTR(glGenBuffers)
 #define glGetAttribLocation         FNPTR(glGetAttribLocation)
 #define glGetError                  FNPTR(glGetError)
@@ -134,6 +138,7 @@ FNDEF(void, glViewport, (GLint x, GLint y, GLsizei width, GLsizei height));
 #define glGetUniformLocation        FNPTR(glGetUniformLocation)
 
 #define glLinkProgram               FNPTR(glLinkProgram)
+#define glReadPixels                FNPTR(glReadPixels)
 #define glShaderSource              FNPTR(glShaderSource)
 #define glUniform1f                 FNPTR(glUniform1f)
 #define glUniform3fv                FNPTR(glUniform3fv)
@@ -2,7 +2,7 @@
 # Use of this source code is governed by a BSD-style license that can be
 # found in the LICENSE file.
 
-import glob, logging, os, sys, commands
+import glob, logging, os, re, sys, commands
 
 from autotest_lib.client.bin import test, utils
 from autotest_lib.client.common_lib import error
@@ -11,7 +11,7 @@ class hardware_Keyboard(test.test):
     """
     Test the keyboard through the user mode /dev/input/event interface.
     """
-    version = 1
+    version = 2
     dev_input_event_path = '/dev/input/event*'
     supported_keys = ['Esc', 'F1', 'F2', 'F3', 'F4', 'F5','F6', 'F7', 'F8',
                       'F9', 'F10', 'Grave', 'Minus', 'Equal', 'Backspace',
@@ -41,7 +41,43 @@ class hardware_Keyboard(test.test):
         logging.info('%s : %s' % (key_name, output))
         return True
 
-    def run_once(self):
+    def _measure_latency(self, presses):
+        """
+        Type |presses| keys on a uinput keyboard and report the event rate and
+        kernel-to-userspace delivery latency measured by evtest capture mode.
+        """
+        cmd = os.path.join(self.srcdir, 'evtest') + ' -u %d' % presses
+        cmd += ' -o ' + os.path.join(self.resultsdir, 'events.bin')
+        (status, output) = commands.getstatusoutput(cmd)
+        if status:
+            raise error.TestError('Event capture failed : %s' % output)
+        logging.info(output)
+        match = re.search(r'^events: (\d+) rate ([\d.]+)/s', output,
+                          re.MULTILINE)
+        if not match or int(match.group(1)) < presses * 4:
+            raise error.TestFail('Synthetic events were lost : %s' % output)
+        self.output_perf_value(description='event_rate',
+                               value=float(match.group(2)), units='events/s',
+                               higher_is_better=True)
+        match = re.search(r'^latency_us: mean ([\d.]+) p50 (\d+) p90 (\d+) '
+                          r'p99 (\d+) max ([\d.]+)', output, re.MULTILINE)
+        if not match:
+            raise error.TestFail('No latency in capture output : %s' % output)
+        for name, value in zip(('mean', 'p50', 'p90', 'p99', 'max'),
+                               match.groups()):
+            self.output_perf_value(description='latency_' + name,
+                                   value=float(value), units='us',
+                                   higher_is_better=False)
+
+    def run_once(self, latency_presses=0):
+        """
+        @param latency_presses: if set, skip the keyboard checks and instead
+                measure input event delivery latency with this many
+                synthetic key presses.
+        """
+        if latency_presses:
+            self._measure_latency(latency_presses)
+            return
         high_key_count = 0
         high_key_event = ''
         for event in glob.glob(hardware_Keyboard.dev_input_event_path):
@@ -29,11 +29,18 @@
 #include <stdint.h>
 
 #include <linux/input.h>
+#include <linux/uinput.h>
 
+#include <errno.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
 
 #ifndef EV_SYN
 #define EV_SYN 0
@@ -482,6 +489,380 @@ int do_evtest_dumpall(int fd)
 	}
 }
 
+/*
+ * Capture mode: events from any number of devices are collected through one
+ * epoll loop into a ring of binary records, and the delay from the kernel
+ * event timestamp to its delivery in userspace is accumulated in a
+ * histogram.
+ */
+
+#define MAX_CAPTURE_DEVICES 64
+#define CAPTURE_RING_SIZE (1 << 16)	/* records, power of two */
+#define LATENCY_BUCKETS 10000		/* 1us buckets, up to 10ms */
+#define CAPTURE_MAGIC 0x45564350	/* "EVCP" */
+
+struct capture_record {
+	struct input_event ev;
+	uint64_t recv_ns;	/* when read() returned, on the event clock */
+	uint32_t device;	/* index into the capture device list */
+	uint32_t pad;
+};
+
+struct capture_device {
+	const char *path;
+	int fd;
+	clockid_t clock;
+	unsigned long events;
+};
+
+struct capture {
+	struct capture_device dev[MAX_CAPTURE_DEVICES];
+	int num_devices;
+	struct capture_record *ring;
+	unsigned long head;		/* total records written */
+	unsigned long latency[LATENCY_BUCKETS + 1];
+	uint64_t latency_sum_ns, latency_max_ns;
+	unsigned long events;
+};
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int capture_add_device(struct capture *cap, const char *path)
+{
+	struct capture_device *dev;
+	int clock = CLOCK_MONOTONIC;
+
+	if (cap->num_devices == MAX_CAPTURE_DEVICES) {
+		fprintf(stderr, "evtest: too many devices\n");
+		return -1;
+	}
+	dev = &cap->dev[cap->num_devices];
+	dev->path = path;
+	dev->fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (dev->fd < 0) {
+		perror(path);
+		return -1;
+	}
+	/* Older kernels only stamp events with CLOCK_REALTIME. */
+	dev->clock = ioctl(dev->fd, EVIOCSCLOCKID, &clock) ?
+			CLOCK_REALTIME : CLOCK_MONOTONIC;
+	dev->events = 0;
+	cap->num_devices++;
+	return 0;
+}
+
+static void capture_record(struct capture *cap, int device,
+			   const struct input_event *ev, uint64_t recv_ns)
+{
+	struct capture_record *rec;
+	uint64_t ev_ns, latency;
+
+	rec = &cap->ring[cap->head++ & (CAPTURE_RING_SIZE - 1)];
+	rec->ev = *ev;
+	rec->recv_ns = recv_ns;
+	rec->device = device;
+	cap->dev[device].events++;
+	cap->events++;
+
+	ev_ns = ev->time.tv_sec * 1000000000ULL + ev->time.tv_usec * 1000ULL;
+	latency = recv_ns > ev_ns ? recv_ns - ev_ns : 0;
+	cap->latency_sum_ns += latency;
+	if (latency > cap->latency_max_ns)
+		cap->latency_max_ns = latency;
+	latency /= 1000;
+	cap->latency[latency < LATENCY_BUCKETS ? latency : LATENCY_BUCKETS]++;
+}
+
+/* Reads everything pending on |device|; returns -1 on a read error. */
+static int capture_drain(struct capture *cap, int device)
+{
+	struct capture_device *dev = &cap->dev[device];
+	struct input_event ev[64];
+	uint64_t recv_ns;
+	int i, rd;
+
+	while (1) {
+		rd = read(dev->fd, ev, sizeof(ev));
+		recv_ns = clock_ns(dev->clock);
+		if (rd < 0)
+			return errno == EAGAIN ? 0 : -1;
+		if (rd < (int) sizeof(struct input_event))
+			return -1;
+		for (i = 0; i < rd / sizeof(struct input_event); i++)
+			capture_record(cap, device, &ev[i], recv_ns);
+	}
+}
+
+/*
+ * Captures until |max_events| events arrived (0: no limit) or |seconds|
+ * passed (0: no limit).
+ */
+static int capture_run(struct capture *cap, unsigned long max_events,
+		       int seconds)
+{
+	struct epoll_event ev, events[MAX_CAPTURE_DEVICES];
+	uint64_t deadline = 0;
+	int epfd, i, n, timeout = -1;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		return 1;
+	}
+	for (i = 0; i < cap->num_devices; i++) {
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, cap->dev[i].fd, &ev)) {
+			perror("epoll_ctl");
+			return 1;
+		}
+	}
+	if (seconds)
+		deadline = clock_ns(CLOCK_MONOTONIC) + seconds * 1000000000ULL;
+
+	while (!max_events || cap->events < max_events) {
+		if (deadline) {
+			uint64_t now = clock_ns(CLOCK_MONOTONIC);
+			if (now >= deadline)
+				break;
+			timeout = (deadline - now) / 1000000 + 1;
+		}
+		n = epoll_wait(epfd, events, MAX_CAPTURE_DEVICES, timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			return 1;
+		}
+		for (i = 0; i < n; i++) {
+			if (capture_drain(cap, events[i].data.u32)) {
+				perror("\nevtest: error reading");
+				return 1;
+			}
+		}
+	}
+	close(epfd);
+	return 0;
+}
+
+static double capture_percentile_us(const struct capture *cap, double pct)
+{
+	unsigned long target = (unsigned long)(cap->events * pct / 100.0);
+	unsigned long seen = 0;
+	int i;
+
+	for (i = 0; i <= LATENCY_BUCKETS; i++) {
+		seen += cap->latency[i];
+		if (seen > target)
+			return i;
+	}
+	return LATENCY_BUCKETS;
+}
+
+static void capture_report(const struct capture *cap, double elapsed_s)
+{
+	unsigned long lost = cap->head > CAPTURE_RING_SIZE ?
+			cap->head - CAPTURE_RING_SIZE : 0;
+	int i;
+
+	for (i = 0; i < cap->num_devices; i++)
+		printf("device: %s events %lu rate %.1f/s\n", cap->dev[i].path,
+		       cap->dev[i].events, cap->dev[i].events / elapsed_s);
+	printf("events: %lu rate %.1f/s overwritten %lu\n", cap->events,
+	       cap->events / elapsed_s, lost);
+	if (!cap->events)
+		return;
+	printf("latency_us: mean %.1f p50 %.0f p90 %.0f p99 %.0f max %.1f\n",
+	       cap->latency_sum_ns / 1000.0 / cap->events,
+	       capture_percentile_us(cap, 50), capture_percentile_us(cap, 90),
+	       capture_percentile_us(cap, 99), cap->latency_max_ns / 1000.0);
+}
+
+/* Writes the records still in the ring, oldest first, after a header. */
+static int capture_save(const struct capture *cap, const char *path)
+{
+	uint32_t header[4] = { CAPTURE_MAGIC, sizeof(struct capture_record) };
+	unsigned long first, n;
+	FILE *f = fopen(path, "wb");
+
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+	first = cap->head > CAPTURE_RING_SIZE ?
+			cap->head - CAPTURE_RING_SIZE : 0;
+	header[2] = cap->head - first;
+	fwrite(header, sizeof(header), 1, f);
+	for (n = first; n < cap->head; n++)
+		fwrite(&cap->ring[n & (CAPTURE_RING_SIZE - 1)],
+		       sizeof(struct capture_record), 1, f);
+	return fclose(f) ? 1 : 0;
+}
+
+/* How long to wait for udev to create the node of the uinput keyboard. */
+#define UDEV_TIMEOUT_US		5000000
+
+/* Extra time allowed in -u mode for the typed keys to arrive. */
+#define SYNTHETIC_SLACK_SECONDS	10
+
+/*
+ * Creates a uinput keyboard, returns its fd and stores the path of its event
+ * node in |path|.
+ */
+static int uinput_create(char *path, size_t len)
+{
+	struct uinput_user_dev udev;
+	char sysname[64], sysdir[128];
+	int fd, i;
+
+	fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+	if (fd < 0) {
+		perror("/dev/uinput");
+		return -1;
+	}
+	ioctl(fd, UI_SET_EVBIT, EV_KEY);
+	ioctl(fd, UI_SET_EVBIT, EV_SYN);
+	for (i = KEY_ESC; i <= KEY_Z; i++)
+		ioctl(fd, UI_SET_KEYBIT, i);
+	memset(&udev, 0, sizeof(udev));
+	snprintf(udev.name, UINPUT_MAX_NAME_SIZE, "evtest synthetic keyboard");
+	udev.id.bustype = BUS_VIRTUAL;
+	if (write(fd, &udev, sizeof(udev)) != sizeof(udev) ||
+	    ioctl(fd, UI_DEV_CREATE)) {
+		perror("uinput: create");
+		close(fd);
+		return -1;
+	}
+	if (ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+		perror("uinput: UI_GET_SYSNAME");
+		close(fd);
+		return -1;
+	}
+	/* /sys/devices/virtual/input/inputN/eventM -> /dev/input/eventM */
+	snprintf(sysdir, sizeof(sysdir), "/sys/devices/virtual/input/%s",
+		 sysname);
+	for (i = 0; i < 1024; i++) {
+		char node[192];
+		snprintf(node, sizeof(node), "%s/event%d", sysdir, i);
+		if (!access(node, F_OK)) {
+			int waited_us = 0;
+
+			snprintf(path, len, "/dev/input/event%d", i);
+			/* Give udev a moment to create the device node. */
+			while (access(path, R_OK)) {
+				if (waited_us >= UDEV_TIMEOUT_US) {
+					fprintf(stderr, "uinput: %s never "
+						"appeared\n", path);
+					ioctl(fd, UI_DEV_DESTROY);
+					close(fd);
+					return -1;
+				}
+				usleep(10000);
+				waited_us += 10000;
+			}
+			return fd;
+		}
+	}
+	fprintf(stderr, "uinput: no event node under %s\n", sysdir);
+	close(fd);
+	return -1;
+}
+
+static void uinput_emit(int fd, int type, int code, int value)
+{
+	struct input_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+	if (write(fd, &ev, sizeof(ev)) != sizeof(ev))
+		perror("uinput: write");
+}
+
+/* Emits |presses| key down/up pairs, |interval_us| apart. */
+static void uinput_generate(int fd, unsigned long presses, int interval_us)
+{
+	unsigned long i;
+
+	for (i = 0; i < presses; i++) {
+		int code = KEY_Q + i % (KEY_P - KEY_Q + 1);
+		uinput_emit(fd, EV_KEY, code, 1);
+		uinput_emit(fd, EV_SYN, SYN_REPORT, 0);
+		uinput_emit(fd, EV_KEY, code, 0);
+		uinput_emit(fd, EV_SYN, SYN_REPORT, 0);
+		if (interval_us)
+			usleep(interval_us);
+	}
+}
+
+int do_capture(char **paths, int num_paths, int seconds,
+	       unsigned long synthetic_presses, int interval_us,
+	       const char *save_path)
+{
+	char uinput_path[64];
+	struct capture *cap;
+	uint64_t start;
+	pid_t child = -1;
+	int uinput_fd = -1;
+	int i, ret;
+
+	cap = calloc(1, sizeof(*cap));
+	if (cap)
+		cap->ring = calloc(CAPTURE_RING_SIZE,
+				   sizeof(struct capture_record));
+	if (!cap || !cap->ring) {
+		perror("evtest: calloc");
+		return 1;
+	}
+
+	if (synthetic_presses) {
+		uinput_fd = uinput_create(uinput_path, sizeof(uinput_path));
+		if (uinput_fd < 0 || capture_add_device(cap, uinput_path))
+			return 1;
+	}
+	for (i = 0; i < num_paths; i++)
+		if (capture_add_device(cap, paths[i]))
+			return 1;
+	if (!cap->num_devices) {
+		fprintf(stderr, "evtest: no devices to capture\n");
+		return 1;
+	}
+
+	start = clock_ns(CLOCK_MONOTONIC);
+	if (synthetic_presses) {
+		child = fork();
+		if (child == 0) {
+			uinput_generate(uinput_fd, synthetic_presses,
+					interval_us);
+			_exit(0);
+		}
+	}
+	/* Each press is key down, SYN, key up, SYN. */
+	ret = capture_run(cap, synthetic_presses * 4, seconds);
+	capture_report(cap, (clock_ns(CLOCK_MONOTONIC) - start) / 1e9);
+
+	if (child > 0)
+		waitpid(child, NULL, 0);
+	if (uinput_fd >= 0) {
+		ioctl(uinput_fd, UI_DEV_DESTROY);
+		close(uinput_fd);
+	}
+	if (!ret && save_path)
+		ret = capture_save(cap, save_path);
+	for (i = 0; i < cap->num_devices; i++)
+		close(cap->dev[i].fd);
+	free(cap->ring);
+	free(cap);
+	return ret;
+}
+
 int main (int argc, char **argv)
 {
 	int path_index, fd, rd, i, j, k;
@@ -494,6 +875,12 @@ int main (int argc, char **argv)
 	int check_num_keys = 0;
 	int supported_key_arg_index = 0;
 	int single_key_capture = 0;
+	int capture_seconds = -1;
+	unsigned long synthetic_presses = 0;
+	int synthetic_interval_us = 1000;
+	char *save_path = NULL;
+	char *paths[MAX_CAPTURE_DEVICES];
+	int num_paths = 0;
 
 	if (argc < 2) {
 		goto Usage;
@@ -511,11 +898,53 @@ int main (int argc, char **argv)
 			} else {
 				goto Usage;
 			}
+		} else if (0 == strcmp(argv[i], "-c")) {
+			if (i + 1 <= argc - 1) {
+				capture_seconds = atoi(argv[++i]);
+			} else {
+				goto Usage;
+			}
+		} else if (0 == strcmp(argv[i], "-u")) {
+			if (i + 1 <= argc - 1) {
+				synthetic_presses = strtoul(argv[++i], NULL, 0);
+			} else {
+				goto Usage;
+			}
+		} else if (0 == strcmp(argv[i], "-i")) {
+			if (i + 1 <= argc - 1) {
+				synthetic_interval_us = atoi(argv[++i]);
+			} else {
+				goto Usage;
+			}
+		} else if (0 == strcmp(argv[i], "-o")) {
+			if (i + 1 <= argc - 1) {
+				save_path = argv[++i];
+			} else {
+				goto Usage;
+			}
 		} else {
 			path_index = i;
+			if (num_paths < MAX_CAPTURE_DEVICES)
+				paths[num_paths++] = argv[i];
 		}
 	}
 
+	if (capture_seconds >= 0 || synthetic_presses) {
+		/* Don't hang on lost synthetic events: they show in the count. */
+		if (capture_seconds < 0 && synthetic_presses)
+			capture_seconds = synthetic_presses *
+				synthetic_interval_us / 1000000 +
+				SYNTHETIC_SLACK_SECONDS;
+		if (capture_seconds < 0)
+			capture_seconds = 0;
+		return do_capture(paths, num_paths, capture_seconds,
+				  synthetic_presses, synthetic_interval_us,
+				  save_path);
+	}
+
+	if (!num_paths)
+		goto Usage;
+
 	if ((fd = open(argv[path_index], O_RDONLY)) < 0) {
 		perror("evtest");
 		return 1;
@@ -544,5 +973,14 @@ Usage:
 	printf("  -n		Show number of keys supported by eventX\n");
 	printf("  -s Keyname	Outputs 1 if key is supported. Outputs 0 if not\n");
 	printf("  -k		Captures one full keystroke (down and up). Outputs keyname.\n");
+	printf("Capture mode: evtest [-c seconds] [-u presses [-i usec]] [-o file] "
+	       "[/dev/input/eventX ...]\n");
+	printf("  -c seconds	Capture from all given devices, report event rate and\n"
+	       "		kernel-to-userspace latency (0: until -u events arrive;\n"
+	       "		default with -u: typing time plus %d)\n",
+	       SYNTHETIC_SLACK_SECONDS);
+	printf("  -u presses	Also create a uinput keyboard and type this many keys\n");
+	printf("  -i usec	Delay between synthetic key presses (default 1000)\n");
+	printf("  -o file	Save captured events as binary records\n");
 	return 1;
 }
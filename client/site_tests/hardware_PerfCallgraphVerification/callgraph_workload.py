@@ -0,0 +1,163 @@
+#!/usr/bin/python
+# Copyright 2015 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+"""Generates synthetic call-graph workloads for perf callchain testing.
+
+The generated program has |depth| levels of |fanout| functions each.  Every
+function picks one function of the next level from its argument, so there are
+fanout^depth distinct call paths but only depth * fanout functions.  The last
+level calls leaf(), which is where nearly all of the time is spent.  Options:
+
+  inline_every: mark every Nth level always_inline, so those frames vanish
+      from the unwound stack just as they do in optimized production code.
+  indirect: call through per-level function pointer tables, like the
+      trampolines of JIT-ed or plugin code.
+  recursion: enter the chain through this many frames of a recursive
+      function, to exercise deep stacks.
+  frame_pointers: build with -fno-omit-frame-pointer; otherwise frames are
+      only described by DWARF unwind info.
+"""
+
+import argparse
+import os
+import subprocess
+
+_HEADER = '''\
+/* Generated by callgraph_workload.py: %(config)s */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NOINLINE __attribute__((noinline))
+#define INLINE static inline __attribute__((always_inline))
+/* Hides the value from the optimizer so calls stay real (non-tail) calls. */
+#define KEEP(v) __asm__ volatile("" : "+r"(v))
+
+typedef unsigned long (*fn_t)(unsigned long);
+
+NOINLINE unsigned long leaf(unsigned long x) {
+    unsigned long i;
+    for (i = 0; i < %(leaf_work)d; i++)
+        x = x * 6364136223846793005UL + 1442695040888963407UL;
+    KEEP(x);
+    return x;
+}
+'''
+
+_RECURSE = '''
+NOINLINE unsigned long recurse(unsigned long n, unsigned long x) {
+    unsigned long r;
+    if (!n)
+        return %(entry)s;
+    r = recurse(n - 1, x);
+    KEEP(r);
+    return r + 1;
+}
+'''
+
+_MAIN = '''
+int main(void) {
+    unsigned long i, sum = 0;
+    for (i = 0; i < %(iterations)dUL; i++) {
+        sum += %(call)s;
+        KEEP(sum);
+    }
+    printf("%%lu\\n", sum);
+    return 0;
+}
+'''
+
+
+def function_name(level, index):
+    """Name of function |index| at call-graph level |level|."""
+    return 'f_%d_%d' % (level, index)
+
+
+def _dispatch(level, fanout, indirect, arg):
+    """C expression calling the level-|level| function chosen by |arg|."""
+    if indirect:
+        return 'level_%d[(%s) %% %d](%s)' % (level, arg, fanout, arg)
+    expr = '%s(%s)' % (function_name(level, fanout - 1), arg)
+    for i in reversed(range(fanout - 1)):
+        expr = '((%s) %% %d == %d ? %s(%s) : %s)' % (
+                arg, fanout, i, function_name(level, i), arg, expr)
+    return expr
+
+
+def generate(depth=8, fanout=2, inline_every=0, indirect=False, recursion=0,
+             iterations=200000, leaf_work=200):
+    """Returns the C source of a workload with the given shape."""
+    config = ('depth=%d fanout=%d inline_every=%d indirect=%d recursion=%d' %
+              (depth, fanout, inline_every, indirect, recursion))
+    src = [_HEADER % {'config': config, 'leaf_work': leaf_work}]
+    # Emit the deepest level first so every callee is defined before use.
+    for level in reversed(range(depth)):
+        if level + 1 < depth:
+            callee = _dispatch(level + 1, fanout, indirect,
+                               'x / %d' % fanout)
+        else:
+            callee = 'leaf(x)'
+        inline = inline_every and level % inline_every == inline_every - 1
+        for i in range(fanout):
+            src.append('%s unsigned long %s(unsigned long x) {\n'
+                       '    unsigned long r = %s;\n'
+                       '    KEEP(r);\n'
+                       '    return r + %d;\n'
+                       '}\n' % ('INLINE' if inline else 'NOINLINE',
+                                function_name(level, i), callee, i))
+        if indirect:
+            src.append('static fn_t const level_%d[] = { %s };\n' % (
+                    level, ', '.join(function_name(level, i)
+                                     for i in range(fanout))))
+    entry = _dispatch(0, fanout, indirect, 'x')
+    if recursion:
+        src.append(_RECURSE % {'entry': entry})
+        call = 'recurse(%d, i)' % recursion
+    else:
+        call = _dispatch(0, fanout, indirect, 'i')
+    src.append(_MAIN % {'iterations': iterations, 'call': call})
+    return '\n'.join(src)
+
+
+def expected_frames(depth, inline_every=0, recursion=0):
+    """Number of frames a full unwind from leaf() up to main() contains."""
+    inlined = depth // inline_every if inline_every else 0
+    # leaf + visible chain levels + recursion (n..0 inclusive) + main
+    return 1 + depth - inlined + (recursion + 1 if recursion else 0) + 1
+
+
+def build(output, frame_pointers=True, cc='gcc', **shape):
+    """Generates and compiles a workload to the binary |output|."""
+    source = output + '.c'
+    with open(source, 'w') as f:
+        f.write(generate(**shape))
+    cflags = ['-O2', '-g']
+    if frame_pointers:
+        cflags.append('-fno-omit-frame-pointer')
+    else:
+        cflags += ['-fomit-frame-pointer', '-fasynchronous-unwind-tables']
+    subprocess.check_call([cc] + cflags + ['-o', output, source])
+    return output
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('output', help='binary to build (source: OUTPUT.c)')
+    parser.add_argument('--depth', type=int, default=8)
+    parser.add_argument('--fanout', type=int, default=2)
+    parser.add_argument('--inline-every', type=int, default=0)
+    parser.add_argument('--indirect', action='store_true')
+    parser.add_argument('--recursion', type=int, default=0)
+    parser.add_argument('--iterations', type=int, default=200000)
+    parser.add_argument('--no-frame-pointers', action='store_true')
+    args = parser.parse_args()
+    build(os.path.abspath(args.output),
+          frame_pointers=not args.no_frame_pointers, depth=args.depth,
+          fanout=args.fanout, inline_every=args.inline_every,
+          indirect=args.indirect, recursion=args.recursion,
+          iterations=args.iterations)
+
+
+if __name__ == '__main__':
+    main()
@@ -2,12 +2,34 @@
 # Use of this source code is governed by a BSD-style license that can be
 # found in the LICENSE file.
 
-import os, subprocess
+import logging, os, subprocess, time
 
 from autotest_lib.client.bin import test
 from autotest_lib.client.bin import utils
 from autotest_lib.client.common_lib import error
 
+import callgraph_workload
+
+# Workload shapes for the unwinding benchmark: name -> callgraph_workload args.
+# The recursion is further limited to what kernel.perf_event_max_stack lets
+# the kernel record.
+WORKLOADS = {
+    'chain': dict(depth=8, fanout=1),
+    'wide': dict(depth=12, fanout=4),
+    'inlined': dict(depth=16, fanout=2, inline_every=2),
+    'indirect': dict(depth=12, fanout=4, indirect=True),
+    'recursive': dict(depth=4, fanout=2, recursion=100),
+}
+
+# perf --call-graph modes to compare.
+CALLGRAPH_MODES = ['fp', 'dwarf', 'lbr']
+
+# Callchain depth cap before kernel.perf_event_max_stack made it tunable.
+DEFAULT_MAX_STACK = 127
+# Frames of a sample that are not part of the workload's stack: the context
+# markers perf puts in the callchain and the odd kernel frame.
+MAX_STACK_HEADROOM = 8
+
 def chain_length(line):
     """
     Return the length of a chain in |line|.
@@ -56,11 +78,18 @@ class hardware_PerfCallgraphVerification(test.test):
                 return True
         return False
 
-    def run_once(self):
+    def run_once(self, benchmark=False):
         """
         Collect a perf callchain profile and check the detailed perf report.
 
+        @param benchmark: instead of the basic check, measure unwinding
+                overhead and completeness for generated workloads in each
+                callgraph mode.
         """
+        if benchmark:
+            self.run_unwind_benchmark()
+            return
+
         # Waiting on ARM/perf support
         if not utils.get_current_kernel_arch().startswith('x86'):
             return
@@ -102,3 +131,122 @@ class hardware_PerfCallgraphVerification(test.test):
         if not result:
             raise error.TestFail('Callchain not found')
 
+
+    def unwind_stats(self, perf_file_path, binary):
+        """
+        Return (samples, complete, mean depth) for samples in |binary|.
+
+        A sample is complete if its unwound stack reaches main().  'perf
+        script' prints one line per sample followed by one indented line per
+        frame and a blank line.
+        """
+        args = ['perf', 'script', '-F', 'comm,ip,sym', '-i', perf_file_path]
+        comm = os.path.basename(binary)[:15]
+        samples = complete = frames = 0
+        stack = None
+        p = subprocess.Popen(args, stdout=subprocess.PIPE)
+        for line in list(p.stdout) + ['']:
+            if not line.strip():
+                if stack is not None:
+                    samples += 1
+                    frames += len(stack)
+                    if 'main' in stack:
+                        complete += 1
+                stack = None
+            elif not line[0].isspace():
+                stack = [] if line.split()[0] == comm else None
+            elif stack is not None:
+                fields = line.split()
+                if len(fields) > 1:
+                    stack.append(fields[1].split('+')[0])
+        p.wait()
+        return samples, complete, frames / float(samples or 1)
+
+    def max_stack(self):
+        """Return the deepest callchain the kernel records for a sample."""
+        try:
+            return int(utils.read_one_line(
+                    '/proc/sys/kernel/perf_event_max_stack'))
+        except (IOError, ValueError):
+            return DEFAULT_MAX_STACK
+
+    def record_time(self, mode, perf_file_path, binary):
+        """
+        Return how long perf record in callgraph |mode| takes to run
+        |binary|, or None if perf does not support |mode|.
+        """
+        args = ['perf', 'record', '-e', 'cycles', '--call-graph', mode,
+                '-o', perf_file_path, '--', binary]
+        start = time.time()
+        try:
+            subprocess.check_output(args, stderr=subprocess.STDOUT)
+        except subprocess.CalledProcessError as cmd_error:
+            # lbr needs Intel LBR call stacks; dwarf needs libunwind/libdw
+            # support in perf.
+            logging.info('perf --call-graph %s unsupported: %s', mode,
+                         cmd_error.output)
+            return None
+        return time.time() - start
+
+    def run_unwind_benchmark(self):
+        """
+        For every workload and callgraph mode, record the workload with perf
+        and report the run time overhead over an unprofiled run and how many
+        samples were completely unwound.
+
+        The workloads only run for a fraction of a second, so the time perf
+        record takes over a no-op program is taken out of the overhead.
+        """
+        perf_file_path = os.path.join(self.tmpdir, 'perf.data')
+        startup = {}
+        for mode in CALLGRAPH_MODES:
+            elapsed = self.record_time(mode, perf_file_path, '/bin/true')
+            if elapsed is not None:
+                startup[mode] = elapsed
+                os.remove(perf_file_path)
+
+        max_stack = self.max_stack()
+        for frame_pointers in (True, False):
+            for name, shape in sorted(WORKLOADS.iteritems()):
+                name = '%s_%s' % (name, 'fp' if frame_pointers else 'nofp')
+                if shape.get('recursion'):
+                    # Deeper stacks are truncated, never complete samples.
+                    chain = callgraph_workload.expected_frames(
+                            shape['depth'], shape.get('inline_every', 0))
+                    shape = dict(shape, recursion=min(
+                            shape['recursion'],
+                            max_stack - MAX_STACK_HEADROOM - chain - 1))
+                binary = callgraph_workload.build(
+                        os.path.join(self.tmpdir, name),
+                        frame_pointers=frame_pointers, **shape)
+                expected = callgraph_workload.expected_frames(
+                        shape['depth'], shape.get('inline_every', 0),
+                        shape.get('recursion', 0))
+
+                start = time.time()
+                utils.system(binary)
+                baseline = time.time() - start
+
+                for mode in [m for m in CALLGRAPH_MODES if m in startup]:
+                    elapsed = self.record_time(mode, perf_file_path, binary)
+                    if elapsed is None:
+                        continue
+                    elapsed -= startup[mode]
+                    samples, complete, depth = self.unwind_stats(
+                            perf_file_path, binary)
+                    os.remove(perf_file_path)
+
+                    key = '%s_%s' % (name, mode)
+                    self.output_perf_value(
+                            description='overhead_' + key,
+                            value=100.0 * (elapsed - baseline) / baseline,
+                            units='percent', higher_is_better=False)
+                    self.output_perf_value(
+                            description='complete_' + key,
+                            value=100.0 * complete / max(samples, 1),
+                            units='percent', higher_is_better=True)
+                    self.output_perf_value(
+                            description='depth_' + key,
+                            value=depth / expected * 100.0,
+                            units='percent_of_expected',
+                            higher_is_better=True)
@@ -0,0 +1,641 @@
+/* AF_ALG throughput and latency benchmark
+ *
+ * Runs hash, skcipher or aead requests of the given sizes through the
+ * kernel crypto user API from one or more threads, each with its own
+ * operation socket, and reports throughput and per request latency.
+ *
+ * Data reaches the kernel through one of three paths:
+ *   sendmsg  sendmsg() the request and read() the result
+ *   splice   vmsplice() the request into a pipe and splice() it into the
+ *            socket, so the pages are not copied on the way in
+ *   user     no kernel at all: the same algorithm in OpenSSL, which uses
+ *            the CPU's SIMD and crypto instructions (when built with it)
+ *
+ * Results are printed as "crypto_bench: ..." lines of key=value pairs.
+ * Exits with 2 when the algorithm or path is not available at all, and
+ * with 1 on any other failure, including results that differ between
+ * paths.
+ */
+#define _GNU_SOURCE
+#include <linux/if_alg.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+#endif
+#ifndef AF_ALG
+#define AF_ALG 38
+#endif
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+
+#define MAX_KEY_SIZE	64
+#define MAX_DIGEST_SIZE	64
+#define MAX_IV_SIZE	16
+#define PAGE_ALIGN	4096
+
+/* skcipher and aead requests must fit in the socket's send buffer */
+#define MAX_CIPHER_SIZE	65536
+
+#define EXIT_UNAVAILABLE	2
+
+enum type { HASH, SKCIPHER, AEAD };
+enum path { PATH_SENDMSG, PATH_SPLICE, PATH_USER };
+
+static const char *type_names[] = { "hash", "skcipher", "aead" };
+static const char *path_names[] = { "sendmsg", "splice", "user" };
+
+static struct {
+	enum type type;
+	const char *alg;
+	enum path path;
+	int keylen;
+	int ivlen;
+	int authsize;
+	int assoclen;
+	int threads;
+	int duration_ms;
+} cfg = {
+	.type = HASH,
+	.alg = "sha256",
+	.path = PATH_SENDMSG,
+	.ivlen = -1,
+	.authsize = 16,
+	.assoclen = 16,
+	.threads = 1,
+	.duration_ms = 1000,
+};
+
+static int tfm_fd = -1;
+static unsigned char key[MAX_KEY_SIZE];
+static unsigned char iv[MAX_IV_SIZE];
+static pthread_barrier_t start_barrier;
+/* No implementation of the algorithm for the path: not a failure. */
+static int unavailable;
+
+struct worker {
+	pthread_t thread;
+	int opfd;
+	int pipefd[2];
+	size_t pipe_size;
+	unsigned char *in, *out;
+	size_t inlen, outlen;
+	uint64_t *lat_ns;
+	size_t nlat, cap;
+	uint64_t elapsed_ns;
+	int err;
+#ifdef HAVE_OPENSSL
+	EVP_MD_CTX *md;
+	EVP_CIPHER_CTX *cipher;
+#endif
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int setup_tfm(void)
+{
+	struct sockaddr_alg sa = { .salg_family = AF_ALG };
+
+	tfm_fd = socket(AF_ALG, SOCK_SEQPACKET, 0);
+	if (tfm_fd < 0) {
+		perror("socket(AF_ALG)");
+		unavailable = 1;
+		return -1;
+	}
+	strncpy((char *)sa.salg_type, type_names[cfg.type],
+		sizeof(sa.salg_type) - 1);
+	strncpy((char *)sa.salg_name, cfg.alg, sizeof(sa.salg_name) - 1);
+	if (bind(tfm_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		unavailable = errno == ENOENT;
+		perror("bind");
+		return -1;
+	}
+	if (cfg.keylen &&
+	    setsockopt(tfm_fd, SOL_ALG, ALG_SET_KEY, key, cfg.keylen) < 0) {
+		perror("setsockopt(ALG_SET_KEY)");
+		return -1;
+	}
+	if (cfg.type == AEAD &&
+	    setsockopt(tfm_fd, SOL_ALG, ALG_SET_AEAD_AUTHSIZE, NULL,
+		       cfg.authsize) < 0) {
+		perror("setsockopt(ALG_SET_AEAD_AUTHSIZE)");
+		return -1;
+	}
+	return 0;
+}
+
+/* Sends data, with the operation, IV and associated data length for
+ * ciphers, as (the start of) one request. */
+static ssize_t send_request(int fd, const void *data, size_t len, int flags)
+{
+	char cbuf[CMSG_SPACE(sizeof(uint32_t)) * 2 +
+		  CMSG_SPACE(sizeof(struct af_alg_iv) + MAX_IV_SIZE)];
+	struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+	struct cmsghdr *cmsg;
+	struct af_alg_iv *alg_iv;
+
+	if (cfg.type == HASH)
+		return sendmsg(fd, &msg, flags);
+
+	memset(cbuf, 0, sizeof(cbuf));
+	msg.msg_control = cbuf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(uint32_t));
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_ALG;
+	cmsg->cmsg_type = ALG_SET_OP;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+	*(uint32_t *)CMSG_DATA(cmsg) = ALG_OP_ENCRYPT;
+
+	if (cfg.ivlen) {
+		cmsg = (struct cmsghdr *)(cbuf + msg.msg_controllen);
+		msg.msg_controllen +=
+			CMSG_SPACE(sizeof(struct af_alg_iv) + cfg.ivlen);
+		cmsg->cmsg_level = SOL_ALG;
+		cmsg->cmsg_type = ALG_SET_IV;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) +
+					  cfg.ivlen);
+		alg_iv = (struct af_alg_iv *)CMSG_DATA(cmsg);
+		alg_iv->ivlen = cfg.ivlen;
+		memcpy(alg_iv->iv, iv, cfg.ivlen);
+	}
+
+	if (cfg.type == AEAD) {
+		cmsg = (struct cmsghdr *)(cbuf + msg.msg_controllen);
+		msg.msg_controllen += CMSG_SPACE(sizeof(uint32_t));
+		cmsg->cmsg_level = SOL_ALG;
+		cmsg->cmsg_type = ALG_SET_AEAD_ASSOCLEN;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+		*(uint32_t *)CMSG_DATA(cmsg) = cfg.assoclen;
+	}
+
+	return sendmsg(fd, &msg, flags);
+}
+
+/* Moves the request into the socket through the worker's pipe. */
+static int splice_request(struct worker *w)
+{
+	size_t off = 0;
+
+	while (off < w->inlen) {
+		struct iovec iov = {
+			.iov_base = w->in + off,
+			.iov_len = w->inlen - off < w->pipe_size ?
+				   w->inlen - off : w->pipe_size,
+		};
+		ssize_t n = vmsplice(w->pipefd[1], &iov, 1, 0);
+
+		if (n <= 0)
+			return -1;
+		off += n;
+		while (n > 0) {
+			ssize_t m = splice(w->pipefd[0], NULL, w->opfd, NULL,
+					   n, off < w->inlen ? SPLICE_F_MORE : 0);
+			if (m <= 0)
+				return -1;
+			n -= m;
+		}
+	}
+	return 0;
+}
+
+static ssize_t read_result(struct worker *w)
+{
+	size_t off = 0;
+
+	/* A digest comes in one piece; cipher output may not. */
+	do {
+		ssize_t n = read(w->opfd, w->out + off, w->outlen - off);
+
+		if (n <= 0)
+			return n;
+		off += n;
+	} while (cfg.type != HASH && off < w->outlen);
+	return off;
+}
+
+static int kernel_request(struct worker *w)
+{
+	if (cfg.path == PATH_SENDMSG) {
+		if (send_request(w->opfd, w->in, w->inlen, 0) !=
+		    (ssize_t)w->inlen)
+			return -1;
+	} else {
+		if (cfg.type != HASH &&
+		    send_request(w->opfd, NULL, 0, MSG_MORE) < 0)
+			return -1;
+		if (splice_request(w) < 0)
+			return -1;
+	}
+	return read_result(w) > 0 ? 0 : -1;
+}
+
+#ifdef HAVE_OPENSSL
+/* Maps a kernel name like "cbc(aes)" with a 16 byte key to OpenSSL's
+ * "aes-128-cbc". */
+static const EVP_CIPHER *user_cipher(void)
+{
+	char mode[16], name[32];
+
+	if (sscanf(cfg.alg, "%15[a-z0-9](aes)", mode) != 1)
+		return NULL;
+	/* An XTS key is two AES keys. */
+	snprintf(name, sizeof(name), "aes-%d-%s",
+		 cfg.keylen * (strcmp(mode, "xts") ? 8 : 4), mode);
+	return EVP_get_cipherbyname(name);
+}
+
+static int user_setup(struct worker *w)
+{
+	if (cfg.type == HASH) {
+		const EVP_MD *md = EVP_get_digestbyname(cfg.alg);
+
+		w->md = EVP_MD_CTX_create();
+		return md && w->md && EVP_DigestInit_ex(w->md, md, NULL) ?
+		       0 : -1;
+	}
+	w->cipher = EVP_CIPHER_CTX_new();
+	if (!w->cipher || !user_cipher())
+		return -1;
+	return EVP_EncryptInit_ex(w->cipher, user_cipher(), NULL, key, iv) ?
+	       0 : -1;
+}
+
+static int user_request(struct worker *w)
+{
+	unsigned char *out = w->out;
+	int len;
+
+	if (cfg.type == HASH) {
+		unsigned int mdlen;
+
+		return EVP_DigestInit_ex(w->md, NULL, NULL) &&
+		       EVP_DigestUpdate(w->md, w->in, w->inlen) &&
+		       EVP_DigestFinal_ex(w->md, w->out, &mdlen) ? 0 : -1;
+	}
+
+	if (!EVP_EncryptInit_ex(w->cipher, NULL, NULL, NULL, iv))
+		return -1;
+	EVP_CIPHER_CTX_set_padding(w->cipher, 0);
+	if (cfg.type == AEAD) {
+		/* Same layout as the kernel: associated data, ciphertext,
+		 * tag. */
+		memcpy(out, w->in, cfg.assoclen);
+		if (!EVP_EncryptUpdate(w->cipher, NULL, &len, w->in,
+				       cfg.assoclen))
+			return -1;
+		out += cfg.assoclen;
+	}
+	if (!EVP_EncryptUpdate(w->cipher, out, &len, w->in + cfg.assoclen *
+			       (cfg.type == AEAD),
+			       w->inlen - cfg.assoclen * (cfg.type == AEAD)))
+		return -1;
+	out += len;
+	if (!EVP_EncryptFinal_ex(w->cipher, out, &len))
+		return -1;
+	out += len;
+	if (cfg.type == AEAD &&
+	    !EVP_CIPHER_CTX_ctrl(w->cipher, EVP_CTRL_GCM_GET_TAG, cfg.authsize,
+				 out))
+		return -1;
+	return 0;
+}
+#else
+static int user_setup(struct worker *w)
+{
+	return -1;
+}
+
+static int user_request(struct worker *w)
+{
+	return -1;
+}
+#endif
+
+static int request(struct worker *w)
+{
+	return cfg.path == PATH_USER ? user_request(w) : kernel_request(w);
+}
+
+static int setup_worker(struct worker *w, size_t size)
+{
+	memset(w, 0, sizeof(*w));
+	w->opfd = w->pipefd[0] = w->pipefd[1] = -1;
+	w->inlen = size + (cfg.type == AEAD ? cfg.assoclen : 0);
+	w->outlen = cfg.type == HASH ? MAX_DIGEST_SIZE :
+		    w->inlen + (cfg.type == AEAD ? cfg.authsize : 0);
+	if (posix_memalign((void **)&w->in, PAGE_ALIGN, w->inlen) ||
+	    posix_memalign((void **)&w->out, PAGE_ALIGN, w->outlen))
+		return -1;
+	memset(w->in, 0x5a, w->inlen);
+	memset(w->out, 0, w->outlen);
+
+	if (cfg.path == PATH_USER) {
+		if (user_setup(w) < 0) {
+			fprintf(stderr, "%s not available in user space\n",
+				cfg.alg);
+			unavailable = 1;
+			return -1;
+		}
+		return 0;
+	}
+
+	w->opfd = accept(tfm_fd, NULL, 0);
+	if (w->opfd < 0) {
+		perror("accept");
+		return -1;
+	}
+	if (cfg.path == PATH_SPLICE) {
+		int size;
+
+		if (pipe(w->pipefd) < 0) {
+			perror("pipe");
+			return -1;
+		}
+		/* Fewer, bigger splices when the pipe may grow. */
+		size = fcntl(w->pipefd[1], F_SETPIPE_SZ, (int)w->inlen);
+		if (size < 0)
+			size = fcntl(w->pipefd[1], F_GETPIPE_SZ);
+		w->pipe_size = size > 0 ? size : 65536;
+	}
+	return 0;
+}
+
+static void cleanup_worker(struct worker *w)
+{
+	if (w->opfd >= 0)
+		close(w->opfd);
+	if (w->pipefd[0] >= 0) {
+		close(w->pipefd[0]);
+		close(w->pipefd[1]);
+	}
+#ifdef HAVE_OPENSSL
+	if (w->md)
+		EVP_MD_CTX_destroy(w->md);
+	if (w->cipher)
+		EVP_CIPHER_CTX_free(w->cipher);
+#endif
+	free(w->in);
+	free(w->out);
+	free(w->lat_ns);
+}
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t start, end, deadline;
+
+	pthread_barrier_wait(&start_barrier);
+	start = now_ns();
+	deadline = start + cfg.duration_ms * 1000000ULL;
+	do {
+		uint64_t t0 = now_ns();
+
+		if (request(w) < 0) {
+			w->err = errno ? errno : EIO;
+			break;
+		}
+		end = now_ns();
+		if (w->nlat == w->cap) {
+			w->cap = w->cap ? w->cap * 2 : 4096;
+			w->lat_ns = realloc(w->lat_ns,
+					    w->cap * sizeof(*w->lat_ns));
+			if (!w->lat_ns) {
+				w->err = ENOMEM;
+				break;
+			}
+		}
+		w->lat_ns[w->nlat++] = end - t0;
+	} while (end < deadline);
+	w->elapsed_ns = now_ns() - start;
+	return NULL;
+}
+
+/* Checks that the request gives the same result as with sendmsg(). */
+static int verify(struct worker *w)
+{
+	enum path path = cfg.path;
+	unsigned char *expected;
+	struct worker ref;
+	int ret = -1;
+
+	if (path == PATH_SENDMSG || tfm_fd < 0)
+		return 0;
+
+	cfg.path = PATH_SENDMSG;
+	if (setup_worker(&ref, w->inlen - (cfg.type == AEAD ?
+					   cfg.assoclen : 0)) < 0 ||
+	    request(&ref) < 0) {
+		perror("sendmsg reference request");
+		goto out;
+	}
+	cfg.path = path;
+	expected = ref.out;
+	if (request(w) < 0) {
+		perror(path_names[path]);
+		goto out;
+	}
+	if (memcmp(w->out, expected,
+		   cfg.type == HASH ? MAX_DIGEST_SIZE : w->outlen)) {
+		fprintf(stderr, "%s result differs from sendmsg\n",
+			path_names[path]);
+		goto out;
+	}
+	ret = 0;
+out:
+	cfg.path = path;
+	cleanup_worker(&ref);
+	return ret;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int run_size(size_t size)
+{
+	struct worker *workers = calloc(cfg.threads, sizeof(*workers));
+	uint64_t *lat, elapsed = 0;
+	size_t total = 0, n = 0;
+	int i, ret = -1;
+
+	if (!workers)
+		return -1;
+	for (i = 0; i < cfg.threads; i++)
+		if (setup_worker(&workers[i], size) < 0)
+			goto out;
+	if (verify(&workers[0]) < 0)
+		goto out;
+
+	pthread_barrier_init(&start_barrier, NULL, cfg.threads);
+	for (i = 0; i < cfg.threads; i++) {
+		errno = pthread_create(&workers[i].thread, NULL, run_worker,
+				       &workers[i]);
+		if (errno) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < cfg.threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].err) {
+			fprintf(stderr, "%s %s request failed: %s\n",
+				path_names[cfg.path], cfg.alg,
+				strerror(workers[i].err));
+			goto out;
+		}
+		total += workers[i].nlat;
+		if (workers[i].elapsed_ns > elapsed)
+			elapsed = workers[i].elapsed_ns;
+	}
+	pthread_barrier_destroy(&start_barrier);
+
+	lat = malloc(total * sizeof(*lat));
+	if (!lat)
+		goto out;
+	for (i = 0; i < cfg.threads; i++) {
+		memcpy(lat + n, workers[i].lat_ns,
+		       workers[i].nlat * sizeof(*lat));
+		n += workers[i].nlat;
+	}
+	qsort(lat, total, sizeof(*lat), compare_u64);
+
+	printf("crypto_bench: type=%s alg=%s path=%s threads=%d size=%zu "
+	       "ops=%zu mb_per_sec=%.1f p50_us=%.2f p99_us=%.2f "
+	       "max_us=%.2f\n",
+	       type_names[cfg.type], cfg.alg, path_names[cfg.path],
+	       cfg.threads, size, total,
+	       (double)total * size * 1e3 / elapsed,
+	       lat[(total - 1) / 2] / 1e3, lat[(total - 1) * 99 / 100] / 1e3,
+	       lat[total - 1] / 1e3);
+	fflush(stdout);
+	free(lat);
+	ret = 0;
+out:
+	for (i = 0; i < cfg.threads; i++)
+		cleanup_worker(&workers[i]);
+	free(workers);
+	return ret;
+}
+
+static void usage(const char *program)
+{
+	fprintf(stderr,
+		"usage: %s [-t hash|skcipher|aead] [-a alg] [-k key_bytes]\n"
+		"       [-i iv_bytes] [-p sendmsg|splice|user] [-j threads]\n"
+		"       [-d duration_ms] size...\n",
+		program);
+	exit(1);
+}
+
+static int lookup(const char *name, const char **names, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (strcmp(name, names[i]) == 0)
+			return i;
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	int c, i, ret = 0;
+
+	while ((c = getopt(argc, argv, "t:a:k:i:p:j:d:")) != -1) {
+		switch (c) {
+		case 't':
+			cfg.type = lookup(optarg, type_names, 3);
+			if ((int)cfg.type < 0)
+				usage(argv[0]);
+			break;
+		case 'a':
+			cfg.alg = optarg;
+			break;
+		case 'k':
+			cfg.keylen = atoi(optarg);
+			break;
+		case 'i':
+			cfg.ivlen = atoi(optarg);
+			break;
+		case 'p':
+			cfg.path = lookup(optarg, path_names, 3);
+			if ((int)cfg.path < 0)
+				usage(argv[0]);
+			break;
+		case 'j':
+			cfg.threads = atoi(optarg);
+			break;
+		case 'd':
+			cfg.duration_ms = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	/* Defaults to the IV size of the usual AES modes. */
+	if (cfg.ivlen < 0)
+		cfg.ivlen = strncmp(cfg.alg, "ecb(", 4) == 0 ? 0 :
+			    strncmp(cfg.alg, "gcm(", 4) == 0 ? 12 : 16;
+	if (optind == argc || cfg.threads < 1 || cfg.keylen < 0 ||
+	    cfg.keylen > MAX_KEY_SIZE || (cfg.type != HASH && !cfg.keylen) ||
+	    cfg.ivlen > MAX_IV_SIZE)
+		usage(argv[0]);
+
+	for (i = 0; i < MAX_KEY_SIZE; i++)
+		key[i] = i;
+	for (i = 0; i < MAX_IV_SIZE; i++)
+		iv[i] = 0xa0 + i;
+
+	/* The user path still checks itself against the kernel when it
+	 * can, but does not need it. */
+	if (setup_tfm() < 0) {
+		if (cfg.path != PATH_USER)
+			return unavailable ? EXIT_UNAVAILABLE : 1;
+		if (tfm_fd >= 0)
+			close(tfm_fd);
+		tfm_fd = -1;
+		unavailable = 0;
+	}
+
+	for (i = optind; i < argc; i++) {
+		size_t size = strtoul(argv[i], NULL, 0);
+
+		if (!size || (cfg.type != HASH &&
+			      (size > MAX_CIPHER_SIZE || size % 16))) {
+			fprintf(stderr, "bad size %s\n", argv[i]);
+			ret = 1;
+			continue;
+		}
+		if (run_size(size) < 0) {
+			/* Missing for one size is missing for all. */
+			if (unavailable)
+				break;
+			ret = 1;
+		}
+	}
+
+	if (tfm_fd >= 0)
+		close(tfm_fd);
+	return ret ? ret : unavailable ? EXIT_UNAVAILABLE : 0;
+}
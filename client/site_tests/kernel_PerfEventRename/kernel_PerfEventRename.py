@@ -23,16 +23,83 @@ class kernel_PerfEventRename(test.test):
         97.43%        149  foobar_name  perf-rename-test   [.] 0x000006f8
     Bad output:
         96.54%        140  foobar_name  [unknown]          [.] 0x777046f3
+
+    With stress=True it instead runs perf-rename-stress, which records the
+    comm, fork and exit events of a tree of processes that rename, fork and
+    exec at high rates, once per ring buffer size. It reports the event
+    throughput, the events lost to a full ring buffer and the fraction of
+    renames whose comm event made it to the right task.
     """
-    version = 1
+    version = 2
     executable = 'perf-rename-test'
+    stress_executable = 'perf-rename-stress'
 
     # This runs during the build process
     def setup(self):
         os.chdir(self.srcdir)
-        utils.make(self.executable)
+        utils.make('%s %s' % (self.executable, self.stress_executable))
+
+    def run_stress(self, buffer_pages, workers, threads, rename_rate,
+                   fork_rate, exec_percent, duration_ms):
+        """Runs perf-rename-stress once per ring buffer size and reports."""
+        keyvals = {}
+        for pages in buffer_pages:
+            cmd = '%s -w %d -t %d -r %g -f %g -x %d -d %d -b %d' % (
+                    os.path.join(self.srcdir, self.stress_executable),
+                    workers, threads, rename_rate, fork_rate, exec_percent,
+                    duration_ms, pages)
+            output = utils.system_output(cmd, retain_output=True,
+                                         timeout=duration_ms / 1000 + 60)
+            results = {}
+            for line in output.splitlines():
+                if line.startswith('perf_rename_stress: '):
+                    results.update(field.split('=')
+                                   for field in line.split()[1:])
+
+            kb = int(results['buffer_kb'])
+            records = int(results['records'])
+            lost = int(results['lost'])
+            renames = int(results['renames'])
+            seen = int(results['renames_seen'])
+            misattributed = int(results['misattributed'])
+            for name, value in results.iteritems():
+                keyvals['perf_rename_stress_%dkb_%s' % (kb, name)] = value
+
+            lost_percent = 100.0 * lost / max(records + lost, 1)
+            seen_percent = 100.0 * seen / max(renames, 1)
+            self.output_perf_value(
+                    description='task_events_rate_%dkb' % kb,
+                    value=float(results['records_per_sec']),
+                    units='events_per_sec', higher_is_better=True)
+            self.output_perf_value(
+                    description='task_events_lost_%dkb' % kb,
+                    value=lost_percent, units='percent',
+                    higher_is_better=False)
+            self.output_perf_value(
+                    description='renames_attributed_%dkb' % kb,
+                    value=seen_percent, units='percent',
+                    higher_is_better=True)
+            logging.info('%d KB ring buffers: %s events/s, %.2f%% lost, '
+                         '%.2f%% of renames attributed',
+                         kb, results['records_per_sec'], lost_percent,
+                         seen_percent)
+
+            # Lost events are a sizing problem, but a comm event naming the
+            # wrong task is a kernel bug.
+            if misattributed:
+                raise error.TestFail('%d comm events attributed to the '
+                                     'wrong task' % misattributed)
+
+        self.write_perf_keyval(keyvals)
+
+    def run_once(self, stress=False, buffer_pages=(16, 64, 256), workers=4,
+                 threads=4, rename_rate=0, fork_rate=200, exec_percent=10,
+                 duration_ms=5000):
+        if stress:
+            self.run_stress(buffer_pages, workers, threads, rename_rate,
+                            fork_rate, exec_percent, duration_ms)
+            return
 
-    def run_once(self):
         # the rename program runs a crc loop for a while to ensure that we get
         # a good number of samples
         loops = 10 * 1000 * 1000
@@ -0,0 +1,490 @@
+/* Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Stress test for perf task events.
+ *
+ * A tree of worker processes keeps changing its tasks' names, forking and
+ * exec'ing at controlled rates. Meanwhile this program records the
+ * PERF_RECORD_COMM/FORK/EXIT events of the tree the way perf record does:
+ * one inherited dummy event per CPU, each with its own mmap ring buffer.
+ *
+ * Renaming threads call themselves "r<worker>.<thread>.<seq>" and write
+ * their tid and rename count to shared memory. A COMM record with such a
+ * name is attributed correctly when its tid is that thread's. Results are
+ * printed as "perf_rename_stress: ..." lines of key=value pairs.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef PERF_COUNT_SW_DUMMY
+#define PERF_COUNT_SW_DUMMY 9
+#endif
+
+#define MAX_WORKERS 64
+#define MAX_THREADS 64
+
+struct options {
+  int workers;         // processes, each forking children
+  int threads;         // renaming threads per worker
+  double rename_rate;  // renames per second per thread, 0 for no limit
+  double fork_rate;    // forks per second per worker
+  int exec_percent;    // forked children that exec instead of exiting
+  int duration_ms;
+  int buffer_pages;    // data pages per CPU ring buffer, a power of two
+};
+
+// What the workers did, in memory shared with them.
+struct thread_truth {
+  pid_t tid;
+  uint32_t renames;
+};
+
+struct worker_truth {
+  uint32_t forks;
+  uint32_t execs;
+  struct thread_truth threads[MAX_THREADS];
+};
+
+struct truth {
+  uint64_t deadline_ns;
+  struct worker_truth workers[MAX_WORKERS];
+};
+
+struct renamer {
+  pthread_t thread;
+  int worker, index;
+};
+
+struct ring {
+  int fd;
+  struct perf_event_mmap_page* page;
+  const char* data;
+  uint64_t size;
+};
+
+struct tally {
+  uint64_t records;
+  uint64_t comm, comm_exec, fork, exit, lost_records, lost;
+  uint64_t renames_seen, misattributed, child_renames_seen;
+};
+
+struct comm_record {
+  struct perf_event_header header;
+  uint32_t pid, tid;
+  char comm[16];
+};
+
+struct task_record {
+  struct perf_event_header header;
+  uint32_t pid, ppid;
+  uint32_t tid, ptid;
+  uint64_t time;
+};
+
+struct lost_record {
+  struct perf_event_header header;
+  uint64_t id;
+  uint64_t lost;
+};
+
+union record {
+  struct perf_event_header header;
+  struct comm_record comm;
+  struct task_record task;
+  struct lost_record lost;
+  char bytes[256];
+};
+
+static struct options options = {
+  .workers = 4,
+  .threads = 4,
+  .rename_rate = 0,
+  .fork_rate = 200,
+  .exec_percent = 10,
+  .duration_ms = 5000,
+  .buffer_pages = 16,
+};
+static struct truth* truth;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns) {
+  struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+         EINTR)
+    ;
+}
+
+static void* run_renamer(void* arg) {
+  struct renamer* r = arg;
+  struct thread_truth* t = &truth->workers[r->worker].threads[r->index];
+  uint64_t interval =
+      options.rename_rate > 0 ? 1e9 / options.rename_rate : 0;
+  uint64_t next = now_ns();
+  char name[16];
+
+  t->tid = syscall(SYS_gettid);
+  while (now_ns() < truth->deadline_ns) {
+    snprintf(name, sizeof(name), "r%d.%d.%u", r->worker, r->index,
+             t->renames);
+    if (prctl(PR_SET_NAME, name) < 0) {
+      perror("prctl(PR_SET_NAME)");
+      break;
+    }
+    t->renames++;
+    if (interval) {
+      next += interval;
+      sleep_until(next);
+    }
+  }
+  return NULL;
+}
+
+static void reap_children(int flags) {
+  while (waitpid(-1, NULL, flags) > 0)
+    ;
+}
+
+static void run_worker(int index) {
+  struct worker_truth* w = &truth->workers[index];
+  struct renamer renamers[MAX_THREADS];
+  uint64_t interval = options.fork_rate > 0 ? 1e9 / options.fork_rate : 0;
+  uint64_t next = now_ns();
+  int i;
+
+  for (i = 0; i < options.threads; i++) {
+    renamers[i].worker = index;
+    renamers[i].index = i;
+    errno = pthread_create(&renamers[i].thread, NULL, run_renamer,
+                           &renamers[i]);
+    if (errno) {
+      perror("pthread_create");
+      _exit(1);
+    }
+  }
+
+  while (interval && now_ns() < truth->deadline_ns) {
+    int exec = w->forks % 100 < (uint32_t)options.exec_percent;
+    pid_t pid = fork();
+
+    if (pid == 0) {
+      char name[16];
+
+      if (exec) {
+        execl("/proc/self/exe", "perf-rename-stress", "--child", NULL);
+        _exit(127);
+      }
+      snprintf(name, sizeof(name), "c%d.%u", index, w->forks);
+      prctl(PR_SET_NAME, name);
+      _exit(0);
+    }
+    if (pid < 0) {
+      perror("fork");
+      break;
+    }
+    w->forks++;
+    w->execs += exec;
+    reap_children(WNOHANG);
+    next += interval;
+    sleep_until(next);
+  }
+
+  for (i = 0; i < options.threads; i++)
+    pthread_join(renamers[i].thread, NULL);
+  reap_children(0);
+  _exit(0);
+}
+
+// The root of the traced tree waits until the events are open, then
+// starts the workers.
+static void run_root(int start_fd) {
+  char c;
+  int i;
+
+  if (read(start_fd, &c, 1) != 1)
+    _exit(1);
+  truth->deadline_ns = now_ns() + options.duration_ms * 1000000ULL;
+  for (i = 0; i < options.workers; i++) {
+    pid_t pid = fork();
+
+    if (pid == 0)
+      run_worker(i);
+    if (pid < 0) {
+      perror("fork");
+      break;
+    }
+  }
+  reap_children(0);
+  _exit(0);
+}
+
+static int open_ring(struct ring* ring, pid_t pid, int cpu) {
+  struct perf_event_attr attr;
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  void* map;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.config = PERF_COUNT_SW_DUMMY;
+  attr.inherit = 1;
+  attr.comm = 1;
+  attr.comm_exec = 1;
+  attr.task = 1;
+  attr.watermark = 1;
+  attr.wakeup_watermark = options.buffer_pages * page_size / 4;
+
+  ring->fd = syscall(__NR_perf_event_open, &attr, pid, cpu, -1, 0);
+  if (ring->fd < 0)
+    return -1;
+  ring->size = (uint64_t)options.buffer_pages * page_size;
+  map = mmap(NULL, ring->size + page_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED, ring->fd, 0);
+  if (map == MAP_FAILED) {
+    close(ring->fd);
+    return -1;
+  }
+  ring->page = map;
+  ring->data = (const char*)map + page_size;
+  return 0;
+}
+
+static void copy_from_ring(const struct ring* ring, uint64_t offset,
+                           void* dst, size_t len) {
+  size_t start = offset & (ring->size - 1);
+  size_t first = len < ring->size - start ? len : ring->size - start;
+
+  memcpy(dst, ring->data + start, first);
+  memcpy((char*)dst + first, ring->data, len - first);
+}
+
+static void count_record(const union record* r, struct tally* tally) {
+  unsigned w, t, seq;
+
+  tally->records++;
+  switch (r->header.type) {
+    case PERF_RECORD_COMM:
+      if (r->header.misc & PERF_RECORD_MISC_COMM_EXEC) {
+        tally->comm_exec++;
+        break;
+      }
+      tally->comm++;
+      if (sscanf(r->comm.comm, "r%u.%u.%u", &w, &t, &seq) == 3 &&
+          w < MAX_WORKERS && t < MAX_THREADS) {
+        if (truth->workers[w].threads[t].tid == (pid_t)r->comm.tid)
+          tally->renames_seen++;
+        else
+          tally->misattributed++;
+      } else if (r->comm.comm[0] == 'c') {
+        tally->child_renames_seen++;
+      }
+      break;
+    case PERF_RECORD_FORK:
+      tally->fork++;
+      break;
+    case PERF_RECORD_EXIT:
+      tally->exit++;
+      break;
+    case PERF_RECORD_LOST:
+      tally->lost_records++;
+      tally->lost += r->lost.lost;
+      break;
+  }
+}
+
+static void drain_ring(struct ring* ring, struct tally* tally) {
+  uint64_t head = ring->page->data_head;
+  uint64_t tail = ring->page->data_tail;
+
+  __sync_synchronize();
+  while (tail < head) {
+    union record record;
+
+    copy_from_ring(ring, tail, &record.header, sizeof(record.header));
+    if (record.header.size < sizeof(record.header))
+      break;
+    if (record.header.size <= sizeof(record)) {
+      copy_from_ring(ring, tail, &record, record.header.size);
+      count_record(&record, tally);
+    }
+    tail += record.header.size;
+  }
+  __sync_synchronize();
+  ring->page->data_tail = tail;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [-w workers] [-t threads] [-r renames_per_sec]\n"
+          "          [-f forks_per_sec] [-x exec_percent] [-d duration_ms]\n"
+          "          [-b buffer_pages]\n",
+          program);
+}
+
+int main(int argc, char* argv[]) {
+  struct ring* rings;
+  struct pollfd* fds;
+  struct tally tally;
+  uint64_t renames = 0, forks = 0, execs = 0, tasks, start, elapsed;
+  int ncpus, nrings = 0, cpu, c, i, j, status;
+  int start_pipe[2];
+  pid_t root;
+
+  // Exec'd children only have to generate their exec COMM record.
+  if (argc == 2 && strcmp(argv[1], "--child") == 0)
+    return 0;
+
+  while ((c = getopt(argc, argv, "w:t:r:f:x:d:b:")) != -1) {
+    switch (c) {
+      case 'w':
+        options.workers = atoi(optarg);
+        break;
+      case 't':
+        options.threads = atoi(optarg);
+        break;
+      case 'r':
+        options.rename_rate = atof(optarg);
+        break;
+      case 'f':
+        options.fork_rate = atof(optarg);
+        break;
+      case 'x':
+        options.exec_percent = atoi(optarg);
+        break;
+      case 'd':
+        options.duration_ms = atoi(optarg);
+        break;
+      case 'b':
+        options.buffer_pages = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc || options.workers < 1 ||
+      options.workers > MAX_WORKERS || options.threads < 0 ||
+      options.threads > MAX_THREADS || options.buffer_pages < 1 ||
+      (options.buffer_pages & (options.buffer_pages - 1))) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  truth = mmap(NULL, sizeof(*truth), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (truth == MAP_FAILED || pipe(start_pipe) < 0) {
+    perror("setup");
+    return 1;
+  }
+  root = fork();
+  if (root < 0) {
+    perror("fork");
+    return 1;
+  }
+  if (root == 0) {
+    close(start_pipe[1]);
+    run_root(start_pipe[0]);
+  }
+  close(start_pipe[0]);
+
+  ncpus = sysconf(_SC_NPROCESSORS_CONF);
+  rings = calloc(ncpus, sizeof(*rings));
+  fds = calloc(ncpus, sizeof(*fds));
+  for (cpu = 0; cpu < ncpus; cpu++) {
+    // Offline CPUs fail to open; their tasks will run elsewhere.
+    if (open_ring(&rings[nrings], root, cpu) < 0) {
+      if (errno != ENODEV && errno != EINVAL) {
+        perror("perf_event_open");
+        kill(root, SIGKILL);
+        return 1;
+      }
+      continue;
+    }
+    fds[nrings].fd = rings[nrings].fd;
+    fds[nrings].events = POLLIN;
+    nrings++;
+  }
+  if (!nrings) {
+    fprintf(stderr, "no CPU could be traced\n");
+    kill(root, SIGKILL);
+    return 1;
+  }
+
+  memset(&tally, 0, sizeof(tally));
+  start = now_ns();
+  if (write(start_pipe[1], "s", 1) != 1) {
+    perror("write");
+    return 1;
+  }
+  for (;;) {
+    poll(fds, nrings, 10);
+    for (i = 0; i < nrings; i++)
+      drain_ring(&rings[i], &tally);
+    if (waitpid(root, &status, WNOHANG) == root)
+      break;
+  }
+  elapsed = now_ns() - start;
+  for (i = 0; i < nrings; i++)
+    drain_ring(&rings[i], &tally);
+
+  for (i = 0; i < options.workers; i++) {
+    forks += truth->workers[i].forks;
+    execs += truth->workers[i].execs;
+    for (j = 0; j < options.threads; j++)
+      renames += truth->workers[i].threads[j].renames;
+  }
+  // Every worker process, renaming thread and forked child is one task
+  // created under the root and one task exit.
+  tasks = options.workers * (1 + options.threads) + forks;
+
+  printf("perf_rename_stress: cpus=%d buffer_kb=%lu duration_ms=%.0f "
+         "records=%llu records_per_sec=%.0f\n",
+         nrings, (unsigned long)(rings[0].size / 1024), elapsed / 1e6,
+         (unsigned long long)tally.records, tally.records * 1e9 / elapsed);
+  printf("perf_rename_stress: comm=%llu comm_exec=%llu fork=%llu exit=%llu "
+         "lost=%llu lost_records=%llu\n",
+         (unsigned long long)tally.comm, (unsigned long long)tally.comm_exec,
+         (unsigned long long)tally.fork, (unsigned long long)tally.exit,
+         (unsigned long long)tally.lost,
+         (unsigned long long)tally.lost_records);
+  printf("perf_rename_stress: renames=%llu renames_seen=%llu "
+         "misattributed=%llu child_renames_seen=%llu forks=%llu execs=%llu "
+         "tasks=%llu\n",
+         (unsigned long long)renames, (unsigned long long)tally.renames_seen,
+         (unsigned long long)tally.misattributed,
+         (unsigned long long)tally.child_renames_seen,
+         (unsigned long long)forks, (unsigned long long)execs,
+         (unsigned long long)tasks);
+
+  for (i = 0; i < nrings; i++)
+    close(rings[i].fd);
+  free(fds);
+  free(rings);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+# Copyright 2016 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+import logging
+
+from autotest_lib.client.common_lib import error
+from autotest_lib.client.cros.crash import user_crash_test
+
+
+# Name, crash count, crashes per second (0 for all at once), crash types.
+_SCENARIOS = [
+    ('burst', 100, 0, ('segv',)),
+    ('steady', 100, 20, ('segv', 'abort', 'stack')),
+    ('large_cores', 16, 0, ('heap',)),
+]
+
+_LATENCY_METRICS = ['exit_ms', 'dump_ms', 'queue_ms']
+_PERCENTILES = ['p50', 'p90', 'p99', 'max']
+
+
+class logging_CrashStorm(user_crash_test.UserCrashTest):
+    """Measures the crash pipeline while many processes crash at once."""
+    version = 1
+
+
+    def _test_crash_storm(self):
+        """Runs every storm scenario and reports its latencies."""
+        for name, count, rate, types in _SCENARIOS:
+            self._clear_spooled_crashes()
+            result = self._run_crash_storm(count, rate=rate, types=types,
+                                           heap_mb=self._heap_mb)
+            logging.info('%s: %s', name, result)
+
+            if result.get('handshakes') != count:
+                raise error.TestFail('%s: only %d of %d crashers started' %
+                                     (name, result.get('handshakes', 0),
+                                      count))
+            if not result.get('queued'):
+                raise error.TestFail('%s: no crash report was queued' % name)
+
+            keyvals = {}
+            for key in ('crashes', 'dumped', 'queued'):
+                keyvals['%s_%s' % (name, key)] = int(result[key])
+            self.write_perf_keyval(keyvals)
+            for metric in _LATENCY_METRICS:
+                for percentile in _PERCENTILES:
+                    key = '%s_%s' % (metric, percentile)
+                    if key not in result:
+                        continue
+                    self.output_perf_value(
+                            description='%s_%s' % (name, key),
+                            value=result[key],
+                            units='milliseconds',
+                            higher_is_better=False)
+            self.output_perf_value(
+                    description='%s_reports_per_sec' % name,
+                    value=result.get('reports_per_sec', 0),
+                    units='reports_per_sec',
+                    higher_is_better=True)
+
+
+    def run_once(self, heap_mb=64):
+        self._heap_mb = heap_mb
+        self._prepare_crasher()
+        self.run_crash_tests(['crash_storm'], initialize_crash_reporter=True)
@@ -8,7 +8,7 @@ from autotest_lib.client.bin import test, utils
 from autotest_lib.client.common_lib import error
 
 class network_WiFiCaps(test.test):
-    version = 1
+    version = 2
 
     def setup(self):
         self.job.setup_dep(['iwcap'])
@@ -32,14 +32,65 @@ class network_WiFiCaps(test.test):
         return results
 
 
-    def __run_iwcap(self, phy, caps):
+    def __run_iwcap(self, phys, caps):
+        """Query the caps of all phys with a single iwcap in batch mode.
+
+        @param phys: List of phy names.
+        @param caps: List of capabilities to check.
+        @return Dict of phy to the dict of its parsed capabilities.
+        """
         iwcapdir = os.path.join(self.autodir, 'deps', 'iwcap', 'iwcap')
-        iwcap = utils.run(iwcapdir + ' ' + phy + ' ' + string.join(caps))
-        return self.__parse_iwcap(iwcap.stdout)
+        queries = ''.join('%s %s\n' % (phy, string.join(caps))
+                          for phy in phys)
+        iwcap = utils.run(iwcapdir + ' -b', stdin=queries)
+        # Each answer ends with a line holding a single '.'.
+        answers = []
+        lines = []
+        for line in iwcap.stdout.splitlines():
+            if line == '.':
+                answers.append('\n'.join(lines))
+                lines = []
+            else:
+                lines.append(line)
+        if len(answers) != len(phys):
+            raise error.TestError('iwcap answered %d of %d queries' %
+                                  (len(answers), len(phys)))
+        results = {}
+        for phy, answer in zip(phys, answers):
+            if answer.startswith('error:'):
+                raise error.TestError('iwcap %s: %s' % (phy, answer))
+            results[phy] = self.__parse_iwcap(answer)
+        return results
+
 
-    def run_once(self):
-        phy = utils.system_output("iw list | awk '/^Wiphy/ {print $2}'")
-        if not phy or 'phy' not in phy:
+    def __load_hwsim(self, radios):
+        """Load mac80211_hwsim and return the names of the phys it added."""
+        if os.path.exists('/sys/module/mac80211_hwsim'):
+            # Its radios would not be ours to count or unload.
+            raise error.TestNAError('mac80211_hwsim is already loaded')
+        sysfs = '/sys/class/ieee80211'
+        before = set(os.listdir(sysfs)) if os.path.exists(sysfs) else set()
+        utils.system('modprobe mac80211_hwsim radios=%d' % radios)
+        self._hwsim_loaded = True
+        return sorted(set(os.listdir(sysfs)) - before)
+
+
+    def cleanup(self):
+        if getattr(self, '_hwsim_loaded', False):
+            utils.system('rmmod mac80211_hwsim', ignore_status=True)
+
+
+    def run_once(self, hwsim_radios=0):
+        """
+        @param hwsim_radios: If set, check that many mac80211_hwsim radios
+                             instead of the WiFi devices of the DUT.
+        """
+        if hwsim_radios:
+            phys = self.__load_hwsim(hwsim_radios)
+        else:
+            phys = utils.system_output(
+                    "iw list | awk '/^Wiphy/ {print $2}'").split()
+        if not phys or not all('phy' in phy for phy in phys):
             raise error.TestFail('WiFi Physical interface not found')
 
         requiredCaps = {
@@ -61,12 +112,14 @@ class network_WiFiCaps(test.test):
         dep_dir = os.path.join(self.autodir, 'deps', dep)
         self.job.install_pkg(dep, 'dep', dep_dir)
 
-        results = self.__run_iwcap(phy, requiredCaps.keys())
-        for cap in requiredCaps:
-            if not cap in results:
-                raise error.TestFail('Internal error, ' +
-                    'capability "%s" not handled' % cap)
-            if results[cap] != requiredCaps[cap]:
-                raise error.TestFail('Requirement not met: ' +
-                    'cap "%s" is "%s" but expected "%s"'
-                    % (cap, results[cap], requiredCaps[cap]))
+        all_results = self.__run_iwcap(phys, requiredCaps.keys())
+        for phy in phys:
+            results = all_results.get(phy, {})
+            for cap in requiredCaps:
+                if not cap in results:
+                    raise error.TestFail('Internal error, ' +
+                        'capability "%s" not handled on %s' % (cap, phy))
+                if results[cap] != requiredCaps[cap]:
+                    raise error.TestFail('Requirement not met on %s: ' % phy +
+                        'cap "%s" is "%s" but expected "%s"'
+                        % (cap, results[cap], requiredCaps[cap]))
@@ -14,7 +14,7 @@ class platform_CompressedSwap(test.test):
     """
     Verify compressed swap is configured and basically works.
     """
-    version = 1
+    version = 2
     executable = 'hog'
     swap_enable_file = '/home/chronos/.swap_enabled'
     swap_disksize_file = '/sys/block/zram0/disksize'
@@ -1,20 +1,45 @@
 /* Compile with:
- * i686-pc-linux-gnu-gcc hog.c -o hog
+ * i686-pc-linux-gnu-gcc -O2 -pthread hog.c -o hog
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #define MEGA (1 << 20)
-#define CHUNK_SIZE MEGA                 /* one-megabyte chunks */
-#define MAX_CHUNKS 4096
-const int n_touches = CHUNK_SIZE >> 12;  /* average 1 per page */
-char *chunks[MAX_CHUNKS];
+#define PAGE_SIZE 4096
+/* Threads claim the region in chunks aligned to transparent huge pages, so
+ * that no two threads fault in the same huge page. */
+#define CHUNK_SIZE (2 * MEGA)
+#define POLL_US 10000
+
+#define ZRAM_PATH "/sys/block/zram0/"
+
+struct filler {
+  pthread_t thread;
+  uint64_t bytes;
+};
+
+static char *region;
+static size_t region_size;
+static size_t n_chunks;
+static size_t next_chunk;
+static int random_words;          /* per page, the rest compresses well */
+static uint64_t seed;
+static volatile int stop;
+static volatile int fillers_running;
 
 
 long int estrtol(const char *s) {
@@ -29,57 +54,213 @@ long int estrtol(const char *s) {
 }
 
 
-int main(int ac, const char **av) {
-  int chunk;
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static uint64_t splitmix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+
+/* Fill a page so that it compresses to roughly the desired compression
+ * factor: a random head from an xorshift64* generator seeded by the page
+ * index, so no two pages are the same, followed by ones.
+ */
+static void fill_page(uint64_t *page, uint64_t index) {
+  uint64_t x = splitmix64(seed ^ index) | 1;
+  int i;
+
+  for (i = 0; i < random_words; i++) {
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    page[i] = x * 0x2545f4914f6cdd1dULL;
+  }
+  memset(page + random_words, 1, PAGE_SIZE - random_words * sizeof(*page));
+}
+
+
+static void *run_filler(void *arg) {
+  struct filler *f = arg;
+  size_t chunk;
+
+  while (!stop &&
+         (chunk = __sync_fetch_and_add(&next_chunk, 1)) < n_chunks) {
+    size_t start = chunk * CHUNK_SIZE;
+    size_t end = start + CHUNK_SIZE < region_size ? start + CHUNK_SIZE
+                                                  : region_size;
+    size_t offset;
+
+    for (offset = start; offset < end; offset += PAGE_SIZE)
+      fill_page((uint64_t *)(region + offset), offset / PAGE_SIZE);
+    f->bytes += end - start;
+  }
+  __sync_fetch_and_sub(&fillers_running, 1);
+  return NULL;
+}
+
+
+static int read_u64(const char *path, uint64_t *value) {
+  FILE *f = fopen(path, "r");
+  int ok;
+
+  if (f == NULL)
+    return 0;
+  ok = fscanf(f, "%" SCNu64, value) == 1;
+  fclose(f);
+  return ok;
+}
+
+
+/* Returns the percentage of the zram disk size taken by swapped out data,
+ * or -1 if zram is not set up. */
+static int zram_percent(void) {
+  uint64_t disksize, orig_data_size;
+
+  if (!read_u64(ZRAM_PATH "disksize", &disksize) || disksize == 0)
+    return -1;
+  /* orig_data_size moved into mm_stat in newer kernels. */
+  if (!read_u64(ZRAM_PATH "mm_stat", &orig_data_size) &&
+      !read_u64(ZRAM_PATH "orig_data_size", &orig_data_size))
+    return -1;
+  return orig_data_size * 100 / disksize;
+}
+
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: hog [-t threads] [-p huge|nohuge] [-z zram_percent] [-e]\n"
+          "           <megabytes> [<compression factor (default = 3)>]\n"
+          "  -t  fill with this many threads (default = 1)\n"
+          "  -p  madvise the memory to use or not use huge pages\n"
+          "  -z  stop filling once swapped out data takes this percentage\n"
+          "      of the zram disk size\n"
+          "  -e  exit after filling instead of idling\n");
+  exit(1);
+}
+
+
+int main(int ac, char **av) {
   int compression_factor = 3;
-  unsigned int i, c, x;
-  long int megabytes;
-  int random_fd = open("/dev/urandom", O_RDONLY);
-  char *fake_data = malloc(CHUNK_SIZE);
+  long int megabytes, n_threads = 1, zram_target = 0;
+  int advice = -1, exit_after_fill = 0;
+  int random_fd, c, i;
+  struct filler *fillers;
+  uint64_t filled = 0;
+  double start, elapsed;
   char *p;
 
-  if (ac != 2 && ac != 3) {
-    fprintf(stderr,
-            "usage: hog <megabytes> [<compression factor (default = 3)>]\n");
+  while ((c = getopt(ac, av, "t:p:z:e")) != -1) {
+    switch (c) {
+      case 't':
+        n_threads = estrtol(optarg);
+        break;
+      case 'p':
+        if (strcmp(optarg, "huge") == 0)
+          advice = MADV_HUGEPAGE;
+        else if (strcmp(optarg, "nohuge") == 0)
+          advice = MADV_NOHUGEPAGE;
+        else
+          usage();
+        break;
+      case 'z':
+        zram_target = estrtol(optarg);
+        break;
+      case 'e':
+        exit_after_fill = 1;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (ac - optind != 1 && ac - optind != 2)
+    usage();
+
+  megabytes = estrtol(av[optind]);
+  if (ac - optind == 2)
+    compression_factor = estrtol(av[optind + 1]);
+
+  if (megabytes <= 0 || n_threads <= 0 || compression_factor <= 0 ||
+      zram_target < 0 || zram_target > 100)
+    usage();
+  if (zram_target && zram_percent() < 0) {
+    fprintf(stderr, "hog: zram is not set up\n");
     exit(1);
   }
 
-  megabytes = estrtol(av[1]);
+  random_fd = open("/dev/urandom", O_RDONLY);
+  if (random_fd < 0 || read(random_fd, &seed, sizeof(seed)) != sizeof(seed)) {
+    perror("hog: /dev/urandom");
+    exit(1);
+  }
+  close(random_fd);
+  random_words = PAGE_SIZE / sizeof(uint64_t) / compression_factor;
 
-  if (megabytes > MAX_CHUNKS) {
-    fprintf(stderr, "hog: too many megabytes (%ld, max = %d)\n",
-            megabytes, MAX_CHUNKS);
+  /* Map an extra chunk to align the region to a chunk. */
+  region_size = (size_t)megabytes * MEGA;
+  p = mmap(NULL, region_size + CHUNK_SIZE, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) {
+    printf("hog: out of memory mapping %ld megabytes\n", megabytes);
+    exit(1);
   }
+  region = (char *)(((uintptr_t)p + CHUNK_SIZE - 1) &
+                    ~(uintptr_t)(CHUNK_SIZE - 1));
+  n_chunks = (region_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  if (advice >= 0 && madvise(region, region_size, advice) < 0)
+    perror("hog: madvise");
 
-  if (ac == 3) {
-     compression_factor = estrtol(av[2]);
+  fillers = calloc(n_threads, sizeof(*fillers));
+  if (fillers == NULL) {
+    perror("hog: calloc");
+    exit(1);
   }
 
-  /* Fill fake_data with fake data so that it compresses to roughly the desired
-   * compression factor.
-   */
-  read(random_fd, fake_data, CHUNK_SIZE / compression_factor);
-  /* Fill the rest of the fake data with ones (compresses well). */
-  memset(fake_data + CHUNK_SIZE / compression_factor, 1,
-         CHUNK_SIZE - (CHUNK_SIZE / compression_factor));
-
-  for (chunk = 0; chunk < megabytes; chunk++) {
-    /* Allocate */
-    p = malloc(CHUNK_SIZE);
-
-    if (p == NULL) {
-      printf("hog: out of memory at chunk %d\n", chunk);
-      break;
+  start = now();
+  fillers_running = n_threads;
+  for (i = 0; i < n_threads; i++) {
+    errno = pthread_create(&fillers[i].thread, NULL, run_filler, &fillers[i]);
+    if (errno) {
+      perror("hog: pthread_create");
+      exit(1);
     }
+  }
 
-    /* Fill allocated memory with fake data */
-    memcpy(p, fake_data, CHUNK_SIZE);
+  /* With a zram target, the fillers stop at the next chunk boundary once
+   * the kernel has swapped out enough. */
+  while (zram_target && fillers_running) {
+    if (zram_percent() >= zram_target)
+      stop = 1;
+    usleep(POLL_US);
+  }
 
-    /* Remember allocated data. */
-    chunks[chunk] = p;
+  for (i = 0; i < n_threads; i++) {
+    pthread_join(fillers[i].thread, NULL);
+    filled += fillers[i].bytes;
   }
+  elapsed = now() - start;
+
+  printf("hog: filled %lu MB in %.3f s (%.1f MB/s) with %ld threads%s\n",
+         (unsigned long)(filled / MEGA), elapsed, filled / elapsed / MEGA,
+         n_threads,
+         stop ? ", stopped at zram target" : "");
+  if (zram_target)
+    printf("hog: zram at %d%% of disksize\n", zram_percent());
+  fflush(stdout);
+
+  if (exit_after_fill)
+    return 0;
 
-  printf("hog: idling\n", chunk);
+  printf("hog: idling\n");
+  fflush(stdout);
   while (1)
     sleep(10);
 }
@@ -5,6 +5,8 @@
 # found in the LICENSE file.
 
 import os
+import re
+import struct
 
 from autotest_lib.client.bin import test, utils
 from autotest_lib.client.common_lib import error
@@ -15,15 +17,36 @@ class platform_TraceClockMonotonic(test.test):
     This verifies that the kernel supports monotonic clock timestamps for
     ftrace events.  This is the same clock that Chrome will use for
     timestamping its trace events.
+
+    With benchmark=True it instead measures trace markers: several threads
+    write markers as fast as they can and the cost of each write, the markers
+    lost and the skew between the CLOCK_MONOTONIC value in each marker and
+    its ftrace timestamp are reported for each of the given trace clocks.
     """
-    version = 1
+    version = 2
 
     executable = 'ftrace-clock-monotonic'
+    bench_executable = 'trace-marker-bench'
 
     TRACE_PATH = '/sys/kernel/debug/tracing/'
     TRACE_CLOCK = TRACE_PATH + 'trace_clock'
     TRACE_FILE = TRACE_PATH + 'trace'
     TRACE_ENABLE = TRACE_PATH + 'tracing_on'
+    TRACE_BUFFER_SIZE = TRACE_PATH + 'buffer_size_kb'
+    TRACE_CPU_STATS = TRACE_PATH + 'per_cpu/cpu%d/stats'
+
+    # Per CPU ring buffer size during the benchmark, big enough that a run
+    # of the default size does not wrap.
+    BENCH_BUFFER_KB = 16384
+
+    # Markers written by trace-marker-bench: "tmb <thread> <seq> <time>" or a
+    # raw marker with id 0x626d74 ("tmb") followed by thread, seq and time in
+    # nanoseconds as little endian u32, u32, u64.
+    TEXT_MARKER_RE = re.compile(
+            r'\s(\d+\.\d+): tracing_mark_write: tmb (\d+) (\d+) (\d+\.\d+)')
+    RAW_MARKER_RE = re.compile(
+            r'\s(\d+\.\d+): # 626d74 buf:((?: [0-9a-f]{2})+)')
+    RAW_MARKER_FORMAT = '<IIQ'
 
     def _setup_trace(self):
         """
@@ -88,8 +111,141 @@ class platform_TraceClockMonotonic(test.test):
             if prev_timestamp == 0:
                 raise error.TestFail('no valid timestamps seen in trace file')
 
-    def run_once(self):
-        self._setup_trace()
-        binpath = os.path.join(self.srcdir, self.executable)
-        utils.system_output(binpath, retain_output = True)
-        self.process_trace()
+    def _read(self, path):
+        with open(path) as f:
+            return f.read().strip()
+
+    def _write(self, path, value):
+        with open(path, 'w') as f:
+            f.write(value)
+
+    def _overruns(self):
+        """Returns the events dropped by the ring buffers on all CPUs."""
+        total = 0
+        for cpu in range(utils.count_cpus()):
+            try:
+                stats = self._read(self.TRACE_CPU_STATS % cpu)
+            except IOError:
+                continue
+            for line in stats.splitlines():
+                name, _, value = line.partition(':')
+                if name in ('overrun', 'dropped events'):
+                    total += int(value)
+        return total
+
+    def _parse_markers(self, raw):
+        """Returns the ftrace minus marker time, in microseconds, of each
+        benchmark marker in the trace, keyed by (thread, seq)."""
+        skews = {}
+        with open(self.TRACE_FILE) as trace:
+            for line in trace:
+                if raw:
+                    match = self.RAW_MARKER_RE.search(line)
+                    if not match:
+                        continue
+                    payload = bytearray(int(b, 16)
+                                        for b in match.group(2).split())
+                    thread, seq, ns = struct.unpack(self.RAW_MARKER_FORMAT,
+                                                    str(payload))
+                    sample = ns / 1e9
+                else:
+                    match = self.TEXT_MARKER_RE.search(line)
+                    if not match:
+                        continue
+                    thread, seq = int(match.group(2)), int(match.group(3))
+                    sample = float(match.group(4))
+                entry = float(match.group(1))
+                skews[(thread, seq)] = (entry - sample) * 1e6
+        return skews
+
+    def _percentile(self, samples, pct):
+        return samples[(len(samples) - 1) * pct // 100]
+
+    def run_benchmark(self, clocks, threads, markers, raw):
+        """Runs trace-marker-bench once per trace clock and reports it."""
+        binpath = os.path.join(self.srcdir, self.bench_executable)
+        args = '-t %d -n %d%s' % (threads, markers, ' -r' if raw else '')
+        available = self._read(self.TRACE_CLOCK).replace('[', '').replace(
+                ']', '').split()
+        kind = 'raw' if raw else 'text'
+        keyvals = {}
+
+        if raw and not os.path.exists(self.TRACE_PATH + 'trace_marker_raw'):
+            raise error.TestNAError('Kernel lacks trace_marker_raw')
+
+        for clock in clocks:
+            if clock not in available:
+                raise error.TestNAError('Kernel lacks trace clock %s' % clock)
+            self._write(self.TRACE_CLOCK, clock)
+            self._write(self.TRACE_FILE, '')
+            self._write(self.TRACE_ENABLE, '1')
+            overruns = self._overruns()
+
+            output = utils.system_output('%s %s' % (binpath, args),
+                                         retain_output=True)
+            self._write(self.TRACE_ENABLE, '0')
+
+            skews = self._parse_markers(raw)
+            lost = threads * markers - len(skews)
+            prefix = 'trace_marker_%s_%s' % (kind, clock)
+            keyvals['%s_lost' % prefix] = lost
+            keyvals['%s_overruns' % prefix] = self._overruns() - overruns
+            self.output_perf_value(description='%s_lost' % prefix,
+                                   value=lost, units='markers',
+                                   higher_is_better=False)
+
+            for line in output.splitlines():
+                if line.startswith('markers='):
+                    fields = dict(f.split('=') for f in line.split())
+                    keyvals['%s_per_sec' % prefix] = fields['markers_per_sec']
+                    self.output_perf_value(
+                            description='%s_rate' % prefix,
+                            value=float(fields['markers_per_sec']),
+                            units='markers_per_sec', higher_is_better=True)
+                elif line.startswith('marker_ns '):
+                    for field in line.split()[1:]:
+                        name, value = field.split('=')
+                        keyvals['%s_cost_%s_ns' % (prefix, name)] = value
+                        self.output_perf_value(
+                                description='%s_cost_%s' % (prefix, name),
+                                value=int(value), units='ns',
+                                higher_is_better=False)
+
+            if not skews:
+                raise error.TestFail('No %s markers found in the trace' % kind)
+            samples = sorted(skews.values())
+            with open(os.path.join(self.resultsdir,
+                                   '%s_skew_us.txt' % prefix), 'w') as f:
+                f.write(''.join('%.1f\n' % s for s in samples))
+            for pct in (1, 50, 99):
+                value = self._percentile(samples, pct)
+                keyvals['%s_skew_p%d_us' % (prefix, pct)] = value
+                self.output_perf_value(
+                        description='%s_skew_p%d' % (prefix, pct),
+                        value=value, units='us', higher_is_better=False)
+            keyvals['%s_skew_min_us' % prefix] = samples[0]
+            keyvals['%s_skew_max_us' % prefix] = samples[-1]
+
+        self.write_perf_keyval(keyvals)
+
+    def run_once(self, benchmark=False, clocks=('mono',), threads=4,
+                 markers=20000, raw=False):
+        if not benchmark:
+            self._setup_trace()
+            binpath = os.path.join(self.srcdir, self.executable)
+            utils.system_output(binpath, retain_output = True)
+            self.process_trace()
+            return
+
+        clock = self._read(self.TRACE_CLOCK)
+        clock = clock[clock.index('[') + 1:clock.index(']')]
+        buffer_kb = self._read(self.TRACE_BUFFER_SIZE).split()[0]
+        enabled = self._read(self.TRACE_ENABLE)
+        try:
+            self._write(self.TRACE_BUFFER_SIZE, str(self.BENCH_BUFFER_KB))
+            self.run_benchmark(clocks, threads, markers, raw)
+        finally:
+            self._write(self.TRACE_ENABLE, enabled)
+            self._write(self.TRACE_BUFFER_SIZE, buffer_kb)
+            self._write(self.TRACE_CLOCK, clock)
+            self._write(self.TRACE_FILE, '')
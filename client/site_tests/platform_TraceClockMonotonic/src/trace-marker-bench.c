@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Writes trace markers from several threads as fast as possible and reports
+ * the cost of each write.
+ *
+ * Every marker carries the writing thread, a sequence number and the
+ * CLOCK_MONOTONIC time taken just before the write, so the trace can be
+ * checked for lost markers and its timestamps compared with the clock.
+ * Text markers look like "tmb <thread> <seq> <sec>.<nsec>"; raw markers
+ * (-r) go to trace_marker_raw as a struct raw_marker.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_PATH "/sys/kernel/debug/tracing/"
+
+// "tmb" in the id field of raw markers.
+#define RAW_MARKER_ID 0x00626d74
+
+struct raw_marker {
+  uint32_t id;
+  uint32_t thread;
+  uint32_t seq;
+  uint64_t ns;
+} __attribute__((packed));
+
+struct worker {
+  pthread_t thread;
+  uint32_t index;
+  uint32_t* cost_ns;
+  unsigned long errors;
+  int first_errno;
+};
+
+static int trace_fd;
+static int raw;
+static unsigned long markers = 10000;
+static pthread_barrier_t start_barrier;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* run_worker(void* arg) {
+  struct worker* w = arg;
+  unsigned long i;
+
+  pthread_barrier_wait(&start_barrier);
+  for (i = 0; i < markers; i++) {
+    char buf[64];
+    struct raw_marker marker;
+    uint64_t start = now_ns();
+    ssize_t size, ret;
+
+    // The cost includes formatting the text, which is part of what every
+    // text marker writer pays.
+    if (raw) {
+      marker.id = RAW_MARKER_ID;
+      marker.thread = w->index;
+      marker.seq = i;
+      marker.ns = start;
+      size = sizeof(marker);
+      ret = write(trace_fd, &marker, size);
+    } else {
+      size = snprintf(buf, sizeof(buf), "tmb %u %lu %llu.%09llu\n",
+                      w->index, i,
+                      (unsigned long long)(start / 1000000000),
+                      (unsigned long long)(start % 1000000000));
+      ret = write(trace_fd, buf, size);
+    }
+    w->cost_ns[i] = now_ns() - start;
+
+    if (ret != size && !w->errors++)
+      w->first_errno = ret < 0 ? errno : 0;
+  }
+  return NULL;
+}
+
+static int compare_u32(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const uint32_t* sorted, size_t n, int pct) {
+  return sorted[(n - 1) * pct / 100];
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [-r] [-t threads] [-n markers_per_thread]\n"
+          "  -r  write binary markers to trace_marker_raw\n",
+          program);
+}
+
+int main(int argc, char* argv[]) {
+  struct worker* workers;
+  uint32_t* costs;
+  unsigned long threads = 1, errors = 0;
+  uint64_t start, elapsed;
+  size_t total;
+  int c, ret = 0;
+  unsigned long i;
+
+  while ((c = getopt(argc, argv, "rt:n:")) != -1) {
+    switch (c) {
+      case 'r':
+        raw = 1;
+        break;
+      case 't':
+        threads = strtoul(optarg, NULL, 0);
+        break;
+      case 'n':
+        markers = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (!threads || !markers || optind != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  trace_fd = open(raw ? TRACE_PATH "trace_marker_raw"
+                      : TRACE_PATH "trace_marker", O_WRONLY);
+  if (trace_fd < 0) {
+    perror("open");
+    return 1;
+  }
+
+  total = threads * markers;
+  workers = calloc(threads, sizeof(*workers));
+  costs = malloc(total * sizeof(*costs));
+  if (!workers || !costs) {
+    perror("malloc");
+    return 1;
+  }
+
+  // The main thread joins the barrier so that the clock starts when the
+  // last worker is ready.
+  pthread_barrier_init(&start_barrier, NULL, threads + 1);
+  for (i = 0; i < threads; i++) {
+    workers[i].index = i;
+    workers[i].cost_ns = costs + i * markers;
+    errno = pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    if (errno) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+  pthread_barrier_wait(&start_barrier);
+  start = now_ns();
+  for (i = 0; i < threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    errors += workers[i].errors;
+    if (workers[i].errors && ret == 0) {
+      fprintf(stderr, "thread %lu: %lu failed writes: %s\n", i,
+              workers[i].errors, strerror(workers[i].first_errno));
+      ret = 1;
+    }
+  }
+  elapsed = now_ns() - start;
+  close(trace_fd);
+
+  qsort(costs, total, sizeof(*costs), compare_u32);
+  printf("markers=%zu errors=%lu elapsed_ms=%.1f markers_per_sec=%.0f\n",
+         total, errors, elapsed / 1e6, total * 1e9 / elapsed);
+  printf("marker_ns p50=%u p90=%u p99=%u max=%u\n",
+         percentile(costs, total, 50), percentile(costs, total, 90),
+         percentile(costs, total, 99), costs[total - 1]);
+
+  free(costs);
+  free(workers);
+  return ret;
+}
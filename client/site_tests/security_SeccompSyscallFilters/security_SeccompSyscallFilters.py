@@ -7,6 +7,7 @@ from autotest_lib.client.bin import utils
 from autotest_lib.client.common_lib import error
 
 import os
+import re
 
 """A test verifying that seccomp calls change permissions correctly.
 
@@ -16,6 +17,7 @@ Compiles tests written in C and then runs them.  Fails if C tests fail.
 class security_SeccompSyscallFilters(test.test):
     version = 1
     executable = 'seccomp_bpf_tests'
+    bench_executable = 'seccomp_bpf_bench'
 
     def setup(self):
         """Cleans and makes seccomp_bpf_tests.c.
@@ -26,13 +28,39 @@ class security_SeccompSyscallFilters(test.test):
         os.chdir(self.srcdir)
         utils.make()
 
-    def run_once(self):
+    def run_once(self, benchmark=False):
         """Main function.
 
         Runs the compiled tests, logs output.  Fails if the call to run
         tests fails (meaning that a test failed). Runs both as root
         and non-root.
+
+        @param benchmark: run the filter-evaluation benchmark instead and
+                report ns/syscall per filter shape, size and stack depth.
         """
+        if benchmark:
+            self.run_benchmark()
+            return
         binpath = os.path.join(self.srcdir, self.executable)
-        utils.system_output(binpath, retain_output = True)
-        utils.system_output("su chronos -c %s" % binpath, retain_output = True)
+        # Tests run in separate processes, so use all CPUs; the root run also
+        # leaves a JUnit report with per-test timings in the results dir.
+        cmd = '%s -j %d' % (binpath, utils.count_cpus())
+        junit = os.path.join(self.resultsdir, self.executable + '.xml')
+        utils.system_output('%s -x %s' % (cmd, junit), retain_output = True)
+        utils.system_output("su chronos -c '%s'" % cmd, retain_output = True)
+
+    def run_benchmark(self):
+        """Runs seccomp_bpf_bench and reports ns/syscall for each filter."""
+        binpath = os.path.join(self.srcdir, self.bench_executable)
+        output = utils.system_output(binpath, retain_output=True)
+        result_re = re.compile(r'^seccomp_bench: shape=(\w+) rules=(\d+) '
+                               r'filters=(\d+) ns_per_syscall=([\d.]+)$',
+                               re.MULTILINE)
+        results = result_re.findall(output)
+        if not results:
+            raise error.TestFail('No benchmark results in output')
+        for shape, rules, filters, ns in results:
+            self.output_perf_value(
+                    description='ns_per_syscall_%s_%s_rules_x%s' % (
+                            shape, rules, filters),
+                    value=float(ns), units='ns', higher_is_better=False)
@@ -0,0 +1,269 @@
+/* seccomp_bpf_bench.c
+ * Copyright (c) 2012 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Microbenchmarks for seccomp bpf filter evaluation.
+ *
+ * Each measurement forks a child, installs the generated filter(s) there and
+ * times a syscall that falls through every rule to the default ALLOW.  The
+ * rules themselves deny syscall numbers that do not exist, so any filter size
+ * can be installed without breaking the process.  Results are printed as
+ *   seccomp_bench: shape=<s> rules=<n> filters=<k> ns_per_syscall=<t>
+ */
+
+#include <errno.h>
+#include <linux/filter.h>
+#include <linux/prctl.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#include "test_harness.h"
+
+#ifndef PR_SET_NO_NEW_PRIVS
+#define PR_SET_NO_NEW_PRIVS 38
+#endif
+
+#ifndef SECCOMP_MODE_FILTER
+#define SECCOMP_MODE_FILTER 2
+#endif
+
+#ifndef SECCOMP_RET_ALLOW
+#define SECCOMP_RET_ERRNO       0x00050000U // returns an errno
+#define SECCOMP_RET_ALLOW       0x7fff0000U // allow
+
+struct seccomp_data {
+	int nr;
+	__u32 arch;
+	__u64 instruction_pointer;
+	__u64 args[6];
+};
+#endif
+
+#ifndef BPF_MAXINSNS
+#define BPF_MAXINSNS 4096
+#endif
+
+/* Syscall numbers far above any real one; denied by the generated rules. */
+#define DECOY_NR_BASE	10000
+#define DECOY_ERRNO	E2BIG
+#define DECOY_ARG	0x0C0FFEE
+
+#define syscall_arg(_n) (offsetof(struct seccomp_data, args[_n]))
+
+#define BENCH_ITERATIONS	200000
+#define MAX_STACKED		32
+
+/* Filter sizes, in rules, used by the size sweeps. */
+static const int rule_counts[] = { 1, 8, 32, 128, 512 };
+#define NUM_RULE_COUNTS (sizeof(rule_counts) / sizeof(rule_counts[0]))
+
+struct bench_filter {
+	struct sock_filter insns[BPF_MAXINSNS];
+	unsigned short len;
+};
+
+static void emit(struct bench_filter *f, struct sock_filter insn)
+{
+	if (f->len >= BPF_MAXINSNS)
+		abort();
+	f->insns[f->len++] = insn;
+}
+
+/*
+ * Every generated filter starts by rejecting a magic first argument.  Looking
+ * at the arguments keeps the kernel from caching the ALLOW verdict per syscall
+ * number, so the filter really runs on each call, as argument-checking
+ * production filters do.
+ */
+static void emit_prologue(struct bench_filter *f)
+{
+	emit(f, (struct sock_filter)BPF_STMT(BPF_LD+BPF_W+BPF_ABS,
+		syscall_arg(0)));
+	emit(f, (struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K,
+		DECOY_ARG, 0, 1));
+	emit(f, (struct sock_filter)BPF_STMT(BPF_RET+BPF_K,
+		SECCOMP_RET_ERRNO | DECOY_ERRNO));
+	emit(f, (struct sock_filter)BPF_STMT(BPF_LD+BPF_W+BPF_ABS,
+		offsetof(struct seccomp_data, nr)));
+}
+
+/* One compare per rule, in order: O(n) instructions run per syscall. */
+static void build_linear(struct bench_filter *f, int rules)
+{
+	int i;
+
+	f->len = 0;
+	emit_prologue(f);
+	for (i = 0; i < rules; i++) {
+		emit(f, (struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K,
+			DECOY_NR_BASE + i, 0, 1));
+		emit(f, (struct sock_filter)BPF_STMT(BPF_RET+BPF_K,
+			SECCOMP_RET_ERRNO | DECOY_ERRNO));
+	}
+	emit(f, (struct sock_filter)BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW));
+}
+
+/*
+ * Binary search over the sorted rule numbers [lo, hi): O(log n) instructions
+ * run per syscall.  Inner nodes use a BPF_JA to reach the upper half since
+ * conditional jump offsets are limited to 8 bits.
+ */
+static void build_tree_node(struct bench_filter *f, int lo, int hi)
+{
+	unsigned short ja;
+	int mid;
+
+	if (hi - lo == 1) {
+		emit(f, (struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K,
+			DECOY_NR_BASE + lo, 0, 1));
+		emit(f, (struct sock_filter)BPF_STMT(BPF_RET+BPF_K,
+			SECCOMP_RET_ERRNO | DECOY_ERRNO));
+		emit(f, (struct sock_filter)BPF_STMT(BPF_RET+BPF_K,
+			SECCOMP_RET_ALLOW));
+		return;
+	}
+	mid = lo + (hi - lo) / 2;
+	emit(f, (struct sock_filter)BPF_JUMP(BPF_JMP+BPF_JGE+BPF_K,
+		DECOY_NR_BASE + mid, 0, 1));
+	ja = f->len;
+	emit(f, (struct sock_filter)BPF_STMT(BPF_JMP+BPF_JA, 0));
+	build_tree_node(f, lo, mid);
+	f->insns[ja].k = f->len - ja - 1;
+	build_tree_node(f, mid, hi);
+}
+
+static void build_tree(struct bench_filter *f, int rules)
+{
+	f->len = 0;
+	emit_prologue(f);
+	build_tree_node(f, 0, rules);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Installs |stacked| copies of |f| (none if f is NULL) in a child, checks the
+ * filter actually denies a decoy syscall, and times getppid().
+ */
+static void measure(struct __test_metadata *_metadata, const char *shape,
+		    struct bench_filter *f, int rules, int stacked)
+{
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+	pid = fork();
+	ASSERT_LE(0, pid);
+	if (pid == 0) {
+		struct sock_fprog prog;
+		double start, elapsed;
+		long i;
+		int k;
+
+		if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+			_exit(1);
+		for (k = 0; f && k < stacked; k++) {
+			prog.len = f->len;
+			prog.filter = f->insns;
+			if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog))
+				_exit(2);
+		}
+		if (f) {
+			/* The last rule is the slowest one to reach linearly. */
+			errno = 0;
+			if (syscall(DECOY_NR_BASE + rules - 1) != -1 ||
+			    errno != DECOY_ERRNO)
+				_exit(3);
+			errno = 0;
+			if (syscall(__NR_getppid, DECOY_ARG) != -1 ||
+			    errno != DECOY_ERRNO)
+				_exit(4);
+		}
+
+		for (i = 0; i < BENCH_ITERATIONS / 10; i++)
+			syscall(__NR_getppid);
+		start = now_ns();
+		for (i = 0; i < BENCH_ITERATIONS; i++)
+			syscall(__NR_getppid);
+		elapsed = now_ns() - start;
+
+		printf("seccomp_bench: shape=%s rules=%d filters=%d "
+		       "ns_per_syscall=%.2f\n", shape, rules,
+		       f ? stacked : 0, elapsed / BENCH_ITERATIONS);
+		fflush(stdout);
+		_exit(0);
+	}
+	ASSERT_EQ(pid, waitpid(pid, &status, 0));
+	ASSERT_TRUE(WIFEXITED(status));
+	EXPECT_EQ(0, WEXITSTATUS(status)) {
+		TH_LOG("%s filter with %d rules x %d failed in stage %d",
+		       shape, rules, stacked, WEXITSTATUS(status));
+	}
+}
+
+FIXTURE_DATA(bench) {
+	struct bench_filter *filter;
+};
+
+FIXTURE_SETUP(bench) {
+	self->filter = malloc(sizeof(*self->filter));
+	ASSERT_NE(NULL, self->filter);
+}
+
+FIXTURE_TEARDOWN(bench) {
+	free(self->filter);
+}
+
+TEST_SERIAL(no_filter) {
+	measure(_metadata, "none", NULL, 0, 0);
+}
+
+TEST_F_SERIAL(bench, linear_sizes) {
+	unsigned int i;
+
+	for (i = 0; i < NUM_RULE_COUNTS; i++) {
+		build_linear(self->filter, rule_counts[i]);
+		measure(_metadata, "linear", self->filter, rule_counts[i], 1);
+	}
+}
+
+TEST_F_SERIAL(bench, tree_sizes) {
+	unsigned int i;
+
+	for (i = 0; i < NUM_RULE_COUNTS; i++) {
+		build_tree(self->filter, rule_counts[i]);
+		measure(_metadata, "tree", self->filter, rule_counts[i], 1);
+	}
+}
+
+TEST_F_SERIAL(bench, linear_stacked) {
+	int stacked;
+
+	build_linear(self->filter, 32);
+	for (stacked = 2; stacked <= MAX_STACKED; stacked *= 2)
+		measure(_metadata, "linear", self->filter, 32, stacked);
+}
+
+TEST_F_SERIAL(bench, tree_stacked) {
+	int stacked;
+
+	build_tree(self->filter, 32);
+	for (stacked = 2; stacked <= MAX_STACKED; stacked *= 2)
+		measure(_metadata, "tree", self->filter, 32, stacked);
+}
+
+TEST_HARNESS_MAIN
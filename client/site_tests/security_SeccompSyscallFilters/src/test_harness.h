@@ -36,17 +36,25 @@
  *
  *   TEST_HARNESS_MAIN
  *
+ * The resulting binary accepts:
+ *   -j <jobs>   run up to <jobs> tests concurrently (default 1).  Output of
+ *               each test is captured and printed in declaration order.
+ *   -x <file>   write a JUnit-style XML report to <file>.
+ *
  * API inspired by code.google.com/p/googletest
  */
 #ifndef TEST_HARNESS_H_
 #define TEST_HARNESS_H_
 
 #define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 /* All exported functionality should be declared through this macro. */
@@ -58,7 +66,8 @@
 
 /* TEST(name) { implementation }
  * Defines a test by name.
- * Names must be unique and tests must not be run in parallel.  The
+ * Names must be unique.  Each test runs in its own forked process and may run
+ * concurrently with other tests when the harness is given -j.  The
  * implementation containing block is a function and scoping should be treated
  * as such.  Returning early may be performed with a bare "return;" statement.
  *
@@ -68,7 +77,7 @@
 
 /* TEST_SIGNAL(name, signal) { implementation }
  * Defines a test by name and the expected term signal.
- * Names must be unique and tests must not be run in parallel.  The
+ * Names must be unique.  The
  * implementation containing block is a function and scoping should be treated
  * as such.  Returning early may be performed with a bare "return;" statement.
  *
@@ -76,6 +85,12 @@
  */
 #define TEST_SIGNAL TEST_API(TEST_SIGNAL)
 
+/* TEST_SERIAL(name) { implementation }
+ * Like TEST(), but the test never runs concurrently with any other test, e.g.
+ * because it measures timing or changes system-wide state.
+ */
+#define TEST_SERIAL TEST_API(TEST_SERIAL)
+
 /* FIXTURE(datatype name) {
  *   type property1;
  *   ...
@@ -122,6 +137,11 @@
 
 #define TEST_F_SIGNAL TEST_API(TEST_F_SIGNAL)
 
+/* TEST_F_SERIAL(fixture, name) { implementation }
+ * Like TEST_F(), but never run concurrently with any other test.
+ */
+#define TEST_F_SERIAL TEST_API(TEST_F_SERIAL)
+
 /* Use once to append a main() to the test file. E.g.,
  *   TEST_HARNESS_MAIN
  */
@@ -211,14 +231,17 @@
             __FILE__, __LINE__, _metadata->name, ##__VA_ARGS__)
 
 /* Defines the test function and creates the registration stub. */
-#define _TEST(test_name) __TEST_IMPL(test_name, -1)
+#define _TEST(test_name) __TEST_IMPL(test_name, -1, 0)
+
+#define _TEST_SIGNAL(test_name, signal) __TEST_IMPL(test_name, signal, 0)
 
-#define _TEST_SIGNAL(test_name, signal) __TEST_IMPL(test_name, signal)
+#define _TEST_SERIAL(test_name) __TEST_IMPL(test_name, -1, 1)
 
-#define __TEST_IMPL(test_name, _signal) \
+#define __TEST_IMPL(test_name, _signal, _serial) \
   static void test_name(struct __test_metadata *_metadata); \
   static struct __test_metadata _##test_name##_object = \
-    { name: "global." #test_name, fn: &test_name, termsig: _signal }; \
+    { name: "global." #test_name, fn: &test_name, termsig: _signal, \
+      serial: _serial }; \
   static void __attribute__((constructor)) _register_##test_name(void) { \
     __register_test(&_##test_name##_object); \
   } \
@@ -253,12 +276,15 @@
  * TODO(wad) register fixtures on dedicated test lists.
  */
 #define _TEST_F(fixture_name, test_name) \
-  __TEST_F_IMPL(fixture_name, test_name, -1)
+  __TEST_F_IMPL(fixture_name, test_name, -1, 0)
 
 #define _TEST_F_SIGNAL(fixture_name, test_name, signal) \
-  __TEST_F_IMPL(fixture_name, test_name, signal)
+  __TEST_F_IMPL(fixture_name, test_name, signal, 0)
+
+#define _TEST_F_SERIAL(fixture_name, test_name) \
+  __TEST_F_IMPL(fixture_name, test_name, -1, 1)
 
-#define __TEST_F_IMPL(fixture_name, test_name, signal) \
+#define __TEST_F_IMPL(fixture_name, test_name, signal, _serial) \
   static void fixture_name##_##test_name( \
     struct __test_metadata *_metadata, \
     _FIXTURE_DATA(fixture_name) *self); \
@@ -277,6 +303,7 @@
     name: #fixture_name "." #test_name, \
     fn: &wrapper_##fixture_name##_##test_name, \
     termsig: signal, \
+    serial: _serial, \
    }; \
   static void __attribute__((constructor)) \
       _register_##fixture_name##_##test_name(void) { \
@@ -384,6 +411,13 @@ struct __test_metadata {
   int termsig;
   int passed;
   int trigger; /* extra handler after the evaluation */
+  int serial; /* never run concurrently with other tests */
+  /* Runner state. */
+  pid_t pid;
+  int done;
+  FILE *output; /* captured child output when running concurrently */
+  struct timespec start;
+  double duration; /* wall time in seconds */
   struct __test_metadata *prev, *next;
 };
 
@@ -418,71 +452,224 @@ static inline int __bail(int for_realz) {
   return 0;
 }
 
-static int test_harness_run(int __attribute__((unused)) argc,
-                            char __attribute__((unused)) **argv) {
-  struct __test_metadata *t;
-  int ret = 0;
+static double __elapsed(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Forks the child for |t|.  If |capture|, its output goes to a temp file. */
+static void __test_start(struct __test_metadata *t, int capture) {
+  t->passed = 1;
+  t->trigger = 0;
+  t->done = 0;
+  t->output = NULL;
+  if (!capture)
+    printf("[ RUN      ] %s\n", t->name);
+  else if (!(t->output = tmpfile()))
+    perror("tmpfile");
+  /* Keep buffered output from being duplicated in the child. */
+  fflush(stdout);
+  fflush(stderr);
+  clock_gettime(CLOCK_MONOTONIC, &t->start);
+  t->pid = fork();
+  if (t->pid < 0) {
+    printf("ERROR SPAWNING TEST CHILD\n");
+    t->passed = 0;
+    t->done = 1;
+  } else if (t->pid == 0) {
+    if (t->output) {
+      dup2(fileno(t->output), STDOUT_FILENO);
+      dup2(fileno(t->output), STDERR_FILENO);
+    }
+    t->fn(t);
+    fflush(stdout);
+    _exit(t->passed);
+  }
+}
+
+/* Records the result of |t| from its wait status. */
+static void __test_finish(struct __test_metadata *t, int status) {
+  FILE *log = t->output ? t->output : TH_LOG_STREAM;
+
+  t->duration = __elapsed(&t->start);
+  t->done = 1;
+  if (WIFEXITED(status)) {
+    t->passed = t->termsig == -1 ? WEXITSTATUS(status) : 0;
+    if (t->termsig != -1) {
+     fprintf(log,
+              "%s: Test exited normally instead of by signal (code: %d)\n",
+             t->name,
+             WEXITSTATUS(status));
+    }
+  } else if (WIFSIGNALED(status)) {
+    t->passed = 0;
+    if (WTERMSIG(status) == SIGABRT) {
+      fprintf(log,
+              "%s: Test terminated by assertion\n",
+             t->name);
+    } else if (WTERMSIG(status) == t->termsig) {
+      t->passed = 1;
+    } else {
+      fprintf(log,
+              "%s: Test terminated unexpectedly by signal %d\n",
+             t->name,
+             WTERMSIG(status));
+    }
+  } else {
+      fprintf(log,
+              "%s: Test ended in some other way [%u]\n",
+             t->name,
+             status);
+  }
+}
+
+/* Prints the (captured) output and result line of a finished test. */
+static void __test_report(struct __test_metadata *t) {
+  char buf[4096];
+  size_t len;
+
+  if (t->output) {
+    printf("[ RUN      ] %s\n", t->name);
+    fflush(stdout);
+    rewind(t->output);
+    while ((len = fread(buf, 1, sizeof(buf), t->output)) > 0)
+      fwrite(buf, 1, len, stdout);
+    fclose(t->output);
+    t->output = NULL;
+  }
+  printf("[     %4s ] %s (%.0f ms)\n", (t->passed ? "OK" : "FAIL"), t->name,
+         t->duration * 1000);
+  fflush(stdout);
+}
+
+static void __write_junit(const char *path, const char *suite,
+                          struct __test_metadata **tests, unsigned int count,
+                          unsigned int failures, double duration) {
+  FILE *xml = fopen(path, "w");
+  unsigned int i;
+
+  if (!xml) {
+    perror(path);
+    return;
+  }
+  fprintf(xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  fprintf(xml, "<testsuite name=\"%s\" tests=\"%u\" failures=\"%u\" "
+          "time=\"%.3f\">\n", suite, count, failures, duration);
+  for (i = 0; i < count; i++) {
+    /* Names are "<fixture>.<test>", both C identifiers. */
+    const char *dot = strchr(tests[i]->name, '.');
+    int class_len = dot ? (int)(dot - tests[i]->name) : 0;
+
+    fprintf(xml, "  <testcase classname=\"%.*s\" name=\"%s\" time=\"%.3f\"",
+            class_len, tests[i]->name, dot ? dot + 1 : tests[i]->name,
+            tests[i]->duration);
+    if (tests[i]->passed)
+      fprintf(xml, "/>\n");
+    else
+      fprintf(xml, ">\n    <failure message=\"failed\"/>\n  </testcase>\n");
+  }
+  fprintf(xml, "</testsuite>\n");
+  fclose(xml);
+}
+
+static void __usage(const char *argv0) {
+  fprintf(stderr, "usage: %s [-j jobs] [-x junit.xml]\n", argv0);
+}
+
+static int test_harness_run(int argc, char **argv) {
+  struct __test_metadata *t, **tests;
+  struct timespec suite_start;
+  const char *junit_path = NULL;
   unsigned int count = 0;
   unsigned int pass_count = 0;
+  unsigned int next_start = 0, next_report = 0, running = 0, i;
+  int serial_running = 0;
+  int jobs = 1;
+  int ret = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "j:x:h")) != -1) {
+    switch (opt) {
+    case 'j':
+      jobs = atoi(optarg);
+      if (jobs < 1) {
+        __usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'x':
+      junit_path = optarg;
+      break;
+    default:
+      __usage(argv[0]);
+      return 1;
+    }
+  }
+
+  tests = calloc(__test_count ? __test_count : 1, sizeof(*tests));
+  if (!tests) {
+    perror("calloc");
+    return 1;
+  }
+  for (t = __test_list; t; t = t->next)
+    tests[count++] = t;
 
-  /* TODO(wad) add optional arguments similar to gtest. */
   printf("[==========] Running %u tests from %u test cases.\n",
           __test_count, __fixture_count + 1);
-  for (t = __test_list; t; t = t->next) {
-    pid_t child_pid;
-    int status;
-    count++;
-    t->passed = 1;
-    t->trigger = 0;
-    printf("[ RUN      ] %s\n", t->name);
-    child_pid = fork();
-    if (child_pid < 0) {
-      printf("ERROR SPAWNING TEST CHILD\n");
-      t->passed = 0;
-    } else if (child_pid == 0) {
-      t->fn(t);
-      _exit(t->passed);
-    } else {
+  clock_gettime(CLOCK_MONOTONIC, &suite_start);
+  while (next_report < count) {
+    /* Fill the pool; serial tests only start once it has drained. */
+    while (next_start < count && (int)running < jobs && !serial_running) {
+      t = tests[next_start];
+      if (t->serial && running)
+        break;
+      __test_start(t, jobs > 1);
+      next_start++;
+      if (t->done)
+        continue;
+      running++;
+      serial_running = t->serial;
+    }
+
+    if (running) {
       /* TODO(wad) add timeout support. */
-      waitpid(child_pid, &status, 0);
-      if (WIFEXITED(status)) {
-        t->passed = t->termsig == -1 ? WEXITSTATUS(status) : 0;
-        if (t->termsig != -1) {
-         fprintf(TH_LOG_STREAM,
-                  "%s: Test exited normally instead of by signal (code: %d)\n",
-                 t->name,
-                 WEXITSTATUS(status));
-        }
-      } else if (WIFSIGNALED(status)) {
-        t->passed = 0;
-        if (WTERMSIG(status) == SIGABRT) {
-          fprintf(TH_LOG_STREAM,
-                  "%s: Test terminated by assertion\n",
-                 t->name);
-        } else if (WTERMSIG(status) == t->termsig) {
-          t->passed = 1;
-        } else {
-          fprintf(TH_LOG_STREAM,
-                  "%s: Test terminated unexpectedly by signal %d\n",
-                 t->name,
-                 WTERMSIG(status));
+      int status;
+      pid_t pid = waitpid(-1, &status, 0);
+      if (pid < 0) {
+        if (errno == EINTR)
+          continue;
+        perror("waitpid");
+        return 1;
+      }
+      for (i = next_report; i < next_start; i++) {
+        if (!tests[i]->done && tests[i]->pid == pid) {
+          __test_finish(tests[i], status);
+          running--;
+          if (tests[i]->serial)
+            serial_running = 0;
+          break;
         }
-      } else {
-          fprintf(TH_LOG_STREAM,
-                  "%s: Test ended in some other way [%u]\n",
-                 t->name,
-                 status);
       }
     }
-    printf("[     %4s ] %s\n", (t->passed ? "OK" : "FAIL"), t->name);
-    if (t->passed)
-      pass_count++;
-    else
-      ret = 1;
+
+    /* Report finished tests in declaration order. */
+    while (next_report < next_start && tests[next_report]->done) {
+      t = tests[next_report++];
+      __test_report(t);
+      if (t->passed)
+        pass_count++;
+      else
+        ret = 1;
+    }
   }
   /* TODO(wad) organize by fixtures since ordering is not guaranteed now. */
   printf("[==========] %u / %u tests passed.\n", pass_count, count);
   printf("[  %s  ]\n", (ret ? "FAILED" : "PASSED"));
+  if (junit_path)
+    __write_junit(junit_path, argv[0], tests, count, count - pass_count,
+                  __elapsed(&suite_start));
+  free(tests);
   return ret;
 }
 
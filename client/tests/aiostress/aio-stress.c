@@ -35,7 +35,12 @@
  *
  * io buffers are aligned in case you want to do raw io
  *
- * compile with gcc -Wall -laio -lpthread -o aio-stress aio-stress.c
+ * compile with gcc -Wall -I<latency_hist>/include -I<perf_results>/include
+ *	-o aio-stress aio-stress.c -L<latency_hist>/lib -llatency_hist
+ *	-L<perf_results>/lib -lperf_results -laio -lpthread
+ *
+ * when AUTOTEST_PERF_RESULTS_FD is set, the throughputs are also reported
+ * to it as perf results, see perf_results.h
  *
  * run aio-stress -h to see the options
  *
@@ -46,6 +51,7 @@
 #define NEW_GETEVENTS
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -62,6 +68,9 @@
 #include <string.h>
 #include <pthread.h>
 
+#include "latency_hist.h"
+#include "perf_results.h"
+
 #define IO_FREE 0
 #define IO_PENDING 1
 #define RUN_FOREVER -1
@@ -123,18 +132,11 @@ struct timeval global_stage_start_time;
 struct thread_info *global_thread_info;
 
 /* 
- * latencies during io_submit are measured, these are the 
- * granularities for deviations 
+ * latencies during io_submit are measured in usecs, and reported in msecs
+ * at these percentiles
  */
-#define DEVIATIONS 6
-int deviations[DEVIATIONS] = { 100, 250, 500, 1000, 5000, 10000 };
-struct io_latency {
-    double max;
-    double min;
-    double total_io;
-    double total_lat;
-    double deviations[DEVIATIONS]; 
-};
+#define PERCENTILES 4
+double percentiles[PERCENTILES] = { 50, 90, 99, 99.9 };
 
 /* container for a series of operations to a file */
 struct io_oper {
@@ -237,7 +239,7 @@ struct thread_info {
     int num_global_events;
 
     /* latency stats for io_submit */
-    struct io_latency io_submit_latency;
+    latency_hist_t io_submit_latency;
 
     /* list of operations still in progress, and of those finished */
     struct io_oper *active_opers;
@@ -250,7 +252,7 @@ struct thread_info {
     double stage_mb_trans;
 
     /* latency completion stats i/o time from io_submit until io_getevents */
-    struct io_latency io_completion_latency;
+    latency_hist_t io_completion_latency;
 };
 
 /*
@@ -286,25 +288,11 @@ static double time_since_now(struct timeval *start_tv)
  * Add latency info to latency struct 
  */
 static void calc_latency(struct timeval *start_tv, struct timeval *stop_tv,
-			struct io_latency *lat)
+			latency_hist_t *lat)
 {
     double delta;
-    int i;
     delta = time_since(start_tv, stop_tv);
-    delta = delta * 1000;
-
-    if (delta > lat->max)
-    	lat->max = delta;
-    if (!lat->min || delta < lat->min)
-    	lat->min = delta;
-    lat->total_io++;
-    lat->total_lat += delta;
-    for (i = 0 ; i < DEVIATIONS ; i++) {
-        if (delta < deviations[i]) {
-	    lat->deviations[i]++;
-	    break;
-	}
-    }
+    latency_hist_record(lat, delta * 1000000);
 }
 
 static void oper_list_add(struct io_oper *oper, struct io_oper **list)
@@ -403,6 +391,27 @@ static inline double oper_mb_trans(struct io_oper *oper) {
                 (double)(1024 * 1024);
 }
 
+/*
+ * report a throughput as a perf result, named the way it is printed
+ * with the spaces replaced, e.g. "random_write_on_poo"
+ */
+static void report_tput(double tput, char *fmt, ...) {
+    char name[256];
+    char *p;
+    va_list ap;
+
+    if (!perf_results_enabled())
+	return;
+    va_start(ap, fmt);
+    vsnprintf(name, sizeof(name), fmt, ap);
+    va_end(ap);
+    for (p = name; *p; p++) {
+	if (*p == ' ')
+	    *p = '_';
+    }
+    perf_result(name, tput, "MB_per_sec", PERF_RESULTS_HIGHER_IS_BETTER);
+}
+
 static void print_time(struct io_oper *oper) {
     double runtime;
     double tput;
@@ -413,34 +422,32 @@ static void print_time(struct io_oper *oper) {
     tput = mb / runtime;
     fprintf(stderr, "%s on %s (%.2f MB/s) %.2f MB in %.2fs\n", 
 	    stage_name(oper->rw), oper->file_name, tput, mb, runtime);
+    report_tput(tput, "%s on %s", stage_name(oper->rw), oper->file_name);
 }
 
-static void print_lat(char *str, struct io_latency *lat) {
-    double avg = lat->total_lat / lat->total_io;
+static void print_lat(char *str, latency_hist_t *lat) {
     int i;
-    double total_counted = 0;
     fprintf(stderr, "%s min %.2f avg %.2f max %.2f\n\t", 
-            str, lat->min, avg, lat->max);
+            str, lat->min / 1000.0, latency_hist_mean(lat) / 1000,
+	    lat->max / 1000.0);
 
-    for (i = 0 ; i < DEVIATIONS ; i++) {
-	fprintf(stderr, " %.0f < %d", lat->deviations[i], deviations[i]);
-	total_counted += lat->deviations[i];
+    for (i = 0 ; i < PERCENTILES ; i++) {
+	fprintf(stderr, " p%g %.2f", percentiles[i],
+		latency_hist_percentile(lat, percentiles[i]) / 1000.0);
     }
-    if (total_counted && lat->total_io - total_counted)
-        fprintf(stderr, " < %.0f", lat->total_io - total_counted);
     fprintf(stderr, "\n");
-    memset(lat, 0, sizeof(*lat));
+    latency_hist_reset(lat);
 }
 
 static void print_latency(struct thread_info *t)
 {
-    struct io_latency *lat = &t->io_submit_latency;
+    latency_hist_t *lat = &t->io_submit_latency;
     print_lat("latency", lat);
 }
 
 static void print_completion_latency(struct thread_info *t)
 {
-    struct io_latency *lat = &t->io_completion_latency;
+    latency_hist_t *lat = &t->io_completion_latency;
     print_lat("completion latency", lat);
 }
 
@@ -1078,6 +1085,7 @@ void global_thread_throughput(struct thread_info *t, char *this_stage) {
         if (stonewall)
 	    fprintf(stderr, " min transfer %.2fMB", min_trans);
         fprintf(stderr, "\n");
+	report_tput(total_mb / runtime, "%s throughput", this_stage);
     }
 }
 
@@ -1173,6 +1181,8 @@ restart:
 	fprintf(stderr, "thread %d %s totals (%.2f MB/s) %.2f MB in %.2fs\n", 
 	        t - global_thread_info, this_stage, t->stage_mb_trans/seconds, 
 		t->stage_mb_trans, seconds);
+	report_tput(t->stage_mb_trans / seconds, "thread %d %s totals",
+		    (int)(t - global_thread_info), this_stage);
     }
 
     if (num_threads > 1) {
@@ -1417,9 +1427,10 @@ int main(int ac, char **av)
 	        num_threads);
     }
 
-    t = malloc(num_threads * sizeof(*t));
+    /* zeroed, so the latency histograms start out empty */
+    t = calloc(num_threads, sizeof(*t));
     if (!t) {
-        perror("malloc");
+        perror("calloc");
 	exit(1);
     }
     global_thread_info = t;
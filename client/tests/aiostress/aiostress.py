@@ -1,17 +1,21 @@
 # This requires aio headers to build.
 # Should work automagically out of deps now.
 import os
-from autotest_lib.client.bin import test, utils
+from autotest_lib.client.bin import perf_results, test, utils
 
 
 class aiostress(test.test):
-    version = 3
+    version = 5
 
     def initialize(self):
         self.job.require_gcc()
-        self.job.setup_dep(['libaio'])
+        self.job.setup_dep(['libaio', 'latency_hist', 'perf_results'])
         ldflags = '-L ' + self.autodir + '/deps/libaio/lib'
         cflags = '-I ' + self.autodir + '/deps/libaio/include'
+        ldflags += ' -L ' + self.autodir + '/deps/latency_hist/lib'
+        cflags += ' -I ' + self.autodir + '/deps/latency_hist/include'
+        ldflags += ' -L ' + self.autodir + '/deps/perf_results/lib'
+        cflags += ' -I ' + self.autodir + '/deps/perf_results/include'
         self.gcc_flags = ldflags + ' ' + cflags
 
 
@@ -21,8 +25,9 @@ class aiostress(test.test):
         os.chdir(self.srcdir)
         utils.system('cp ' + self.bindir+'/aio-stress.c .')
         os.chdir(self.srcdir)
-        self.gcc_flags += ' -Wall -lpthread -laio'
-        cmd = 'gcc ' + self.gcc_flags + ' aio-stress.c -o aio-stress'
+        self.gcc_flags += ' -Wall'
+        cmd = ('gcc ' + self.gcc_flags + ' aio-stress.c -o aio-stress'
+               ' -llatency_hist -lperf_results -lpthread -laio')
         utils.system(cmd)
 
 
@@ -35,27 +40,13 @@ class aiostress(test.test):
         cmd = self.srcdir + '/aio-stress ' + args + ' poo'
 
         stderr = os.path.join(self.debugdir, 'stderr')
-        utils.system('%s %s 2> %s' % (var_ld_path, cmd, stderr))
-        report = open(stderr)
-        self.format_results(report)
-
-
-    def format_results(self, report):
-        for line in report:
-            if 'threads' in line:
-                if 'files' in line:
-                    if 'contexts' in line:
-                        break
-
-        keyval = {}
-        for line in report:
-            line = line.split(')')[0]
-            key, value = line.split('(')
-            key = key.strip().replace(' ', '_')
-            value = value.split()[0]
-            keyval[key] = value
-
-        self.write_perf_keyval(keyval)
+        results_file = os.path.join(self.resultsdir,
+                                    'perf_results_%d.json' % self.iteration)
+        utils.system(perf_results.wrap_command(
+                '%s %s 2> %s' % (var_ld_path, cmd, stderr), results_file))
+        results = perf_results.output_perf_values(self, results_file)
+        self.write_perf_keyval(dict((r['description'], '%.2f' % r['value'])
+                                    for r in results))
 
 """
 file size 1024MB, record size 64KB, depth 64, ios per iteration 8
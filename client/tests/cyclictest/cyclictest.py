@@ -1,21 +1,34 @@
 import os
-from autotest_lib.client.bin import test
+from autotest_lib.client.bin import latency_hist, perf_results, test
 from autotest_lib.client.common_lib import utils
 
 
 class cyclictest(test.test):
-    version = 2
+    version = 4
     preserve_srcdir = True
 
     # git://git.kernel.org/pub/scm/linux/kernel/git/tglx/rt-tests.git
     def initialize(self):
         self.job.require_gcc()
+        self.job.setup_dep(['latency_hist', 'perf_results'])
+        self._depdir = os.path.join(self.autodir, 'deps', 'latency_hist')
+        self._perf_results_dir = os.path.join(self.autodir, 'deps',
+                                              'perf_results')
 
 
     def setup(self):
         os.chdir(self.srcdir)
-        utils.make()
+        utils.make('DEPDIR=%s PERF_RESULTS_DIR=%s' %
+                   (self._depdir, self._perf_results_dir))
 
 
     def execute(self, args = '-t 10 -l 100000'):
-        utils.system(self.srcdir + '/cyclictest ' + args)
+        histfile = os.path.join(self.resultsdir, 'latency.hist')
+        results_file = os.path.join(self.resultsdir, 'perf_results.json')
+        utils.system(perf_results.wrap_command(
+                self.srcdir + '/cyclictest ' + args + ' --histfile ' + histfile,
+                results_file))
+        perf_results.output_perf_values(self, results_file)
+        for hist in latency_hist.read_binary(histfile):
+            if hist.name == 'all':
+                self.write_perf_keyval(hist.perf_keyvals('latency'))
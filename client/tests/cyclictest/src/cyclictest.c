@@ -28,6 +28,9 @@
 #include <sys/types.h>
 #include <sys/time.h>
 
+#include "latency_hist.h"
+#include "perf_results.h"
+
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
 /* Ugly, but .... */
@@ -72,10 +75,8 @@ struct thread_param {
 struct thread_stat {
 	unsigned long cycles;
 	unsigned long cyclesread;
-	long min;
-	long max;
 	long act;
-	double avg;
+	latency_hist_t hist;
 	long *values;
 	pthread_t thread;
 	int threadstarted;
@@ -313,11 +314,7 @@ void *timerthread(void *param)
 		clock_gettime(par->clock, &now);
 
 		diff = calcdiff(now, next);
-		if (diff < stat->min)
-			stat->min = diff;
-		if (diff > stat->max)
-			stat->max = diff;
-		stat->avg += (double) diff;
+		latency_hist_record(&stat->hist, diff > 0 ? diff : 0);
 
 		if (!stopped && tracelimit && (diff > tracelimit)) {
 			stopped++;
@@ -375,6 +372,7 @@ static void display_help(void)
 	       "                           1 = CLOCK_REALTIME\n"
 	       "-d DIST  --distance=DIST   distance of thread intervals in us default=500\n"
 	       "-f                         function trace (when -b is active)\n"
+	       "-H FILE  --histfile=FILE   write latency histograms to FILE on exit\n"
 	       "-i INTV  --interval=INTV   base interval of thread in us default=1000\n"
 	       "-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
 	       "-n       --nanosleep       use clock_nanosleep\n"
@@ -399,6 +397,7 @@ static int verbose;
 static int quiet;
 static int interval = 1000;
 static int distance = 500;
+static char *histfile;
 
 static int clocksources[] = {
 	CLOCK_MONOTONIC,
@@ -417,6 +416,7 @@ static void process_options (int argc, char *argv[])
 			{"clock", required_argument, NULL, 'c'},
 			{"distance", required_argument, NULL, 'd'},
 			{"ftrace", no_argument, NULL, 'f'},
+			{"histfile", required_argument, NULL, 'H'},
 			{"interval", required_argument, NULL, 'i'},
 			{"loops", required_argument, NULL, 'l'},
 			{"nanosleep", no_argument, NULL, 'n'},
@@ -429,7 +429,7 @@ static void process_options (int argc, char *argv[])
 			{"help", no_argument, NULL, '?'},
 			{NULL, 0, NULL, 0}
 		};
-		int c = getopt_long (argc, argv, "b:c:d:fi:l:np:qrst:v",
+		int c = getopt_long (argc, argv, "b:c:d:fH:i:l:np:qrst:v",
 			long_options, &option_index);
 		if (c == -1)
 			break;
@@ -438,6 +438,7 @@ static void process_options (int argc, char *argv[])
 		case 'c': clocksel = atoi(optarg); break;
 		case 'd': distance = atoi(optarg); break;
 		case 'f': ftrace = 1; break;
+		case 'H': histfile = optarg; break;
 		case 'i': interval = atoi(optarg); break;
 		case 'l': max_cycles = atoi(optarg); break;
 		case 'n': use_nanosleep = MODE_CLOCK_NANOSLEEP; break;
@@ -503,9 +504,9 @@ static void print_stat(struct thread_param *par, int index, int verbose)
 			printf("T:%2d (%5d) P:%2d I:%ld C:%7lu "
 			       "Min:%7ld Act:%5ld Avg:%5ld Max:%8ld\n",
 			       index, stat->tid, par->prio, par->interval,
-			       stat->cycles, stat->min, stat->act,
-			       stat->cycles ?
-			       (long)(stat->avg/stat->cycles) : 0, stat->max);
+			       stat->cycles, (long)stat->hist.min, stat->act,
+			       (long)latency_hist_mean(&stat->hist),
+			       (long)stat->hist.max);
 		}
 	} else {
 		while (stat->cycles != stat->cyclesread) {
@@ -516,6 +517,58 @@ static void print_stat(struct thread_param *par, int index, int verbose)
 	}
 }
 
+/* Write each thread's histogram, and their total as "all" */
+static void write_histograms(struct thread_stat *stat)
+{
+	latency_hist_t total;
+	char name[16];
+	FILE *f;
+	int i;
+
+	f = fopen(histfile, "w");
+	if (!f) {
+		perror(histfile);
+		return;
+	}
+	latency_hist_reset(&total);
+	for (i = 0; i < num_threads; i++) {
+		snprintf(name, sizeof(name), "T%d", i);
+		latency_hist_write_binary(&stat[i].hist, f, name, "us");
+		latency_hist_merge(&total, &stat[i].hist);
+	}
+	latency_hist_write_binary(&total, f, "all", "us");
+	if (fclose(f))
+		perror(histfile);
+}
+
+/* Report the latencies of all threads, and each thread's worst */
+static void report_results(struct thread_stat *stat)
+{
+	latency_hist_t total;
+	double *thread_max;
+	int i;
+
+	thread_max = calloc(num_threads, sizeof(*thread_max));
+	if (!thread_max)
+		return;
+	latency_hist_reset(&total);
+	for (i = 0; i < num_threads; i++) {
+		latency_hist_merge(&total, &stat[i].hist);
+		thread_max[i] = stat[i].hist.max;
+	}
+	perf_result("latency_avg", latency_hist_mean(&total), "us",
+		    PERF_RESULTS_LOWER_IS_BETTER);
+	perf_result("latency_p50", latency_hist_percentile(&total, 50), "us",
+		    PERF_RESULTS_LOWER_IS_BETTER);
+	perf_result("latency_p99", latency_hist_percentile(&total, 99), "us",
+		    PERF_RESULTS_LOWER_IS_BETTER);
+	perf_result("latency_max", total.max, "us",
+		    PERF_RESULTS_LOWER_IS_BETTER);
+	perf_result_values("latency_thread_max", thread_max, num_threads, "us",
+			   PERF_RESULTS_LOWER_IS_BETTER);
+	free(thread_max);
+}
+
 int main(int argc, char **argv)
 {
 	sigset_t sigset;
@@ -572,9 +625,6 @@ int main(int argc, char **argv)
 		interval += distance;
 		par[i].max_cycles = max_cycles;
 		par[i].stats = &stat[i];
-		stat[i].min = 1000000;
-		stat[i].max = -1000000;
-		stat[i].avg = 0.0;
 		pthread_create(&stat[i].thread, NULL, timerthread, &par[i]);
 		stat[i].threadstarted = 1;
 	}
@@ -620,6 +670,10 @@ int main(int argc, char **argv)
 		if (stat[i].values)
 			free(stat[i].values);
 	}
+	if (histfile)
+		write_histograms(stat);
+	if (perf_results_enabled())
+		report_results(stat);
 	free(stat);
  outpar:
 	free(par);
@@ -1,5 +1,5 @@
 import os
-from autotest_lib.client.bin import test, utils
+from autotest_lib.client.bin import latency_hist, test, utils
 
 
 class hackbench(test.test):
@@ -11,7 +11,7 @@ class hackbench(test.test):
     @author: Nikhil Rao (ncrao@google.com)
     @see: http://people.redhat.com/~mingo/cfs-scheduler/tools/hackbench.c
     """
-    version = 1
+    version = 2
     preserve_srcdir = True
 
 
@@ -21,23 +21,29 @@ class hackbench(test.test):
             cc = '$CC'
         else:
             cc = 'cc'
-        utils.system('%s -lpthread hackbench.c -o hackbench' % cc)
+        utils.system('%s hackbench.c -o hackbench -I%s/include -L%s/lib '
+                     '-llatency_hist -lpthread' %
+                     (cc, self._depdir, self._depdir))
 
 
     def initialize(self):
         self.job.require_gcc()
+        self.job.setup_dep(['latency_hist'])
+        self._depdir = os.path.join(self.autodir, 'deps', 'latency_hist')
         self.results = None
 
 
-    def run_once(self, num_groups=90):
+    def run_once(self, num_groups=90, latency=False):
         """
         Run hackbench, store the output in raw output files per iteration and
         also in the results list attribute.
 
         @param num_groups: Number of children processes hackbench will spawn.
+        @param latency: Also measure the latency of every message.
         """
         hackbench_bin = os.path.join(self.srcdir, 'hackbench')
-        cmd = '%s %s' % (hackbench_bin, num_groups)
+        cmd = '%s %s%s' % (hackbench_bin, '-latency ' if latency else '',
+                           num_groups)
         raw_output = utils.system_output(cmd, retain_output=True)
         self.results = raw_output
 
@@ -54,3 +60,6 @@ class hackbench(test.test):
             if line.startswith('Time:'):
                 time_val = line.split()[1]
                 self.write_perf_keyval({'time': time_val})
+        hists = latency_hist.parse_text(self.results)
+        if 'message' in hists:
+            self.write_perf_keyval(hists['message'].perf_keyvals('message'))
@@ -3,10 +3,15 @@
  * This is the latest version of hackbench.c, that tests scheduler and
  * unix-socket (or pipe) performance.
  *
- * Usage: hackbench [-pipe] <num groups> [process|thread] [loops]
+ * Usage: hackbench [-pipe] [-latency] <num groups> [process|thread] [loops]
+ *
+ * With -latency, every message carries its send time and the receivers
+ * keep a histogram of the send to receive latencies, printed after the
+ * run time as a "latency_hist:" line.
  *
  * Build it with:
- *   gcc -g -Wall -O2 -o hackbench hackbench.c -lpthread
+ *   gcc -g -Wall -O2 -o hackbench hackbench.c -I<latency_hist>/include \
+ *	-L<latency_hist>/lib -llatency_hist -lpthread
  */
 #if 0
 
@@ -89,7 +94,11 @@ Thank Ingo for his great comments!
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/poll.h>
+#include <sys/mman.h>
 #include <limits.h>
+#include <time.h>
+
+#include "latency_hist.h"
 
 #define DATASIZE 100
 static unsigned int loops = 100;
@@ -99,6 +108,10 @@ static unsigned int loops = 100;
 static unsigned int process_mode = 1;
 
 static int use_pipes = 0;
+static int measure_latency = 0;
+
+/* Message latencies of all receivers, in memory shared by the processes. */
+static latency_hist_t *latency = NULL;
 
 struct sender_context {
 	unsigned int num_fds;
@@ -123,7 +136,7 @@ static void barf(const char *msg)
 
 static void print_usage_exit()
 {
-	printf("Usage: hackbench [-pipe] <num groups> [process|thread] [loops]\n");
+	printf("Usage: hackbench [-pipe] [-latency] <num groups> [process|thread] [loops]\n");
 	exit(1);
 }
 
@@ -139,6 +152,14 @@ static void fdpair(int fds[2])
 	barf("Creating fdpair");
 }
 
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 /* Block until we're ready to go */
 static void ready(int ready_out, int wakefd)
 {
@@ -167,6 +188,11 @@ static void *sender(struct sender_context *ctx)
 		for (j = 0; j < ctx->num_fds; j++) {
 			int ret, done = 0;
 
+			if (latency) {
+				uint64_t sent = now_ns();
+
+				memcpy(data, &sent, sizeof(sent));
+			}
 again:
 			ret = write(ctx->out_fds[j], data + done, sizeof(data)-done);
 			if (ret < 0)
@@ -184,11 +210,18 @@ again:
 /* One receiver per fd */
 static void *receiver(struct receiver_context* ctx)
 {
+	latency_hist_t *hist = NULL;
 	unsigned int i;
 
 	if (process_mode)
 		close(ctx->in_fds[1]);
 
+	if (latency) {
+		hist = calloc(1, sizeof(*hist));
+		if (!hist)
+			barf("calloc()");
+	}
+
 	/* Wait for start... */
 	ready(ctx->ready_out, ctx->wakefd);
 
@@ -204,6 +237,18 @@ again:
 		done += ret;
 		if (done < DATASIZE)
 			goto again;
+
+		if (hist) {
+			uint64_t sent, received = now_ns();
+
+			memcpy(&sent, data, sizeof(sent));
+			latency_hist_record(hist, received - sent);
+		}
+	}
+
+	if (hist) {
+		latency_hist_merge_atomic(latency, hist);
+		free(hist);
 	}
 
 	return NULL;
@@ -320,8 +365,13 @@ int main(int argc, char *argv[])
 	char dummy;
 	pthread_t *pth_tab;
 
-	if (argv[1] && strcmp(argv[1], "-pipe") == 0) {
-		use_pipes = 1;
+	while (argv[1] && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-pipe") == 0)
+			use_pipes = 1;
+		else if (strcmp(argv[1], "-latency") == 0)
+			measure_latency = 1;
+		else
+			print_usage_exit();
 		argc--;
 		argv++;
 	}
@@ -346,6 +396,14 @@ int main(int argc, char *argv[])
 	if (argc > 3)
 		loops = atoi(argv[3]);
 
+	if (measure_latency) {
+		latency = mmap(NULL, sizeof(*latency), PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (latency == MAP_FAILED)
+			barf("mmap()");
+		latency_hist_reset_shared(latency);
+	}
+
 	pth_tab = malloc(num_fds * 2 * num_groups * sizeof(pthread_t));
 
 	if (!pth_tab)
@@ -378,6 +436,8 @@ int main(int argc, char *argv[])
 	/* Print time... */
 	timersub(&stop, &start, &diff);
 	printf("Time: %lu.%03lu\n", diff.tv_sec, diff.tv_usec/1000);
+	if (latency)
+		latency_hist_write_text(latency, stdout, "message", "ns");
 	exit(0);
 }
 
@@ -3,17 +3,23 @@ from autotest_lib.client.bin import test, utils
 from autotest_lib.client.common_lib import error
 
 class monotonic_time(test.test):
-    version = 1
+    version = 3
 
     preserve_srcdir = True
 
     def setup(self):
         os.chdir(self.srcdir)
-        utils.make()
+        utils.make('clobber')
+        utils.make('DEPDIR=%s LATENCY_DEPDIR=%s' %
+                   (self._depdir, self._latency_depdir))
 
 
     def initialize(self):
         self.job.require_gcc()
+        self.job.setup_dep(['cpu_threads', 'latency_hist'])
+        self._depdir = os.path.join(self.autodir, 'deps', 'cpu_threads')
+        self._latency_depdir = os.path.join(self.autodir, 'deps',
+                                            'latency_hist')
 
 
     def run_once(self, test_type = None, duration = 300, threshold = None):
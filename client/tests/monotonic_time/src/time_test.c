@@ -22,6 +22,7 @@
 #include <time.h>
 
 #include "cpuset.h"
+#include "latency_hist.h"
 #include "spinlock.h"
 #include "threads.h"
 #include "logging.h"
@@ -134,28 +135,46 @@ static inline uint64_t rdclock(void)
 /*
  * test data
  */
+typedef struct test_result {
+	long		loops;		/* # of test loop iterations	*/
+	latency_hist_t	warps;		/* sizes of backward time jumps	*/
+} test_result_t;
+
 typedef struct test_info {
 	const char	*name;		/* test name			*/
-	void		(*func)(struct test_info *);	/* the test	*/
+	const char	*unit;		/* unit of the time values	*/
+	void		(*func)(struct test_info *, test_result_t *);
 	spinlock_t	lock;
 	uint64_t	last;		/* last time value		*/
-	long		loops;		/* # of test loop iterations	*/
-	long		warps;		/* # of backward time jumps	*/
-	int64_t		worst;		/* worst backward time jump	*/
 	uint64_t	start;		/* test start time		*/
 	int		done;		/* flag to stop test		*/
+	thread_group_t	*threads;
 } test_info_t;
 
 
-void show_warps(struct test_info *test)
+void show_warps(struct test_info *test, int64_t worst)
+{
+	INFO("new %s-warp maximum: %9"PRId64, test->name, worst);
+}
+
+
+void record_warp(struct test_info *test, test_result_t *result,
+		 int64_t delta)
 {
-	INFO("new %s-warp maximum: %9"PRId64, test->name, test->worst);
+	if ((uint64_t)-delta > result->warps.max)
+		show_warps(test, delta);
+	latency_hist_record(&result->warps, -delta);
 }
 
 
-#define	DEFINE_TEST(_name)				\
+/*
+ * Only the shared last time value is locked. The loop count and warps
+ * go to the calling thread's result slot, so they add no contention.
+ */
+#define	DEFINE_TEST(_name, _unit)			\
 							\
-void _name##_test(struct test_info *test)		\
+void _name##_test(struct test_info *test,		\
+		  test_result_t *result)		\
 {							\
 	uint64_t t0, t1;				\
 	int64_t delta;					\
@@ -164,18 +183,12 @@ void _name##_test(struct test_info *test)		\
 	t1 = rd##_name();				\
 	t0 = test->last;				\
 	test->last = rd##_name();			\
-	test->loops++;					\
 	spin_unlock(&test->lock);			\
+	result->loops++;				\
 							\
 	delta = t1 - t0;				\
 	if (delta < 0 && delta < -threshold) {		\
-		spin_lock(&test->lock);			\
-		++test->warps;				\
-		if (delta < test->worst) {		\
-			test->worst = delta;		\
-			show_warps(test);		\
-		}					\
-		spin_unlock(&test->lock);		\
+		record_warp(test, result, delta);	\
 	}						\
 	if (!((unsigned long)t0 & 31))			\
 		asm volatile ("rep; nop");		\
@@ -183,14 +196,15 @@ void _name##_test(struct test_info *test)		\
 							\
 struct test_info _name##_test_info = {			\
 	.name = #_name,					\
+	.unit = _unit,					\
 	.func = _name##_test,				\
 }
 
-DEFINE_TEST(tsc);
-DEFINE_TEST(tsc_lfence);
-DEFINE_TEST(tsc_mfence);
-DEFINE_TEST(gtod);
-DEFINE_TEST(clock);
+DEFINE_TEST(tsc, "cycles");
+DEFINE_TEST(tsc_lfence, "cycles");
+DEFINE_TEST(tsc_mfence, "cycles");
+DEFINE_TEST(gtod, "us");
+DEFINE_TEST(clock, "ns");
 
 struct test_info *tests[] = {
 	&tsc_test_info,
@@ -202,29 +216,40 @@ struct test_info *tests[] = {
 };
 
 
+void merge_result(void *total, const void *result)
+{
+	test_result_t		*t = total;
+	const test_result_t	*r = result;
+
+	t->loops += r->loops;
+	latency_hist_merge(&t->warps, &r->warps);
+}
+
+
 void show_progress(struct test_info *test)
 {
 	static int	count;
 	const char	progress[] = "\\|/-";
 	uint64_t	elapsed = rdgtod() - test->start;
+	test_result_t	total	= { 0 };
 
-        printf(" | %.2f us, %s-warps:%ld %c\r",
-                        (double)elapsed/(double)test->loops,
+	merge_results(test->threads, merge_result, &total);
+
+        printf(" | %.2f us, %s-warps:%"PRIu64" %c\r",
+                        (double)elapsed/(double)total.loops,
 			test->name,
-                        test->warps,
+                        total.warps.count,
 			progress[++count & 3]);
 	fflush(stdout);
 }
 
 
-void *test_loop(void *arg)
+void test_loop(thread_t *self)
 {
-	struct test_info *test = arg;
+	struct test_info *test = self->arg;
 	
 	while (! test->done)
-		(*test->func)(test);
-
-	return NULL;
+		(*test->func)(test, self->result);
 }
 
 
@@ -233,6 +258,8 @@ int run_test(cpu_set_t *cpus, long duration, struct test_info *test)
 	int		errs;
 	int		ncpus;
 	int		nthreads;
+	test_result_t	total		= { 0 };
+	char		name[64];
 	struct timespec ts		= { .tv_sec = 0, .tv_nsec = 200000000 };
 	struct timespec	*timeout	= (verbose || duration) ? &ts : NULL;
 	sigset_t	signals;
@@ -246,22 +273,26 @@ int run_test(cpu_set_t *cpus, long duration, struct test_info *test)
 	sigprocmask(SIG_BLOCK, &signals, NULL);
 
 	/*
-	 * test start time
+ 	 * create the threads, one per cpu
+ 	 */
+	ncpus = count_cpus(cpus);
+	test->threads = create_thread_group(cpus, 0, sizeof(test_result_t));
+	if (!test->threads) {
+		ERROR(0, "failed to allocate %d threads", ncpus);
+		return 1;
+	}
+
+	/*
+	 * test start time; the threads start together once all exist
 	 */
 	test->start = rdgtod();
 
-	/*
- 	 * create the threads
- 	 */
-	ncpus = count_cpus(cpus);
-	nthreads = create_per_cpu_threads(cpus, test_loop, test);
+	nthreads = start_threads(test->threads, test_loop, test);
 	if (nthreads != ncpus) {
 		ERROR(0, "failed to create threads: expected %d, got %d",
 			ncpus, nthreads);
-		if (nthreads) {
-			test->done = 1;
-			join_threads();
-		}
+		join_threads(test->threads);
+		destroy_thread_group(test->threads);
 		return 1;
 	}
 
@@ -288,15 +319,20 @@ int run_test(cpu_set_t *cpus, long duration, struct test_info *test)
 	 */
 	test->done = 1;
 
-	join_threads();
+	join_threads(test->threads);
+	merge_results(test->threads, merge_result, &total);
+	destroy_thread_group(test->threads);
 
-	errs = (test->warps != 0);
+	errs = (total.warps.count != 0);
 
 	if (!errs)
 		printf("PASS:\n");
-	else
-		printf("FAIL: %s-worst-warp=%"PRId64"\n",
-			test->name, test->worst);
+	else {
+		printf("FAIL: %s-worst-warp=-%"PRIu64"\n",
+			test->name, total.warps.max);
+		snprintf(name, sizeof name, "%s-warps", test->name);
+		latency_hist_write_text(&total.warps, stdout, name, test->unit);
+	}
 	
 	return errs;
 }
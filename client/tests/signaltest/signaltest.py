@@ -1,21 +1,28 @@
 import os
-from autotest_lib.client.bin import test
+from autotest_lib.client.bin import latency_hist, test
 from autotest_lib.client.common_lib import utils
 
 
 class signaltest(test.test):
-    version = 1
+    version = 2
     preserve_srcdir = True
 
     def initialize(self):
         self.job.require_gcc()
+        self.job.setup_dep(['latency_hist'])
+        self._depdir = os.path.join(self.autodir, 'deps', 'latency_hist')
 
 
     # git://git.kernel.org/pub/scm/linux/kernel/git/tglx/rt-tests.git
     def setup(self):
         os.chdir(self.srcdir)
-        utils.make()
+        utils.make('DEPDIR=%s' % self._depdir)
 
 
     def execute(self, args = '-t 10 -l 100000'):
-        utils.system(self.srcdir + '/signaltest ' + args)
+        histfile = os.path.join(self.resultsdir, 'latency.hist')
+        utils.system(self.srcdir + '/signaltest ' + args +
+                     ' --histfile ' + histfile)
+        for hist in latency_hist.read_binary(histfile):
+            if hist.name == 'all':
+                self.write_perf_keyval(hist.perf_keyvals('latency'))
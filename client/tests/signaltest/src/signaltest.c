@@ -28,6 +28,8 @@
 #include <sys/types.h>
 #include <sys/time.h>
 
+#include "latency_hist.h"
+
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
 /* Ugly, but .... */
@@ -53,10 +55,8 @@ struct thread_param {
 struct thread_stat {
 	unsigned long cycles;
 	unsigned long cyclesread;
-	long min;
-	long max;
 	long act;
-	double avg;
+	latency_hist_t hist;
 	long *values;
 	pthread_t thread;
 	pthread_t tothread;
@@ -167,11 +167,7 @@ void *signalthread(void *param)
 
 		diff = calcdiff(after, before);
 		before = now;
-		if (diff < stat->min)
-			stat->min = diff;
-		if (diff > stat->max)
-			stat->max = diff;
-		stat->avg += (double) diff;
+		latency_hist_record(&stat->hist, diff > 0 ? diff : 0);
 
 		if (!stopped && tracelimit && (diff > tracelimit)) {
 			stopped++;
@@ -210,6 +206,7 @@ static void display_help(void)
 	       "signaltest <options>\n\n"
 	       "-b USEC  --breaktrace=USEC send break trace command when latency > USEC\n"
 	       "-f                         function trace (when -b is active)\n"
+	       "-H FILE  --histfile=FILE   write latency histograms to FILE on exit\n"
 	       "-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
 	       "-p PRIO  --prio=PRIO       priority of highest prio thread\n"
 	       "-q       --quiet           print only a summary on exit\n"
@@ -224,6 +221,7 @@ static int num_threads = 2;
 static int max_cycles;
 static int verbose;
 static int quiet;
+static char *histfile;
 
 /* Process commandline options */
 static void process_options (int argc, char *argv[])
@@ -235,6 +233,7 @@ static void process_options (int argc, char *argv[])
 		static struct option long_options[] = {
 			{"breaktrace", required_argument, NULL, 'b'},
 			{"ftrace", no_argument, NULL, 'f'},
+			{"histfile", required_argument, NULL, 'H'},
 			{"loops", required_argument, NULL, 'l'},
 			{"priority", required_argument, NULL, 'p'},
 			{"quiet", no_argument, NULL, 'q'},
@@ -243,12 +242,13 @@ static void process_options (int argc, char *argv[])
 			{"help", no_argument, NULL, '?'},
 			{NULL, 0, NULL, 0}
 		};
-		int c = getopt_long (argc, argv, "b:fl:p:qt:v",
+		int c = getopt_long (argc, argv, "b:fH:l:p:qt:v",
 			long_options, &option_index);
 		if (c == -1)
 			break;
 		switch (c) {
 		case 'b': tracelimit = atoi(optarg); break;
+		case 'H': histfile = optarg; break;
 		case 'l': max_cycles = atoi(optarg); break;
 		case 'p': priority = atoi(optarg); break;
 		case 'q': quiet = 1; break;
@@ -297,9 +297,9 @@ static void print_stat(struct thread_param *par, int index, int verbose)
 			printf("T:%2d (%5d) P:%2d C:%7lu "
 			       "Min:%7ld Act:%5ld Avg:%5ld Max:%8ld\n",
 			       index, stat->tid, par->prio,
-			       stat->cycles, stat->min, stat->act,
-			       stat->cycles ?
-			       (long)(stat->avg/stat->cycles) : 0, stat->max);
+			       stat->cycles, (long)stat->hist.min, stat->act,
+			       (long)latency_hist_mean(&stat->hist),
+			       (long)stat->hist.max);
 		}
 	} else {
 		while (stat->cycles != stat->cyclesread) {
@@ -310,6 +310,30 @@ static void print_stat(struct thread_param *par, int index, int verbose)
 	}
 }
 
+/* Write each thread's histogram, and their total as "all" */
+static void write_histograms(struct thread_stat *stat)
+{
+	latency_hist_t total;
+	char name[16];
+	FILE *f;
+	int i;
+
+	f = fopen(histfile, "w");
+	if (!f) {
+		perror(histfile);
+		return;
+	}
+	latency_hist_reset(&total);
+	for (i = 0; i < num_threads; i++) {
+		snprintf(name, sizeof(name), "T%d", i);
+		latency_hist_write_binary(&stat[i].hist, f, name, "us");
+		latency_hist_merge(&total, &stat[i].hist);
+	}
+	latency_hist_write_binary(&total, f, "all", "us");
+	if (fclose(f))
+		perror(histfile);
+}
+
 int main(int argc, char **argv)
 {
 	sigset_t sigset;
@@ -358,9 +382,6 @@ int main(int argc, char **argv)
 		par[i].signal = signum;
 		par[i].max_cycles = max_cycles;
 		par[i].stats = &stat[i];
-		stat[i].min = 1000000;
-		stat[i].max = -1000000;
-		stat[i].avg = 0.0;
 		stat[i].threadstarted = 1;
 		pthread_create(&stat[i].thread, NULL, signalthread, &par[i]);
 	}
@@ -421,6 +442,8 @@ int main(int argc, char **argv)
 		if (stat[i].values)
 			free(stat[i].values);
 	}
+	if (histfile)
+		write_histograms(stat);
 	free(stat);
  outpar:
 	free(par);
@@ -8,6 +8,9 @@ class Tracer(object):
     """
 
     tracing_dir = None
+    # Extra arguments for syscall_microbench, for tracing states that have to
+    # be set up from inside the measured process (perf sampling, seccomp).
+    bench_args = ''
 
     def trace_config(self, path, value):
         """
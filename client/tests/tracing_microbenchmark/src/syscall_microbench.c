@@ -0,0 +1,273 @@
+/*
+ * Times a set of cheap system calls in batches and prints the per-call cost
+ * distribution of each one, so the overhead of tracing states (tracepoints,
+ * perf sampling, seccomp, audit) can be compared across workloads.
+ */
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <linux/filter.h>
+#include <linux/futex.h>
+#include <linux/perf_event.h>
+#include <linux/seccomp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_BATCHES 100000
+
+/* First argument the seccomp filters reject, which no workload passes. */
+#define DECOY_ARG 0x0C0FFEE
+
+static int zero_fd = -1;
+static int futex_word;
+
+static void do_getuid(void) {
+  syscall(SYS_getuid);
+}
+
+static void do_getppid(void) {
+  syscall(SYS_getppid);
+}
+
+static void do_read_zero(void) {
+  char buf[64];
+
+  if (read(zero_fd, buf, sizeof(buf)) != sizeof(buf))
+    abort();
+}
+
+static void do_clock_vdso(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+}
+
+static void do_clock_syscall(void) {
+  struct timespec ts;
+
+  syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+}
+
+static void do_futex_wake(void) {
+  syscall(SYS_futex, &futex_word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+struct workload {
+  const char *name;
+  void (*fn)(void);
+};
+
+static const struct workload workloads[] = {
+  { "getuid", do_getuid },
+  { "getppid", do_getppid },
+  { "read_zero", do_read_zero },
+  { "clock_gettime_vdso", do_clock_vdso },
+  { "clock_gettime_syscall", do_clock_syscall },
+  { "futex_wake", do_futex_wake },
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static double now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, long n, double pct) {
+  long idx = (long)(pct / 100.0 * (n - 1) + 0.5);
+
+  return sorted[idx];
+}
+
+/*
+ * Installs filters that allow everything but a decoy first argument. Since
+ * 5.11 the kernel skips filters whose verdict depends only on the syscall
+ * number, so the argument check is what makes them run on every call.
+ */
+static int install_seccomp(int nfilters) {
+  struct sock_filter insns[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+             offsetof(struct seccomp_data, args[0])),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, DECOY_ARG, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | E2BIG),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+  };
+  struct sock_fprog prog = {
+    .len = sizeof(insns) / sizeof(insns[0]),
+    .filter = insns,
+  };
+  int i;
+
+  if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0)) {
+    perror("prctl(PR_SET_NO_NEW_PRIVS)");
+    return -1;
+  }
+  for (i = 0; i < nfilters; i++) {
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog)) {
+      perror("prctl(PR_SET_SECCOMP)");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Samples this process on cpu-clock at the given frequency. */
+static int start_perf_sampling(long freq) {
+  struct perf_event_attr attr;
+  int fd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.config = PERF_COUNT_SW_CPU_CLOCK;
+  attr.freq = 1;
+  attr.sample_freq = freq;
+  attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME;
+  attr.exclude_hv = 1;
+
+  fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd < 0) {
+    perror("perf_event_open");
+    return -1;
+  }
+  return fd;
+}
+
+static void run_workload(const struct workload *w, long batch, long batches,
+                         double *samples) {
+  long i, j;
+  double start, sum = 0;
+
+  /* warm caches and page in everything the call path touches */
+  for (j = 0; j < batch; j++)
+    w->fn();
+
+  for (i = 0; i < batches; i++) {
+    start = now_ns();
+    for (j = batch; j; j--)
+      w->fn();
+    samples[i] = (now_ns() - start) / batch;
+    sum += samples[i];
+  }
+
+  qsort(samples, batches, sizeof(*samples), cmp_double);
+  printf("%s: %ld calls min %.2f p50 %.2f p90 %.2f p99 %.2f max %.2f "
+         "mean %.2f ns/call\n", w->name, batch * batches,
+         samples[0], percentile(samples, batches, 50),
+         percentile(samples, batches, 90), percentile(samples, batches, 99),
+         samples[batches - 1], sum / batches);
+}
+
+static void usage(const char *cmd) {
+  size_t i;
+
+  fprintf(stderr,
+          "usage: %s [-b batch] [-n batches] [-p perf_freq] [-s filters] "
+          "[workload ...]\n"
+          "  -b  calls per timed batch (default 1000)\n"
+          "  -n  number of timed batches (default 100)\n"
+          "  -p  sample this process with perf at perf_freq Hz\n"
+          "  -s  install this many seccomp filters\n"
+          "workloads:", cmd);
+  for (i = 0; i < NUM_WORKLOADS; i++)
+    fprintf(stderr, " %s", workloads[i].name);
+  fprintf(stderr, " (default: all)\n");
+}
+
+int main(int argc, char *argv[]) {
+  long batch = 1000, batches = 100, perf_freq = 0;
+  int seccomp_filters = 0, perf_fd = -1;
+  double *samples;
+  size_t i;
+  int opt, n;
+
+  while ((opt = getopt(argc, argv, "b:n:p:s:h")) != -1) {
+    switch (opt) {
+    case 'b':
+      batch = atol(optarg);
+      break;
+    case 'n':
+      batches = atol(optarg);
+      break;
+    case 'p':
+      perf_freq = atol(optarg);
+      break;
+    case 's':
+      seccomp_filters = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (batch <= 0 || batches <= 0 || batches > MAX_BATCHES ||
+      perf_freq < 0 || seccomp_filters < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  for (n = optind; n < argc; n++) {
+    for (i = 0; i < NUM_WORKLOADS; i++)
+      if (!strcmp(argv[n], workloads[i].name))
+        break;
+    if (i == NUM_WORKLOADS) {
+      fprintf(stderr, "unknown workload: %s\n", argv[n]);
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  zero_fd = open("/dev/zero", O_RDONLY);
+  if (zero_fd < 0) {
+    perror("open(/dev/zero)");
+    return errno;
+  }
+
+  samples = calloc(batches, sizeof(*samples));
+  if (!samples) {
+    perror("calloc");
+    return 1;
+  }
+
+  if (perf_freq) {
+    perf_fd = start_perf_sampling(perf_freq);
+    if (perf_fd < 0)
+      return 1;
+  }
+  if (seccomp_filters && install_seccomp(seccomp_filters))
+    return 1;
+
+  for (i = 0; i < NUM_WORKLOADS; i++) {
+    if (optind < argc) {
+      for (n = optind; n < argc; n++)
+        if (!strcmp(argv[n], workloads[i].name))
+          break;
+      if (n == argc)
+        continue;
+    }
+    run_workload(&workloads[i], batch, batches, samples);
+  }
+
+  if (perf_fd >= 0)
+    close(perf_fd);
+  close(zero_fd);
+  free(samples);
+  return 0;
+}
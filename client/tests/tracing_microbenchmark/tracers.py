@@ -15,6 +15,7 @@ class ftrace(base_tracer.Tracer):
 
     mountpoint = '/sys/kernel/debug'
     tracing_dir = os.path.join(mountpoint, 'tracing')
+    events = ['syscalls/sys_enter_getuid']
 
     def warmup(self, buffer_size_kb):
         if not os.path.exists(self.tracing_dir):
@@ -28,7 +29,8 @@ class ftrace(base_tracer.Tracer):
         # set ring buffer size:
         self.trace_config('buffer_size_kb', str(buffer_size_kb))
         # enable tracepoints:
-        self.trace_config('events/syscalls/sys_enter_getuid/enable', '1')
+        for event in self.events:
+            self.trace_config(os.path.join('events', event, 'enable'), '1')
 
     def cleanup(self):
         # reset ring buffer size:
@@ -58,3 +60,43 @@ class ftrace(base_tracer.Tracer):
                 results[cpu_key] = val
                 results[total_key] = (results.get(total_key, 0) +
                                       results[cpu_key])
+
+
+class ftrace_syscalls(ftrace):
+    """ftrace with every syscall entry and exit tracepoint enabled."""
+
+    events = ['syscalls']
+
+
+class perf(base_tracer.Tracer):
+    """perf cpu-clock sampling of the benchmark process at 1 kHz."""
+
+    bench_args = '-p 1000'
+
+
+class seccomp(base_tracer.Tracer):
+    """A single argument checking seccomp filter in the benchmark process."""
+
+    bench_args = '-s 1'
+
+
+class audit(base_tracer.Tracer):
+    """
+    Syscall auditing enabled with a rule that suppresses all records, so the
+    audit filter runs on every syscall without flooding the audit log.
+    """
+
+    rule = '-a never,exit -F arch=b64 -S all'
+
+    def warmup(self, buffer_size_kb):
+        utils.system('auditctl -e 1')
+
+    def cleanup(self):
+        utils.system('auditctl -e 0', ignore_status=True)
+
+    def start_tracing(self):
+        utils.system('auditctl %s' % self.rule)
+
+    def stop_tracing(self):
+        utils.system('auditctl %s' % self.rule.replace('-a', '-d', 1),
+                     ignore_status=True)
@@ -7,24 +7,41 @@ import tracers
 import base_tracer
 
 class tracing_microbenchmark(test.test):
-    version = 1
+    version = 3
     preserve_srcdir = True
 
     def setup(self):
         os.chdir(self.srcdir)
         utils.system('make CROSS_COMPILE=""')
 
-    def initialize(self, tracer='ftrace', calls=100000, **kwargs):
+    def initialize(self, tracer='ftrace', calls=100000, benchmark='getuid',
+                   batch=1000, workloads=(), **kwargs):
         self.job.require_gcc()
         tracer_class = getattr(tracers, tracer)
         if not issubclass(tracer_class, base_tracer.Tracer):
             raise TypeError
         self.tracer = tracer_class()
+        self.benchmark = benchmark
 
-        getuid_microbench = os.path.join(self.srcdir, 'getuid_microbench')
-        self.cmd = '%s %d' % (getuid_microbench, calls)
+        if benchmark == 'getuid':
+            getuid_microbench = os.path.join(self.srcdir, 'getuid_microbench')
+            self.cmd = '%s %d' % (getuid_microbench, calls)
+        elif benchmark == 'syscalls':
+            syscall_microbench = os.path.join(self.srcdir,
+                                              'syscall_microbench')
+            self.baseline_cmd = '%s -b %d -n %d %s' % (
+                    syscall_microbench, batch, max(calls // batch, 1),
+                    ' '.join(workloads))
+            self.cmd = '%s %s' % (self.baseline_cmd, self.tracer.bench_args)
+        else:
+            raise ValueError('unknown benchmark: %s' % benchmark)
 
     def warmup(self, buffer_size_kb=8000, **kwargs):
+        if self.benchmark == 'syscalls':
+            # Untraced run to compute overhead deltas against, taken before
+            # the tracer's warmup: that already enables tracepoints or
+            # auditing, which slows down every syscall.
+            self.baseline_result = utils.run(self.baseline_cmd)
         self.tracer.warmup(buffer_size_kb)
 
     def cleanup(self):
@@ -40,7 +57,37 @@ class tracing_microbenchmark(test.test):
         self.tracer.gather_stats(self.results)
         self.tracer.reset_tracing()
 
+    def _parse_syscall_stats(self, output):
+        """
+        Parse syscall_microbench output into {workload: {stat: ns_per_call}}.
+        """
+        stats_re = re.compile(r'(?P<workload>\w+): \d+ calls (?P<stats>.*) '
+                              r'ns/call$')
+        stats = {}
+        for line in output.splitlines():
+            match = stats_re.match(line)
+            if not match:
+                continue
+            fields = match.group('stats').split()
+            stats[match.group('workload')] = dict(
+                    (key, float(val))
+                    for key, val in zip(fields[::2], fields[1::2]))
+        return stats
+
     def postprocess_iteration(self):
+        if self.benchmark == 'syscalls':
+            baseline = self._parse_syscall_stats(self.baseline_result.stdout)
+            traced = self._parse_syscall_stats(self.cmd_result.stdout)
+            for workload, stats in traced.iteritems():
+                for stat, value in stats.iteritems():
+                    key = '%s_%s_ns_per_call' % (workload, stat)
+                    self.results[key] = value
+                    self.results['baseline_' + key] = baseline[workload][stat]
+                    self.results['overhead_' + key] = (
+                            value - baseline[workload][stat])
+            self.write_perf_keyval(self.results)
+            return
+
         result_re = re.compile(r'(?P<calls>\d+) calls '
                                r'in (?P<time>\d+\.\d+) s '
                                '\((?P<ns_per_call>\d+\.\d+) ns/call\)')
@@ -8,10 +8,12 @@
 #include <getopt.h>
 #include <pthread.h>
 #include <errno.h>
-#include "sched.h"
+
+#include "cpuset.h"
+#include "logging.h"
+#include "threads.h"
 
 
-#define MAX_CPUS		32
 #define	DEFAULT_THRESHOLD	500	/* default maximum TSC skew	*/
 
 
@@ -50,81 +52,6 @@ void help(void)
 }
 
 
-void error(int err, const char *fmt, ...)
-{
-	va_list	ap;
-
-	fprintf(stderr, "%s: ", program);
-	va_start(ap, fmt);
-	vfprintf(stderr, fmt, ap);
-	va_end(ap);
-
-	if (err)
-		fprintf(stderr, ": %s\n", strerror(err));
-	putc('\n', stderr);
-}
-
-
-/*
- * parse a string containing a comma separated list of ranges
- * of cpu numbers such as: "0,2,4-7" into a cpu_set_t
- */
-int parse_cpu_set(const char *s, cpu_set_t *cpus)
-{
-	CPU_ZERO(cpus);
-
-	while (*s) {
-		char	*next;
-		int	cpu;
-		int	start, end;
-
-		start = end = (int)strtol(s, &next, 0);
-		if (s == next)
-			break;
-		s = next;
-
-		if (*s == '-') {
-			++s;
-			end = (int)strtol(s, &next, 0);
-			if (s == next)
-				break;
-			s = next;
-		}
-
-		if (*s == ',')
-			++s;
-
-		if (start < 0 || start >= CPU_SETSIZE) {
-			error(0, "bad cpu number '%d' in cpu set", start);
-			return 1;
-		}
-
-		if (end < 0 || end >= CPU_SETSIZE) {
-			error(0, "bad cpu number '%d' in cpu set", end);
-			return 1;
-		}
-
-		if (end < start) {
-			error(0, "bad cpu range '%d-%d' in cpu set",
-				start, end);
-			return 1;
-		}
-
-		for (cpu = start; cpu <= end; ++cpu)
-			CPU_SET(cpu, cpus);
-
-	}
-
-	if (*s) {
-		error(0, "unexpected character '%c' in cpu set", *s);
-		return 1;
-	}
-
-	return 0;
-}
-
-
-#define	CACHE_LINE_SIZE	256
 typedef union state {
 	int	state;
 	char	pad[CACHE_LINE_SIZE];
@@ -165,7 +92,7 @@ static inline uint64_t rdtsc(void)
 
 #define	READY	1
 #define	DONE	2
-#define	ERROR	3
+#define	ABORT	3
 
 state_t		master;
 state_t		slave;
@@ -181,7 +108,7 @@ int set_cpu_affinity(int cpu)
 	CPU_ZERO(&cpus);
 	CPU_SET(cpu, &cpus);
 	if (sched_setaffinity(0, sizeof cpus, &cpus) < 0) {
-		error(errno, "sched_setaffinity() failed for CPU %d", cpu);
+		ERROR(errno, "sched_setaffinity() failed for CPU %d", cpu);
 		return -1;
 	}
 	return 0;
@@ -236,8 +163,8 @@ tsc_delta(int cpu_a, int cpu_b)
 }
 
 
-void *
-slave_thread(void *arg)
+void
+slave_thread(thread_t *self)
 {
 	int	current_cpu = -1;
 
@@ -246,14 +173,14 @@ slave_thread(void *arg)
 		wait_for_state(&master, READY);
 
 		if (slave_cpu < 0) {
-			return NULL;
+			return;
 		}
 
 		if (slave_cpu != current_cpu) {
 
 			if (set_cpu_affinity(slave_cpu) < 0) {
-				set_state(&slave, ERROR);
-				return NULL;
+				set_state(&slave, ABORT);
+				return;
 			}
 
 			current_cpu = slave_cpu;
@@ -267,7 +194,6 @@ slave_thread(void *arg)
 
 		set_state(&slave, DONE);
 	}
-	return NULL;
 }
 
 
@@ -277,19 +203,24 @@ check_tsc(cpu_set_t *cpus)
 	int		cpu_a, cpu_b;
 	int64_t		delta;
 	int		err	= 0;
-	pthread_t	thread;
+	thread_group_t	*slave_group;
 
-	if ((err = pthread_create(&thread, NULL, slave_thread, NULL))) {
-		error(err, "pthread_create_failed");
+	/*
+	 * the slave moves itself from cpu to cpu, so it is not bound
+	 */
+	slave_group = create_thread_group(NULL, 1, 0);
+	if (!slave_group || start_threads(slave_group, slave_thread, NULL) != 1) {
+		ERROR(0, "failed to create the slave thread");
+		if (slave_group)
+			destroy_thread_group(slave_group);
 		return -1;
 	}
-	
 
-	for (cpu_a = 0; cpu_a < MAX_CPUS; cpu_a++) {
+	for (cpu_a = 0; cpu_a < CPU_SETSIZE; cpu_a++) {
 		if (!CPU_ISSET(cpu_a, cpus))
 			continue;
 
-		for (cpu_b = 0; cpu_b < MAX_CPUS; cpu_b++) {
+		for (cpu_b = 0; cpu_b < CPU_SETSIZE; cpu_b++) {
 			if (!CPU_ISSET(cpu_b, cpus) || cpu_a == cpu_b)
 				continue;
 
@@ -307,7 +238,8 @@ check_tsc(cpu_set_t *cpus)
 	slave_cpu = -1;
 	set_state(&master, READY);
 
-	pthread_join(thread, NULL);
+	join_threads(slave_group);
+	destroy_thread_group(slave_group);
 
 	return err;
 }
@@ -326,11 +258,14 @@ main(int argc, char *argv[])
 		++program;
 	else
 		program = argv[0];
+	set_program_name(program);
+	set_log_file(stderr);
 
 	/*
 	 * default to checking all cpus
 	 */
-	for (c = 0; c < MAX_CPUS; c++) {
+	CPU_ZERO(&cpus);
+	for (c = 0; c < CPU_SETSIZE; c++) {
 		CPU_SET(c, &cpus);
 	}
 
@@ -371,7 +306,7 @@ main(int argc, char *argv[])
 	 */
 	sched_setaffinity(0, sizeof cpus, &cpus);
 	if (sched_getaffinity(0, sizeof cpus, &cpus) < 0) {
-		error(errno, "sched_getaffinity() failed");
+		ERROR(errno, "sched_getaffinity() failed");
 		exit(1);
 	}
 
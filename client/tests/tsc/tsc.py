@@ -3,17 +3,20 @@ from autotest_lib.client.bin import test, utils
 from autotest_lib.client.common_lib import error
 
 class tsc(test.test):
-    version = 3
+    version = 4
 
     preserve_srcdir = True
 
     def setup(self):
         os.chdir(self.srcdir)
-        utils.make()
+        utils.make('clobber')
+        utils.make('DEPDIR=%s' % self._depdir)
 
 
     def initialize(self):
         self.job.require_gcc()
+        self.job.setup_dep(['cpu_threads'])
+        self._depdir = os.path.join(self.autodir, 'deps', 'cpu_threads')
 
 
     def run_once(self, args = '-t 650'):
@@ -0,0 +1,144 @@
+#!/usr/bin/python
+# Copyright 2015 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+"""Compares the wake up latency of named semaphores and shared futexes.
+
+Each round the parent wakes every waiter process at once and then waits for
+all of them to acknowledge. With named semaphores that takes one sem_post() and
+one sem_wait() per waiter; with the shared futex a single futex_post(n) and a
+single futex_wait(n). The round trip times are reported in microseconds.
+
+Build the namedsem module first (python setup.py build) and run this script
+with it on the python path.
+"""
+
+import argparse
+import os
+import time
+
+import namedsem
+
+
+def _percentile(samples, pct):
+    return samples[int(round(pct / 100.0 * (len(samples) - 1)))]
+
+
+class _Semaphores(object):
+    """Wake and acknowledge through two named semaphores."""
+
+    name = 'sem'
+
+    def __init__(self, prefix):
+        self._names = ['/%s_wake' % prefix, '/%s_done' % prefix]
+        self._wake, self._done = [
+                namedsem.sem_open(name, os.O_CREAT | os.O_EXCL, 0)
+                for name in self._names]
+        if namedsem.SEM_FAILED in (self._wake, self._done):
+            raise OSError('sem_open() failed')
+
+    def wake(self, n):
+        for _ in xrange(n):
+            namedsem.sem_post(self._wake)
+
+    def collect(self, n):
+        for _ in xrange(n):
+            namedsem.sem_wait(self._done)
+
+    def wait(self):
+        namedsem.sem_wait(self._wake)
+
+    def ack(self):
+        namedsem.sem_post(self._done)
+
+    def close(self):
+        for sem, name in zip((self._wake, self._done), self._names):
+            namedsem.sem_close(sem)
+            namedsem.sem_unlink(name)
+
+
+class _Futexes(object):
+    """Wake and acknowledge through two shared futex counters."""
+
+    name = 'futex'
+
+    def __init__(self, prefix):
+        self._names = ['/%s_fwake' % prefix, '/%s_fdone' % prefix]
+        self._wake, self._done = [
+                namedsem.futex_open(name, os.O_CREAT | os.O_EXCL)
+                for name in self._names]
+        if not (self._wake and self._done):
+            raise OSError('futex_open() failed')
+
+    def wake(self, n):
+        namedsem.futex_post(self._wake, n)
+
+    def collect(self, n):
+        namedsem.futex_wait(self._done, n)
+
+    def wait(self):
+        namedsem.futex_wait(self._wake)
+
+    def ack(self):
+        namedsem.futex_post(self._done)
+
+    def close(self):
+        for futex, name in zip((self._wake, self._done), self._names):
+            namedsem.futex_close(futex)
+            namedsem.futex_unlink(name)
+
+
+def run(primitive, waiters, rounds):
+    """Returns the sorted round trip times, in seconds, of |rounds| rounds."""
+    pids = []
+    for _ in range(waiters):
+        pid = os.fork()
+        if pid == 0:
+            try:
+                for _ in xrange(rounds):
+                    primitive.wait()
+                    primitive.ack()
+            finally:
+                os._exit(0)
+        pids.append(pid)
+
+    samples = []
+    try:
+        for _ in xrange(rounds):
+            start = time.time()
+            primitive.wake(waiters)
+            primitive.collect(waiters)
+            samples.append(time.time() - start)
+    finally:
+        for pid in pids:
+            os.waitpid(pid, 0)
+    return sorted(samples)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--waiters', type=int, nargs='+',
+                        default=[1, 4, 16, 64])
+    parser.add_argument('--rounds', type=int, default=2000)
+    args = parser.parse_args()
+
+    prefix = 'namedsem_bench_%d' % os.getpid()
+    for waiters in args.waiters:
+        for cls in (_Semaphores, _Futexes):
+            primitive = cls(prefix)
+            try:
+                samples = run(primitive, waiters, args.rounds)
+            finally:
+                primitive.close()
+            print('%-5s waiters=%-3d p50=%.1fus p90=%.1fus p99=%.1fus '
+                  'max=%.1fus' % (
+                          primitive.name, waiters,
+                          _percentile(samples, 50) * 1e6,
+                          _percentile(samples, 90) * 1e6,
+                          _percentile(samples, 99) * 1e6,
+                          samples[-1] * 1e6))
+
+
+if __name__ == '__main__':
+    main()
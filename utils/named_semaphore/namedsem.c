@@ -1,5 +1,42 @@
 #include <Python.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <semaphore.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+/*
+ * A futex based counter and barrier living in a named shared memory segment.
+ * Unlike a semaphore it can be posted and waited on by more than one unit at a
+ * time, and the waiters are only woken by a syscall when there are any.
+ */
+struct shared_futex {
+    uint32_t count;             /* futex word of the counter */
+    uint32_t waiters;           /* tasks sleeping on |count| */
+    uint32_t batch_waiters;     /* those of them waiting for > 1 unit */
+    /*
+     * The barrier: generation << 32 | tasks waiting on that generation, so
+     * both change in one compare and swap. The generation half is the futex
+     * word.
+     */
+    union {
+        uint64_t state;
+        uint32_t word[2];
+    } barrier;
+};
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BARRIER_GENERATION_WORD 1
+#else
+#define BARRIER_GENERATION_WORD 0
+#endif
 
 
 static int
@@ -10,6 +47,36 @@ parse_sem_t(PyObject *object, void *address)
 }
 
 
+/* Converts a timeout in seconds to an absolute deadline on |clock|. */
+static void
+deadline_from_timeout(clockid_t clock, double timeout, struct timespec *ts)
+{
+    double seconds;
+
+    clock_gettime(clock, ts);
+    ts->tv_nsec += (long)(modf(timeout, &seconds) * 1e9);
+    ts->tv_sec += (time_t)seconds + ts->tv_nsec / 1000000000;
+    ts->tv_nsec %= 1000000000;
+}
+
+
+/* Time left until |deadline| on CLOCK_MONOTONIC, or 0 if it passed. */
+static int
+time_left(const struct timespec *deadline, struct timespec *left)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left->tv_sec = deadline->tv_sec - now.tv_sec;
+    left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (left->tv_nsec < 0) {
+        left->tv_sec--;
+        left->tv_nsec += 1000000000;
+    }
+    return left->tv_sec >= 0;
+}
+
+
 static PyObject *
 namedsem_sem_open(PyObject *self, PyObject *args)
 {
@@ -55,7 +122,47 @@ namedsem_sem_wait(PyObject *self, PyObject *args)
     int result;
 
     PyArg_ParseTuple(args, "O&", &parse_sem_t, &sem);
-    result = sem_wait(sem);
+    /* Let the other threads run while we block. */
+    do {
+        Py_BEGIN_ALLOW_THREADS
+        result = sem_wait(sem);
+        Py_END_ALLOW_THREADS
+    } while (result && errno == EINTR && !PyErr_CheckSignals());
+    if (PyErr_Occurred())
+        return NULL;
+
+    return Py_BuildValue("i", result);
+}
+
+static PyObject *
+namedsem_sem_timedwait(PyObject *self, PyObject *args)
+{
+    sem_t *sem;
+    double timeout;
+    struct timespec deadline;
+    int result;
+
+    PyArg_ParseTuple(args, "O&d", &parse_sem_t, &sem, &timeout);
+    deadline_from_timeout(CLOCK_REALTIME, timeout, &deadline);
+    do {
+        Py_BEGIN_ALLOW_THREADS
+        result = sem_timedwait(sem, &deadline);
+        Py_END_ALLOW_THREADS
+    } while (result && errno == EINTR && !PyErr_CheckSignals());
+    if (PyErr_Occurred())
+        return NULL;
+
+    return Py_BuildValue("i", result);
+}
+
+static PyObject *
+namedsem_sem_trywait(PyObject *self, PyObject *args)
+{
+    sem_t *sem;
+    int result;
+
+    PyArg_ParseTuple(args, "O&", &parse_sem_t, &sem);
+    result = sem_trywait(sem);
 
     return Py_BuildValue("i", result);
 }
@@ -86,6 +193,251 @@ namedsem_sem_getvalue(PyObject *self, PyObject *args)
 }
 
 
+static long
+futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout)
+{
+    /* Shared (not FUTEX_PRIVATE) since waiters live in other processes. */
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+
+static int
+parse_futex(PyObject *object, void *address)
+{
+    *((struct shared_futex **)address) = PyLong_AsVoidPtr(object);
+    return !PyErr_Occurred();
+}
+
+
+static PyObject *
+namedsem_futex_open(PyObject *self, PyObject *args)
+{
+    const char *name;
+    int oflag, fd;
+    void *result = NULL;
+
+    if (!PyArg_ParseTuple(args, "si", &name, &oflag))
+        return NULL;
+    fd = shm_open(name, oflag | O_RDWR, 0600);
+    if (fd >= 0) {
+        /* A new segment is zero filled: count 0, no waiters. */
+        if (ftruncate(fd, sizeof(struct shared_futex)) == 0)
+            result = mmap(NULL, sizeof(struct shared_futex),
+                          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (result == MAP_FAILED)
+            result = NULL;
+    }
+
+    return PyLong_FromVoidPtr(result);
+}
+
+static PyObject *
+namedsem_futex_close(PyObject *self, PyObject *args)
+{
+    struct shared_futex *f;
+    int result;
+
+    if (!PyArg_ParseTuple(args, "O&", &parse_futex, &f))
+        return NULL;
+    result = munmap(f, sizeof(*f));
+
+    return Py_BuildValue("i", result);
+}
+
+static PyObject *
+namedsem_futex_unlink(PyObject *self, PyObject *args)
+{
+    const char *name;
+    int result;
+
+    if (!PyArg_ParseTuple(args, "s", &name))
+        return NULL;
+    result = shm_unlink(name);
+
+    return Py_BuildValue("i", result);
+}
+
+static PyObject *
+namedsem_futex_post(PyObject *self, PyObject *args)
+{
+    struct shared_futex *f;
+    unsigned int n = 1;
+
+    if (!PyArg_ParseTuple(args, "O&|I", &parse_futex, &f, &n))
+        return NULL;
+    __atomic_add_fetch(&f->count, n, __ATOMIC_SEQ_CST);
+    /*
+     * One syscall wakes up to |n| waiters; none if nobody sleeps. A waiter
+     * for several units could swallow the wake up of one it can't satisfy,
+     * so wake them all when there are any.
+     */
+    if (__atomic_load_n(&f->waiters, __ATOMIC_SEQ_CST))
+        futex(&f->count, FUTEX_WAKE,
+              __atomic_load_n(&f->batch_waiters, __ATOMIC_SEQ_CST) ||
+              n > INT_MAX ? INT_MAX : n, NULL);
+
+    return Py_BuildValue("i", 0);
+}
+
+/* Takes |n| units from the counter, sleeping until they are available. */
+static int
+futex_take(struct shared_futex *f, uint32_t n, const struct timespec *deadline)
+{
+    struct timespec left;
+    uint32_t count;
+    long result;
+
+    for (;;) {
+        count = __atomic_load_n(&f->count, __ATOMIC_SEQ_CST);
+        if (count >= n) {
+            if (__atomic_compare_exchange_n(&f->count, &count, count - n, 0,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_SEQ_CST))
+                return 0;
+            continue;
+        }
+        if (deadline && !time_left(deadline, &left)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        __atomic_add_fetch(&f->waiters, 1, __ATOMIC_SEQ_CST);
+        if (n > 1)
+            __atomic_add_fetch(&f->batch_waiters, 1, __ATOMIC_SEQ_CST);
+        /* Sleeps only if |count| didn't change since we read it. */
+        result = futex(&f->count, FUTEX_WAIT, count, deadline ? &left : NULL);
+        if (n > 1)
+            __atomic_sub_fetch(&f->batch_waiters, 1, __ATOMIC_SEQ_CST);
+        __atomic_sub_fetch(&f->waiters, 1, __ATOMIC_SEQ_CST);
+        if (result && errno == EINTR)
+            return -1;
+    }
+}
+
+static PyObject *
+namedsem_futex_wait(PyObject *self, PyObject *args)
+{
+    struct shared_futex *f;
+    unsigned int n = 1;
+    double timeout = -1;
+    struct timespec deadline;
+    int result;
+
+    if (!PyArg_ParseTuple(args, "O&|Id", &parse_futex, &f, &n, &timeout))
+        return NULL;
+    if (timeout >= 0)
+        deadline_from_timeout(CLOCK_MONOTONIC, timeout, &deadline);
+    do {
+        Py_BEGIN_ALLOW_THREADS
+        result = futex_take(f, n, timeout >= 0 ? &deadline : NULL);
+        Py_END_ALLOW_THREADS
+    } while (result && errno == EINTR && !PyErr_CheckSignals());
+    if (PyErr_Occurred())
+        return NULL;
+
+    return Py_BuildValue("i", result);
+}
+
+static PyObject *
+namedsem_futex_getvalue(PyObject *self, PyObject *args)
+{
+    struct shared_futex *f;
+
+    if (!PyArg_ParseTuple(args, "O&", &parse_futex, &f))
+        return NULL;
+
+    return Py_BuildValue("I", __atomic_load_n(&f->count, __ATOMIC_SEQ_CST));
+}
+
+/*
+ * Takes a task that stopped waiting back out of |generation|, unless that
+ * generation tripped already. Returns 0 if it did, -1 otherwise.
+ */
+static int
+barrier_leave(struct shared_futex *f, uint32_t generation)
+{
+    uint64_t state = __atomic_load_n(&f->barrier.state, __ATOMIC_SEQ_CST);
+
+    do {
+        if ((uint32_t)(state >> 32) != generation)
+            return 0;
+    } while (!__atomic_compare_exchange_n(&f->barrier.state, &state,
+                                          state - 1, 0, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_SEQ_CST));
+    return -1;
+}
+
+/*
+ * Waits until |parties| tasks called it; the last one to arrive returns 1.
+ * Returns -1 with errno set on timeout or signal, no longer counted as
+ * arrived.
+ */
+static int
+futex_barrier(struct shared_futex *f, uint32_t parties,
+              const struct timespec *deadline)
+{
+    uint32_t *word = &f->barrier.word[BARRIER_GENERATION_WORD];
+    struct timespec left;
+    uint64_t state, next;
+    uint32_t generation;
+    int err;
+
+    state = __atomic_load_n(&f->barrier.state, __ATOMIC_SEQ_CST);
+    do {
+        generation = state >> 32;
+        if ((uint32_t)state + 1 >= parties)
+            next = (uint64_t)(generation + 1) << 32;
+        else
+            next = state + 1;
+    } while (!__atomic_compare_exchange_n(&f->barrier.state, &state, next, 0,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    if ((uint32_t)(next >> 32) != generation) {
+        futex(word, FUTEX_WAKE, INT_MAX, NULL);
+        return 1;
+    }
+
+    while (__atomic_load_n(word, __ATOMIC_SEQ_CST) == generation) {
+        if (deadline && !time_left(deadline, &left)) {
+            err = ETIMEDOUT;
+        } else if (futex(word, FUTEX_WAIT, generation,
+                         deadline ? &left : NULL) && errno == EINTR) {
+            err = EINTR;
+        } else {
+            continue;
+        }
+        if (barrier_leave(f, generation) == 0)
+            return 0;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+namedsem_futex_barrier(PyObject *self, PyObject *args)
+{
+    struct shared_futex *f;
+    unsigned int parties;
+    double timeout = -1;
+    struct timespec deadline;
+    int result;
+
+    if (!PyArg_ParseTuple(args, "O&I|d", &parse_futex, &f, &parties,
+                          &timeout))
+        return NULL;
+    if (timeout >= 0)
+        deadline_from_timeout(CLOCK_MONOTONIC, timeout, &deadline);
+    /* An interrupted wait left the barrier, so it arrives again. */
+    do {
+        Py_BEGIN_ALLOW_THREADS
+        result = futex_barrier(f, parties, timeout >= 0 ? &deadline : NULL);
+        Py_END_ALLOW_THREADS
+    } while (result && errno == EINTR && !PyErr_CheckSignals());
+    if (PyErr_Occurred())
+        return NULL;
+
+    return Py_BuildValue("i", result);
+}
 
 static PyMethodDef NamedsemMethods[] = {
     {"sem_open", namedsem_sem_open, METH_VARARGS, "Execute sem_open()."},
@@ -94,6 +446,27 @@ static PyMethodDef NamedsemMethods[] = {
     {"sem_wait", namedsem_sem_wait, METH_VARARGS, "Execute sem_wait()."},
     {"sem_post", namedsem_sem_post, METH_VARARGS, "Execute sem_post()."},
     {"sem_getvalue", namedsem_sem_getvalue, METH_VARARGS, "Execute sem_getvalue()."},
+    {"sem_timedwait", namedsem_sem_timedwait, METH_VARARGS,
+     "sem_timedwait(sem, timeout): sem_wait() giving up after |timeout| "
+     "seconds."},
+    {"sem_trywait", namedsem_sem_trywait, METH_VARARGS, "Execute sem_trywait()."},
+    {"futex_open", namedsem_futex_open, METH_VARARGS,
+     "futex_open(name, oflag): maps the named shared futex counter/barrier, "
+     "returns 0 on failure."},
+    {"futex_close", namedsem_futex_close, METH_VARARGS,
+     "Unmaps a shared futex."},
+    {"futex_unlink", namedsem_futex_unlink, METH_VARARGS,
+     "Removes a named shared futex."},
+    {"futex_post", namedsem_futex_post, METH_VARARGS,
+     "futex_post(futex, n=1): adds |n| units to the counter."},
+    {"futex_wait", namedsem_futex_wait, METH_VARARGS,
+     "futex_wait(futex, n=1, timeout=-1): takes |n| units from the counter, "
+     "returns -1 on timeout."},
+    {"futex_getvalue", namedsem_futex_getvalue, METH_VARARGS,
+     "Returns the value of the counter."},
+    {"futex_barrier", namedsem_futex_barrier, METH_VARARGS,
+     "futex_barrier(futex, parties, timeout=-1): waits for |parties| callers, "
+     "returns 1 in the last one, 0 in the rest, -1 on timeout."},
     {NULL, NULL, 0, NULL}
 };
 
@@ -1,7 +1,9 @@
 import distutils.core
 
 
-module = distutils.core.Extension("namedsem", sources=["namedsem.c"])
+# shm_open() and clock_gettime() live in librt before glibc 2.34.
+module = distutils.core.Extension("namedsem", sources=["namedsem.c"],
+                                  libraries=["rt"])
 
 distutils.core.setup(name="namedsem", version="1.0",
                      description="Named semaphore functions",